@@ -0,0 +1,68 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace gsl_p {
+
+    /**
+     * A non-owning view of a contiguous sequence of objects, a subset
+     * of C++20's std::span with a dynamic extent.
+     *
+     * @tparam T element type (e.g. const int for a read-only view)
+     */
+    template <typename T>
+    class span {
+    public:
+        using element_type = T;
+        using pointer = T*;
+        using reference = T&;
+        using iterator = T*;
+        using size_type = std::size_t;
+
+        constexpr span() noexcept : ptr(nullptr), len(0) {
+        }
+
+        constexpr span(pointer ptr_, size_type len_) noexcept
+            : ptr(ptr_), len(len_) {
+        }
+
+        constexpr iterator begin() const noexcept {
+            return ptr;
+        }
+
+        constexpr iterator end() const noexcept {
+            return ptr + len;
+        }
+
+        constexpr reference operator[](size_type index) const {
+            return ptr[index];
+        }
+
+        constexpr pointer data() const noexcept {
+            return ptr;
+        }
+
+        constexpr size_type size() const noexcept {
+            return len;
+        }
+
+        constexpr bool empty() const noexcept {
+            return len == 0;
+        }
+
+    private:
+        pointer ptr;
+        size_type len;
+    };
+}
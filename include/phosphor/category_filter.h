@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <initializer_list>
+#include <string_view>
+
+/** \file
+ * Compile-time filtering of trace points by category
+ *
+ * PHOSPHOR_COMPILED_CATEGORIES may be defined as a comma separated list
+ * of string literals, the prefixes of the categories whose trace points
+ * are compiled in (e.g. by the PHOSPHOR_COMPILED_CATEGORIES CMake option,
+ * or before phosphor.h is first included):
+ *
+ *     #define PHOSPHOR_COMPILED_CATEGORIES "memcached", "ep-engine"
+ *
+ * The trace point macros of any other category compile down to nothing:
+ * no static tracepoint_info or category status, and their arguments are
+ * never evaluated. Lock guards still acquire their mutex, as when
+ * PHOSPHOR_DISABLED is defined. When it isn't defined every category is
+ * compiled in.
+ *
+ * Unlike the categories enabled by a TraceConfig this can't be changed
+ * at runtime, it is intended to remove verbose debug categories from
+ * release builds.
+ */
+
+namespace phosphor {
+
+/**
+ * @param category The category (or comma separated category group) of a
+ *        trace point
+ * @param prefixes The prefixes of the categories which are compiled in
+ * @return true if any category of the group starts with one of the
+ *         prefixes
+ */
+constexpr bool isCategoryCompiled(
+        std::string_view category,
+        std::initializer_list<std::string_view> prefixes) {
+    while (!category.empty()) {
+        const auto end = category.find(',');
+        const auto member = category.substr(0, end);
+        for (const auto prefix : prefixes) {
+            if (member.substr(0, prefix.size()) == prefix) {
+                return true;
+            }
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        category.remove_prefix(end + 1);
+    }
+    return false;
+}
+
+} // namespace phosphor
+
+/**
+ * Evaluates to true if the trace points of the given category (a string
+ * literal) are compiled in
+ */
+#if defined(PHOSPHOR_COMPILED_CATEGORIES)
+#define PHOSPHOR_CATEGORY_COMPILED(category) \
+    phosphor::isCategoryCompiled(category, {PHOSPHOR_COMPILED_CATEGORIES})
+#else
+#define PHOSPHOR_CATEGORY_COMPILED(category) true
+#endif
@@ -17,19 +17,41 @@
 
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace phosphor {
 
+/**
+ * Maximum number of concurrent trace sessions of a TraceLog, session 0
+ * is the primary session (see TraceLog::startSession())
+ */
+constexpr size_t max_trace_sessions = 4;
+
 /**
  * The states of tracing that a given category can be in
+ *
+ * The status is a mask of the sessions the category is enabled in, bit
+ * `i` is set for session `i`. Enabled is the status of a category which
+ * is only enabled in the primary session, any status other than Disabled
+ * means that events of the category must be logged.
  */
-enum class CategoryStatus : char { Disabled, Enabled };
+enum class CategoryStatus : char { Disabled = 0, Enabled = 1 };
 
 using AtomicCategoryStatus = std::atomic<CategoryStatus>;
 
+/**
+ * List of category globs and the minimum duration a scoped event in a
+ * matching category must last for it to be logged
+ */
+using CategoryThresholds =
+        std::vector<std::pair<std::string, std::chrono::nanoseconds>>;
+
 // Forward declare
 class StatsCallback;
 
@@ -61,17 +83,149 @@ public:
      */
     const AtomicCategoryStatus& getStatus(const char* category_group);
 
+    /**
+     * Get the minimum duration of a scoped event for the category group
+     * of a CategoryStatus previously returned by getStatus().
+     *
+     * @param status The CategoryStatus of the category group
+     * @return The minimum duration (zero if the group has no threshold)
+     */
+    std::chrono::steady_clock::duration getThreshold(
+            const AtomicCategoryStatus& status) const {
+        const auto index = indexOf(status);
+        if (index >= registry_size) {
+            return std::chrono::steady_clock::duration::zero();
+        }
+        return std::chrono::steady_clock::duration(
+                group_thresholds[index].load(std::memory_order_relaxed));
+    }
+
+    /**
+     * Check whether any category has a threshold, so that scoped events
+     * can skip looking up the threshold of their category group.
+     *
+     * @return true if updateEnabled() was last given any thresholds
+     */
+    bool hasThresholds() const {
+        return has_thresholds.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Check whether scoped events of the category group of a
+     * CategoryStatus previously returned by getStatus() record perf
+     * counters (see updateCounted()).
+     *
+     * @param status The CategoryStatus of the category group
+     * @return true if the group's scoped events record perf counters
+     */
+    bool isCounted(const AtomicCategoryStatus& status) const {
+        const auto index = indexOf(status);
+        if (index >= registry_size) {
+            return false;
+        }
+        return group_counted[index].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the index of the category group of a CategoryStatus previously
+     * returned by getStatus(). The index of a group never changes.
+     *
+     * @param status The CategoryStatus of the category group
+     * @return The index of the group
+     */
+    size_t getGroupIndex(const AtomicCategoryStatus& status) const {
+        const auto index = indexOf(status);
+        return index < registry_size ? index : index_category_limit;
+    }
+
+    /**
+     * Get the buffer partition which events of a category group should
+     * be logged to.
+     *
+     * @param index The index of the group (see getGroupIndex())
+     * @return The buffer partition for the group
+     */
+    size_t getPartition(size_t index) const {
+        return group_partitions[index].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Set the categories assigned to each buffer partition other than the
+     * default partition (0). Category groups are assigned to the first
+     * partition with a category glob matching one of the group's
+     * categories, or the default partition if none match.
+     *
+     * @param partitions The categories of partitions 1 onwards
+     */
+    void updatePartitions(
+            const std::vector<std::vector<std::string>>& partitions);
+
+    /**
+     * Calculates the buffer partition of a given category group
+     *
+     * @param category_group The category_group to get the partition of
+     * @param partitions The categories of partitions 1 onwards
+     * @return The buffer partition for the group
+     */
+    static size_t calculatePartition(
+            const std::string& category_group,
+            const std::vector<std::vector<std::string>>& partitions);
+
+    /**
+     * Set the categories whose scoped events record perf counters. A
+     * category group is counted if any of its categories match one of
+     * the category globs.
+     *
+     * @param categories The counted categories (may include wildcards)
+     */
+    void updateCounted(const std::vector<std::string>& categories);
+
     /**
      * Enable a list of categories for tracing (and disable all others)
      *
      * @param enabled Vector of categories to mark as enabled
      * @param disabled Vector of categories to mark as disabled
+     * @param thresholds Minimum scoped event durations for categories
      */
     void updateEnabled(const std::vector<std::string>& enabled,
-                       const std::vector<std::string>& disabled);
+                       const std::vector<std::string>& disabled,
+                       const CategoryThresholds& thresholds = {});
+
+    /**
+     * Enable a list of categories for tracing in a session (and disable
+     * all others in that session)
+     *
+     * Category thresholds are only taken from the primary session (see
+     * updateEnabled()).
+     *
+     * @param session The session, less than max_trace_sessions
+     * @param enabled Vector of categories to mark as enabled
+     * @param disabled Vector of categories to mark as disabled
+     */
+    void updateSessionEnabled(size_t session,
+                              const std::vector<std::string>& enabled,
+                              const std::vector<std::string>& disabled);
+
+    /**
+     * Disables all category groups in a session
+     *
+     * @param session The session, less than max_trace_sessions
+     */
+    void disableSession(size_t session);
+
+    /**
+     * Get the mask of the sessions a category group is enabled in
+     *
+     * @param index The index of the group (see getGroupIndex())
+     * @return Mask with bit `i` set if session `i` is enabled
+     */
+    unsigned int getSessionMask(size_t index) const {
+        return static_cast<unsigned char>(
+                group_statuses[index].load(std::memory_order_acquire));
+    }
 
     /**
-     * Disables all category groups
+     * Disables all category groups in every session
      *
      * Equivalent to:
      *
@@ -96,6 +250,34 @@ public:
             const std::vector<std::string>& enabled,
             const std::vector<std::string>& disabled);
 
+    /**
+     * Calculates the minimum duration of scoped events in a given
+     * category group. Where a group contains multiple enabled categories
+     * the smallest threshold applies, so that no category loses events
+     * it would otherwise have kept.
+     *
+     * @param category_group The category_group to get the threshold of
+     * @param enabled The enabled groups
+     * @param disabled The disabled groups
+     * @param thresholds The category thresholds, the first matching glob
+     *        for each category is used
+     * @return The minimum duration of scoped events in the group
+     */
+    static std::chrono::nanoseconds calculateThreshold(
+            const std::string& category_group,
+            const std::vector<std::string>& enabled,
+            const std::vector<std::string>& disabled,
+            const CategoryThresholds& thresholds);
+
+    /**
+     * Get the mask of the category groups which contain any of the given
+     * categories, in the form used by TraceChunk::categoryMask().
+     *
+     * @param categories Categories to match (may include wildcards)
+     * @return Mask with bit `i % 64` set for each matching group index `i`
+     */
+    uint64_t getGroupMask(const std::vector<std::string>& categories) const;
+
     /**
      * Invokes methods on the callback to supply various
      * stats about the category registry.
@@ -104,8 +286,8 @@ public:
 
 protected:
     /**
-     * Calculates whether or not a given group index should
-     * be enabled based on the currently enabled categories.
+     * Calculates the sessions a given group index should be enabled in
+     * based on the currently enabled categories of each session.
      *
      * @param index The index of the group to calculate
      * @return The calculated status of the group based on the
@@ -113,6 +295,28 @@ protected:
      */
     CategoryStatus calculateEnabled(size_t index);
 
+    /**
+     * Calculates the minimum duration of scoped events for a given
+     * group index based on the current category thresholds.
+     */
+    std::chrono::nanoseconds calculateThreshold(size_t index);
+
+    /**
+     * @return The index of a CategoryStatus in group_statuses, or
+     *         registry_size if it isn't one of the registry's (std::less
+     *         as pointers into different objects can't be subtracted or
+     *         compared with the built-in operators)
+     */
+    size_t indexOf(const AtomicCategoryStatus& status) const {
+        const std::less<const AtomicCategoryStatus*> less;
+        const auto* first = group_statuses.data();
+        if (less(&status, first) ||
+            !less(&status, first + group_statuses.size())) {
+            return registry_size;
+        }
+        return size_t(&status - first);
+    }
+
     mutable std::mutex mutex;
 
     std::array<std::string, registry_size> groups;
@@ -121,9 +325,22 @@ protected:
     static constexpr int index_non_default_categories = 3;
 
     std::array<AtomicCategoryStatus, registry_size> group_statuses;
+    std::array<std::atomic<std::chrono::steady_clock::duration::rep>,
+               registry_size>
+            group_thresholds;
+    std::array<std::atomic<uint8_t>, registry_size> group_partitions;
+    std::array<std::atomic<bool>, registry_size> group_counted;
+    std::atomic<bool> has_thresholds;
     std::atomic<size_t> group_count;
 
-    std::vector<std::string> enabled_categories;
-    std::vector<std::string> disabled_categories;
+    // The enabled and disabled categories of each session
+    struct SessionCategories {
+        std::vector<std::string> enabled;
+        std::vector<std::string> disabled;
+    };
+    std::array<SessionCategories, max_trace_sessions> session_categories;
+    CategoryThresholds category_thresholds;
+    std::vector<std::vector<std::string>> partition_categories;
+    std::vector<std::string> counted_categories;
 };
 } // namespace phosphor
@@ -15,7 +15,13 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "category_registry.h"
+#include "trace_buffer.h"
 
 namespace phosphor {
 
@@ -91,6 +97,18 @@ public:
      */
     bool tryLockSlave();
 
+    /**
+     * This method will attempt to acquire the slave lock without blocking
+     * at all, failing if either lock is currently held.
+     *
+     * As only the tenant's own thread takes the slave lock this is what a
+     * signal handler interrupting that thread must use, as waiting for a
+     * slave lock held by the interrupted code would never return.
+     *
+     * @return true if the slave lock is acquired
+     */
+    bool tryLockSlaveOnce();
+
     /**
      * This method will release the slave lock
      *
@@ -157,8 +175,9 @@ public:
 
 struct ChunkTenant {
     /**
-     * ChunkTenant is trivially constructible to allow for use in
-     * MacOS compatible `thread_local` variables.
+     * ChunkTenant's default constructor does no more than zero
+     * initialisation to allow for use in MacOS compatible
+     * `thread_local` variables (its destructor frees the staging chunk).
      *
      * ChunkTenant is 'constructed' by memsetting to zero
      */
@@ -181,9 +200,76 @@ struct ChunkTenant {
         lck.slave().unlock();
     }
 
+    /**
+     * @return The chunk held for the given buffer partition
+     */
+    TraceChunk*& chunkFor(size_t partition) {
+        return partition == 0 ? chunk : partition_chunks[partition - 1];
+    }
+
+    /**
+     * @return The chunk held for the given secondary trace session
+     */
+    TraceChunk*& chunkForSession(size_t session) {
+        return session_chunks[session - 1];
+    }
+
     ChunkLock lck;
     TraceChunk* chunk;
 
+    /**
+     * Chunks held for buffer partitions other than the first, these are
+     * acquired lazily when an event is first logged to the partition.
+     */
+    std::array<TraceChunk*, max_buffer_partitions - 1> partition_chunks;
+
+    /**
+     * Spare chunks by buffer partition (see TraceConfig::setSpareChunks)
+     *
+     * A spare is an empty chunk ready to replace the partition's chunk
+     * when it fills. Spares are only set by the TraceLog's replenisher
+     * thread and taken by the tenant's own thread.
+     */
+    std::array<std::atomic<TraceChunk*>, max_buffer_partitions> spare_chunks;
+
+    /**
+     * Full chunks which were replaced by a spare, waiting for the
+     * replenisher thread to return them to the buffer
+     */
+    std::array<std::atomic<TraceChunk*>, max_buffer_partitions>
+            retired_chunks;
+
+    /**
+     * Set by the tenant's thread when it had to replace a partition's
+     * chunk without a spare, asking the replenisher thread for one
+     */
+    std::array<std::atomic<bool>, max_buffer_partitions> spare_wanted;
+
+    /**
+     * Id of the tenant's thread, which spare chunks are reset with as
+     * they are acquired by the replenisher thread
+     */
+    uint32_t thread_id;
+
+    /**
+     * Chunks held for the trace sessions other than the primary session
+     * (see TraceLog::startSession), acquired lazily like the partition
+     * chunks.
+     */
+    std::array<TraceChunk*, max_trace_sessions - 1> session_chunks;
+
+    /**
+     * Thread-local chunk which events are staged in while a deferred span
+     * is open (allocated on first use and freed when the thread is
+     * deregistered or exits)
+     */
+    std::unique_ptr<TraceChunk> staging;
+
+    /**
+     * Number of deferred spans currently open on the thread
+     */
+    unsigned int deferred_depth;
+
     /**
      * Special variable for use when registering a thread to tell if it's
      * already been registered (and not just that the tenant is unlocked
@@ -0,0 +1,178 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+/** \file
+ * This file is internal to the inner workings of
+ * Phosphor and is not intended for public consumption.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+namespace phosphor {
+
+/**
+ * InternIndex is the open-addressed hash index shared by the tables which
+ * give each distinct entry (tracepoint, stack, string) a dense index, e.g.
+ * TracepointTable, StackTable and StringTable.
+ *
+ * The owning table stores the entries themselves in an array of
+ * `capacity` entries, InternIndex assigns each new entry the next index
+ * into that array and finds existing entries by their hash. Entries are
+ * never removed, once the index is full any further entries are given
+ * `npos`.
+ *
+ * Lookups are lock-free, adding a new entry takes a lock. An entry is
+ * published (and so can be found or looked up by its index) only once it
+ * has been stored.
+ */
+class InternIndex {
+public:
+    /**
+     * Index of entries which couldn't be added
+     */
+    static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+    /**
+     * @param capacity_ Maximum number of entries
+     */
+    explicit InternIndex(size_t capacity_)
+        : capacity(capacity_),
+          bucket_count(capacity_ * 2),
+          buckets(new std::atomic<uint32_t>[capacity_ * 2]),
+          count(0),
+          dropped(0) {
+        for (size_t i = 0; i < bucket_count; ++i) {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    InternIndex(const InternIndex&) = delete;
+    InternIndex& operator=(const InternIndex&) = delete;
+
+    /**
+     * @return Maximum number of entries
+     */
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    /**
+     * @return Number of entries, entries below this index have been
+     *         stored
+     */
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @return Number of entries which couldn't be added as the index was
+     *         full (or locked when not waiting for it)
+     */
+    size_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Find an existing entry
+     *
+     * @param hash Hash of the entry
+     * @param equal Called with the index of each candidate entry, returns
+     *        true if it is the entry being looked for
+     * @return Index of the entry or npos if absent
+     */
+    template <typename Equal>
+    uint32_t find(size_t hash, Equal&& equal) const {
+        for (size_t probe = 0; probe < bucket_count; ++probe) {
+            const auto entry = buckets[(hash + probe) % bucket_count].load(
+                    std::memory_order_acquire);
+            if (entry == 0) {
+                break;
+            }
+            if (equal(entry - 1)) {
+                return entry - 1;
+            }
+        }
+        return npos;
+    }
+
+    /**
+     * Find an entry, adding it if it isn't already in the index
+     *
+     * @param hash Hash of the entry
+     * @param equal As find()
+     * @param store Called with the index of a new entry (under the lock)
+     *        to store it before it is published
+     * @param wait Whether to wait for the lock if another thread holds it,
+     *        if not the entry is dropped
+     * @return Index of the entry or npos if it couldn't be added
+     */
+    template <typename Equal, typename Store>
+    uint32_t findOrInsert(size_t hash,
+                          Equal&& equal,
+                          Store&& store,
+                          bool wait = true) {
+        auto index = find(hash, equal);
+        if (index != npos) {
+            return index;
+        }
+
+        std::unique_lock<std::mutex> lh(mutex, std::defer_lock);
+        if (wait) {
+            lh.lock();
+        } else if (!lh.try_lock()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return npos;
+        }
+        // Check again in case it was added before we got the lock
+        index = find(hash, equal);
+        if (index != npos) {
+            return index;
+        }
+        const auto next = count.load(std::memory_order_relaxed);
+        if (next == capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return npos;
+        }
+        store(uint32_t(next));
+        count.store(next + 1, std::memory_order_release);
+        // The index holds at most half as many entries as buckets so
+        // there is always an empty bucket
+        size_t bucket = hash % bucket_count;
+        while (buckets[bucket].load(std::memory_order_relaxed) != 0) {
+            bucket = (bucket + 1) % bucket_count;
+        }
+        buckets[bucket].store(uint32_t(next + 1), std::memory_order_release);
+        return uint32_t(next);
+    }
+
+protected:
+    const size_t capacity;
+    const size_t bucket_count;
+
+    // Open-addressed hash table of entry index + 1 (0 if empty)
+    std::unique_ptr<std::atomic<uint32_t>[]> buckets;
+
+    // Number of entries, published after each entry is stored
+    std::atomic<size_t> count;
+
+    std::atomic<size_t> dropped;
+
+    // Serialises inserts
+    std::mutex mutex;
+};
+
+} // namespace phosphor
@@ -0,0 +1,198 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace phosphor {
+
+// Forward declare
+struct tracepoint_info;
+
+/**
+ * The mode in which a lock was acquired
+ */
+enum class LockMode : char { exclusive, shared };
+
+/**
+ * Flag backing LockProfiler::isEnabled(), defined at namespace scope so
+ * that checking it from a lock guard is a single relaxed load.
+ */
+extern std::atomic<bool> lock_profiler_enabled;
+
+/**
+ * The LockProfiler aggregates lock contention statistics from
+ * TRACE_LOCKGUARD* call sites instead of logging a pair of events for
+ * every acquisition.
+ *
+ * While the profiler is enabled each lock guard records the time spent
+ * waiting for and holding its mutex into a table local to the calling
+ * thread, keyed on the address of the mutex. The tables are merged on
+ * demand into a report ranked by the total time spent waiting:
+ *
+ *     phosphor::LockProfiler::getInstance().enable();
+ *     // Run the workload
+ *     for (const auto& lock : LockProfiler::getInstance().getReport(10)) {
+ *         std::cerr << lock.tpi->name << ": " << lock.total_wait_ns << "\n";
+ *     }
+ *
+ * Lock guards do not log trace events while the profiler is enabled.
+ *
+ * This class is thread-safe.
+ */
+class LockProfiler {
+public:
+    /**
+     * Number of buckets in the duration histograms. Bucket 0 holds
+     * zero-length durations and bucket i holds durations in the range
+     * [2^(i-1), 2^i) nanoseconds, the last bucket holds everything
+     * larger.
+     */
+    static constexpr size_t histogram_buckets = 32;
+
+    using Histogram = std::array<uint64_t, histogram_buckets>;
+
+    /**
+     * Aggregated statistics for a single mutex
+     */
+    struct LockStats {
+        /**
+         * Merge another set of statistics for the same mutex into this
+         */
+        void merge(const LockStats& other);
+
+        /**
+         * Approximate a percentile from one of the histograms
+         *
+         * @param histogram The histogram to calculate from
+         * @param percentile The percentile to find, in the range [0, 100]
+         * @return The upper bound in nanoseconds of the histogram bucket
+         *         containing the percentile
+         */
+        static uint64_t percentile(const Histogram& histogram,
+                                   double percentile);
+
+        /// Address of the mutex
+        const void* mutex = nullptr;
+        /// Tracepoint of the first call site seen for the mutex
+        const tracepoint_info* tpi = nullptr;
+        /// Count of successful exclusive acquisitions
+        uint64_t acquisitions = 0;
+        /// Count of successful shared acquisitions
+        uint64_t shared_acquisitions = 0;
+        /// Count of try-lock attempts which failed to acquire the mutex
+        uint64_t try_lock_failures = 0;
+        uint64_t total_wait_ns = 0;
+        uint64_t max_wait_ns = 0;
+        uint64_t total_held_ns = 0;
+        uint64_t max_held_ns = 0;
+        Histogram wait_histogram{};
+        Histogram held_histogram{};
+    };
+
+    ~LockProfiler();
+
+    /**
+     * @return The process wide LockProfiler instance
+     */
+    static LockProfiler& getInstance();
+
+    /**
+     * @return true if lock guards should record into the profiler
+     */
+    static bool isEnabled() {
+        return lock_profiler_enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Start aggregating lock statistics
+     */
+    void enable();
+
+    /**
+     * Stop aggregating lock statistics, previously aggregated statistics
+     * are kept until reset() is called.
+     */
+    void disable();
+
+    /**
+     * Record a successful acquisition of a mutex by the calling thread
+     *
+     * @param mutex Address of the mutex
+     * @param tpi Tracepoint of the call site
+     * @param mode Mode in which the mutex was acquired
+     * @param wait Time spent waiting to acquire the mutex
+     * @param held Time the mutex was held for
+     */
+    void record(const void* mutex,
+                const tracepoint_info* tpi,
+                LockMode mode,
+                std::chrono::steady_clock::duration wait,
+                std::chrono::steady_clock::duration held);
+
+    /**
+     * Record a failed attempt to try-lock a mutex by the calling thread
+     *
+     * @param mutex Address of the mutex
+     * @param tpi Tracepoint of the call site
+     */
+    void recordTryLockFailure(const void* mutex, const tracepoint_info* tpi);
+
+    /**
+     * Merge the statistics of all threads into a report
+     *
+     * @param limit Maximum number of entries to return (0 for all)
+     * @return Statistics for each mutex, ordered by the total time spent
+     *         waiting to acquire it (most contended first)
+     */
+    std::vector<LockStats> getReport(size_t limit = 0) const;
+
+    /**
+     * Discard all previously aggregated statistics
+     */
+    void reset();
+
+    class ThreadTable;
+
+protected:
+    LockProfiler();
+
+    /**
+     * @return The calling thread's table, created on first use
+     */
+    ThreadTable& getThreadTable();
+
+    /**
+     * Called when a thread exits to fold its table into the statistics
+     * of retired threads
+     */
+    void retire(ThreadTable& table);
+
+    friend struct ThreadTableHolder;
+
+    mutable std::mutex mutex;
+
+    /// Tables of all live threads which have recorded statistics
+    std::unordered_set<ThreadTable*> tables;
+
+    /// Statistics from threads which have since exited
+    std::unique_ptr<ThreadTable> retired;
+};
+
+} // namespace phosphor
@@ -15,6 +15,8 @@
 
 #include <atomic>
 
+#include "category_filter.h"
+
 /*
  * Generates a variable name that will be unique per-line for the given prefix
  */
@@ -76,6 +78,124 @@
                        std::memory_order_release);                   \
     }
 
+/*
+ * Sets up the category status variables and the wait / held tracepoints
+ * used by the TRACE_LOCKGUARD family of macros
+ */
+#define PHOSPHOR_INTERNAL_INITIALIZE_LOCKGUARD(category, name)             \
+    PHOSPHOR_INTERNAL_CATEGORY_INFO                                        \
+    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_wait,                             \
+                                     category,                             \
+                                     name ".wait",                         \
+                                     phosphor::TraceEvent::Type::Complete, \
+                                     "this",                               \
+                                     void*,                                \
+                                     "",                                   \
+                                     phosphor::NoneType);                  \
+    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_held,                             \
+                                     category,                             \
+                                     name ".held",                         \
+                                     phosphor::TraceEvent::Type::Complete, \
+                                     "",                                   \
+                                     void*,                                \
+                                     "",                                   \
+                                     phosphor::NoneType);                  \
+    PHOSPHOR_INTERNAL_INITIALIZE_CATEGORY_ENABLED(category)
+
+/*
+ * The leading constructor arguments of a MutexEventGuard declared after
+ * PHOSPHOR_INTERNAL_INITIALIZE_LOCKGUARD
+ */
+#define PHOSPHOR_INTERNAL_LOCKGUARD_ARGS                             \
+    &PHOSPHOR_INTERNAL_UID(tpi_wait), &PHOSPHOR_INTERNAL_UID(tpi_held), \
+            PHOSPHOR_INTERNAL_UID(category_enabled_temp)                \
+                            ->load(std::memory_order_acquire) !=        \
+                    phosphor::CategoryStatus::Disabled
+
+/*
+ * Declares a guard for the rest of the enclosing scope
+ *
+ * If the category is compiled in (see category_filter.h) the trace point
+ * is set up by `setup` and the guard is initialised from the trailing
+ * guard expression. Otherwise the guard is `fallback` and neither the
+ * setup nor the guard expression (with the trace point's arguments) is
+ * compiled.
+ *
+ * Without a category filter every category is compiled in, so the guard
+ * is declared directly. With one, the choice is made in a lambda which
+ * is generic so that the discarded branch is never instantiated, even
+ * without optimisation, and is inlined whenever optimisation is enabled.
+ * The setup can't use __func__ (which would name the lambda).
+ */
+#ifndef PHOSPHOR_COMPILED_CATEGORIES
+#define PHOSPHOR_INTERNAL_SCOPED_GUARD(             \
+        guard_name, category, setup, fallback, ...) \
+    setup [[maybe_unused]] auto guard_name = __VA_ARGS__
+#else
+#define PHOSPHOR_INTERNAL_SCOPED_GUARD(                       \
+        guard_name, category, setup, fallback, ...)           \
+    [[maybe_unused]] auto guard_name = [&](auto) {            \
+        if constexpr (PHOSPHOR_CATEGORY_COMPILED(category)) { \
+            setup                                             \
+            return __VA_ARGS__;                               \
+        } else {                                              \
+            return fallback;                                  \
+        }                                                     \
+    }(0)
+#endif
+
+/*
+ * Declares the guard of a scoped event with two arguments, `guard_type` is
+ * the guard's class template (e.g. phosphor::ScopedEventGuard)
+ *
+ * The name is bound outside of the guard's lambda so that __func__ names
+ * the enclosing function.
+ */
+#define PHOSPHOR_INTERNAL_SCOPED_EVENT2(                                 \
+        guard_type,                                                      \
+        category,                                                        \
+        name,                                                            \
+        threshold,                                                       \
+        argNameA,                                                        \
+        argA,                                                            \
+        argNameB,                                                        \
+        argB)                                                            \
+    [[maybe_unused]] constexpr const char* PHOSPHOR_INTERNAL_UID(        \
+            event_name) = name;                                          \
+    PHOSPHOR_INTERNAL_SCOPED_GUARD(                                      \
+            PHOSPHOR_INTERNAL_UID(guard),                                \
+            category,                                                    \
+            PHOSPHOR_INTERNAL_CATEGORY_INFO                              \
+            PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(                     \
+                    category,                                            \
+                    PHOSPHOR_INTERNAL_UID(event_name),                   \
+                    phosphor::TraceEvent::Type::Complete,                \
+                    argNameA,                                            \
+                    decltype(argA),                                      \
+                    argNameB,                                            \
+                    decltype(argB)),                                     \
+            phosphor::NoneType(),                                        \
+            guard_type<decltype(argA), decltype(argB)>(                  \
+                    &PHOSPHOR_INTERNAL_UID(tpi),                         \
+                    *PHOSPHOR_INTERNAL_UID(category_enabled_temp),       \
+                    threshold,                                           \
+                    argA,                                                \
+                    argB))
+
+/*
+ * Declares the guard of a lock guard, `guard_type` is the guard's class
+ * (e.g. phosphor::MutexEventGuard<decltype(mutex)>) and `fallback` the
+ * plain lock guard used when the category is compiled out
+ */
+#define PHOSPHOR_INTERNAL_LOCKGUARD(                                \
+        guard_name, guard_type, fallback, category, name, ...)      \
+    PHOSPHOR_INTERNAL_SCOPED_GUARD(                                 \
+            guard_name,                                             \
+            category,                                               \
+            PHOSPHOR_INTERNAL_INITIALIZE_LOCKGUARD(category, name), \
+            fallback,                                               \
+            guard_type(PHOSPHOR_INTERNAL_LOCKGUARD_ARGS, __VA_ARGS__))
+
 /*
  * Traces an event of a specified type with two arguments
  *
@@ -83,20 +203,26 @@
  * for comparison to 0 rather than comparison to 1 which saves an instruction
  * on the disabled path when compiled.
  */
-#define PHOSPHOR_INTERNAL_TRACE_EVENT2(                                      \
-        category, name, type, argNameA, argA, argNameB, argB)                \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                          \
-    PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(category,                        \
-                                            name,                            \
-                                            type,                            \
-                                            argNameA,                        \
-                                            decltype(argA),                  \
-                                            argNameB,                        \
-                                            decltype(argB))                  \
-    if (PHOSPHOR_INTERNAL_UID(category_enabled_temp)                         \
-                ->load(std::memory_order_acquire) !=                         \
-        phosphor::CategoryStatus::Disabled) {                                \
-        PHOSPHOR_INSTANCE.logEvent(&PHOSPHOR_INTERNAL_UID(tpi), argA, argB); \
+#define PHOSPHOR_INTERNAL_TRACE_EVENT2(                            \
+        category, name, type, argNameA, argA, argNameB, argB)      \
+    if constexpr (PHOSPHOR_CATEGORY_COMPILED(category)) {          \
+        PHOSPHOR_INTERNAL_CATEGORY_INFO                            \
+        PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(category,          \
+                                                name,              \
+                                                type,              \
+                                                argNameA,          \
+                                                decltype(argA),    \
+                                                argNameB,          \
+                                                decltype(argB))    \
+        if (PHOSPHOR_INTERNAL_UID(category_enabled_temp)           \
+                    ->load(std::memory_order_acquire) !=           \
+            phosphor::CategoryStatus::Disabled) {                  \
+            PHOSPHOR_INSTANCE.logEvent(                            \
+                    &PHOSPHOR_INTERNAL_UID(tpi),                   \
+                    *PHOSPHOR_INTERNAL_UID(category_enabled_temp), \
+                    argA,                                          \
+                    argB);                                         \
+        }                                                          \
     }
 
 /*
@@ -125,19 +251,26 @@
 // moving `type` from the TraceEvent object into the tpi in a future commit.
 #define PHOSPHOR_INTERNAL_TRACE_COMPLETE2(                                     \
         category, name, type, start, duration, argNameA, argA, argNameB, argB) \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                            \
-    PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(category,                          \
-                                            name,                              \
-                                            type,                              \
-                                            argNameA,                          \
-                                            decltype(argA),                    \
-                                            argNameB,                          \
-                                            decltype(argB))                    \
-    if (PHOSPHOR_INTERNAL_UID(category_enabled_temp)                           \
-                ->load(std::memory_order_acquire) !=                           \
-        phosphor::CategoryStatus::Disabled) {                                  \
-        PHOSPHOR_INSTANCE.logEvent(                                            \
-                &PHOSPHOR_INTERNAL_UID(tpi), start, duration, argA, argB);     \
+    if constexpr (PHOSPHOR_CATEGORY_COMPILED(category)) {                      \
+        PHOSPHOR_INTERNAL_CATEGORY_INFO                                        \
+        PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(category,                      \
+                                                name,                          \
+                                                type,                          \
+                                                argNameA,                      \
+                                                decltype(argA),                \
+                                                argNameB,                      \
+                                                decltype(argB))                \
+        if (PHOSPHOR_INTERNAL_UID(category_enabled_temp)                       \
+                    ->load(std::memory_order_acquire) !=                       \
+            phosphor::CategoryStatus::Disabled) {                              \
+            PHOSPHOR_INSTANCE.logEvent(                                        \
+                    &PHOSPHOR_INTERNAL_UID(tpi),                               \
+                    *PHOSPHOR_INTERNAL_UID(category_enabled_temp),             \
+                    start,                                                     \
+                    duration,                                                  \
+                    argA,                                                      \
+                    argB);                                                     \
+        }                                                                      \
     }
 
 /*
@@ -11,6 +11,9 @@
 
 #pragma once
 
+#include <mutex>
+#include <shared_mutex>
+
 #include "phosphor-internal.h"
 #include "scoped_event_guard.h"
 #include "trace_log.h"
@@ -60,6 +63,16 @@
  *  - double
  *  - char* pointing to a cstring
  *  - void*
+ *
+ * Short dynamic strings can be inlined with PHOSPHOR_INLINE_STR and
+ * repeated dynamic strings interned with PHOSPHOR_INTERNED_STR.
+ *
+ * Defining PHOSPHOR_DISABLED removes every trace point at compile time,
+ * PHOSPHOR_COMPILED_CATEGORIES removes those of the categories it doesn't
+ * list (see category_filter.h).
+ *
+ * trace_template.h offers the instant and scoped events as templates,
+ * which take the category and names as template arguments.
  */
 
 /**
@@ -75,6 +88,14 @@
 #define PHOSPHOR_INLINE_STR(arg) phosphor::inline_zstring<8>(arg)
 #define PHOSPHOR_INLINE_STR_N(arg, len) phosphor::inline_zstring<8>(arg, len)
 
+/**
+ * Utility for logging a runtime string of any length which is likely to
+ * be repeated (e.g. a bucket name). Accepts std::string, std::string_view
+ * or char* as argument. The string is interned into a table owned by the
+ * TraceLog and the event stores an 8 byte reference to it.
+ */
+#define PHOSPHOR_INTERNED_STR(arg) PHOSPHOR_INSTANCE.internString(arg)
+
 #if !defined(PHOSPHOR_DISABLED)
 #define PHOSPHOR_DISABLED 0
 #endif
@@ -163,64 +184,70 @@
  *     } // Automatically log a synchronous end event on function exit
  *       // (Through return or exception)
  *
+ * The TRACE_EVENT_THRESHOLD and TRACE_FUNCTION_THRESHOLD macros take an
+ * additional minimum duration; scopes which finish more quickly than it
+ * are dropped instead of being logged. A minimum duration can also be
+ * given for a whole category with TraceConfig::setCategoryThreshold(),
+ * which applies to every scoped event in that category (the larger of
+ * the two thresholds is used).
+ *
+ * Example:
+ *
+ *     TRACE_FUNCTION_THRESHOLD0("ep-engine:vbucket",
+ *                               std::chrono::microseconds(10));
+ *
  * @{
  */
-#define TRACE_EVENT0(category, name)                                   \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                    \
-    PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(                           \
-            category,                                                  \
-            name,                                                      \
-            phosphor::TraceEvent::Type::Complete,                      \
-            "",                                                        \
-            phosphor::NoneType,                                        \
-            "",                                                        \
-            phosphor::NoneType)                                        \
-    phosphor::ScopedEventGuard<phosphor::NoneType, phosphor::NoneType> \
-    PHOSPHOR_INTERNAL_UID(guard)(                                      \
-            &PHOSPHOR_INTERNAL_UID(tpi),                               \
-            PHOSPHOR_INTERNAL_UID(category_enabled_temp)               \
-                            ->load(std::memory_order_acquire) !=       \
-                    phosphor::CategoryStatus::Disabled,                \
-            phosphor::NoneType(),                                      \
-            phosphor::NoneType())
-
-#define TRACE_EVENT1(category, name, arg1_name, arg1)              \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                \
-    PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(                       \
-            category,                                              \
-            name,                                                  \
-            phosphor::TraceEvent::Type::Complete,                  \
-            arg1_name,                                             \
-            decltype(arg1),                                        \
-            "",                                                    \
-            phosphor::NoneType)                                    \
-    phosphor::ScopedEventGuard<decltype(arg1), phosphor::NoneType> \
-    PHOSPHOR_INTERNAL_UID(guard)(                                  \
-            &PHOSPHOR_INTERNAL_UID(tpi),                           \
-            PHOSPHOR_INTERNAL_UID(category_enabled_temp)           \
-                            ->load(std::memory_order_acquire) !=   \
-                    phosphor::CategoryStatus::Disabled,            \
-            arg1,                                                  \
-            phosphor::NoneType())
-
-#define TRACE_EVENT2(category, name, arg1_name, arg1, arg2_name, arg2) \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                    \
-    PHOSPHOR_INTERNAL_INITIALIZE_TRACEPOINT(                           \
-            category,                                                  \
-            name,                                                      \
-            phosphor::TraceEvent::Type::Complete,                      \
-            arg1_name,                                                 \
-            decltype(arg1),                                            \
-            arg2_name,                                                 \
-            decltype(arg2))                                            \
-    phosphor::ScopedEventGuard<decltype(arg1), decltype(arg2)>         \
-    PHOSPHOR_INTERNAL_UID(guard)(                                      \
-            &PHOSPHOR_INTERNAL_UID(tpi),                               \
-            PHOSPHOR_INTERNAL_UID(category_enabled_temp)               \
-                            ->load(std::memory_order_acquire) !=       \
-                    phosphor::CategoryStatus::Disabled,                \
-            arg1,                                                      \
-            arg2)
+#define TRACE_EVENT_THRESHOLD0(category, name, threshold)       \
+    PHOSPHOR_INTERNAL_SCOPED_EVENT2(phosphor::ScopedEventGuard, \
+                                    category,                   \
+                                    name,                       \
+                                    threshold,                  \
+                                    "",                         \
+                                    phosphor::NoneType(),       \
+                                    "",                         \
+                                    phosphor::NoneType())
+
+#define TRACE_EVENT_THRESHOLD1(category, name, threshold, arg1_name, arg1) \
+    PHOSPHOR_INTERNAL_SCOPED_EVENT2(phosphor::ScopedEventGuard,            \
+                                    category,                              \
+                                    name,                                  \
+                                    threshold,                             \
+                                    arg1_name,                             \
+                                    arg1,                                  \
+                                    "",                                    \
+                                    phosphor::NoneType())
+
+#define TRACE_EVENT_THRESHOLD2(                                      \
+        category, name, threshold, arg1_name, arg1, arg2_name, arg2) \
+    PHOSPHOR_INTERNAL_SCOPED_EVENT2(phosphor::ScopedEventGuard,      \
+                                    category,                        \
+                                    name,                            \
+                                    threshold,                       \
+                                    arg1_name,                       \
+                                    arg1,                            \
+                                    arg2_name,                       \
+                                    arg2)
+
+#define TRACE_EVENT0(category, name) \
+    TRACE_EVENT_THRESHOLD0(          \
+            category, name, std::chrono::steady_clock::duration::zero())
+
+#define TRACE_EVENT1(category, name, arg1_name, arg1)                   \
+    TRACE_EVENT_THRESHOLD1(category,                                    \
+                           name,                                        \
+                           std::chrono::steady_clock::duration::zero(), \
+                           arg1_name,                                   \
+                           arg1)
+
+#define TRACE_EVENT2(category, name, arg1_name, arg1, arg2_name, arg2)  \
+    TRACE_EVENT_THRESHOLD2(category,                                    \
+                           name,                                        \
+                           std::chrono::steady_clock::duration::zero(), \
+                           arg1_name,                                   \
+                           arg1,                                        \
+                           arg2_name,                                   \
+                           arg2)
 
 #define TRACE_FUNCTION0(category) TRACE_EVENT0(category, __func__)
 
@@ -229,6 +256,77 @@
 
 #define TRACE_FUNCTION2(category, arg1_name, arg1, arg2_name, arg2) \
     TRACE_EVENT2(category, __func__, arg1_name, arg1, arg2_name, arg2)
+
+#define TRACE_FUNCTION_THRESHOLD0(category, threshold) \
+    TRACE_EVENT_THRESHOLD0(category, __func__, threshold)
+
+#define TRACE_FUNCTION_THRESHOLD1(category, threshold, arg1_name, arg1) \
+    TRACE_EVENT_THRESHOLD1(category, __func__, threshold, arg1_name, arg1)
+
+#define TRACE_FUNCTION_THRESHOLD2(                                         \
+        category, threshold, arg1_name, arg1, arg2_name, arg2)             \
+    TRACE_EVENT_THRESHOLD2(                                                \
+            category, __func__, threshold, arg1_name, arg1, arg2_name, arg2)
+/** @} */
+
+/**
+ * \defgroup deferred Deferred Spans
+ *
+ * Deferred spans are scoped events which decide at the end of the scope
+ * whether they (and every event logged inside them) are worth keeping.
+ * While a deferred span is open the thread's events are staged in a
+ * small thread-local chunk. When the span ends the staged events are
+ * copied into the trace buffer in bulk if the span lasted at least as
+ * long as the given threshold, otherwise they are all discarded.
+ *
+ * This allows the full nested breakdown of slow operations to be traced
+ * without the buffer cost of tracing every fast operation. Deferred
+ * spans only take effect on registered threads.
+ *
+ * Example:
+ *
+ *     void handle_request(Request& req) {
+ *         TRACE_DEFERRED_EVENT1("memcached:request",
+ *                               "handle_request",
+ *                               std::chrono::milliseconds(1),
+ *                               "opcode",
+ *                               req.opcode);
+ *         // Events logged here are only kept if the request takes 1ms
+ *         ...
+ *     }
+ *
+ * @{
+ */
+#define TRACE_DEFERRED_EVENT0(category, name, threshold)         \
+    PHOSPHOR_INTERNAL_SCOPED_EVENT2(phosphor::DeferredSpanGuard, \
+                                    category,                    \
+                                    name,                        \
+                                    threshold,                   \
+                                    "",                          \
+                                    phosphor::NoneType(),        \
+                                    "",                          \
+                                    phosphor::NoneType())
+
+#define TRACE_DEFERRED_EVENT1(category, name, threshold, arg1_name, arg1) \
+    PHOSPHOR_INTERNAL_SCOPED_EVENT2(phosphor::DeferredSpanGuard,          \
+                                    category,                             \
+                                    name,                                 \
+                                    threshold,                            \
+                                    arg1_name,                            \
+                                    arg1,                                 \
+                                    "",                                   \
+                                    phosphor::NoneType())
+
+#define TRACE_DEFERRED_EVENT2(                                       \
+        category, name, threshold, arg1_name, arg1, arg2_name, arg2) \
+    PHOSPHOR_INTERNAL_SCOPED_EVENT2(phosphor::DeferredSpanGuard,     \
+                                    category,                        \
+                                    name,                            \
+                                    threshold,                       \
+                                    arg1_name,                       \
+                                    arg1,                            \
+                                    arg2_name,                       \
+                                    arg2)
 /** @} */
 
 /**
@@ -267,63 +365,71 @@
  * If either of the acquire or held durations exceed 10ms, then trace events
  * are recorded.
  *
+ * TRACE_LOCKGUARD_SHARED and TRACE_LOCKGUARD_SHARED_TIMED acquire the mutex
+ * in shared mode (e.g. as a reader of a std::shared_mutex):
+ *
+ *    TRACE_LOCKGUARD_SHARED(rwlock, "category", "lock_name");
+ *
+ * TRACE_TRY_LOCKGUARD attempts to acquire the mutex without blocking and
+ * declares a guard with the given name which can be tested for ownership:
+ *
+ *    TRACE_TRY_LOCKGUARD(guard, mutex, "category", "lock_name");
+ *    if (guard.owns_lock()) {
+ *        // Mutex is held until the guard goes out of scope
+ *    }
+ *
+ * While the phosphor::LockProfiler is enabled the lock guards aggregate
+ * wait / held histograms per mutex (and count failed try-locks) instead
+ * of recording events, see lock_profiler.h.
+ *
  * @{
  */
-#define TRACE_LOCKGUARD(mutex, category, name)                               \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                          \
-    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_wait,                               \
-                                     category,                               \
-                                     name ".wait",                           \
-                                     phosphor::TraceEvent::Type::Complete,   \
-                                     "this",                                 \
-                                     void*,                                  \
-                                     "",                                     \
-                                     phosphor::NoneType);                    \
-    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_held,                               \
-                                     category,                               \
-                                     name ".held",                           \
-                                     phosphor::TraceEvent::Type::Complete,   \
-                                     "",                                     \
-                                     void*,                                  \
-                                     "",                                     \
-                                     phosphor::NoneType);                    \
-    PHOSPHOR_INTERNAL_INITIALIZE_CATEGORY_ENABLED(category)                  \
-    phosphor::MutexEventGuard<decltype(mutex)> PHOSPHOR_INTERNAL_UID(guard)( \
-            &PHOSPHOR_INTERNAL_UID(tpi_wait),                                \
-            &PHOSPHOR_INTERNAL_UID(tpi_held),                                \
-            PHOSPHOR_INTERNAL_UID(category_enabled_temp)                     \
-                            ->load(std::memory_order_acquire) !=             \
-                    phosphor::CategoryStatus::Disabled,                      \
+#define TRACE_LOCKGUARD(mutex, category, name)                              \
+    PHOSPHOR_INTERNAL_LOCKGUARD(PHOSPHOR_INTERNAL_UID(guard),               \
+                                phosphor::MutexEventGuard<decltype(mutex)>, \
+                                std::lock_guard<decltype(mutex)>(mutex),    \
+                                category,                                   \
+                                name,                                       \
+                                mutex)
+
+#define TRACE_LOCKGUARD_TIMED(mutex, category, name, limit)                 \
+    PHOSPHOR_INTERNAL_LOCKGUARD(PHOSPHOR_INTERNAL_UID(guard),               \
+                                phosphor::MutexEventGuard<decltype(mutex)>, \
+                                std::lock_guard<decltype(mutex)>(mutex),    \
+                                category,                                   \
+                                name,                                       \
+                                mutex,                                      \
+                                limit)
+
+#define TRACE_LOCKGUARD_SHARED(mutex, category, name)         \
+    PHOSPHOR_INTERNAL_LOCKGUARD(                              \
+            PHOSPHOR_INTERNAL_UID(guard),                     \
+            phosphor::SharedMutexEventGuard<decltype(mutex)>, \
+            std::shared_lock<decltype(mutex)>(mutex),         \
+            category,                                         \
+            name,                                             \
             mutex)
 
-#define TRACE_LOCKGUARD_TIMED(mutex, category, name, limit)                  \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                          \
-    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_wait,                               \
-                                     category,                               \
-                                     name ".wait",                           \
-                                     phosphor::TraceEvent::Type::Complete,   \
-                                     "this",                                 \
-                                     void*,                                  \
-                                     "",                                     \
-                                     phosphor::NoneType);                    \
-    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_held,                               \
-                                     category,                               \
-                                     name ".held",                           \
-                                     phosphor::TraceEvent::Type::Complete,   \
-                                     "",                                     \
-                                     void*,                                  \
-                                     "",                                     \
-                                     phosphor::NoneType);                    \
-    PHOSPHOR_INTERNAL_INITIALIZE_CATEGORY_ENABLED(category)                  \
-    phosphor::MutexEventGuard<decltype(mutex)> PHOSPHOR_INTERNAL_UID(guard)( \
-            &PHOSPHOR_INTERNAL_UID(tpi_wait),                                \
-            &PHOSPHOR_INTERNAL_UID(tpi_held),                                \
-            PHOSPHOR_INTERNAL_UID(category_enabled_temp)                     \
-                            ->load(std::memory_order_acquire) !=             \
-                    phosphor::CategoryStatus::Disabled,                      \
-            mutex,                                                           \
+#define TRACE_LOCKGUARD_SHARED_TIMED(mutex, category, name, limit) \
+    PHOSPHOR_INTERNAL_LOCKGUARD(                                   \
+            PHOSPHOR_INTERNAL_UID(guard),                          \
+            phosphor::SharedMutexEventGuard<decltype(mutex)>,      \
+            std::shared_lock<decltype(mutex)>(mutex),              \
+            category,                                              \
+            name,                                                  \
+            mutex,                                                 \
             limit)
 
+#define TRACE_TRY_LOCKGUARD(guard, mutex, category, name)               \
+    PHOSPHOR_INTERNAL_LOCKGUARD(                                        \
+            guard,                                                      \
+            phosphor::MutexEventGuard<decltype(mutex)>,                 \
+            std::unique_lock<decltype(mutex)>(mutex, std::try_to_lock), \
+            category,                                                   \
+            name,                                                       \
+            mutex,                                                      \
+            std::try_to_lock)
+
 /** @} */
 
 /**
@@ -384,33 +490,46 @@
                                    arg1_name,                            \
                                    arg1)
 
-#define TRACE_ASYNC_COMPLETE2(                                                 \
-        category, name, id, start, end, arg1_name, arg1, arg2_name, arg2)      \
-    PHOSPHOR_INTERNAL_CATEGORY_INFO                                            \
-    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_async_start,                          \
-                                     category,                                 \
-                                     name,                                     \
-                                     phosphor::TraceEvent::Type::AsyncStart,   \
-                                     "id",                                     \
-                                     void*,                                    \
-                                     arg1_name,                                \
-                                     decltype(arg1));                          \
-    PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_async_end,                            \
-                                     category,                                 \
-                                     name,                                     \
-                                     phosphor::TraceEvent::Type::AsyncEnd,     \
-                                     "id_end",                                 \
-                                     void*,                                    \
-                                     arg2_name,                                \
-                                     decltype(arg2));                          \
-    PHOSPHOR_INTERNAL_INITIALIZE_CATEGORY_ENABLED(category)                    \
-    if (PHOSPHOR_INTERNAL_UID(category_enabled_temp)                           \
-                ->load(std::memory_order_acquire) !=                           \
-        phosphor::CategoryStatus::Disabled) {                                  \
-        PHOSPHOR_INSTANCE.logEvent(                                            \
-                &PHOSPHOR_INTERNAL_UID(tpi_async_start), start, {}, id, arg1); \
-        PHOSPHOR_INSTANCE.logEvent(                                            \
-                &PHOSPHOR_INTERNAL_UID(tpi_async_end), end, {}, id, arg2);     \
+#define TRACE_ASYNC_COMPLETE2(                                                  \
+        category, name, id, start, end, arg1_name, arg1, arg2_name, arg2)       \
+    if constexpr (PHOSPHOR_CATEGORY_COMPILED(category)) {                       \
+        PHOSPHOR_INTERNAL_CATEGORY_INFO                                         \
+        PHOSPHOR_INTERNAL_INITIALIZE_TPI(                                       \
+                tpi_async_start,                                                \
+                category,                                                       \
+                name,                                                           \
+                phosphor::TraceEvent::Type::AsyncStart,                         \
+                "id",                                                           \
+                void*,                                                          \
+                arg1_name,                                                      \
+                decltype(arg1));                                                \
+        PHOSPHOR_INTERNAL_INITIALIZE_TPI(tpi_async_end,                         \
+                                         category,                              \
+                                         name,                                  \
+                                         phosphor::TraceEvent::Type::AsyncEnd,  \
+                                         "id_end",                              \
+                                         void*,                                 \
+                                         arg2_name,                             \
+                                         decltype(arg2));                       \
+        PHOSPHOR_INTERNAL_INITIALIZE_CATEGORY_ENABLED(category)                 \
+        if (PHOSPHOR_INTERNAL_UID(category_enabled_temp)                        \
+                    ->load(std::memory_order_acquire) !=                        \
+            phosphor::CategoryStatus::Disabled) {                               \
+            PHOSPHOR_INSTANCE.logEvent(                                         \
+                    &PHOSPHOR_INTERNAL_UID(tpi_async_start),                    \
+                    *PHOSPHOR_INTERNAL_UID(category_enabled_temp),              \
+                    start,                                                      \
+                    {},                                                         \
+                    id,                                                         \
+                    arg1);                                                      \
+            PHOSPHOR_INSTANCE.logEvent(                                         \
+                    &PHOSPHOR_INTERNAL_UID(tpi_async_end),                      \
+                    *PHOSPHOR_INTERNAL_UID(category_enabled_temp),              \
+                    end,                                                        \
+                    {},                                                         \
+                    id,                                                         \
+                    arg2);                                                      \
+        }                                                                       \
     }
 
 #define TRACE_ASYNC_COMPLETE1(category, name, id, start, end, arg1_name, arg1) \
@@ -574,10 +693,31 @@
 #define TRACE_FUNCTION1(category, name, arg1_name, arg1)
 #define TRACE_FUNCTION2(category, name, arg1_name, arg1, arg2_name, arg2)
 
+#define TRACE_EVENT_THRESHOLD0(category, name, threshold)
+#define TRACE_EVENT_THRESHOLD1(category, name, threshold, arg1_name, arg1)
+#define TRACE_EVENT_THRESHOLD2( \
+        category, name, threshold, arg1_name, arg1, arg2_name, arg2)
+
+#define TRACE_FUNCTION_THRESHOLD0(category, threshold)
+#define TRACE_FUNCTION_THRESHOLD1(category, threshold, arg1_name, arg1)
+#define TRACE_FUNCTION_THRESHOLD2( \
+        category, threshold, arg1_name, arg1, arg2_name, arg2)
+
+#define TRACE_DEFERRED_EVENT0(category, name, threshold)
+#define TRACE_DEFERRED_EVENT1(category, name, threshold, arg1_name, arg1)
+#define TRACE_DEFERRED_EVENT2( \
+        category, name, threshold, arg1_name, arg1, arg2_name, arg2)
+
 #define TRACE_LOCKGUARD(mutex, category, name) \
     std::lock_guard<decltype(mutex)> PHOSPHOR_INTERNAL_UID(guard)(mutex);
 #define TRACE_LOCKGUARD_TIMED(mutex, category, name, limit) \
     std::lock_guard<decltype(mutex)> PHOSPHOR_INTERNAL_UID(guard)(mutex);
+#define TRACE_LOCKGUARD_SHARED(mutex, category, name) \
+    std::shared_lock<decltype(mutex)> PHOSPHOR_INTERNAL_UID(guard)(mutex);
+#define TRACE_LOCKGUARD_SHARED_TIMED(mutex, category, name, limit) \
+    std::shared_lock<decltype(mutex)> PHOSPHOR_INTERNAL_UID(guard)(mutex);
+#define TRACE_TRY_LOCKGUARD(guard, mutex, category, name) \
+    std::unique_lock<decltype(mutex)> guard(mutex, std::try_to_lock);
 
 #define TRACE_ASYNC_START0(category, name, id)
 #define TRACE_ASYNC_START1(category, name, id, arg1_name, arg1)
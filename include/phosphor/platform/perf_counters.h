@@ -0,0 +1,113 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace phosphor {
+namespace platform {
+
+/**
+ * The set of counters a thread's PerfCounters were able to open
+ */
+enum class PerfCounterSet : uint8_t {
+    /// No counters are available (e.g. not Linux, or perf_event_paranoid
+    /// forbids them)
+    none,
+    /// Instructions, cycles and last level cache misses
+    hardware,
+    /// Context switches and page faults, used when the hardware counters
+    /// are unavailable (e.g. in most VMs)
+    software
+};
+
+/**
+ * Maximum number of counters in a PerfCounterSet
+ */
+constexpr size_t max_perf_counters = 3;
+
+using PerfCounterValues = std::array<uint64_t, max_perf_counters>;
+
+/**
+ * PerfCounters holds the perf_event counters of a single thread.
+ *
+ * The counters are opened on the thread's first call to
+ * getThreadInstance() and closed when the thread exits. Where the
+ * kernel allows it the hardware counters are read in user space with
+ * rdpmc (through the mmap'd perf_event_mmap_page), otherwise all the
+ * counters are read with a single read() of the group.
+ */
+class PerfCounters {
+public:
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters();
+
+    /**
+     * @return The counters of the calling thread
+     */
+    static PerfCounters& getThreadInstance();
+
+    /**
+     * @return The set of counters which are available
+     */
+    PerfCounterSet getSet() const {
+        return set;
+    }
+
+    /**
+     * @return The number of counters in the set
+     */
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * Read the current value of each counter, values past size() are
+     * left as they are.
+     *
+     * @param values Where to store the values of the counters
+     * @return false if the counters are unavailable or couldn't be read
+     */
+    bool read(PerfCounterValues& values);
+
+protected:
+    PerfCounters();
+
+    /**
+     * Open the counters of the given set as a group
+     *
+     * @return true if every counter of the set was opened
+     */
+    bool open(PerfCounterSet counters);
+
+    void close();
+
+    /**
+     * Read a hardware counter from user space with rdpmc
+     *
+     * @return false if the counter isn't currently readable with rdpmc
+     */
+    bool readUserspace(size_t index, uint64_t& value) const;
+
+    PerfCounterSet set = PerfCounterSet::none;
+    size_t count = 0;
+    std::array<int, max_perf_counters> fds;
+    // perf_event_mmap_page of each counter, null if not mapped
+    std::array<void*, max_perf_counters> pages;
+};
+
+} // namespace platform
+} // namespace phosphor
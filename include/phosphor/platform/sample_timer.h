@@ -0,0 +1,127 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <chrono>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+namespace phosphor {
+namespace platform {
+
+/**
+ * SampleTimer interrupts a thread with SIGPROF each time the thread has
+ * used a given interval of CPU time, so that the thread can be sampled.
+ *
+ * A single signal handler is shared by every timer of the process, it
+ * invokes the handler given to install() with the context of the timer
+ * which fired. The handler runs in signal context so must be
+ * async-signal-safe. SIGPROF signals which weren't sent by a timer (e.g.
+ * those of setitimer() based profilers) are passed on to the handler the
+ * process had installed before. The signal handler stays installed once
+ * sampling stops, as a timer's signal may still be delivered after the
+ * timer has been deleted.
+ *
+ * Timers are only available on Linux (a timer_create() timer on the
+ * thread's CPU clock, signalling the thread with SIGEV_THREAD_ID),
+ * elsewhere they are never valid.
+ */
+class SampleTimer {
+public:
+    /**
+     * @param context The context of the timer which fired
+     * @param pc The instruction the thread was interrupted at, or null if
+     *        it isn't known on this platform
+     */
+    using Handler = void (*)(void* context, const void* pc);
+
+    /**
+     * Identifies a thread which can be sampled, so that its timer can be
+     * created by another thread
+     */
+    struct Thread {
+        /**
+         * @return The calling thread
+         */
+        static Thread current();
+
+#if defined(__linux__)
+        int tid;
+        clockid_t cpu_clock;
+#endif
+    };
+
+    /**
+     * Create a disarmed timer on the given thread's CPU clock
+     *
+     * @param thread The thread to be sampled
+     * @param context Passed to the handler when the timer fires
+     */
+    SampleTimer(const Thread& thread, void* context);
+
+    SampleTimer(const SampleTimer&) = delete;
+    SampleTimer& operator=(const SampleTimer&) = delete;
+
+    /**
+     * Deletes the timer, a signal it already sent may still be delivered
+     * afterwards (and is ignored once every install has been uninstalled)
+     */
+    ~SampleTimer();
+
+    /**
+     * Install the SIGPROF handler which invokes the given handler when
+     * any timer fires, saving the process' previous SIGPROF handler (the
+     * signal handler is only replaced if it isn't already installed)
+     *
+     * Installs are counted, each successful install must be paired with
+     * a call to uninstall().
+     *
+     * @return false if the signal handler couldn't be installed
+     */
+    static bool install(Handler handler);
+
+    /**
+     * Stop invoking the handler given to install() once every install has
+     * been uninstalled. The SIGPROF handler itself isn't restored: the
+     * default action of SIGPROF would terminate the process if a signal
+     * of a deleted timer were still pending, so timer signals are ignored
+     * instead and other signals are still passed on to the saved handler.
+     */
+    static void uninstall();
+
+    /**
+     * @return true if the timer was created
+     */
+    bool isValid() const {
+        return valid;
+    }
+
+    /**
+     * Arm the timer to fire each time the thread has used the given
+     * interval of CPU time
+     *
+     * @param interval CPU time between signals, zero disarms the timer
+     * @return false if the timer isn't valid or couldn't be armed
+     */
+    bool arm(std::chrono::nanoseconds interval);
+
+protected:
+#if defined(__linux__)
+    timer_t timer;
+#endif
+    bool valid = false;
+};
+
+} // namespace platform
+} // namespace phosphor
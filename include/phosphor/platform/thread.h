@@ -40,6 +40,18 @@ int getCurrentProcessID();
  */
 uint32_t getCurrentThreadID();
 
+/**
+ * Get the number of the CPU the calling thread is running on
+ *
+ * On Linux this reads the cpu_id which the kernel keeps up to date in
+ * the thread's restartable sequences (rseq) area when glibc has
+ * registered one, falling back to sched_getcpu(). The thread may have
+ * migrated by the time the result is used.
+ *
+ * @return CPU number, or -1 if it can't be determined on this platform
+ */
+int getCurrentCPU();
+
 /**
  * Get the cached system thread id for the calling thread
  *
@@ -67,6 +67,10 @@ public:
         return value.fetch_sub(1, std::memory_order_relaxed);
     }
 
+    T operator+=(T val) {
+        return value.fetch_add(val, std::memory_order_relaxed) + val;
+    }
+
 protected:
     std::atomic<T> value;
 };
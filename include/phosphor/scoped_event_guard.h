@@ -9,9 +9,15 @@
  *   the file licenses/APL2.txt.
  */
 
+#pragma once
+
+#include <algorithm>
 #include <chrono>
+#include <mutex>
 
+#include "lock_profiler.h"
 #include "phosphor.h"
+#include "platform/perf_counters.h"
 #include "trace_log.h"
 
 namespace phosphor {
@@ -21,7 +27,10 @@ struct tracepoint_info;
  * RAII-style object which captures the arguments for a scoped event.
  *
  * If enabled==true, saves the time of object creation; upon destruction
- * records end time and logs an event.
+ * records end time and logs an event if the scope lasted at least as long
+ * as the threshold. Scopes of counted categories also log the change in
+ * the thread's perf counters (see TraceConfig::setCountedCategories()),
+ * and slow scopes log their stack (see TraceConfig::setStackThreshold()).
  * If !enabled; then no times are recorded and no event logged.
  */
 template <typename T, typename U>
@@ -36,21 +45,186 @@ struct ScopedEventGuard {
         }
     }
 
+    /**
+     * Constructs a guard which is enabled if the given category status is
+     * enabled. Scopes shorter than the larger of the given threshold and
+     * the category's configured threshold are dropped without logging.
+     */
+    ScopedEventGuard(const tracepoint_info* tpi_,
+                     const AtomicCategoryStatus& status_,
+                     std::chrono::steady_clock::duration threshold_,
+                     T arg1_,
+                     U arg2_)
+        : tpi(tpi_),
+          status(&status_),
+          enabled(status_.load(std::memory_order_acquire) !=
+                  CategoryStatus::Disabled),
+          arg1(arg1_),
+          arg2(arg2_) {
+        if (enabled) {
+            auto& traceLog = TraceLog::getInstance();
+            threshold = threshold_;
+            if (traceLog.hasCategoryThresholds()) {
+                threshold = std::max(threshold,
+                                     traceLog.getCategoryThreshold(status_));
+            }
+            start = std::chrono::steady_clock::now();
+            if (traceLog.isCategoryCounted(status_)) {
+                // Read last so the counters cover as little of the guard
+                // as possible
+                counters = &platform::PerfCounters::getThreadInstance();
+                if (!counters->read(counters_start)) {
+                    counters = nullptr;
+                }
+            }
+        }
+    }
+
     ~ScopedEventGuard() {
+        if (enabled) {
+            platform::PerfCounterValues counters_end;
+            if (counters && !counters->read(counters_end)) {
+                counters = nullptr;
+            }
+            const auto end = std::chrono::steady_clock::now();
+            if ((end - start) >= threshold) {
+                auto& traceLog = TraceLog::getInstance();
+                if (status) {
+                    traceLog.logEvent(
+                            tpi, *status, start, end - start, arg1, arg2);
+                } else {
+                    traceLog.logEvent(tpi, start, end - start, arg1, arg2);
+                }
+                if (counters) {
+                    for (size_t i = 0; i < counters->size(); ++i) {
+                        counters_end[i] -= counters_start[i];
+                    }
+                    traceLog.logPerfCounters(*status,
+                                             start,
+                                             end - start,
+                                             counters->getSet(),
+                                             counters_end);
+                }
+                if (traceLog.isStackThresholdExceeded(end - start)) {
+                    traceLog.logStackTrace(tpi);
+                }
+            }
+        }
+    }
+
+    const tracepoint_info* tpi;
+    // The category status if the guard was constructed from it, which
+    // saves looking up the category group of the tracepoint
+    const AtomicCategoryStatus* status = nullptr;
+    const bool enabled;
+    const T arg1;
+    const U arg2;
+    std::chrono::steady_clock::duration threshold =
+            std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::time_point start;
+    // The thread's perf counters if the category is counted
+    platform::PerfCounters* counters = nullptr;
+    platform::PerfCounterValues counters_start;
+};
+
+/**
+ * RAII-style object for a deferred span, a scoped event whose nested
+ * events are only kept if the scope is slow.
+ *
+ * If enabled, opens a deferred span on construction so that events logged
+ * by the thread are staged rather than written to the buffer. Upon
+ * destruction, if the scope lasted at least as long as the threshold the
+ * scope's own event is logged and the staged events are committed,
+ * otherwise they are all discarded.
+ */
+template <typename T, typename U>
+struct DeferredSpanGuard {
+    DeferredSpanGuard(const tracepoint_info* tpi_,
+                      const AtomicCategoryStatus& status_,
+                      std::chrono::steady_clock::duration threshold_,
+                      T arg1_,
+                      U arg2_)
+        : tpi(tpi_),
+          status(status_),
+          enabled(status.load(std::memory_order_acquire) !=
+                  CategoryStatus::Disabled),
+          threshold(threshold_),
+          arg1(arg1_),
+          arg2(arg2_) {
+        if (enabled) {
+            mark = TraceLog::getInstance().beginDeferredSpan();
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~DeferredSpanGuard() {
         if (enabled) {
             const auto end = std::chrono::steady_clock::now();
-            TraceLog::getInstance().logEvent(
-                    tpi, start, end - start, arg1, arg2);
+            auto& traceLog = TraceLog::getInstance();
+            const bool commit = (end - start) >= threshold;
+            if (commit) {
+                traceLog.logEvent(
+                        tpi, status, start, end - start, arg1, arg2);
+            }
+            traceLog.endDeferredSpan(mark, commit);
         }
     }
 
     const tracepoint_info* tpi;
+    const AtomicCategoryStatus& status;
     const bool enabled;
+    const std::chrono::steady_clock::duration threshold;
     const T arg1;
     const U arg2;
+    size_t mark = 0;
     std::chrono::steady_clock::time_point start;
 };
 
+/**
+ * Locking policy for MutexEventGuard which acquires a mutex exclusively
+ */
+struct ExclusiveLockPolicy {
+    static constexpr LockMode mode = LockMode::exclusive;
+
+    template <class Mutex>
+    static void lock(Mutex& mutex) {
+        mutex.lock();
+    }
+
+    template <class Mutex>
+    static bool try_lock(Mutex& mutex) {
+        return mutex.try_lock();
+    }
+
+    template <class Mutex>
+    static void unlock(Mutex& mutex) {
+        mutex.unlock();
+    }
+};
+
+/**
+ * Locking policy for MutexEventGuard which acquires a mutex in shared
+ * mode (e.g. a reader of a std::shared_mutex)
+ */
+struct SharedLockPolicy {
+    static constexpr LockMode mode = LockMode::shared;
+
+    template <class Mutex>
+    static void lock(Mutex& mutex) {
+        mutex.lock_shared();
+    }
+
+    template <class Mutex>
+    static bool try_lock(Mutex& mutex) {
+        return mutex.try_lock_shared();
+    }
+
+    template <class Mutex>
+    static void unlock(Mutex& mutex) {
+        mutex.unlock_shared();
+    }
+};
+
 /**
  * RAII-style object to record events for acquiring and locking a mutex.
  * Locks the underlying mutex on construction, unlocks when it goes out of
@@ -58,9 +232,14 @@ struct ScopedEventGuard {
  * 1. Time taken to acquire the mutex.
  * 2. Time the mutex is held for.
  *
+ * While the LockProfiler is enabled the timespans are aggregated by the
+ * profiler instead of being logged as events.
+ *
  * @tparam Mutex Type of mutex to guard.
+ * @tparam LockPolicy How the mutex should be acquired and released, one
+ *         of ExclusiveLockPolicy or SharedLockPolicy.
  */
-template <class Mutex>
+template <class Mutex, class LockPolicy = ExclusiveLockPolicy>
 class MutexEventGuard {
 public:
     /**
@@ -80,25 +259,65 @@ public:
         : tpiWait(tpiWait_),
           tpiHeld(tpiHeld_),
           enabled(enabled_),
+          profiling(LockProfiler::isEnabled()),
           mutex(mutex_),
           threshold(threshold_) {
-        if (enabled) {
+        if (enabled || profiling) {
             start = std::chrono::steady_clock::now();
-            mutex.lock();
+            LockPolicy::lock(mutex);
             lockedAt = std::chrono::steady_clock::now();
         } else {
-            mutex.lock();
+            LockPolicy::lock(mutex);
+        }
+        owns = true;
+    }
+
+    /**
+     * Attempts to acquire ownership of the specified mutex without
+     * blocking, owns_lock() reports if the attempt was successful.
+     *
+     * Failed attempts are counted by the LockProfiler when it is enabled,
+     * no events are logged for them.
+     */
+    MutexEventGuard(const tracepoint_info* tpiWait_,
+                    const tracepoint_info* tpiHeld_,
+                    bool enabled_,
+                    Mutex& mutex_,
+                    std::try_to_lock_t,
+                    std::chrono::steady_clock::duration threshold_ =
+                            std::chrono::steady_clock::duration::zero())
+        : tpiWait(tpiWait_),
+          tpiHeld(tpiHeld_),
+          enabled(enabled_),
+          profiling(LockProfiler::isEnabled()),
+          mutex(mutex_),
+          threshold(threshold_) {
+        if (enabled || profiling) {
+            start = std::chrono::steady_clock::now();
+            owns = LockPolicy::try_lock(mutex);
+            lockedAt = std::chrono::steady_clock::now();
+        } else {
+            owns = LockPolicy::try_lock(mutex);
+        }
+        if (!owns && profiling) {
+            LockProfiler::getInstance().recordTryLockFailure(&mutex, tpiWait);
         }
     }
 
     /// Unlocks the mutex, and records trace events if enabled.
     ~MutexEventGuard() {
-        mutex.unlock();
-        if (enabled) {
+        if (!owns) {
+            return;
+        }
+        LockPolicy::unlock(mutex);
+        if (enabled || profiling) {
             releasedAt = std::chrono::steady_clock::now();
             const auto waitTime = lockedAt - start;
             const auto heldTime = releasedAt - lockedAt;
-            if (waitTime > threshold || heldTime > threshold) {
+            if (profiling) {
+                LockProfiler::getInstance().record(
+                        &mutex, tpiWait, LockPolicy::mode, waitTime, heldTime);
+            } else if (waitTime > threshold || heldTime > threshold) {
                 auto& traceLog = TraceLog::getInstance();
                 traceLog.logEvent(tpiWait,
                                   start,
@@ -110,14 +329,29 @@ public:
                                   heldTime,
                                   reinterpret_cast<void*>(&mutex),
                                   NoneType());
+                if (traceLog.isStackThresholdExceeded(
+                            std::max(waitTime, heldTime))) {
+                    traceLog.logStackTrace(tpiWait);
+                }
             }
         }
     }
 
+    /// @return true if the guard acquired the mutex
+    bool owns_lock() const {
+        return owns;
+    }
+
+    explicit operator bool() const {
+        return owns;
+    }
+
 private:
     const tracepoint_info* tpiWait;
     const tracepoint_info* tpiHeld;
     const bool enabled;
+    const bool profiling;
+    bool owns = false;
     Mutex& mutex;
     const std::chrono::steady_clock::duration threshold;
     std::chrono::steady_clock::time_point start;
@@ -125,4 +359,10 @@ private:
     std::chrono::steady_clock::time_point releasedAt;
 };
 
+/**
+ * MutexEventGuard which acquires the mutex in shared mode
+ */
+template <class Mutex>
+using SharedMutexEventGuard = MutexEventGuard<Mutex, SharedLockPolicy>;
+
 } // namespace phosphor
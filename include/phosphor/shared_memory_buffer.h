@@ -0,0 +1,191 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trace_buffer.h"
+
+namespace phosphor {
+
+// Forward decl
+class SharedMemorySegment;
+
+/**
+ * Creates a TraceBuffer backed by a named POSIX shared memory segment
+ *
+ * Several processes may attach to the same segment as writers, each
+ * with their own TraceLog. Chunks are loaned out of a common pool of
+ * slots and are published to the segment once returned. The first time
+ * a process publishes an event of a tracepoint, the tracepoint info is
+ * interned into the segment so that a SharedMemoryReader in another
+ * process can decode it without access to the writer's address space.
+ *
+ * A slot is on loan until its chunk is returned, so the slots of a
+ * writer which exits without returning its chunks (e.g. crashes) are
+ * only freed once a reader notices that the writer's process no longer
+ * exists (see SharedMemoryReader::reclaimedSlots()).
+ *
+ * The segment is created by the first writer to attach with room for
+ * `buffer_size` chunks, subsequent writers use the size of the existing
+ * segment. The segment outlives the processes attached to it until it is
+ * removed with remove_shared_memory_buffer().
+ *
+ * Unlike a fixed buffer the shared buffer never reports itself as full,
+ * the reader returns collected chunks to the pool so if no chunk is
+ * available the event is dropped rather than tracing being stopped.
+ *
+ * Iterating over the buffer only visits chunks written by the calling
+ * process which have not yet been collected by a reader.
+ *
+ * @param name Name of the shared memory segment (e.g. "/memcached-trace")
+ * @param generation Generation number of the buffer
+ * @param buffer_size Number of chunks in the segment if it is created
+ * @throw std::system_error if the segment could not be created or mapped
+ * @throw std::runtime_error if the existing segment is incompatible
+ */
+buffer_ptr make_shared_memory_buffer(const std::string& name,
+                                     size_t generation,
+                                     size_t buffer_size);
+
+/**
+ * @param name Name of the shared memory segment
+ * @return A TraceBuffer factory which creates shared memory buffers
+ *         attached to the given segment, for use with TraceConfig
+ */
+trace_buffer_factory make_shared_memory_buffer_factory(std::string name);
+
+/**
+ * Creates a TraceBuffer which mirrors the chunks returned to another
+ * buffer into a named shared memory segment
+ *
+ * This allows a SharedMemoryReader (e.g. the phosphor-tail tool) to
+ * follow the events of a running trace while the decorated buffer is
+ * exported as usual. A returned chunk is only queued, it is copied into
+ * the segment by a thread owned by the buffer which then hands the chunk
+ * on to the decorated buffer. If the segment has no free slots (the
+ * reader has fallen behind or isn't running) the copy is dropped.
+ *
+ * As the copy is asynchronous the events of a returned chunk are only
+ * visible to the reader shortly afterwards. Iterating over the buffer
+ * first waits for the queued chunks to reach the decorated buffer.
+ *
+ * @param buffer The buffer to decorate
+ * @param name Name of the shared memory segment
+ * @param tail_size Number of chunks in the segment if it is created
+ * @throw std::system_error if the segment could not be created or mapped
+ */
+buffer_ptr make_tail_buffer(buffer_ptr buffer,
+                            const std::string& name,
+                            size_t tail_size = 64);
+
+/**
+ * Removes the name of a shared memory segment so that the next writer
+ * creates a new segment. Processes already attached are unaffected.
+ *
+ * @param name Name of the shared memory segment
+ * @return true if the segment existed and was removed
+ */
+bool remove_shared_memory_buffer(const std::string& name);
+
+/**
+ * Reader for the chunks published to a shared memory TraceBuffer
+ *
+ * The reader may run in a separate process from the writers and
+ * collects chunks without requiring the writers to stop tracing.
+ * Events are decoded using the interned tracepoint info of the
+ * process that wrote them. String arguments recorded by pointer
+ * (rather than inline) cannot be resolved in another process and
+ * are exported as their address.
+ *
+ * Usage:
+ *
+ *     SharedMemoryReader reader("/memcached-trace");
+ *     std::cout << reader.collectJSON() << std::endl;
+ */
+class SharedMemoryReader {
+public:
+    /**
+     * Attach to an existing shared memory segment
+     *
+     * @param name Name of the shared memory segment
+     * @throw std::system_error if the segment could not be opened
+     * @throw std::runtime_error if the segment is incompatible
+     */
+    explicit SharedMemoryReader(const std::string& name);
+
+    ~SharedMemoryReader();
+
+    /**
+     * Callback for decoded events, the event is only valid for the
+     * duration of the call.
+     */
+    using EventCallback = std::function<void(const TraceEvent& event,
+                                             uint32_t thread_id,
+                                             uint32_t process_id)>;
+
+    /**
+     * Decode all chunks that have been published to the segment
+     *
+     * Slots left on loan to writers which have exited are freed first.
+     *
+     * @param callback Called for each decoded event
+     * @param release true if the decoded chunks should be returned to
+     *        the writers for reuse, otherwise they will be decoded again
+     *        by the next call
+     * @return The number of decoded events
+     */
+    size_t decode(const EventCallback& callback, bool release = true);
+
+    /**
+     * Decode all chunks that have been published to the segment
+     *
+     * @param release As per decode()
+     * @return Chromium Tracing JSON object for each decoded event
+     */
+    std::vector<std::string> collect(bool release = true);
+
+    /**
+     * Decode all chunks that have been published to the segment
+     *
+     * @param release As per collect()
+     * @return Chromium Tracing JSON document of the decoded events
+     */
+    std::string collectJSON(bool release = true);
+
+    /**
+     * @return The number of chunks the segment can hold
+     */
+    size_t size() const;
+
+    /**
+     * @return The number of slots this reader has freed because the
+     *         writer they were on loan to had exited
+     */
+    size_t reclaimedSlots() const;
+
+private:
+    struct Tracepoint;
+
+    const Tracepoint* resolve(uint32_t id);
+
+    std::unique_ptr<SharedMemorySegment> segment;
+    std::unordered_map<uint32_t, std::unique_ptr<Tracepoint>> tracepoints;
+    size_t reclaimed_slots = 0;
+};
+
+} // namespace phosphor
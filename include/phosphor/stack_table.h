@@ -0,0 +1,177 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+/** \file
+ * This file is internal to the inner workings of
+ * Phosphor and is not intended for public consumption.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "intern_index.h"
+
+namespace phosphor {
+
+// Forward declare
+class StatsCallback;
+
+/**
+ * Reference to a stack held by the StackTable, small enough to be
+ * stored in a TraceArgument
+ */
+struct stack_trace {
+    uint32_t id;
+};
+
+/**
+ * StackTable holds the return addresses of the stacks captured for slow
+ * events (see TraceConfig::setStackThreshold()) so that events can refer
+ * to a stack by a 32-bit id. Identical stacks share an id.
+ *
+ * Stacks are only symbolized when they are exported. Stacks are never
+ * removed from the table, once the table is full any further stacks are
+ * given `npos` and resolve to an empty stack.
+ *
+ * Lookups are lock-free, adding a new stack takes a lock. The storage of
+ * every stack is allocated up front so that stacks can also be captured
+ * from signal handlers (see captureInterrupted()).
+ */
+class StackTable {
+public:
+    /**
+     * Maximum number of stacks that the table can hold
+     */
+    static constexpr size_t table_size = 1024;
+
+    /**
+     * Maximum number of frames of a captured stack
+     */
+    static constexpr size_t max_depth = 32;
+
+    /**
+     * Id of stacks which couldn't be captured or added to the table
+     */
+    static constexpr uint32_t npos = InternIndex::npos;
+
+    using Frames = std::vector<const void*>;
+
+    StackTable();
+
+    StackTable(const StackTable&) = delete;
+    StackTable& operator=(const StackTable&) = delete;
+
+    /**
+     * @return The process-wide table
+     */
+    static StackTable& getInstance();
+
+    /**
+     * Capture the return addresses of the calling thread's stack and add
+     * them to the table
+     *
+     * @param skip Number of innermost frames to leave out, the frame of
+     *        capture() itself is always left out
+     * @return Reference to the stack, npos if stacks can't be captured
+     *         on this platform or the table is full
+     */
+    stack_trace capture(size_t skip = 0);
+
+    /**
+     * Capture the stack of a thread interrupted by a signal, from within
+     * the signal handler.
+     *
+     * Unlike capture() this never blocks or allocates, so the stack is
+     * dropped if the table is locked (by another thread adding a stack or
+     * by the interrupted thread itself). prime() must have been called
+     * beforehand.
+     *
+     * @param pc The interrupted instruction, the frames of the signal
+     *        handler up to it are left out
+     * @return Reference to the stack, npos if stacks can't be captured
+     *         on this platform or the stack couldn't be added to the table
+     */
+    stack_trace captureInterrupted(const void* pc);
+
+    /**
+     * Load everything which capturing a stack lazily loads on first use
+     * (e.g. the unwinder used by backtrace()), which mustn't happen
+     * within a signal handler
+     */
+    static void prime();
+
+    /**
+     * Find the id of a stack, adding it if it isn't already in the table
+     *
+     * @param frames Return addresses, innermost first, only the innermost
+     *        max_depth frames are kept
+     * @return Reference to the stack, npos if the table is full
+     */
+    stack_trace intern(const Frames& frames);
+
+    /**
+     * @param stack A reference previously returned by capture() or
+     *        intern()
+     * @return The return addresses of the stack, empty if the reference
+     *         is not in the table
+     */
+    Frames lookup(stack_trace stack) const;
+
+    /**
+     * Symbolize each frame of a stack, as `function+0xoffset` where the
+     * function's symbol can be found or `module+0xoffset` otherwise
+     *
+     * @param stack A reference previously returned by capture() or
+     *        intern()
+     * @return The symbolized frames, innermost first
+     */
+    std::vector<std::string> symbolize(stack_trace stack) const;
+
+    /**
+     * @return Number of stacks in the table
+     */
+    size_t size() const {
+        return intern_index.size();
+    }
+
+    /**
+     * Invokes methods on the callback to supply various
+     * stats about the stack table.
+     */
+    void getStats(StatsCallback& addStats) const;
+
+protected:
+    struct Stack {
+        size_t depth;
+        std::array<const void*, max_depth> frames;
+    };
+
+    /**
+     * As intern(const Frames&)
+     *
+     * @param wait Whether to wait for the lock if another thread holds
+     *        it, if not the stack is dropped
+     */
+    stack_trace intern(const void* const* frames, size_t depth, bool wait);
+
+    // Counts the stacks which couldn't be added as the table was full (or
+    // locked when captured from a signal handler) as dropped
+    InternIndex intern_index;
+
+    // Stacks by index, published by the index
+    std::unique_ptr<Stack[]> stacks;
+};
+
+} // namespace phosphor
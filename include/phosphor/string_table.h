@@ -0,0 +1,135 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+/** \file
+ * This file is internal to the inner workings of
+ * Phosphor and is not intended for public consumption.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "intern_index.h"
+
+namespace phosphor {
+
+// Forward declare
+class StatsCallback;
+
+/**
+ * Reference to a string held by a StringTable, small enough to be
+ * stored in a TraceArgument
+ */
+struct interned_string {
+    uint64_t id;
+};
+
+/**
+ * StringTable interns runtime strings (e.g. bucket or connection names)
+ * so that they can be logged as an 8 byte id rather than truncated to an
+ * inline_zstring or passed as a pointer which must outlive the trace.
+ *
+ * Strings are never removed from the table, once the table is full any
+ * further strings resolve to an empty string. The capacity of the
+ * TraceLog's table can be set with TraceLogConfig::setStringTableSize().
+ *
+ * Up to 64 tables can be live at once for their ids to be resolved by
+ * resolve(), the ids of any further tables can only be looked up with
+ * lookup().
+ *
+ * Lookups are lock-free, each thread also keeps a small cache of recently
+ * interned strings so repeated strings avoid the table entirely. Inserting
+ * a new string takes a lock.
+ */
+class StringTable {
+public:
+    /**
+     * Default maximum number of strings that a table can hold
+     */
+    static constexpr size_t default_table_size = 1024;
+
+    /**
+     * @param table_size Maximum number of strings the table can hold
+     */
+    explicit StringTable(size_t table_size = default_table_size);
+
+    ~StringTable();
+
+    StringTable(const StringTable&) = delete;
+    StringTable& operator=(const StringTable&) = delete;
+
+    /**
+     * Intern a string, returning the existing id if the string has
+     * already been interned
+     *
+     * @param str The string to intern
+     * @return Reference to the interned string
+     */
+    interned_string intern(std::string_view str);
+
+    /**
+     * @param str A reference previously returned by intern()
+     * @return The interned string, empty if the reference was not
+     *         returned by this table
+     */
+    std::string_view lookup(interned_string str) const;
+
+    /**
+     * Resolve a reference returned by any live table
+     *
+     * @param str A reference previously returned by intern()
+     * @return The interned string, empty if the table which returned
+     *         the reference no longer exists
+     */
+    static std::string_view resolve(interned_string str);
+
+    /**
+     * @return Number of strings in the table
+     */
+    size_t size() const {
+        return intern_index.size();
+    }
+
+    /**
+     * @return Maximum number of strings the table can hold
+     */
+    size_t getCapacity() const {
+        return intern_index.getCapacity();
+    }
+
+    /**
+     * Invokes methods on the callback to supply various
+     * stats about the string table.
+     */
+    void getStats(StatsCallback& addStats) const;
+
+protected:
+    StringTable(size_t table_size, size_t slot);
+
+    // Identifies the table in the upper half of an id, the low bits are
+    // the table's slot in the live tables if it has one
+    const uint32_t serial;
+
+    // Whether the table holds a slot in the live tables
+    const bool live;
+
+    // Assigns each distinct string its id and finds the id of a string
+    // already in the table (also counting the strings dropped when full)
+    InternIndex intern_index;
+
+    // Strings indexed by id, published by the index
+    std::unique_ptr<std::unique_ptr<const std::string>[]> strings;
+};
+
+} // namespace phosphor
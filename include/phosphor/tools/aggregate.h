@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "phosphor/trace_context.h"
+#include "phosphor/tracepoint_info.h"
+
+namespace phosphor {
+
+// Forward declare
+class StatsCallback;
+
+namespace tools {
+
+/**
+ * The Aggregator summarises the durations of the events of a captured
+ * trace in-process, e.g. to find the slowest operations without exporting
+ * and post-processing the trace.
+ *
+ * Complete events contribute their duration directly, SyncStart / SyncEnd
+ * events are paired by nesting on the thread that logged them and
+ * AsyncStart / AsyncEnd events are paired by their id and name. Paired
+ * events are attributed to the tracepoint of the start event.
+ *
+ * The chunks of the buffer are divided between a number of worker
+ * threads, only the start and end events which cannot be paired within
+ * their own chunk are paired afterwards on the calling thread.
+ *
+ * Usage:
+ *
+ *     auto context = TraceLog::getInstance().getTraceContext();
+ *     auto result = Aggregator().aggregate(context);
+ *     for (const auto& summary : result.summaries) {
+ *         std::cout << summary.tpi->name << " " << summary.max_ns << "\n";
+ *     }
+ */
+class Aggregator {
+public:
+    /**
+     * Summary of the durations of a single tracepoint
+     *
+     * Percentiles are approximate, they are within 1/8th of the true
+     * value.
+     */
+    struct Summary {
+        const tracepoint_info* tpi;
+        uint64_t count;
+        uint64_t total_ns;
+        uint64_t min_ns;
+        uint64_t max_ns;
+        uint64_t p50_ns;
+        uint64_t p90_ns;
+        uint64_t p99_ns;
+    };
+
+    struct Result {
+        /**
+         * Invokes methods on the callback to supply the summaries, keyed
+         * by "<category>:<name>:<field>"
+         */
+        void getStats(StatsCallback& addStats) const;
+
+        // Ordered by descending total duration
+        std::vector<Summary> summaries;
+        // Number of events examined
+        size_t events = 0;
+        // Number of start / end events which could not be paired
+        size_t unmatched = 0;
+    };
+
+    /**
+     * @param concurrency Maximum number of worker threads to use, 0 to
+     *        use the number of hardware threads
+     */
+    explicit Aggregator(size_t concurrency = 0);
+
+    /**
+     * Summarise the events of a trace
+     *
+     * The context's buffer must not be modified during aggregation.
+     *
+     * @param context The trace to summarise
+     * @return Per-tracepoint summaries of the trace
+     */
+    Result aggregate(const TraceContext& context) const;
+
+private:
+    size_t concurrency;
+};
+
+} // namespace tools
+} // namespace phosphor
@@ -0,0 +1,119 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "phosphor/string_table.h"
+#include "phosphor/trace_context.h"
+#include "phosphor/trace_event.h"
+
+namespace phosphor {
+namespace tools {
+
+/**
+ * Write a TraceContext to a file in the phosphor binary dump format
+ *
+ * The dump consists of a small header and table of the tracepoints and
+ * thread names used by the trace, followed by the events of every chunk
+ * in their in-memory representation. The events are not copied or
+ * formatted, the chunks of the buffer are handed to the kernel directly
+ * with vectored writes (pwritev) so the dump is limited by the speed of
+ * the disk.
+ *
+ * The dump uses the native byte order and layout of TraceEvent so is
+ * intended to be read with a BinaryDumpReader on the same platform.
+ * String arguments recorded by pointer are dumped as the pointer,
+ * interned strings are included in the dump.
+ *
+ * @param context The trace to dump
+ * @param path Path of the file to create (or truncate)
+ * @param sync true to fsync the file before returning
+ * @return Number of bytes written
+ * @throw std::system_error if the file could not be written
+ */
+size_t writeBinaryDump(const TraceContext& context,
+                       const std::string& path,
+                       bool sync = false);
+
+/**
+ * The BinaryDumpReader decodes a file written by writeBinaryDump()
+ *
+ * Usage:
+ *
+ *     BinaryDumpReader reader("phosphor.dump");
+ *     reader.decode([](const TraceEvent& event,
+ *                      uint32_t thread_id,
+ *                      uint32_t process_id) {
+ *         std::cout << event << std::endl;
+ *     });
+ */
+class BinaryDumpReader {
+public:
+    using EventCallback = std::function<void(
+            const TraceEvent& event, uint32_t thread_id, uint32_t process_id)>;
+
+    /**
+     * Read a dump into memory
+     *
+     * @param path Path of the dump to read
+     * @throw std::system_error if the file could not be read
+     * @throw std::runtime_error if the file is not a valid dump
+     */
+    explicit BinaryDumpReader(const std::string& path);
+
+    ~BinaryDumpReader();
+
+    /**
+     * Invoke callback for every event in the dump
+     *
+     * @return Number of events decoded
+     */
+    size_t decode(const EventCallback& callback) const;
+
+    /**
+     * @return Map of thread IDs -> names recorded in the dump
+     */
+    const TraceContext::ThreadNamesMap& getThreadNames() const {
+        return thread_names;
+    }
+
+    /**
+     * @return The dump in the Chromium Tracing JSON format
+     */
+    std::string toJSON() const;
+
+private:
+    struct Tracepoint;
+
+    std::vector<char> data;
+    // Offset of the first chunk in data
+    size_t chunks_offset;
+    uint64_t chunk_count;
+    // Process which wrote the dump
+    uint32_t process_id;
+    // Keyed by the address of the tracepoint_info in the dumped process
+    std::unordered_map<uint64_t, std::unique_ptr<Tracepoint>> tracepoints;
+    TraceContext::ThreadNamesMap thread_names;
+    // Interned strings of the dump keyed by their id in the dump
+    StringTable string_table;
+    std::unordered_map<uint64_t, interned_string> strings;
+};
+
+} // namespace tools
+} // namespace phosphor
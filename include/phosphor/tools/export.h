@@ -11,6 +11,16 @@
 
 #pragma once
 
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #include "phosphor/trace_buffer.h"
 #include "phosphor/trace_context.h"
 #include "phosphor/trace_log.h"
@@ -35,13 +45,20 @@ namespace tools {
  *
  * The above will write the JSON to stderr.
  *
+ * An EventQuery can be given to only export the events within a time
+ * window or set of categories, chunks of the buffer which can't match
+ * the query are skipped entirely.
  */
 class JSONExport {
 public:
     /**
      * Creates the export object
+     *
+     * @param _context The trace to export
+     * @param _query The events to export, defaults to every event
      */
-    explicit JSONExport(const TraceContext& _context);
+    explicit JSONExport(const TraceContext& _context,
+                        EventQuery _query = EventQuery());
 
     ~JSONExport();
 
@@ -89,14 +106,111 @@ protected:
         dead
     };
 
+    /**
+     * Advance to the next event matching the query, if the current
+     * event matches it is not skipped
+     *
+     * @return false if there are no more matching events
+     */
+    bool findEvent();
+
     const TraceContext& context;
-    TraceBuffer::event_iterator it;
+    EventQuery query;
+    // Chunks which may contain events matching the query
+    std::vector<const TraceChunk*> chunks;
+    size_t chunk_index = 0;
+    size_t event_index = 0;
     std::unordered_map<uint64_t, std::string>::const_iterator tit;
 
     State state = State::opening;
     std::string cache;
 };
 
+/**
+ * The PerfettoExport class is a tool provided to allow exporting a
+ * TraceBuffer in the Perfetto protobuf trace format (as loaded by
+ * ui.perfetto.dev and trace_processor) in a chunked manner.
+ *
+ * Each thread is written as its own packet sequence on which event
+ * names, categories and argument names are interned and timestamps
+ * are delta-encoded, making the output considerably smaller and faster
+ * to load than the JSON format.
+ *
+ * Usage is the same as for JSONExport:
+ *
+ *     PerfettoExport exporter(context);
+ *
+ *     do {
+ *         p = exporter.read(4096);
+ *         file.write(p.data(), p.size());
+ *     }  while(p.size());
+ */
+class PerfettoExport {
+public:
+    /**
+     * Creates the export object
+     */
+    explicit PerfettoExport(const TraceContext& _context);
+
+    ~PerfettoExport();
+
+    /**
+     * Read 'length' worth of the protobuf trace
+     *
+     * @param out roughly 'length' bytes of the trace starting from
+     *            the point that was previously left off. This will
+     *            return less than 'length' at the end of the buffer.
+     * @param length Max size in bytes of the trace to put into out
+     * @return Number of bytes written to out
+     */
+    size_t read(char* out, size_t length);
+
+    /**
+     * Read 'length' worth of the protobuf trace
+     *
+     * @returns roughly 'length' bytes of the trace starting from
+     *          the point that was previously left off. This will
+     *          return less than 'length' at the end of the buffer.
+     */
+    std::string read(size_t length);
+
+    /**
+     * Read entire buffer's worth of the protobuf trace
+     *
+     * @returns The entire buffer converted to a protobuf trace
+     */
+    std::string read();
+
+    /**
+     * @return True if the export is complete
+     */
+    bool done();
+
+protected:
+    // Per-thread packet sequence state, defined in the implementation
+    struct Sequence;
+
+    /**
+     * Get the packet sequence of a thread, starting a new sequence
+     * at the given time if this is the first event of the thread
+     */
+    Sequence& getSequence(uint32_t process_id,
+                          uint32_t thread_id,
+                          uint64_t timestamp);
+
+    void writeEvent(const TraceEvent& event, Sequence& sequence);
+
+    const TraceContext& context;
+    TraceBuffer::event_iterator it;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Sequence>> sequences;
+    // Track uuids which have already been described
+    std::unordered_set<uint64_t> tracks;
+
+    bool finished = false;
+    std::string cache;
+};
+
 /**
  * Reference callback for saving a buffer to a file if tracing stops.
  *
@@ -130,5 +244,120 @@ public:
 private:
     std::string file_path;
 };
+
+/**
+ * AsyncFileStopCallback saves the buffer to a file like FileStopCallback
+ * except that the file is written by a background thread.
+ *
+ * The callback only takes ownership of the TraceContext while the
+ * TraceLog lock is held, so other threads can register, deregister or
+ * restart tracing while a large buffer is being written out. Each write
+ * runs on a detached thread which owns everything it needs, so it
+ * outlives the callback if the callback is destroyed first (e.g. when
+ * tracing is restarted with a new config). Use wait() or getLastWrite()
+ * to wait for a write, e.g. before the process exits.
+ *
+ * Usage:
+ *
+ *     AsyncFileStopCallback::Options options;
+ *     options.sync = AsyncFileStopCallback::SyncPolicy::on_close;
+ *     options.on_complete = [](const std::string& path,
+ *                              std::exception_ptr error) { ... };
+ *     auto callback = std::make_shared<AsyncFileStopCallback>(
+ *             "phosphor.%p.json", options);
+ *     log.start(TraceConfig(BufferMode::fixed, 80000)
+ *                       .setStoppedCallback(callback));
+ */
+class AsyncFileStopCallback final : public TracingStoppedCallback {
+public:
+    /**
+     * When the written file should be flushed to stable storage
+     */
+    enum class SyncPolicy {
+        // Leave it to the OS
+        none,
+        // fsync once the whole file has been written
+        on_close,
+        // fsync after every write
+        every_write
+    };
+
+    /**
+     * Format of the written file
+     */
+    enum class Format {
+        // Chromium Tracing JSON (as JSONExport)
+        json,
+        // Binary dump (as writeBinaryDump())
+        binary
+    };
+
+    struct Options {
+        Format format = Format::json;
+
+        // Size in bytes of each write to the file, the binary format
+        // writes directly from the buffer so ignores this
+        size_t write_size = 1024 * 1024;
+
+        SyncPolicy sync = SyncPolicy::none;
+
+        /**
+         * Called from the writer thread once the file has been written,
+         * error is null if the file was written successfully
+         */
+        std::function<void(const std::string& path, std::exception_ptr error)>
+                on_complete;
+    };
+
+    /**
+     * @param file_path File path to save the buffer to on completion,
+     *                  accepts the same wild cards as FileStopCallback
+     */
+    explicit AsyncFileStopCallback(std::string file_path = "phosphor.%p.json");
+
+    /**
+     * @param file_path File path to save the buffer to on completion,
+     *                  accepts the same wild cards as FileStopCallback
+     * @param options Options for the writer thread
+     */
+    AsyncFileStopCallback(std::string file_path, Options options);
+
+    /**
+     * Doesn't wait for outstanding writes, which carry on in the
+     * background
+     */
+    ~AsyncFileStopCallback() override;
+
+    /**
+     * Callback method called by TraceLog, takes the TraceContext and
+     * returns without writing anything
+     *
+     * @param log Reference to the calling TraceLog
+     * @param lh The lock being held when this callback is invoked
+     */
+    void operator()(TraceLog& log, std::lock_guard<TraceLog>& lh) override;
+
+    /**
+     * @return Future for the most recently started write which holds any
+     *         exception thrown by the writer (invalid if tracing has not
+     *         been stopped yet)
+     */
+    std::shared_future<void> getLastWrite() const;
+
+    /**
+     * Block until all outstanding writes have completed
+     */
+    void wait() const;
+
+    /// Exposed for testing
+    std::string generateFilePath() const;
+
+private:
+    std::string file_path;
+    Options options;
+
+    mutable std::mutex mutex;
+    std::vector<std::shared_future<void>> writes;
+};
 } // namespace tools
 } // namespace phosphor
@@ -0,0 +1,121 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "phosphor/trace_event.h"
+
+namespace phosphor {
+namespace tools {
+
+/**
+ * The TailAggregator summarises a stream of TraceEvents into a rolling
+ * view of how often each tracepoint is firing and how long the complete
+ * events take, as displayed by the phosphor-tail tool.
+ *
+ * Events are added to the current interval which is closed by calling
+ * advance(), the view covers the last `window` closed intervals.
+ *
+ * Usage:
+ *
+ *     TailAggregator aggregator;
+ *     reader.decode([&aggregator](const TraceEvent& event,
+ *                                 uint32_t, uint32_t) {
+ *         aggregator.add(event);
+ *     });
+ *     aggregator.advance(std::chrono::seconds(1));
+ *     std::cout << TailAggregator::format(aggregator.getRows());
+ */
+class TailAggregator {
+public:
+    /**
+     * A summary of the events of a single tracepoint (or category)
+     */
+    struct Row {
+        std::string category;
+        // Empty if the row summarises a whole category
+        std::string name;
+        uint64_t count;
+        // Events per second over the window
+        double rate;
+        // Duration of the complete events over the window
+        uint64_t mean_duration_ns;
+        uint64_t max_duration_ns;
+    };
+
+    /**
+     * @param window Number of intervals to include in the view
+     */
+    explicit TailAggregator(size_t window = 5);
+
+    /**
+     * Add an event to the current interval
+     */
+    void add(const TraceEvent& event);
+
+    /**
+     * Close the current interval, discarding the oldest interval if the
+     * window is full
+     *
+     * @param length The length of the interval being closed
+     */
+    void advance(std::chrono::steady_clock::duration length);
+
+    /**
+     * @param by_category true to summarise each category rather than
+     *        each tracepoint
+     * @return Summary of the closed intervals in the window ordered by
+     *         descending rate
+     */
+    std::vector<Row> getRows(bool by_category = false) const;
+
+    /**
+     * Format rows as a table for display
+     *
+     * @param rows Rows to format
+     * @param limit Maximum number of rows to include
+     * @return The formatted table
+     */
+    static std::string format(const std::vector<Row>& rows,
+                              size_t limit = 25);
+
+protected:
+    struct Totals {
+        uint64_t count = 0;
+        uint64_t complete = 0;
+        uint64_t total_duration = 0;
+        uint64_t max_duration = 0;
+
+        Totals& operator+=(const Totals& other);
+    };
+
+    using Key = std::pair<std::string, std::string>;
+
+    struct Interval {
+        std::map<Key, Totals> totals;
+        std::chrono::steady_clock::duration length{};
+    };
+
+    size_t window;
+    // Closed intervals followed by the current interval
+    std::deque<Interval> intervals;
+};
+
+} // namespace tools
+} // namespace phosphor
@@ -22,6 +22,8 @@
 #include <type_traits>
 
 #include "inline_zstring.h"
+#include "stack_table.h"
+#include "string_table.h"
 #include "tracepoint_info.h"
 
 namespace phosphor {
@@ -47,6 +49,8 @@ union TraceArgument {
     const char* as_string;
     const void* as_pointer;
     inline_zstring<8> as_istring;
+    interned_string as_interned;
+    stack_trace as_stack;
     NoneType as_none;
 
     /**
@@ -176,6 +180,10 @@ ARGUMENT_CONVERSION(char*, string)
 
 ARGUMENT_CONVERSION(inline_zstring<8>, istring)
 
+ARGUMENT_CONVERSION(interned_string, interned)
+
+ARGUMENT_CONVERSION(stack_trace, stack)
+
 ARGUMENT_CONVERSION(NoneType, none)
 
 #undef ARGUMENT_CONVERSION
@@ -215,8 +223,28 @@ inline std::string TraceArgument::to_string(TraceArgument::Type type) const {
         return "\"" + std::string(as_string) + "\"";
     case Type::is_istring:
         return "\"" + std::string(as_istring) + "\"";
+    case Type::is_interned:
+        return "\"" + std::string(StringTable::resolve(as_interned)) + "\"";
     case Type::is_none:
         return std::string("\"Type::is_none\"");
+    case Type::is_stack: {
+        std::string result = "[";
+        for (const auto& frame :
+             StackTable::getInstance().symbolize(as_stack)) {
+            if (result.size() > 1) {
+                result += ",";
+            }
+            result += "\"";
+            for (const auto c : frame) {
+                if (c == '"' || c == '\\') {
+                    result += '\\';
+                }
+                result += c;
+            }
+            result += "\"";
+        }
+        return result + "]";
+    }
     }
     throw std::invalid_argument("Invalid TraceArgument type");
 }
@@ -15,15 +15,23 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <gsl_p/iterator.h>
+#include <gsl_p/span.h>
 
 #include "trace_event.h"
 
@@ -33,6 +41,36 @@ namespace phosphor {
 #define PHOSPHOR_CHUNK_PAGE_COUNT 1
 #endif
 
+/**
+ * The encoding of the events stored in a TraceChunk
+ *
+ *   - Full events are stored as TraceEvents, which can be reviewed in
+ *     place (see TraceChunk::events())
+ *   - Compact events are stored as CompactEvents, so a chunk holds more
+ *     of them but they are decoded into TraceEvents to be reviewed
+ */
+enum class EventFormat : char {
+    full = 0,
+    compact,
+};
+
+/**
+ * The compact encoding of a TraceEvent
+ *
+ * The tracepoint is replaced by its index in the TracepointTable and
+ * the start time by an offset from the base time of the chunk (the
+ * start time of its first event).
+ */
+struct CompactEvent {
+    uint32_t tpi_index;
+    int32_t time_offset;
+    uint64_t duration;
+    std::array<TraceArgument, arg_count> args;
+};
+
+static_assert(sizeof(CompactEvent) == 32,
+              "CompactEvent should be half of a cache-line");
+
 /**
  * TraceChunk represents an array of TraceEvents
  *
@@ -47,9 +85,118 @@ public:
     static constexpr auto chunk_size =
             (((page_size * chunk_page_count) - array_offset) /
              sizeof(TraceEvent));
+    /**
+     * Number of events in a chunk of the compact format
+     */
+    static constexpr auto compact_chunk_size =
+            (((page_size * chunk_page_count) - array_offset) /
+             sizeof(CompactEvent));
+    /**
+     * Number of events in a chunk of any format
+     */
+    static constexpr auto max_chunk_size =
+            std::max<size_t>(chunk_size, compact_chunk_size);
     using event_array = std::array<TraceEvent, chunk_size>;
+    using compact_array = std::array<CompactEvent, compact_chunk_size>;
+
+    /**
+     * Const random access iterator over the events of a TraceChunk
+     *
+     * The events of a compact chunk are decoded into the iterator, so
+     * a reference obtained from the iterator is only valid until the
+     * iterator is next modified or destroyed.
+     */
+    class const_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = TraceEvent;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const TraceEvent*;
+        using reference = const TraceEvent&;
+
+        const_iterator() = default;
+
+        const_iterator(const TraceChunk* chunk_, size_t index_)
+            : chunk(chunk_),
+              index(index_),
+              compact(chunk_->event_format == EventFormat::compact) {
+        }
+
+        reference operator*() const {
+            if (!compact) {
+                return chunk->chunk[index];
+            }
+            decoded = chunk->decode(index);
+            return decoded;
+        }
+
+        pointer operator->() const {
+            return &(**this);
+        }
+
+        const_iterator& operator++() {
+            ++index;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto copy = *this;
+            ++index;
+            return copy;
+        }
+
+        const_iterator& operator--() {
+            --index;
+            return *this;
+        }
 
-    using const_iterator = event_array::const_iterator;
+        const_iterator& operator+=(difference_type n) {
+            index += n;
+            return *this;
+        }
+
+        const_iterator& operator-=(difference_type n) {
+            index -= n;
+            return *this;
+        }
+
+        const_iterator operator+(difference_type n) const {
+            auto copy = *this;
+            copy.index += n;
+            return copy;
+        }
+
+        const_iterator operator-(difference_type n) const {
+            auto copy = *this;
+            copy.index -= n;
+            return copy;
+        }
+
+        difference_type operator-(const const_iterator& other) const {
+            return difference_type(index) - difference_type(other.index);
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return chunk == other.chunk && index == other.index;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+        bool operator<(const const_iterator& other) const {
+            return index < other.index;
+        }
+
+    private:
+        const TraceChunk* chunk = nullptr;
+        size_t index = 0;
+        // Copy of the chunk's format so that it isn't reloaded for
+        // every event
+        bool compact = false;
+        // The last event decoded from a compact chunk
+        mutable TraceEvent decoded;
+    };
 
     /**
      * Constructor for a TraceChunk
@@ -61,26 +208,125 @@ public:
      *
      * This should be called before the TraceChunk is first used
      * as TraceChunk is a trivial type and requires initialisation.
+     * The chunk is reset to the full format with regular stores.
      */
     void reset(uint32_t thread_id);
 
+    /**
+     * Change the format of the events stored in the chunk
+     *
+     * @param format The new format
+     * @throw std::logic_error if the chunk isn't empty
+     */
+    void setFormat(EventFormat format);
+
+    /**
+     * @return The format of the events stored in the chunk
+     */
+    EventFormat format() const {
+        return event_format;
+    }
+
+    /**
+     * Store events with non-temporal (streaming) stores
+     *
+     * Streaming stores write the events around the CPU caches so the
+     * chunk doesn't evict the traced application's working set. They are
+     * ordered like regular stores, so the events are published by the
+     * same release operations (unlocking the tenant, returning the
+     * chunk) without a fence.
+     *
+     * Platforms without suitable streaming stores (currently all but
+     * AArch64) use regular stores, as do events assigned in place
+     * through addEvent().
+     *
+     * @param enabled Whether to use streaming stores
+     */
+    void setStreaming(bool enabled) {
+        streaming = enabled;
+    }
+
+    /**
+     * @return true if events are stored with streaming stores
+     */
+    bool isStreaming() const {
+        return streaming;
+    }
+
+    /**
+     * Mask of every category group, see categoryMask()
+     */
+    static constexpr uint64_t all_categories = ~uint64_t(0);
+
     /**
      * Used for adding TraceEvents to the chunk
      *
+     * As the event isn't known until it is assigned the chunk's summary
+     * is widened to match any time and category.
+     *
      * @return A reference to a TraceEvent to be replaced
+     * @throw std::logic_error if the chunk is in the compact format
      */
     TraceEvent& addEvent();
 
+    /**
+     * Add an event to the chunk and include it in the chunk's summary
+     *
+     * @param event The event to add
+     * @param category_group The CategoryRegistry group index of the
+     *        event's category
+     * @throw std::out_of_range if the event can't be added (see canAdd())
+     */
+    void addEvent(const TraceEvent& event, size_t category_group);
+
+    /**
+     * Determine if an event can be added to the chunk
+     *
+     * A compact chunk can only hold events which started within ~2s of
+     * its first event, an event outside that window must be added to a
+     * new chunk even if this chunk isn't full.
+     *
+     * @return true if the event can be added or false if the chunk
+     *         should be replaced
+     */
+    bool canAdd(const TraceEvent& event) const;
+
+    /**
+     * Copies as many events from a range as can be added to the chunk
+     *
+     * @param first Iterator to the first event to copy
+     * @param last Iterator to after the last event to copy
+     * @param category_mask Mask of the category groups of the events
+     *        (or a superset)
+     * @return The number of events copied
+     */
+    size_t append(const_iterator first,
+                  const_iterator last,
+                  uint64_t category_mask = all_categories);
+
+    /**
+     * Discards events from the end of the chunk
+     *
+     * @param new_count The number of events to keep, if greater than
+     *        `count()` then the chunk is unchanged.
+     */
+    void truncate(size_t new_count);
+
     /**
      * Used for reviewing TraceEvents in the chunk
      *
      * Valid indexes are from 0 to `count()`. There is no
      * bounds checking.
      *
-     * @return A const reference to a TraceEvent in the chunk
-     *         that can be used to review the event data
+     * @return A copy of the TraceEvent at the index, decoded if the
+     *         chunk is in the compact format
      */
-    const TraceEvent& operator[](const size_t index) const;
+    TraceEvent operator[](const size_t index) const {
+        if (event_format == EventFormat::compact) {
+            return decode(index);
+        }
+        return chunk[index];
+    }
 
     /**
      * Determine if the chunk is full
@@ -90,34 +336,185 @@ public:
      */
     bool isFull() const;
 
+    /**
+     * @return The number of events the chunk can hold in its format
+     */
+    size_t capacity() const {
+        return event_format == EventFormat::compact ? compact_chunk_size
+                                                    : chunk_size;
+    }
+
     /**
      * Determine up to which index of events is initialised
      *
      * @return The number of initialised events in the chunk
      */
-    size_t count() const;
+    size_t count() const {
+        return next_free;
+    }
 
     /**
      * @return The id of the thread that owns this chunk
      */
     uint32_t threadID() const;
 
+    /**
+     * @return The id of the process that owns this chunk
+     */
+    uint32_t processID() const;
+
+    /**
+     * @return The earliest start time of the events in the chunk (in
+     *         nanoseconds since the steady_clock epoch)
+     */
+    uint64_t minTime() const {
+        return min_time;
+    }
+
+    /**
+     * @return The latest start time of the events in the chunk
+     */
+    uint64_t maxTime() const {
+        return max_time;
+    }
+
+    /**
+     * @return Mask of the category groups of the events in the chunk,
+     *         group index `i` sets bit `i % 64`
+     */
+    uint64_t categoryMask() const {
+        return category_mask;
+    }
+
+    /**
+     * @return The initialised events of the chunk as a contiguous range
+     * @throws std::logic_error if the chunk is in the compact format,
+     *         whose events must be decoded (see TraceBuffer::getSpan())
+     */
+    gsl_p::span<const TraceEvent> events() const {
+        if (event_format == EventFormat::compact) {
+            throw std::logic_error(
+                    "phosphor::TraceChunk::events: "
+                    "Compact chunks must be decoded");
+        }
+        return {chunk.data(), next_free};
+    }
+
     /**
      * @return Const iterator to the start of the chunk
      */
-    const_iterator begin() const;
+    const_iterator begin() const {
+        return {this, 0};
+    }
 
     /**
      * @return Const iterator to the last initialised event in the chunk
      */
-    const_iterator end() const;
+    const_iterator end() const {
+        return {this, next_free};
+    }
 
 private:
+    /**
+     * Store an event, which must satisfy canAdd()
+     */
+    void store(const TraceEvent& event);
+
+    /**
+     * @return The compact event at the index as a TraceEvent
+     */
+    TraceEvent decode(size_t index) const;
+
     // Index into event array of next free element
     unsigned short next_free;
+    EventFormat event_format;
+    // Whether events are stored with streaming stores
+    bool streaming;
     // System generated id for the thread this chunk belongs to
     uint32_t thread_id;
-    event_array chunk;
+    // System generated id for the process this chunk belongs to, this
+    // allows chunks to be attributed when shared between processes
+    uint32_t process_id;
+    // Summary of the events in the chunk used to skip the chunk when
+    // it can't match an EventQuery
+    uint64_t min_time;
+    uint64_t max_time;
+    uint64_t category_mask;
+    // Start time of the first event, compact events are stored relative
+    // to it
+    uint64_t base_time;
+    union {
+        event_array chunk;
+        compact_array compact_chunk;
+    };
+};
+
+static_assert(sizeof(TraceChunk) <=
+                      TraceChunk::page_size * TraceChunk::chunk_page_count,
+              "TraceChunk header must fit within array_offset");
+
+/**
+ * EventQuery selects the events of a TraceBuffer which were logged
+ * within a time window and/or belong to a set of categories.
+ *
+ * The summary kept by each TraceChunk allows chunks which can't contain
+ * a matching event to be skipped without visiting their events.
+ *
+ * Usage:
+ *
+ *     const auto now = std::chrono::steady_clock::now();
+ *     EventQuery query;
+ *     query.setTimeRange(now - std::chrono::milliseconds(200), now)
+ *          .setCategories({"ep-engine"},
+ *                         log.getCategoryGroupMask({"ep-engine"}));
+ *     for (const auto* chunk : buffer.query(query)) {
+ *         for (const auto& event : *chunk) {
+ *             if (query.matches(event)) { ... }
+ *         }
+ *     }
+ */
+class EventQuery {
+public:
+    /**
+     * Creates a query which matches every event
+     */
+    EventQuery();
+
+    /**
+     * Only match events which started within [begin, end)
+     */
+    EventQuery& setTimeRange(std::chrono::steady_clock::time_point begin,
+                             std::chrono::steady_clock::time_point end);
+
+    /**
+     * Only match events with a category matching one of the given
+     * category globs
+     *
+     * @param categories Categories to match (may include wildcards)
+     * @param group_mask Mask of the category groups which match the
+     *        categories (see TraceLog::getCategoryGroupMask()) used to
+     *        skip chunks, defaults to visiting every chunk
+     */
+    EventQuery& setCategories(std::vector<std::string> categories,
+                              uint64_t group_mask = TraceChunk::all_categories);
+
+    /**
+     * @return true if the chunk may contain a matching event
+     */
+    bool matches(const TraceChunk& chunk) const;
+
+    /**
+     * @return true if the event matches the query
+     */
+    bool matches(const TraceEvent& event) const;
+
+private:
+    uint64_t begin_time;
+    uint64_t end_time;
+    std::vector<std::string> categories;
+    uint64_t group_mask;
+    // Category matches by tracepoint as matching globs is expensive
+    mutable std::unordered_map<const tracepoint_info*, bool> category_cache;
 };
 
 /**
@@ -136,6 +533,11 @@ enum class BufferMode : char {
 // Forward decl
 class StatsCallback;
 
+/**
+ * Maximum number of partitions that a TraceBuffer can be divided into
+ */
+constexpr size_t max_buffer_partitions = 8;
+
 /**
  * Abstract base-class for a buffer of TraceEvents
  *
@@ -170,6 +572,11 @@ public:
     /**
      * Used for getting a TraceChunk to add events to
      *
+     * A buffer which is not full MAY also return nullptr if no chunk
+     * could be acquired in a timely manner (e.g. a ring buffer with
+     * every chunk currently on loan), callers should treat this as
+     * transient and drop the event rather than stop tracing.
+     *
      * @return A pointer to a TraceChunk to insert events into or
      *         nullptr if the buffer is full.
      */
@@ -186,9 +593,42 @@ public:
      */
     virtual void returnChunk(TraceChunk& chunk) = 0;
 
+    /**
+     * Used for getting a TraceChunk from a given partition of the buffer
+     *
+     * Buffers which are not partitioned only have partition 0, which is
+     * equivalent to TraceBuffer::getChunk().
+     *
+     * @param partition The partition to get the chunk from
+     * @return A pointer to a TraceChunk to insert events into or
+     *         nullptr if the partition is full.
+     */
+    virtual TraceChunk* getPartitionChunk(size_t partition) {
+        (void)partition;
+        return getChunk();
+    }
+
+    /**
+     * Used for returning a TraceChunk acquired from getPartitionChunk()
+     *
+     * @param chunk The chunk to be returned
+     * @param partition The partition the chunk was acquired from
+     */
+    virtual void returnPartitionChunk(TraceChunk& chunk, size_t partition) {
+        (void)partition;
+        returnChunk(chunk);
+    }
+
+    /**
+     * @return The number of partitions the buffer is divided into
+     */
+    virtual size_t partitionCount() const {
+        return 1;
+    }
+
     /**
      * Determine if there are no remaining chunks left to be
-     * used
+     * used (in any partition)
      *
      * @return true if there are no chunks left or false
      *         otherwise
@@ -249,6 +689,78 @@ public:
      */
     virtual BufferMode bufferMode() const = 0;
 
+    /**
+     * Find the chunks which may contain events matching a query,
+     * chunks which can't match are skipped without visiting their
+     * events. The events of the returned chunks must still be checked
+     * with EventQuery::matches().
+     *
+     * @param query The query to match
+     * @return The chunks which may contain a matching event
+     */
+    std::vector<const TraceChunk*> query(const EventQuery& query) const;
+
+    using chunk_callback = std::function<void(const TraceChunk& chunk)>;
+
+    /**
+     * Invoke a callback for every chunk in the buffer, in the same order
+     * as the chunk iterators
+     *
+     * Unlike the iterators, which look up each chunk through the virtual
+     * `operator[]`, implementations walk their own storage directly so
+     * the cost is a single call per chunk. Consumers can then process
+     * the events of each chunk as a contiguous range, decoding those of
+     * compact chunks (see also forEachSpan()):
+     *
+     *     std::vector<TraceEvent> scratch;
+     *     buffer.forEachChunk([&scratch](const TraceChunk& chunk) {
+     *         for (const auto& event :
+     *              TraceBuffer::getSpan(chunk, scratch).events) {
+     *             // Do something with every event
+     *         }
+     *     });
+     *
+     * @param callback Callback to invoke with each chunk
+     */
+    virtual void forEachChunk(const chunk_callback& callback) const;
+
+    /**
+     * The events of a single chunk and the thread which logged them
+     */
+    struct chunk_span {
+        gsl_p::span<const TraceEvent> events;
+        uint32_t thread_id;
+        uint32_t process_id;
+        // Whether the events were decoded from a compact chunk into
+        // scratch storage, otherwise they refer directly to the chunk
+        bool decoded;
+    };
+
+    using span_callback = std::function<void(const chunk_span& span)>;
+
+    /**
+     * Invoke a callback with the events of every non-empty chunk in the
+     * buffer, in the same order as the chunk iterators
+     *
+     * The events of compact chunks are decoded one chunk at a time into
+     * storage which is reused for the next chunk, so a decoded span is
+     * only valid until the callback returns.
+     *
+     * @param callback Callback to invoke with each span
+     */
+    void forEachSpan(const span_callback& callback) const;
+
+    /**
+     * Get the events of a single chunk
+     *
+     * @param chunk The chunk
+     * @param scratch Storage for the events if the chunk is compact, the
+     *        span is only valid until it is next used
+     * @return The events of the chunk
+     */
+    static chunk_span getSpan(const TraceChunk& chunk,
+                              std::vector<TraceEvent>& scratch);
+
     /**
      * Const bi-directional iterator over the TraceChunks in a TraceBuffer
      *
@@ -275,15 +787,41 @@ public:
 
         chunk_iterator(const TraceBuffer& buffer_);
         chunk_iterator(const TraceBuffer& buffer_, size_t index_);
-        const_reference operator*() const;
-        const_pointer operator->() const;
-        chunk_iterator& operator++();
-        bool operator==(const chunk_iterator& other) const;
-        bool operator!=(const chunk_iterator& other) const;
+
+        // Defined inline so the event_iterator, which checks the end of
+        // the current chunk on every increment, needs no calls per event
+
+        const_reference operator*() const {
+            if (!chunk) {
+                chunk = &buffer[index];
+            }
+            return *chunk;
+        }
+
+        const_pointer operator->() const {
+            return &(**this);
+        }
+
+        chunk_iterator& operator++() {
+            ++index;
+            chunk = nullptr;
+            return *this;
+        }
+
+        bool operator==(const chunk_iterator& other) const {
+            return &buffer == &(other.buffer) && index == other.index;
+        }
+
+        bool operator!=(const chunk_iterator& other) const {
+            return !(*this == other);
+        }
 
     protected:
         const TraceBuffer& buffer;
         size_t index;
+        // The chunk at index, looked up once on first use rather than
+        // every time the iterator is dereferenced
+        mutable const TraceChunk* chunk;
     };
 
     /**
@@ -381,15 +919,162 @@ using buffer_ptr = std::unique_ptr<TraceBuffer>;
 using trace_buffer_factory =
         std::function<buffer_ptr(size_t generation, size_t buffer_size)>;
 
+class ChunkStoragePool;
+
+/**
+ * Fixed-size array of TraceChunks backing a built-in TraceBuffer
+ *
+ * Storage acquired from a ChunkStoragePool is handed back to the pool
+ * when it is destroyed (i.e. when the buffer's TraceContext is released)
+ * so that a later buffer of the same size can reuse it.
+ */
+class ChunkStorage {
+public:
+    /**
+     * Allocate storage which doesn't belong to any pool
+     *
+     * @param size Number of chunks
+     */
+    explicit ChunkStorage(size_t size);
+
+    ChunkStorage(ChunkStorage&& other) noexcept;
+
+    ChunkStorage& operator=(ChunkStorage&& other) = delete;
+
+    ~ChunkStorage();
+
+    TraceChunk& operator[](size_t index) {
+        return chunks[index];
+    }
+
+    const TraceChunk& operator[](size_t index) const {
+        return chunks[index];
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+protected:
+    friend class ChunkStoragePool;
+
+    ChunkStorage(std::unique_ptr<TraceChunk[]> chunks_,
+                 size_t count_,
+                 std::weak_ptr<ChunkStoragePool> pool_);
+
+    std::unique_ptr<TraceChunk[]> chunks;
+    size_t count;
+    // The pool to return the storage to, if any
+    std::weak_ptr<ChunkStoragePool> pool;
+};
+
+/**
+ * The ChunkStoragePool retains the storage of released buffers so that
+ * repeated trace sessions with the same buffer size don't pay for a
+ * fresh allocation (and the page faults of touching it) on every start.
+ *
+ * Storage is matched on its exact size in chunks, the pool keeps at most
+ * `max_retained` arrays, discarding the least recently released.
+ *
+ * A pool must be owned by a std::shared_ptr as storage holds a weak
+ * reference back to the pool, storage released after its pool has been
+ * destroyed is simply freed.
+ */
+class ChunkStoragePool
+        : public std::enable_shared_from_this<ChunkStoragePool> {
+public:
+    /**
+     * @param max_retained Maximum number of arrays to keep, 0 to keep none
+     */
+    explicit ChunkStoragePool(size_t max_retained);
+
+    /**
+     * Take storage of a given size from the pool, allocating it if the
+     * pool has none of that size
+     *
+     * @param size Number of chunks
+     */
+    ChunkStorage acquire(size_t size);
+
+    /**
+     * Change the number of arrays which may be retained, discarding any
+     * excess
+     */
+    void setMaxRetained(size_t max_retained);
+
+    /**
+     * Free all of the retained storage
+     */
+    void clear();
+
+    /**
+     * Invokes methods on the callback to supply various
+     * stats about the pool.
+     */
+    void getStats(StatsCallback& addStats) const;
+
+protected:
+    friend class ChunkStorage;
+
+    void release(std::unique_ptr<TraceChunk[]> chunks, size_t size);
+
+    struct Retained {
+        std::unique_ptr<TraceChunk[]> chunks;
+        size_t size;
+    };
+
+    mutable std::mutex mutex;
+    size_t max_retained;
+    // Least recently released first
+    std::vector<Retained> retained;
+    size_t reused = 0;
+    size_t allocated = 0;
+};
+
 buffer_ptr make_fixed_buffer(size_t generation, size_t buffer_size);
 
 buffer_ptr make_ring_buffer(size_t generation, size_t buffer_size);
 
+/**
+ * Create a fixed buffer using storage from a pool
+ */
+buffer_ptr make_pooled_fixed_buffer(size_t generation,
+                                    size_t buffer_size,
+                                    ChunkStoragePool& pool);
+
+/**
+ * Create a ring buffer using storage from a pool
+ */
+buffer_ptr make_pooled_ring_buffer(size_t generation,
+                                   size_t buffer_size,
+                                   ChunkStoragePool& pool);
+
+/**
+ * Create a TraceBuffer which is divided into independent partitions,
+ * each partition loans out chunks from its own sub-buffer so that one
+ * partition filling up (or rotating) has no effect on the others.
+ *
+ * Iterating over the buffer visits the chunks of each partition in turn.
+ *
+ * @param partitions The sub-buffer of each partition, there must be at
+ *        least one and no more than max_buffer_partitions.
+ * @throw std::invalid_argument if the number of partitions is invalid
+ */
+buffer_ptr make_partitioned_buffer(std::vector<buffer_ptr> partitions);
+
 /// Parse the buffer mode from provided string (the comparison is case
 /// insensitive). throws std::invalid_argument for invalid modes
 BufferMode parseBufferMode(std::string_view mode);
+
+/// Parse the event format from provided string. throws
+/// std::invalid_argument for invalid formats
+EventFormat parseEventFormat(std::string_view format);
 } // namespace phosphor
 
 /// Get a textual representation for the provided buffer mode. Throws
 /// std::invalid_argument for invalid modes
 std::string to_string(phosphor::BufferMode mode);
+
+/// Get a textual representation for the provided event format. Throws
+/// std::invalid_argument for invalid formats
+std::string to_string(phosphor::EventFormat format);
@@ -14,6 +14,8 @@
 #include <memory>
 #include <mutex>
 
+#include "category_registry.h"
+#include "string_table.h"
 #include "trace_buffer.h"
 
 namespace phosphor {
@@ -61,6 +63,16 @@ public:
  */
 std::ostream& operator<<(std::ostream& stream, const BufferMode mode);
 
+/**
+ * A partition of the trace buffer reserved for a set of categories
+ */
+struct BufferPartition {
+    /// Categories (globs) whose events are logged to the partition
+    std::vector<std::string> categories;
+    /// Size in bytes of the partition
+    size_t buffer_size;
+};
+
 /**
  * The TraceConfig is used to configure a TraceLog for starting Trace
  * when it is enabled.
@@ -173,6 +185,234 @@ public:
      */
     const std::vector<std::string>& getDisabledCategories() const;
 
+    /**
+     * Reserve a separate partition of the trace buffer for the given
+     * categories, so that their events cannot be evicted (or have space
+     * used up) by events of other categories.
+     *
+     * Each partition is a TraceBuffer of its own, created with the
+     * configured buffer factory. Events in categories not matching any
+     * partition are logged to the default partition which has the size
+     * given to the TraceConfig constructor. Where a category matches
+     * several partitions the first one added is used.
+     *
+     * Example:
+     *
+     *     TraceConfig(BufferMode::ring, 8 * 1024 * 1024)
+     *             .addPartition({"memcached:frontend"}, 1024 * 1024);
+     *
+     * @param categories Categories (globs) to log to the partition
+     * @param buffer_size Size in bytes of the partition
+     * @return reference to the TraceConfig being configured
+     * @throw std::invalid_argument if there would be more than
+     *        max_buffer_partitions partitions
+     */
+    TraceConfig& addPartition(const std::vector<std::string>& categories,
+                              size_t buffer_size);
+
+    /**
+     * @return The buffer partitions (other than the default partition)
+     *         for this trace config
+     */
+    const std::vector<BufferPartition>& getPartitions() const;
+
+    /**
+     * Set the minimum duration of scoped events (TRACE_EVENT* and
+     * TRACE_FUNCTION*) in the given category, shorter scopes are dropped
+     * rather than logged. Replaces any threshold previously set for the
+     * same category glob.
+     *
+     * Example:
+     *
+     *     config.setCategoryThreshold("memcached:*",
+     *                                 std::chrono::microseconds(10));
+     *
+     * @param category Category (glob) the threshold applies to
+     * @param threshold Minimum duration of a scoped event
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setCategoryThreshold(const std::string& category,
+                                      std::chrono::nanoseconds threshold);
+
+    /**
+     * @return The scoped event thresholds for this trace config
+     */
+    const CategoryThresholds& getCategoryThresholds() const;
+
+    /**
+     * Set the categories whose scoped events (TRACE_EVENT* and
+     * TRACE_FUNCTION*) record the calling thread's perf counters at
+     * entry and exit (see platform::PerfCounters).
+     *
+     * The counters' deltas are logged as a Complete event spanning the
+     * scope, named "perf_counters" (instructions and cycles) and
+     * "perf_cache" (last level cache misses) when the hardware counters
+     * are available, or "perf_sched" (context switches and page faults)
+     * otherwise. Reading the counters costs a syscall per scope entry and
+     * exit unless the kernel allows rdpmc.
+     *
+     * @param categories Counted categories (may include wildcards)
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setCountedCategories(std::vector<std::string> categories);
+
+    /**
+     * @return The categories whose scoped events record perf counters
+     */
+    const std::vector<std::string>& getCountedCategories() const;
+
+    /**
+     * Set the duration beyond which scoped events (TRACE_EVENT* and
+     * TRACE_FUNCTION*) and lock guards (TRACE_LOCKGUARD*) capture the
+     * calling thread's stack, defaults to zero (never capture).
+     *
+     * The stack is captured when the slow scope ends and logged as an
+     * Instant "stack_trace" event following the scope's event(s). Its
+     * return addresses are kept in the StackTable and only symbolized
+     * when the trace is exported. Scopes faster than the threshold pay
+     * nothing beyond the comparison.
+     *
+     * @param threshold Minimum duration of a scope to capture its stack
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setStackThreshold(std::chrono::nanoseconds threshold);
+
+    /**
+     * @return The minimum duration of a scope to capture its stack, zero
+     *         if stacks aren't captured
+     */
+    std::chrono::nanoseconds getStackThreshold() const;
+
+    /**
+     * Set the interval of CPU time between samples of the stacks of
+     * registered threads, defaults to zero (don't sample).
+     *
+     * Each registered thread is interrupted by a SIGPROF timer on its own
+     * CPU clock, so idle threads aren't sampled. The handler captures the
+     * thread's stack into the StackTable and logs a Sample "cpu_sample"
+     * event into the thread's current chunk, interleaved with its other
+     * events. A sample is dropped (and counted by the "log_dropped_samples"
+     * stat) rather than waiting if the thread is interrupted while
+     * logging, or if the sample would need a chunk from a buffer which
+     * can't hand one out without locking.
+     *
+     * Only supported on Linux. The SIGPROF handler and the timers only
+     * exist while sampling. The process' previous SIGPROF handler is
+     * restored when tracing stops, and is passed any SIGPROF which wasn't
+     * sent by a sample timer in the meantime.
+     *
+     * @param interval CPU time between samples of each thread
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setSampleInterval(std::chrono::nanoseconds interval);
+
+    /**
+     * @return The CPU time between samples of each thread, zero if
+     *         threads aren't sampled
+     */
+    std::chrono::nanoseconds getSampleInterval() const;
+
+    /**
+     * Mirror the chunks of the trace buffer into the named shared
+     * memory segment as they are filled, so that the trace can be
+     * followed by the phosphor-tail tool while it is running
+     * (see make_tail_buffer()).
+     *
+     * @param name Name of the shared memory segment or an empty
+     *        string to disable
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setTailSegment(std::string name);
+
+    /**
+     * @return The name of the shared memory segment to mirror the
+     *         trace buffer to (or an empty string if disabled)
+     */
+    const std::string& getTailSegment() const;
+
+    /**
+     * Set the format events are stored in (see EventFormat), defaults
+     * to EventFormat::full.
+     *
+     * The compact format fits about a quarter more events in the same
+     * buffer size but chunks are replaced early when an event starts
+     * more than ~2s from the first event of its chunk, so it suits
+     * buffers which are filled quickly. It only applies to the fixed
+     * and ring buffer modes, custom buffers always use the full format.
+     *
+     * @param format The format to store events in
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setEventFormat(EventFormat format);
+
+    /**
+     * @return The format events are stored in
+     */
+    EventFormat getEventFormat() const;
+
+    /**
+     * Set whether events are written to the buffer with non-temporal
+     * (streaming) stores, defaults to false.
+     *
+     * Streaming stores bypass the CPU caches so tracing evicts less of
+     * the traced application's working set. Only AArch64 has streaming
+     * stores which are cheap enough, other platforms use regular stores.
+     * See TraceChunk::setStreaming().
+     *
+     * @param enabled Whether to use streaming stores
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setStreamingStores(bool enabled);
+
+    /**
+     * @return Whether events are written with streaming stores
+     */
+    bool getStreamingStores() const;
+
+    /**
+     * Set whether each thread holds a spare chunk, defaults to false.
+     *
+     * When a thread's chunk fills it is swapped for the spare instead of
+     * being replaced from the buffer. A background thread of the
+     * TraceLog returns the full chunk and acquires a new spare, which
+     * keeps the buffer's shared state off the path of the thread's
+     * events. If the new spare isn't ready by the time the thread's
+     * chunk fills again the chunk is replaced from the buffer as usual,
+     * in which case the thread's chunks may be out of order in the buffer
+     * (the events keep their timestamps).
+     * Each thread holds one more chunk out of the buffer (so a fixed
+     * buffer may stop with some chunks unused), ring buffers are sized to
+     * hold at least two chunks per thread.
+     *
+     * @param enabled Whether threads hold spare chunks
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setSpareChunks(bool enabled);
+
+    /**
+     * @return Whether threads hold spare chunks
+     */
+    bool getSpareChunks() const;
+
+    /**
+     * Set whether the CPU each event was logged on is recorded, defaults
+     * to false.
+     *
+     * The CPU number (see platform::getCurrentCPU()) is packed into the
+     * spare high bits of the event's duration, so it doesn't grow the
+     * events. It is exported as the "cpu" argument of each event, which
+     * shows where threads migrated between CPUs (or NUMA nodes).
+     *
+     * @param enabled Whether to record the CPU of each event
+     * @return reference to the TraceConfig being configured
+     */
+    TraceConfig& setRecordCPU(bool enabled);
+
+    /**
+     * @return Whether the CPU of each event is recorded
+     */
+    bool getRecordCPU() const;
+
     /**
      * Update a pre-existing TraceConfig from a config string
      *
@@ -237,6 +477,16 @@ protected:
 
     std::vector<std::string> enabled_categories;
     std::vector<std::string> disabled_categories;
+    CategoryThresholds category_thresholds;
+    std::vector<std::string> counted_categories;
+    std::chrono::nanoseconds stack_threshold{0};
+    std::chrono::nanoseconds sample_interval{0};
+    std::vector<BufferPartition> partitions;
+    std::string tail_segment;
+    EventFormat event_format = EventFormat::full;
+    bool streaming_stores = false;
+    bool spare_chunks = false;
+    bool record_cpu = false;
 };
 
 /**
@@ -280,6 +530,39 @@ public:
      */
     TraceConfig* getStartupTrace() const;
 
+    /**
+     * Sets the number of released trace buffers whose memory the
+     * TraceLog keeps for reuse by later traces of the same buffer size
+     * (with the fixed or ring buffer modes). Defaults to 0, i.e. the
+     * memory of a buffer is freed when its TraceContext is released.
+     *
+     * @param _buffer_pool_size Maximum number of buffers to keep
+     * @return A reference to this config
+     */
+    TraceLogConfig& setBufferPoolSize(size_t _buffer_pool_size);
+
+    /**
+     * @return The maximum number of released buffers to keep for reuse
+     */
+    size_t getBufferPoolSize() const;
+
+    /**
+     * Sets the maximum number of distinct strings the TraceLog can intern
+     * (see PHOSPHOR_INTERNED_STR). Interned strings are kept for the
+     * lifetime of the TraceLog, once the table is full any further
+     * strings are logged as an empty string. Only used when the TraceLog
+     * is constructed. Defaults to StringTable::default_table_size.
+     *
+     * @param _string_table_size Maximum number of strings to intern
+     * @return A reference to this config
+     */
+    TraceLogConfig& setStringTableSize(size_t _string_table_size);
+
+    /**
+     * @return The maximum number of strings the TraceLog can intern
+     */
+    size_t getStringTableSize() const;
+
     /**
      * Factory method which sets up a TraceLogConfig from the
      * environment variables
@@ -293,6 +576,8 @@ public:
 
 protected:
     std::unique_ptr<TraceConfig> startup_trace;
+    size_t buffer_pool_size = 0;
+    size_t string_table_size = StringTable::default_table_size;
 };
 
 } // namespace phosphor
@@ -34,6 +34,15 @@ constexpr auto arg_count = 2;
 class TraceEvent {
 public:
     using Type = TraceEventType;
+
+    /**
+     * The CPU number of an event is packed into the high bits of its
+     * duration (see setCPU()), so durations are limited to 48 bits
+     * (~78 hours) and longer durations are clamped.
+     */
+    static constexpr int cpu_shift = 48;
+    static constexpr uint64_t max_duration = (uint64_t(1) << cpu_shift) - 1;
+
     /**
      * Default constructor for efficient TraceChunk initialisation
      */
@@ -79,6 +88,17 @@ public:
      */
     std::string to_json(uint32_t thread_id) const;
 
+    /**
+     * Used to get a JSON object representation of the TraceEvent
+     * attributed to the given process rather than the current one
+     * (e.g. when decoding events recorded by another process)
+     *
+     * @param thread_id id of the thread that generated the event
+     * @param process_id id of the process that generated the event
+     * @return JSON object representing the TraceEvent
+     */
+    std::string to_json(uint32_t thread_id, uint32_t process_id) const;
+
     /**
      * Converts a TraceEvent::Type to a cstring
      *
@@ -101,6 +121,11 @@ public:
      */
     Type getType() const;
 
+    /**
+     * @return the tracepoint info (name, category, ...) of the event
+     */
+    const tracepoint_info* getTracepointInfo() const;
+
     /**
      * @return the arguments of the event
      */
@@ -127,6 +152,20 @@ public:
      */
     uint64_t getDuration() const;
 
+    /**
+     * @return the CPU the event was logged on or -1 if it wasn't
+     *         recorded (see TraceConfig::setRecordCPU)
+     */
+    int getCPU() const;
+
+    /**
+     * Record the CPU the event was logged on
+     *
+     * @param cpu The CPU number, as returned by platform::getCurrentCPU(),
+     *            negative numbers (unknown CPU) are not recorded
+     */
+    void setCPU(int cpu);
+
 protected:
     class ToJsonResult {
     public:
@@ -151,7 +190,8 @@ private:
 
     /**
      * Only used by Type::Complete events to specify the duration (in
-     * nanoseconds). Unused by other Types.
+     * nanoseconds) in the low 48 bits. The high 16 bits hold the CPU
+     * number + 1 for any Type, or 0 if the CPU wasn't recorded.
      */
     uint64_t duration;
 };
@@ -11,15 +11,21 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <set>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "category_registry.h"
 #include "chunk_lock.h"
+#include "platform/perf_counters.h"
+#include "platform/sample_timer.h"
+#include "string_table.h"
 #include "trace_buffer.h"
 #include "trace_config.h"
 #include "trace_context.h"
@@ -88,6 +94,9 @@ public:
     /**
      * Start tracing with the specified config
      *
+     * When using a ring buffer the buffer will be grown if necessary to
+     * hold at least one chunk more than the number of registered threads.
+     *
      * @param _trace_config TraceConfig to use for this tracing run
      */
     void start(const TraceConfig& _trace_config);
@@ -112,6 +121,73 @@ public:
      */
     void stop(std::lock_guard<TraceLog>&, bool shutdown = false);
 
+    /**
+     * Start a secondary trace session with the specified config
+     *
+     * Secondary sessions run alongside the primary session (controlled
+     * by start() and stop()) and each other, with their own categories,
+     * buffer and stopped callback. An event is logged once to every
+     * session which has its category enabled. For example an always-on
+     * flight recorder can run in a small ring buffer while deep captures
+     * are taken with start() and stop().
+     *
+     * Secondary sessions don't support buffer partitions, tail segments,
+     * category thresholds, counted categories, stack thresholds, spare
+     * chunks or recording the CPU. These settings of the primary session
+     * do apply to the events it shares with secondary sessions, and
+     * deferred spans only defer the events logged to the primary
+     * session.
+     *
+     * A session's id is reused once it has stopped and its context has
+     * been taken, or if no other id is free.
+     *
+     * @param config TraceConfig to use for the session
+     * @return The id of the session, from 1 to max_trace_sessions - 1
+     * @throw std::invalid_argument if the config uses a feature that
+     *        isn't supported by secondary sessions
+     * @throw std::logic_error if max_trace_sessions - 1 secondary
+     *        sessions are already running
+     */
+    size_t startSession(const TraceConfig& config);
+
+    /**
+     * Immediately stops a trace session, invoking its stopped callback
+     *
+     * While the callback of a secondary session runs getBuffer() and
+     * getTraceContext() (with external locking) return the session's
+     * buffer, so callbacks such as FileStopCallback save the session
+     * that stopped.
+     *
+     * @param session The id of the session, 0 stops the primary session
+     * @throw std::invalid_argument if the id is out of range
+     */
+    void stopSession(size_t session);
+
+    /**
+     * @param session The id of the session, 0 for the primary session
+     * @return True if the session is enabled
+     * @throw std::invalid_argument if the id is out of range
+     */
+    bool isSessionEnabled(size_t session) const;
+
+    /**
+     * @param session The id of the session, 0 for the primary session
+     * @return The current or last-used TraceConfig of the session
+     * @throw std::invalid_argument if the id is out of range
+     */
+    TraceConfig getSessionConfig(size_t session) const;
+
+    /**
+     * Returns a trace context object for the last trace of a session,
+     * see getTraceContext()
+     *
+     * @param session The id of the session, 0 for the primary session
+     * @return TraceContext for the last trace of the session
+     * @throw std::invalid_argument if the id is out of range
+     * @throw std::logic_error if the session is currently enabled
+     */
+    TraceContext getSessionContext(size_t session);
+
     /**
      * Logs an event in the current buffer (if applicable)
      *
@@ -126,6 +202,24 @@ public:
                   TraceArgument argA,
                   TraceArgument argB);
 
+    /**
+     * Logs an event in the current buffer (if applicable)
+     *
+     * As logEvent() but the category group of the event is taken from its
+     * category status rather than looked up from the tracepoint, which is
+     * what the macros use.
+     *
+     * @param tpi Tracepoint info (name, category, etc) of the event.
+     * @param status Status of the tracepoint's category group, as
+     *        returned by getCategoryStatus()
+     * @param argA Argument to be saved with the event
+     * @param argB Argument to be saved with the event
+     */
+    void logEvent(const tracepoint_info* tpi,
+                  const AtomicCategoryStatus& status,
+                  TraceArgument argA,
+                  TraceArgument argB);
+
     /**
      * Logs a Complete event in the current buffer (if applicable)
      *
@@ -144,6 +238,86 @@ public:
                   TraceArgument argA,
                   TraceArgument argB);
 
+    /**
+     * Logs a Complete event in the current buffer (if applicable)
+     *
+     * As logEvent() but the category group of the event is taken from its
+     * category status rather than looked up from the tracepoint.
+     *
+     * @param tpi Tracepoint information (name, category, ...)
+     * @param status Status of the tracepoint's category group, as
+     *        returned by getCategoryStatus()
+     * @param start Start time of the event
+     * @param duration Duration of the event
+     * @param argA Argument to be saved with the event
+     * @param argB Argument to be saved with the event
+     */
+    void logEvent(const tracepoint_info* tpi,
+                  const AtomicCategoryStatus& status,
+                  std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::duration duration,
+                  TraceArgument argA,
+                  TraceArgument argB);
+
+    /**
+     * Logs the deltas of the perf counters over a scoped event, as
+     * Complete events spanning the scope in the scope's category group
+     * (see TraceConfig::setCountedCategories())
+     *
+     * This method should not be used directly, instead the
+     * macros contained within phosphor.h should be used instead.
+     *
+     * @param status Status of the scoped event's category group
+     * @param start Start time of the scoped event
+     * @param duration Duration of the scoped event
+     * @param counters The set of counters which were read
+     * @param deltas Change in each counter over the scope
+     */
+    void logPerfCounters(const AtomicCategoryStatus& status,
+                         std::chrono::steady_clock::time_point start,
+                         std::chrono::steady_clock::duration duration,
+                         platform::PerfCounterSet counters,
+                         const platform::PerfCounterValues& deltas);
+
+    /**
+     * Captures the calling thread's stack and logs it as a
+     * "stack_trace" event in the category group of a slow scope (see
+     * TraceConfig::setStackThreshold())
+     *
+     * This method should not be used directly, instead the
+     * macros contained within phosphor.h should be used instead.
+     *
+     * @param tpi Tracepoint information of the slow scope's event
+     */
+    void logStackTrace(const tracepoint_info* tpi);
+
+    /**
+     * Opens a deferred span on the current thread
+     *
+     * While a deferred span is open, events logged by the thread are
+     * staged in a thread-local chunk instead of the shared buffer. When
+     * the outermost span is closed with endDeferredSpan() the staged
+     * events are either copied in bulk into the buffer or discarded.
+     *
+     * Deferred spans may be nested, the events of an inner span which
+     * is not committed are discarded straight away while the events of
+     * a committed inner span are kept until the outermost span decides.
+     *
+     * Only registered threads can defer events, on other threads the
+     * span has no effect.
+     *
+     * @return Mark to be passed to the matching endDeferredSpan()
+     */
+    size_t beginDeferredSpan();
+
+    /**
+     * Closes the innermost deferred span opened on the current thread
+     *
+     * @param mark The value returned by the matching beginDeferredSpan()
+     * @param commit Whether the events staged in the span should be kept
+     */
+    void endDeferredSpan(size_t mark, bool commit);
+
     /**
      * Used to get a reference to a reusable CategoryStatus. This should
      * generally be held in a block-scope static at a given trace point
@@ -156,6 +330,74 @@ public:
      */
     const AtomicCategoryStatus& getCategoryStatus(const char* category_group);
 
+    /**
+     * Get the minimum duration a scoped event must last to be logged
+     *
+     * @param status A CategoryStatus returned by getCategoryStatus()
+     * @return The minimum duration of scoped events in the category group
+     */
+    std::chrono::steady_clock::duration getCategoryThreshold(
+            const AtomicCategoryStatus& status) const {
+        return registry.getThreshold(status);
+    }
+
+    /**
+     * Check whether any category has a threshold, if not scoped events
+     * needn't call getCategoryThreshold()
+     *
+     * @return true if the trace config has category thresholds
+     */
+    bool hasCategoryThresholds() const {
+        return registry.hasThresholds();
+    }
+
+    /**
+     * Check whether scoped events record perf counters
+     *
+     * @param status A CategoryStatus returned by getCategoryStatus()
+     * @return true if the category group is counted
+     */
+    bool isCategoryCounted(const AtomicCategoryStatus& status) const {
+        return registry.isCounted(status);
+    }
+
+    /**
+     * Check whether a scope lasted long enough to capture its stack
+     *
+     * @param duration The duration of the scope
+     * @return true if the stack should be logged with logStackTrace()
+     */
+    bool isStackThresholdExceeded(
+            std::chrono::steady_clock::duration duration) const {
+        const auto threshold = stack_threshold.load();
+        return threshold != 0 && duration.count() >= threshold;
+    }
+
+    /**
+     * Get the mask of the category groups which contain any of the given
+     * categories, used by an EventQuery to skip chunks which can't
+     * contain events of those categories.
+     *
+     * @param categories Categories to match (may include wildcards)
+     * @return Mask of the matching category groups
+     */
+    uint64_t getCategoryGroupMask(
+            const std::vector<std::string>& categories) const {
+        return registry.getGroupMask(categories);
+    }
+
+    /**
+     * Intern a runtime string so that it can be logged as an argument
+     * without being truncated or having to outlive the trace, see
+     * PHOSPHOR_INTERNED_STR.
+     *
+     * @param str The string to intern
+     * @return Reference to the interned string
+     */
+    interned_string internString(std::string_view str) {
+        return string_table.intern(str);
+    }
+
     /**
      * Transfers ownership of the current TraceBuffer to the caller
      *
@@ -265,10 +507,131 @@ protected:
      * Gets a pointer to the appropriate ChunkTenant (or nullptr)
      * with the lock acquired.
      *
+     * @param partition The buffer partition the ChunkTenant should have a
+     *        chunk with available events for
+     * @param event The event to be added, if given the chunk is also
+     *        replaced when it can't hold the event (see
+     *        TraceChunk::canAdd())
      * @return A valid ChunkTenant with available events or a
      *         nullptr if a valid ChunkTenant could not be acquired.
      */
-    std::unique_lock<ChunkTenant> getChunkTenant();
+    std::unique_lock<ChunkTenant> getChunkTenant(
+            size_t partition = 0, const TraceEvent* event = nullptr);
+
+    /**
+     * Logs a sample of the calling thread's stack, called from the
+     * SIGPROF handler when the thread's SampleTimer fires (see
+     * TraceConfig::setSampleInterval())
+     *
+     * @param pc The instruction the thread was interrupted at
+     */
+    void logSample(const void* pc);
+
+    /**
+     * SampleTimer handler, the context is the TraceLog
+     */
+    static void handleSample(void* context, const void* pc);
+
+    /**
+     * Creates and arms the sample timer of a registered thread, if the
+     * thread can be sampled
+     *
+     * @param tenant The ChunkTenant of the thread
+     * @param thread The thread, as captured when it registered
+     */
+    void armSampleTimer(ChunkTenant* tenant,
+                        const platform::SampleTimer::Thread& thread);
+
+    /**
+     * State of a secondary trace session
+     */
+    struct Session {
+        /// The current or last-used config of the session
+        TraceConfig trace_config;
+        /// Whether the session is enabled, see TraceLog::enabled
+        std::atomic<bool> enabled{false};
+        /// The session's buffer (null once taken)
+        std::unique_ptr<TraceBuffer> buffer;
+        /// Incremented when the session is started, see maybe_stop()
+        std::atomic<size_t> generation{0};
+        /// Format of the events in the chunks of the buffer
+        RelaxedAtomic<EventFormat> event_format{EventFormat::full};
+        /// Whether chunks of the buffer use streaming stores
+        RelaxedAtomic<bool> streaming_stores{false};
+    };
+
+    /**
+     * @return The state of a secondary session
+     * @throw std::invalid_argument if the id isn't that of a secondary
+     *        session
+     */
+    Session& getSession(size_t session);
+    const Session& getSession(size_t session) const;
+
+    /**
+     * Logs an event to every session which should receive it
+     *
+     * @param event The event to log
+     * @param group The CategoryRegistry group index of the event's
+     *        category
+     */
+    void addEvent(const TraceEvent& event, size_t group);
+
+    /**
+     * Logs an event to the secondary sessions in a session mask
+     */
+    void addSessionEvent(const TraceEvent& event,
+                         size_t group,
+                         unsigned int sessions);
+
+    /**
+     * Gets the current thread's ChunkTenant with the lock acquired and
+     * a chunk of the given secondary session which can hold the event
+     *
+     * @return The locked ChunkTenant or an unlocked one if the event
+     *         can't be logged to the session
+     */
+    std::unique_lock<ChunkTenant> getSessionChunkTenant(
+            size_t session, const TraceEvent& event);
+
+    /**
+     * Stops a secondary session (with external locking)
+     */
+    void stopSession(std::lock_guard<TraceLog>& lh,
+                     size_t session,
+                     bool shutdown = false);
+
+    /**
+     * Attempts to stop a secondary session without waiting for the
+     * internal lock, see maybe_stop()
+     */
+    void maybeStopSession(size_t session, size_t _generation);
+
+    /**
+     * Used for evicting the chunks of a secondary session from all
+     * ChunkTenants, see evictThreads()
+     */
+    void evictSession(std::lock_guard<TraceLog>& lh, size_t session);
+
+    /**
+     * Convert a buffer size in bytes to a number of chunks
+     *
+     * @param buffer_size Size of the buffer in bytes
+     * @param mode Mode of the buffer
+     * @param spares Whether threads hold spare chunks of the buffer
+     * @throw std::invalid_argument if the size is less than a chunk
+     */
+    size_t getBufferChunks(size_t buffer_size,
+                           BufferMode mode,
+                           bool spares) const;
+
+    /**
+     * Create a buffer for a session, the built-in buffers take their
+     * storage from the buffer pool
+     */
+    buffer_ptr makeBuffer(const TraceConfig& config,
+                          size_t buffer_generation,
+                          size_t buffer_chunks);
 
     /**
      * Replaces the current chunk held by the ChunkTenant with a new chunk
@@ -276,12 +639,82 @@ protected:
      *
      * This function must be called while the ChunkTenant lock is held.
      *
+     * If the ChunkTenant holds a spare chunk (see
+     * TraceConfig::setSpareChunks) the full chunk is swapped for it and
+     * left for the replenisher thread to return, otherwise the chunk is
+     * returned and replaced from the buffer.
+     *
      * @param ct The ChunkTenant that should have it's chunk returned
      *           and replaced
+     * @param partition The buffer partition of the chunk
+     * @param wake Whether to wake the replenisher thread, which must not
+     *        be done from a signal handler
      * @return true if the chunk has been successfully
      *              replaced, false otherwise
      */
-    bool replaceChunk(ChunkTenant& ct);
+    bool replaceChunk(ChunkTenant& ct,
+                      size_t partition = 0,
+                      bool wake = true);
+
+    /**
+     * Asks the replenisher thread to return the retired chunks and
+     * replace the spare chunks of the ChunkTenants
+     *
+     * @param wake Whether to wake the thread rather than leaving the
+     *        request for its next periodic pass
+     */
+    void requestReplenish(bool wake);
+
+    /**
+     * Body of the replenisher thread, which takes the buffer operations
+     * of spare chunks off the threads logging events
+     */
+    void runReplenisher();
+
+    /**
+     * Returns the retired chunks of a ChunkTenant to the buffer and
+     * acquires the spare chunks it wants. This function must be called
+     * while replenisher_mutex is held.
+     *
+     * @return false if a wanted spare couldn't be acquired (and should be
+     *         retried later)
+     */
+    bool replenishSpareChunks(ChunkTenant& ct);
+
+    /**
+     * @return The buffer partition that events of the given tracepoint
+     *         should be logged to
+     */
+    size_t getPartition(const tracepoint_info* tpi);
+
+    /**
+     * @return The buffer partition that events of the given category
+     *         group should be logged to
+     */
+    size_t getGroupPartition(size_t group) const;
+
+    /**
+     * @return The CategoryRegistry group index of the given tracepoint's
+     *         category
+     */
+    size_t getGroupIndex(const tracepoint_info* tpi);
+
+    /**
+     * Adds the current CPU to the event (if recorded) and adds it to the
+     * buffer and sessions of the given category group
+     */
+    void logGroupEvent(TraceEvent& event, size_t group);
+
+    /**
+     * Adds an event to the current thread's deferred span staging chunk
+     */
+    void stageEvent(const TraceEvent& event, size_t group);
+
+    /**
+     * Copies the events staged by the current thread into its chunk(s)
+     * in the buffer and empties the staging chunk.
+     */
+    void commitStagedEvents();
 
     /**
      * Used for evicting all ChunkTenants from the log
@@ -352,6 +785,12 @@ protected:
      */
     std::unique_ptr<TraceBuffer> buffer;
 
+    /**
+     * Storage of released buffers kept for reuse by later traces, see
+     * TraceLogConfig::setBufferPoolSize()
+     */
+    std::shared_ptr<ChunkStoragePool> buffer_pool;
+
     /**
      * The current tracing generation. This is incremented every-time
      * tracing is stopped and is passed into the TraceBuffer when it is
@@ -364,11 +803,31 @@ protected:
      */
     std::unordered_set<ChunkTenant*> registered_chunk_tenants;
 
+    /**
+     * The registered threads which can be sampled, captured when a thread
+     * registers so that its timer can be created by start()
+     */
+    std::unordered_map<ChunkTenant*, platform::SampleTimer::Thread>
+            sample_threads;
+
+    /**
+     * The armed sample timers of the registered threads, which only exist
+     * while samples are logged
+     */
+    std::unordered_map<ChunkTenant*, std::unique_ptr<platform::SampleTimer>>
+            sample_timers;
+
     /**
      * Category registry which manages the enabled / disabled categories
      */
     CategoryRegistry registry;
 
+    /**
+     * Strings interned by internString(), kept for the lifetime of the
+     * TraceLog so that they can be resolved by any later export
+     */
+    StringTable string_table;
+
     /**
      * Map of registered thread TIDs to names
      */
@@ -378,5 +837,137 @@ protected:
      * List of deregistered thread ids while tracing is running
      */
     std::set<uint64_t> deregistered_threads;
+
+    /**
+     * Number of events dropped because a chunk could not be acquired
+     * from a buffer which was not full.
+     */
+    RelaxedAtomic<size_t> dropped_events;
+
+    /**
+     * Number of staged events discarded because their deferred span was
+     * not committed.
+     */
+    RelaxedAtomic<size_t> discarded_deferred_events;
+
+    /**
+     * Number of partitions of the current buffer
+     */
+    RelaxedAtomic<size_t> partition_count;
+
+    /**
+     * Format of the events in the chunks of the current buffer
+     */
+    RelaxedAtomic<EventFormat> event_format;
+
+    /**
+     * Whether chunks of the current buffer use streaming stores
+     */
+    RelaxedAtomic<bool> streaming_stores;
+
+    /**
+     * Whether ChunkTenants hold spare chunks for the current buffer
+     */
+    RelaxedAtomic<bool> spare_chunks;
+
+    /**
+     * Thread which returns the retired chunks of the ChunkTenants and
+     * acquires their spares, started the first time tracing starts with
+     * spare chunks and stopped when the TraceLog is destroyed.
+     */
+    std::thread replenisher;
+
+    /**
+     * Held by the replenisher thread for each pass, and by anything which
+     * changes the ChunkTenants it replenishes (registration and eviction)
+     * so that the pass doesn't need the TraceLog lock. Acquired after the
+     * TraceLog lock when both are held.
+     */
+    std::mutex replenisher_mutex;
+
+    /**
+     * Wakes the replenisher thread, waited on with replenisher_mutex
+     */
+    std::condition_variable replenisher_cv;
+
+    /**
+     * Set when a ChunkTenant needs the replenisher thread
+     */
+    std::atomic<bool> replenish_pending;
+
+    /**
+     * Set (with replenisher_mutex held) to stop the replenisher thread
+     */
+    bool replenisher_stopping;
+
+    /**
+     * Whether events are tagged with the CPU they were logged on
+     */
+    RelaxedAtomic<bool> record_cpu;
+
+    /**
+     * Minimum duration of a scope to capture its stack in
+     * steady_clock ticks, zero if stacks aren't captured
+     */
+    RelaxedAtomic<std::chrono::steady_clock::duration::rep> stack_threshold;
+
+    /**
+     * Whether the sample timers are armed (and the SIGPROF handler
+     * installed)
+     */
+    RelaxedAtomic<bool> sampling;
+
+    /**
+     * Whether samples may replace a full chunk, which is only the case
+     * for buffers which hand out chunks without locking
+     */
+    RelaxedAtomic<bool> sample_chunks;
+
+    /**
+     * CategoryRegistry group index of the samples' category, looked up
+     * before sampling starts as the lookup isn't async-signal-safe
+     */
+    RelaxedAtomic<size_t> sample_group;
+
+    /**
+     * Number of samples dropped as the thread was interrupted while
+     * logging, or no chunk or stack id could be acquired for them
+     */
+    RelaxedAtomic<size_t> dropped_samples;
+
+    /**
+     * The secondary sessions, the session with id `i` is at index `i - 1`
+     */
+    std::array<Session, max_trace_sessions - 1> sessions;
+
+    /**
+     * Number of enabled secondary sessions
+     */
+    RelaxedAtomic<size_t> active_sessions;
+
+    /**
+     * The secondary session whose stopped callback is running (or 0),
+     * see stopSession()
+     */
+    size_t callback_session;
+
+    /**
+     * Entry of the cache of tracepoints' category group indexes
+     */
+    struct TracepointGroup {
+        std::atomic<const tracepoint_info*> tpi;
+        /// Group index + 1, or 0 if the index isn't yet known
+        std::atomic<size_t> group;
+    };
+
+    static constexpr size_t tracepoint_cache_probes = 8;
+
+    /**
+     * Lock-free cache used to map tracepoints to their category group
+     * (and therefore buffer partition) without looking up the category
+     * string for every event. Only used by the callers which don't pass
+     * the category status (see logEvent()).
+     */
+    std::array<TracepointGroup, 1024> tracepoint_groups;
 };
 } // namespace phosphor
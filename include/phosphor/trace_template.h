@@ -0,0 +1,343 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "category_filter.h"
+#include "platform/core.h"
+#include "scoped_event_guard.h"
+#include "trace_argument.h"
+#include "trace_log.h"
+#include "tracepoint_info.h"
+
+/** \file
+ * Template trace API
+ *
+ * An alternative to the TRACE_INSTANT / TRACE_EVENT macros which takes
+ * the category, name and argument names as template arguments, so that
+ * the tracepoint_info of each trace point is generated at compile time
+ * from the types of its arguments:
+ *
+ *     phosphor::trace<"memcached", "accept", "fd">(fd);
+ *
+ *     auto guard = phosphor::traceScope<"ep-engine", "flush">();
+ *
+ * String literals can only be template arguments from C++20 (see
+ * PHOSPHOR_HAVE_STRING_TEMPLATE_ARGS), in C++17 the strings must be
+ * constexpr char arrays with static storage duration:
+ *
+ *     static constexpr char category[] = "memcached";
+ *     static constexpr char name[] = "accept";
+ *     static constexpr char fd_name[] = "fd";
+ *     phosphor::trace<category, name, fd_name>(fd);
+ *
+ * Each argument is stored in the cheapest encoding for its type (enums
+ * as their underlying integer, string literals as a pointer), and
+ * strings which may not outlive the trace (std::string, std::string_view,
+ * char* and mutable char arrays) are rejected at compile time in favour
+ * of PHOSPHOR_INLINE_STR / PHOSPHOR_INTERNED_STR. Only the pointer of a
+ * const char* or const char array is stored, which can't be told apart
+ * from a string literal at compile time: passing std::string::c_str() or
+ * a const array on the stack compiles but leaves a dangling pointer in
+ * the buffer, so such strings must also use PHOSPHOR_INLINE_STR /
+ * PHOSPHOR_INTERNED_STR.
+ *
+ * Like the macros an event holds at most two arguments, and while a
+ * category is disabled a trace point costs a load of its category status
+ * and a branch. Unlike the macros the arguments are evaluated by the
+ * caller before the template is entered, so they are evaluated even when
+ * the category is disabled or compiled out (or PHOSPHOR_DISABLED is set);
+ * an expensive argument should be computed behind a check of the
+ * category or traced with the macros.
+ *
+ * The templates honour PHOSPHOR_DISABLED and PHOSPHOR_COMPILED_CATEGORIES,
+ * which should therefore be the same in every translation unit of the
+ * program.
+ */
+
+#if defined(__cpp_nontype_template_args) && \
+        __cpp_nontype_template_args >= 201911L
+/**
+ * Defined to 1 if string literals can be given as the strings of the
+ * template trace API
+ */
+#define PHOSPHOR_HAVE_STRING_TEMPLATE_ARGS 1
+#else
+#define PHOSPHOR_HAVE_STRING_TEMPLATE_ARGS 0
+#endif
+
+namespace phosphor {
+
+#if PHOSPHOR_HAVE_STRING_TEMPLATE_ARGS
+/**
+ * A string literal which can be used as a template argument
+ */
+template <size_t N>
+struct fixed_string {
+    constexpr fixed_string(const char (&str)[N]) {
+        for (size_t i = 0; i < N; ++i) {
+            data[i] = str[i];
+        }
+    }
+
+    char data[N];
+};
+
+#define PHOSPHOR_INTERNAL_TEMPLATE_STRING phosphor::fixed_string
+#else
+#define PHOSPHOR_INTERNAL_TEMPLATE_STRING const char*
+#endif
+
+#if PHOSPHOR_DISABLED
+#define PHOSPHOR_INTERNAL_TEMPLATE_COMPILED(category) false
+#else
+#define PHOSPHOR_INTERNAL_TEMPLATE_COMPILED(category) \
+    PHOSPHOR_CATEGORY_COMPILED(category)
+#endif
+
+namespace detail {
+
+constexpr const char* stringData(const char* str) {
+    return str;
+}
+
+#if PHOSPHOR_HAVE_STRING_TEMPLATE_ARGS
+template <size_t N>
+constexpr const char* stringData(const fixed_string<N>& str) {
+    return str.data;
+}
+#endif
+
+/**
+ * A string given as a template argument, as a type
+ */
+template <PHOSPHOR_INTERNAL_TEMPLATE_STRING Str>
+struct StringConstant {
+    static constexpr const char* value = stringData(Str);
+};
+
+/**
+ * The name of an absent argument
+ */
+struct EmptyString {
+    static constexpr const char* value = "";
+};
+
+template <size_t I, typename... Ts>
+using Nth = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+/**
+ * Maps the type of an argument to the type it is stored as
+ */
+template <typename T, typename = void>
+struct StoredArgument {
+    using type = T;
+};
+
+template <typename T>
+struct StoredArgument<T, std::enable_if_t<std::is_enum_v<T>>> {
+    using type = std::underlying_type_t<T>;
+};
+
+template <typename T>
+using Stored = typename StoredArgument<std::decay_t<T>>::type;
+
+template <typename T>
+constexpr void checkArgument() {
+    using Arg = std::remove_reference_t<T>;
+    static_assert(!std::is_same_v<std::decay_t<T>, std::string> &&
+                          !std::is_same_v<std::decay_t<T>, std::string_view>,
+                  "phosphor::trace: strings must outlive the trace, use "
+                  "PHOSPHOR_INLINE_STR or PHOSPHOR_INTERNED_STR for "
+                  "dynamic strings");
+    static_assert(!std::is_array_v<Arg> ||
+                          std::is_const_v<std::remove_extent_t<Arg>>,
+                  "phosphor::trace: a mutable char array may be modified "
+                  "before the trace is exported, use PHOSPHOR_INLINE_STR "
+                  "or PHOSPHOR_INTERNED_STR");
+    static_assert(std::is_array_v<Arg> ||
+                          !std::is_same_v<std::decay_t<T>, char*>,
+                  "phosphor::trace: a char* may be modified or freed "
+                  "before the trace is exported, use PHOSPHOR_INLINE_STR "
+                  "or PHOSPHOR_INTERNED_STR");
+}
+
+/**
+ * The static tracepoint_info and category status shared by every trace
+ * point of the given strings, event type and argument types
+ */
+template <typename Category,
+          typename Name,
+          TraceEventType Type,
+          typename NameA,
+          typename NameB,
+          typename A,
+          typename B>
+struct Tracepoint {
+    static constexpr tracepoint_info tpi = {
+            Category::value,
+            Name::value,
+            Type,
+            {{NameA::value, NameB::value}},
+            {{TraceArgumentConversion<A>::getType(),
+              TraceArgumentConversion<B>::getType()}}};
+
+    static const AtomicCategoryStatus& getCategoryStatus() {
+        auto* status = category_enabled.load(std::memory_order_acquire);
+        if (unlikely(!status)) {
+            status = &TraceLog::getInstance().getCategoryStatus(
+                    Category::value);
+            category_enabled.store(status, std::memory_order_release);
+        }
+        return *status;
+    }
+
+    static inline std::atomic<const AtomicCategoryStatus*> category_enabled{
+            nullptr};
+};
+
+template <typename Category,
+          typename Name,
+          TraceEventType Type,
+          typename ArgNames,
+          typename Args>
+struct TracepointFor;
+
+template <typename Category,
+          typename Name,
+          TraceEventType Type,
+          typename... ArgNames,
+          typename... Args>
+struct TracepointFor<Category,
+                     Name,
+                     Type,
+                     std::tuple<ArgNames...>,
+                     std::tuple<Args...>> {
+    static_assert(sizeof...(Args) <= 2,
+                  "phosphor::trace: an event holds at most two arguments");
+    static_assert(sizeof...(ArgNames) == sizeof...(Args),
+                  "phosphor::trace: each argument must be given a name");
+
+    using type = Tracepoint<Category,
+                            Name,
+                            Type,
+                            Nth<0, ArgNames..., EmptyString, EmptyString>,
+                            Nth<1, ArgNames..., EmptyString, EmptyString>,
+                            Nth<0, Stored<Args>..., NoneType, NoneType>,
+                            Nth<1, Stored<Args>..., NoneType, NoneType>>;
+};
+
+/**
+ * @return The I'th argument in its stored type, or NoneType if there are
+ *         fewer arguments
+ */
+template <size_t I, typename... Args>
+constexpr auto storedArgument(Args&&... args) {
+    if constexpr (I < sizeof...(Args)) {
+        return static_cast<Stored<Nth<I, Args...>>>(
+                std::get<I>(std::forward_as_tuple(args...)));
+    } else {
+        return NoneType();
+    }
+}
+
+template <size_t I, typename... Args>
+constexpr TraceArgument traceArgument(Args&&... args) {
+    auto arg = storedArgument<I>(args...);
+    return TraceArgumentConversion<decltype(arg)>::asArgument(arg);
+}
+
+} // namespace detail
+
+/**
+ * Logs an Instant event
+ *
+ * The arguments are evaluated even if the category is disabled or
+ * compiled out.
+ *
+ * @tparam Category Category of the event
+ * @tparam Name Name of the event
+ * @tparam ArgNames Name of each argument
+ * @param args Up to two arguments to be saved with the event
+ */
+template <PHOSPHOR_INTERNAL_TEMPLATE_STRING Category,
+          PHOSPHOR_INTERNAL_TEMPLATE_STRING Name,
+          PHOSPHOR_INTERNAL_TEMPLATE_STRING... ArgNames,
+          typename... Args>
+inline void trace(Args&&... args) {
+    (detail::checkArgument<Args>(), ...);
+    using Point = typename detail::TracepointFor<
+            detail::StringConstant<Category>,
+            detail::StringConstant<Name>,
+            TraceEventType::Instant,
+            std::tuple<detail::StringConstant<ArgNames>...>,
+            std::tuple<Args...>>::type;
+    if constexpr (PHOSPHOR_INTERNAL_TEMPLATE_COMPILED(Point::tpi.category)) {
+        const auto& status = Point::getCategoryStatus();
+        if (status.load(std::memory_order_acquire) !=
+            CategoryStatus::Disabled) {
+            TraceLog::getInstance().logEvent(
+                    &Point::tpi,
+                    status,
+                    detail::traceArgument<0>(args...),
+                    detail::traceArgument<1>(args...));
+        }
+    }
+}
+
+/**
+ * Starts a scoped event, which is logged as a Complete event when the
+ * returned guard is destroyed
+ *
+ * The arguments are evaluated even if the category is disabled or
+ * compiled out.
+ *
+ * @tparam Category Category of the event
+ * @tparam Name Name of the event
+ * @tparam ArgNames Name of each argument
+ * @param args Up to two arguments to be saved with the event
+ * @return Guard for the scope (NoneType if the category is compiled out)
+ */
+template <PHOSPHOR_INTERNAL_TEMPLATE_STRING Category,
+          PHOSPHOR_INTERNAL_TEMPLATE_STRING Name,
+          PHOSPHOR_INTERNAL_TEMPLATE_STRING... ArgNames,
+          typename... Args>
+[[nodiscard]] inline auto traceScope(Args&&... args) {
+    (detail::checkArgument<Args>(), ...);
+    using Point = typename detail::TracepointFor<
+            detail::StringConstant<Category>,
+            detail::StringConstant<Name>,
+            TraceEventType::Complete,
+            std::tuple<detail::StringConstant<ArgNames>...>,
+            std::tuple<Args...>>::type;
+    if constexpr (PHOSPHOR_INTERNAL_TEMPLATE_COMPILED(Point::tpi.category)) {
+        auto argA = detail::storedArgument<0>(args...);
+        auto argB = detail::storedArgument<1>(args...);
+        return ScopedEventGuard<decltype(argA), decltype(argB)>(
+                &Point::tpi,
+                Point::getCategoryStatus(),
+                std::chrono::steady_clock::duration::zero(),
+                argA,
+                argB);
+    } else {
+        return NoneType();
+    }
+}
+
+} // namespace phosphor
@@ -31,7 +31,11 @@ enum class TraceArgumentType : char {
     is_pointer,
     is_string,
     is_istring,
-    is_none
+    is_interned,
+    is_none,
+    // After is_none so that the values of the other types (recorded in
+    // binary dumps and shared memory buffers) are unchanged
+    is_stack
 };
 
 /**
@@ -44,7 +48,9 @@ enum class TraceEventType : char {
     SyncEnd,
     Instant,
     GlobalInstant,
-    Complete
+    Complete,
+    // A sample of the thread's stack (see TraceConfig::setSampleInterval)
+    Sample
 };
 
 /**
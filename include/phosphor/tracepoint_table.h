@@ -0,0 +1,98 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+/** \file
+ * This file is internal to the inner workings of
+ * Phosphor and is not intended for public consumption.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "intern_index.h"
+#include "tracepoint_info.h"
+
+namespace phosphor {
+
+// Forward declare
+class StatsCallback;
+
+/**
+ * TracepointTable assigns each tracepoint a 32-bit index so that events
+ * in the compact format (see EventFormat) can refer to their tracepoint
+ * in half the space of a pointer.
+ *
+ * Tracepoints are never removed from the table, once the table is full
+ * any further tracepoints are given `npos` and resolve to a placeholder
+ * tracepoint.
+ *
+ * Lookups are lock-free, adding a new tracepoint takes a lock.
+ */
+class TracepointTable {
+public:
+    /**
+     * Maximum number of tracepoints that the table can hold
+     */
+    static constexpr size_t table_size = 4096;
+
+    /**
+     * Index of tracepoints which couldn't be added to the table
+     */
+    static constexpr uint32_t npos = InternIndex::npos;
+
+    TracepointTable();
+
+    TracepointTable(const TracepointTable&) = delete;
+    TracepointTable& operator=(const TracepointTable&) = delete;
+
+    /**
+     * @return The process-wide table used by the compact event format
+     */
+    static TracepointTable& getInstance();
+
+    /**
+     * Find the index of a tracepoint, adding it if it isn't already in
+     * the table
+     *
+     * @param tpi The tracepoint to find
+     * @return Index of the tracepoint or npos if the table is full
+     */
+    uint32_t indexOf(const tracepoint_info* tpi);
+
+    /**
+     * @param index An index previously returned by indexOf()
+     * @return The tracepoint at the index, or a placeholder tracepoint
+     *         if the index is not in the table
+     */
+    const tracepoint_info* lookup(uint32_t index) const;
+
+    /**
+     * @return Number of tracepoints in the table
+     */
+    size_t size() const {
+        return intern_index.size();
+    }
+
+    /**
+     * Invokes methods on the callback to supply various
+     * stats about the tracepoint table.
+     */
+    void getStats(StatsCallback& addStats) const;
+
+protected:
+    InternIndex intern_index;
+
+    // Tracepoints by index, published by the index
+    std::array<const tracepoint_info*, table_size> tracepoints;
+};
+
+} // namespace phosphor
@@ -21,10 +21,20 @@ namespace phosphor {
 
 CategoryRegistry::CategoryRegistry()
     : groups({{"default", "category limit reached", "__metadata"}}),
+      has_thresholds(false),
       group_count(index_non_default_categories) {
     for (auto& status : group_statuses) {
         status.store(CategoryStatus::Disabled, std::memory_order_relaxed);
     }
+    for (auto& threshold : group_thresholds) {
+        threshold.store(0, std::memory_order_relaxed);
+    }
+    for (auto& partition : group_partitions) {
+        partition.store(0, std::memory_order_relaxed);
+    }
+    for (auto& counted : group_counted) {
+        counted.store(false, std::memory_order_relaxed);
+    }
 }
 
 const AtomicCategoryStatus& CategoryRegistry::getStatus(
@@ -50,6 +60,19 @@ const AtomicCategoryStatus& CategoryRegistry::getStatus(
     // Otherwise add it to the array
     if (currIndex < registry_size) {
         groups[currIndex] = category_group;
+        group_partitions[currIndex].store(
+                uint8_t(calculatePartition(category_group,
+                                           partition_categories)),
+                std::memory_order_relaxed);
+        group_counted[currIndex].store(
+                calculateEnabled(category_group, counted_categories, {}) ==
+                        CategoryStatus::Enabled,
+                std::memory_order_relaxed);
+        group_thresholds[currIndex].store(
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        calculateThreshold(currIndex))
+                        .count(),
+                std::memory_order_relaxed);
         group_statuses[currIndex] = calculateEnabled(currIndex);
         group_count.fetch_add(1, std::memory_order_release);
         return group_statuses[currIndex];
@@ -93,28 +116,159 @@ CategoryStatus CategoryRegistry::calculateEnabled(
     return CategoryStatus::Disabled;
 }
 
+std::chrono::nanoseconds CategoryRegistry::calculateThreshold(
+        const std::string& category_group,
+        const std::vector<std::string>& enabled,
+        const std::vector<std::string>& disabled,
+        const CategoryThresholds& thresholds) {
+    if (thresholds.empty()) {
+        return std::chrono::nanoseconds::zero();
+    }
+
+    bool found = false;
+    auto result = std::chrono::nanoseconds::max();
+    for (const auto& category : utils::split_string(category_group, ',')) {
+        // Only categories which are enabled contribute to the threshold
+        if (calculateEnabled(category, enabled, disabled) !=
+            CategoryStatus::Enabled) {
+            continue;
+        }
+
+        auto threshold = std::chrono::nanoseconds::zero();
+        const auto it = std::find_if(
+                thresholds.begin(),
+                thresholds.end(),
+                [&category](const CategoryThresholds::value_type& entry) {
+                    return utils::glob_match(entry.first, category);
+                });
+        if (it != thresholds.end()) {
+            threshold = it->second;
+        }
+        result = std::min(result, threshold);
+        found = true;
+    }
+
+    return found ? result : std::chrono::nanoseconds::zero();
+}
+
+size_t CategoryRegistry::calculatePartition(
+        const std::string& category_group,
+        const std::vector<std::vector<std::string>>& partitions) {
+    const auto categories = utils::split_string(category_group, ',');
+    for (size_t i = 0; i < partitions.size(); ++i) {
+        for (const auto& glob : partitions[i]) {
+            for (const auto& category : categories) {
+                if (utils::glob_match(glob, category)) {
+                    return i + 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void CategoryRegistry::updatePartitions(
+        const std::vector<std::vector<std::string>>& partitions) {
+    std::lock_guard<std::mutex> lh(mutex);
+    partition_categories = partitions;
+
+    // We're protected by the mutex so relaxed atomics are fine here
+    size_t currIndex = group_count.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < currIndex; ++i) {
+        group_partitions[i].store(
+                uint8_t(calculatePartition(groups[i], partition_categories)),
+                std::memory_order_relaxed);
+    }
+}
+
+void CategoryRegistry::updateCounted(
+        const std::vector<std::string>& categories) {
+    std::lock_guard<std::mutex> lh(mutex);
+    counted_categories = categories;
+
+    // We're protected by the mutex so relaxed atomics are fine here
+    size_t currIndex = group_count.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < currIndex; ++i) {
+        group_counted[i].store(
+                calculateEnabled(groups[i], counted_categories, {}) ==
+                        CategoryStatus::Enabled,
+                std::memory_order_relaxed);
+    }
+}
+
 CategoryStatus CategoryRegistry::calculateEnabled(size_t index) {
-    return this->calculateEnabled(
-            groups[index], enabled_categories, disabled_categories);
+    unsigned int mask = 0;
+    for (size_t session = 0; session < max_trace_sessions; ++session) {
+        const auto& categories = session_categories[session];
+        if (calculateEnabled(groups[index],
+                             categories.enabled,
+                             categories.disabled) == CategoryStatus::Enabled) {
+            mask |= 1u << session;
+        }
+    }
+    return CategoryStatus(mask);
+}
+
+std::chrono::nanoseconds CategoryRegistry::calculateThreshold(size_t index) {
+    return this->calculateThreshold(groups[index],
+                                    session_categories[0].enabled,
+                                    session_categories[0].disabled,
+                                    category_thresholds);
 }
 
 void CategoryRegistry::updateEnabled(const std::vector<std::string>& enabled,
-                                     const std::vector<std::string>& disabled) {
+                                     const std::vector<std::string>& disabled,
+                                     const CategoryThresholds& thresholds) {
     std::lock_guard<std::mutex> lh(mutex);
-    enabled_categories = enabled;
-    disabled_categories = disabled;
+    session_categories[0] = {enabled, disabled};
+    category_thresholds = thresholds;
+    has_thresholds.store(!thresholds.empty(), std::memory_order_relaxed);
 
     // We're protected by the mutex so relaxed atomics are fine here
     size_t currIndex = group_count.load(std::memory_order_relaxed);
     for (size_t i = 0; i < currIndex; ++i) {
+        group_thresholds[i].store(
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        calculateThreshold(i))
+                        .count(),
+                std::memory_order_relaxed);
         group_statuses[i].store(calculateEnabled(i), std::memory_order_relaxed);
     }
 }
 
+void CategoryRegistry::updateSessionEnabled(
+        size_t session,
+        const std::vector<std::string>& enabled,
+        const std::vector<std::string>& disabled) {
+    std::lock_guard<std::mutex> lh(mutex);
+    session_categories.at(session) = {enabled, disabled};
+
+    // We're protected by the mutex so relaxed atomics are fine here
+    size_t currIndex = group_count.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < currIndex; ++i) {
+        group_statuses[i].store(calculateEnabled(i), std::memory_order_relaxed);
+    }
+}
+
+void CategoryRegistry::disableSession(size_t session) {
+    std::lock_guard<std::mutex> lh(mutex);
+    session_categories.at(session) = SessionCategories();
+
+    // Only the session's bit changes so the other sessions' statuses
+    // are left as they are
+    const auto bit = char(1u << session);
+    size_t currIndex = group_count.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < currIndex; ++i) {
+        const auto status =
+                char(group_statuses[i].load(std::memory_order_relaxed));
+        group_statuses[i].store(CategoryStatus(status & ~bit),
+                                std::memory_order_relaxed);
+    }
+}
+
 void CategoryRegistry::disableAll() {
     std::lock_guard<std::mutex> lh(mutex);
-    enabled_categories = {{}};
-    disabled_categories = {{}};
+    session_categories.fill(SessionCategories());
 
     // We're protected by the mutex so relaxed atomics are fine here
     size_t currIndex = group_count.load(std::memory_order_relaxed);
@@ -124,6 +278,21 @@ void CategoryRegistry::disableAll() {
     }
 }
 
+uint64_t CategoryRegistry::getGroupMask(
+        const std::vector<std::string>& categories) const {
+    // Groups past the registry limit share the last index and may
+    // contain any category
+    uint64_t mask = uint64_t(1) << (index_category_limit % 64);
+    const auto count = group_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (calculateEnabled(groups[i], categories, {}) ==
+            CategoryStatus::Enabled) {
+            mask |= uint64_t(1) << (i % 64);
+        }
+    }
+    return mask;
+}
+
 void CategoryRegistry::getStats(StatsCallback& addStats) const {
     std::lock_guard<std::mutex> lh(mutex);
     addStats("registry_group_count",
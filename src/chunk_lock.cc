@@ -44,6 +44,11 @@ bool ChunkLock::tryLockSlave() {
     return true;
 }
 
+bool ChunkLock::tryLockSlaveOnce() {
+    auto expected = State::Unlocked;
+    return state.compare_exchange_strong(expected, State::SlaveLocked);
+}
+
 void ChunkLock::unlockSlave() {
 #ifdef NDEBUG
     state.store(State::Unlocked, std::memory_order_release);
@@ -104,6 +109,16 @@ void MasterChunkLock::unlock() {
 }
 
 ChunkTenant::ChunkTenant(non_trivial_constructor_t)
-    : lck(non_trivial_constructor), chunk(nullptr), initialised(true) {
+    : lck(non_trivial_constructor),
+      chunk(nullptr),
+      partition_chunks(),
+      spare_chunks(),
+      retired_chunks(),
+      spare_wanted(),
+      thread_id(0),
+      session_chunks(),
+      staging(nullptr),
+      deferred_depth(0),
+      initialised(true) {
 }
 } // namespace phosphor
@@ -0,0 +1,252 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "phosphor/lock_profiler.h"
+
+namespace phosphor {
+
+std::atomic<bool> lock_profiler_enabled{false};
+
+namespace {
+
+size_t histogramBucket(uint64_t ns) {
+    size_t bucket = 0;
+    while (ns != 0 && bucket < (LockProfiler::histogram_buckets - 1)) {
+        ns >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void addDuration(LockProfiler::Histogram& histogram,
+                 uint64_t& total,
+                 uint64_t& max,
+                 uint64_t ns) {
+    ++histogram[histogramBucket(ns)];
+    total += ns;
+    max = std::max(max, ns);
+}
+
+uint64_t toNanos(std::chrono::steady_clock::duration duration) {
+    const auto ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+                    .count();
+    return ns < 0 ? 0 : uint64_t(ns);
+}
+
+} // anonymous namespace
+
+/**
+ * Per-thread table of lock statistics
+ *
+ * The mutex is only contended when the table is being merged into a
+ * report or reset, so it costs an uncontended lock / unlock on the
+ * recording path.
+ */
+class LockProfiler::ThreadTable {
+public:
+    LockStats& get(const void* mutex, const tracepoint_info* tpi) {
+        auto& stats = locks[mutex];
+        if (!stats.mutex) {
+            stats.mutex = mutex;
+            stats.tpi = tpi;
+        }
+        return stats;
+    }
+
+    void mergeInto(std::unordered_map<const void*, LockStats>& result) const {
+        for (const auto& entry : locks) {
+            auto& stats = result[entry.first];
+            if (!stats.mutex) {
+                stats.mutex = entry.second.mutex;
+                stats.tpi = entry.second.tpi;
+            }
+            stats.merge(entry.second);
+        }
+    }
+
+    std::mutex mutex;
+    std::unordered_map<const void*, LockStats> locks;
+};
+
+/**
+ * Owner of the calling thread's table, which folds the table into the
+ * statistics of retired threads when the thread exits.
+ */
+struct ThreadTableHolder {
+    ~ThreadTableHolder() {
+        if (table) {
+            LockProfiler::getInstance().retire(*table);
+        }
+    }
+
+    std::unique_ptr<LockProfiler::ThreadTable> table;
+};
+
+namespace {
+thread_local ThreadTableHolder thread_table;
+} // anonymous namespace
+
+void LockProfiler::LockStats::merge(const LockStats& other) {
+    acquisitions += other.acquisitions;
+    shared_acquisitions += other.shared_acquisitions;
+    try_lock_failures += other.try_lock_failures;
+    total_wait_ns += other.total_wait_ns;
+    max_wait_ns = std::max(max_wait_ns, other.max_wait_ns);
+    total_held_ns += other.total_held_ns;
+    max_held_ns = std::max(max_held_ns, other.max_held_ns);
+    for (size_t i = 0; i < histogram_buckets; ++i) {
+        wait_histogram[i] += other.wait_histogram[i];
+        held_histogram[i] += other.held_histogram[i];
+    }
+}
+
+uint64_t LockProfiler::LockStats::percentile(const Histogram& histogram,
+                                             double percentile) {
+    uint64_t total = 0;
+    for (const auto count : histogram) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    const auto target = std::max(uint64_t(1),
+                                 uint64_t((percentile / 100.0) * total + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram_buckets; ++i) {
+        seen += histogram[i];
+        if (seen >= target) {
+            return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+        }
+    }
+    return (uint64_t(1) << (histogram_buckets - 1)) - 1;
+}
+
+LockProfiler::LockProfiler() : retired(std::make_unique<ThreadTable>()) {
+}
+
+LockProfiler::~LockProfiler() = default;
+
+LockProfiler& LockProfiler::getInstance() {
+    static LockProfiler profiler;
+    return profiler;
+}
+
+void LockProfiler::enable() {
+    lock_profiler_enabled.store(true, std::memory_order_relaxed);
+}
+
+void LockProfiler::disable() {
+    lock_profiler_enabled.store(false, std::memory_order_relaxed);
+}
+
+LockProfiler::ThreadTable& LockProfiler::getThreadTable() {
+    if (!thread_table.table) {
+        thread_table.table = std::make_unique<ThreadTable>();
+        std::lock_guard<std::mutex> lh(mutex);
+        tables.insert(thread_table.table.get());
+    }
+    return *thread_table.table;
+}
+
+void LockProfiler::retire(ThreadTable& table) {
+    std::lock_guard<std::mutex> lh(mutex);
+    tables.erase(&table);
+
+    std::unordered_map<const void*, LockStats> merged;
+    {
+        std::lock_guard<std::mutex> tlh(table.mutex);
+        table.mergeInto(merged);
+    }
+    std::lock_guard<std::mutex> rlh(retired->mutex);
+    for (const auto& entry : merged) {
+        retired->get(entry.first, entry.second.tpi).merge(entry.second);
+    }
+}
+
+void LockProfiler::record(const void* mutex,
+                          const tracepoint_info* tpi,
+                          LockMode mode,
+                          std::chrono::steady_clock::duration wait,
+                          std::chrono::steady_clock::duration held) {
+    auto& table = getThreadTable();
+    std::lock_guard<std::mutex> lh(table.mutex);
+    auto& stats = table.get(mutex, tpi);
+    if (mode == LockMode::shared) {
+        ++stats.shared_acquisitions;
+    } else {
+        ++stats.acquisitions;
+    }
+    addDuration(stats.wait_histogram,
+                stats.total_wait_ns,
+                stats.max_wait_ns,
+                toNanos(wait));
+    addDuration(stats.held_histogram,
+                stats.total_held_ns,
+                stats.max_held_ns,
+                toNanos(held));
+}
+
+void LockProfiler::recordTryLockFailure(const void* mutex,
+                                        const tracepoint_info* tpi) {
+    auto& table = getThreadTable();
+    std::lock_guard<std::mutex> lh(table.mutex);
+    ++table.get(mutex, tpi).try_lock_failures;
+}
+
+std::vector<LockProfiler::LockStats> LockProfiler::getReport(
+        size_t limit) const {
+    std::unordered_map<const void*, LockStats> merged;
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        for (auto* table : tables) {
+            std::lock_guard<std::mutex> tlh(table->mutex);
+            table->mergeInto(merged);
+        }
+        std::lock_guard<std::mutex> rlh(retired->mutex);
+        retired->mergeInto(merged);
+    }
+
+    std::vector<LockStats> report;
+    report.reserve(merged.size());
+    for (auto& entry : merged) {
+        report.push_back(entry.second);
+    }
+    std::sort(report.begin(),
+              report.end(),
+              [](const LockStats& a, const LockStats& b) {
+                  if (a.total_wait_ns != b.total_wait_ns) {
+                      return a.total_wait_ns > b.total_wait_ns;
+                  }
+                  return (a.acquisitions + a.shared_acquisitions) >
+                         (b.acquisitions + b.shared_acquisitions);
+              });
+    if (limit != 0 && report.size() > limit) {
+        report.resize(limit);
+    }
+    return report;
+}
+
+void LockProfiler::reset() {
+    std::lock_guard<std::mutex> lh(mutex);
+    for (auto* table : tables) {
+        std::lock_guard<std::mutex> tlh(table->mutex);
+        table->locks.clear();
+    }
+    std::lock_guard<std::mutex> rlh(retired->mutex);
+    retired->locks.clear();
+}
+
+} // namespace phosphor
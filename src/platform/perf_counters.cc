@@ -0,0 +1,215 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "phosphor/platform/perf_counters.h"
+
+namespace phosphor::platform {
+
+#if defined(__linux__)
+namespace {
+
+struct PerfCounterConfig {
+    uint32_t type;
+    uint64_t config;
+};
+
+const std::array<PerfCounterConfig, max_perf_counters> hardware_counters = {
+        {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+         {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+         // Generic cache misses are the last level cache on most CPUs
+         {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}}};
+
+const std::array<PerfCounterConfig, 2> software_counters = {
+        {{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+         {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}}};
+
+int openCounter(const PerfCounterConfig& counter,
+                bool exclude_kernel,
+                int group_fd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter.type;
+    attr.config = counter.config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    // Count the calling thread on any CPU
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+#if defined(__x86_64__)
+uint64_t rdpmc(uint32_t counter) {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+    return (uint64_t(high) << 32) | low;
+}
+#endif
+
+} // namespace
+#endif
+
+PerfCounters::PerfCounters() {
+    fds.fill(-1);
+    pages.fill(nullptr);
+    // Prefer the hardware counters, these aren't available in most VMs
+    if (!open(PerfCounterSet::hardware)) {
+        open(PerfCounterSet::software);
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    close();
+}
+
+PerfCounters& PerfCounters::getThreadInstance() {
+    static thread_local PerfCounters counters;
+    return counters;
+}
+
+bool PerfCounters::open(PerfCounterSet counters) {
+#if defined(__linux__)
+    const PerfCounterConfig* configs = hardware_counters.data();
+    size_t size = hardware_counters.size();
+    if (counters == PerfCounterSet::software) {
+        configs = software_counters.data();
+        size = software_counters.size();
+    }
+
+    // Kernel counting may be forbidden by perf_event_paranoid
+    for (const bool exclude_kernel : {false, true}) {
+        for (count = 0; count < size; ++count) {
+            fds[count] = openCounter(
+                    configs[count], exclude_kernel, count ? fds[0] : -1);
+            if (fds[count] < 0) {
+                break;
+            }
+        }
+        if (count == size) {
+            break;
+        }
+        close();
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    set = counters;
+#if defined(__x86_64__)
+    if (set == PerfCounterSet::hardware) {
+        const auto page_size = size_t(sysconf(_SC_PAGESIZE));
+        for (size_t i = 0; i < count; ++i) {
+            auto* page = mmap(
+                    nullptr, page_size, PROT_READ, MAP_SHARED, fds[i], 0);
+            pages[i] = page == MAP_FAILED ? nullptr : page;
+        }
+    }
+#endif
+    return true;
+#else
+    (void)counters;
+    return false;
+#endif
+}
+
+void PerfCounters::close() {
+#if defined(__linux__)
+    const auto page_size = size_t(sysconf(_SC_PAGESIZE));
+    for (size_t i = 0; i < max_perf_counters; ++i) {
+        if (pages[i]) {
+            munmap(pages[i], page_size);
+            pages[i] = nullptr;
+        }
+        // Close the group leader last
+        const auto index = max_perf_counters - 1 - i;
+        if (fds[index] >= 0) {
+            ::close(fds[index]);
+            fds[index] = -1;
+        }
+    }
+#endif
+    set = PerfCounterSet::none;
+    count = 0;
+}
+
+bool PerfCounters::readUserspace(size_t index, uint64_t& value) const {
+#if defined(__linux__) && defined(__x86_64__)
+    const auto* page = static_cast<const volatile perf_event_mmap_page*>(
+            pages[index]);
+    if (!page) {
+        return false;
+    }
+    // The kernel updates the page under a sequence lock
+    uint32_t seq;
+    do {
+        seq = page->lock;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        const auto hw_index = page->index;
+        if (!page->cap_user_rdpmc || hw_index == 0) {
+            return false;
+        }
+        const auto width = page->pmc_width;
+        // Sign extend the pmc_width bits of the hardware counter
+        const auto pmc = int64_t(rdpmc(hw_index - 1) << (64 - width)) >>
+                         (64 - width);
+        value = uint64_t(page->offset + pmc);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    } while (page->lock != seq);
+    return true;
+#else
+    (void)index;
+    (void)value;
+    return false;
+#endif
+}
+
+bool PerfCounters::read(PerfCounterValues& values) {
+#if defined(__linux__)
+    if (set == PerfCounterSet::none) {
+        return false;
+    }
+    if (set == PerfCounterSet::hardware) {
+        size_t i = 0;
+        while (i < count && readUserspace(i, values[i])) {
+            ++i;
+        }
+        if (i == count) {
+            return true;
+        }
+    }
+
+    // Group read format: the number of counters, then their values
+    std::array<uint64_t, max_perf_counters + 1> data;
+    const auto size = sizeof(uint64_t) * (count + 1);
+    if (::read(fds[0], data.data(), size) != ssize_t(size)) {
+        return false;
+    }
+    std::copy(data.begin() + 1, data.begin() + 1 + count, values.begin());
+    return true;
+#else
+    (void)values;
+    return false;
+#endif
+}
+
+} // namespace phosphor::platform
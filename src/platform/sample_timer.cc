@@ -0,0 +1,178 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <signal.h>
+#include <ucontext.h>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#include "phosphor/platform/sample_timer.h"
+#include "phosphor/platform/thread.h"
+
+// Older glibc versions don't name the thread id member of sigevent
+#if defined(__linux__) && !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace phosphor::platform {
+
+#if defined(__linux__)
+namespace {
+
+std::atomic<SampleTimer::Handler> sample_handler{nullptr};
+
+// Guards the install count and the saved handler. Once installed the
+// signal handler is never removed (see SampleTimer::uninstall()).
+std::mutex install_mutex;
+size_t install_count = 0;
+struct sigaction previous_action;
+
+const void* interruptedPC(void* ucontext) {
+    const auto* uc = static_cast<const ucontext_t*>(ucontext);
+#if defined(__x86_64__)
+    return reinterpret_cast<const void*>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+    return reinterpret_cast<const void*>(uc->uc_mcontext.pc);
+#else
+    (void)uc;
+    return nullptr;
+#endif
+}
+
+void handleSampleSignal(int signo, siginfo_t* info, void* ucontext) {
+    if (info->si_code != SI_TIMER) {
+        // Pass on SIGPROF which wasn't sent by a timer (e.g. by
+        // setitimer()) to the handler we replaced
+        if (previous_action.sa_flags & SA_SIGINFO) {
+            previous_action.sa_sigaction(signo, info, ucontext);
+        } else if (previous_action.sa_handler != SIG_DFL &&
+                   previous_action.sa_handler != SIG_IGN) {
+            previous_action.sa_handler(signo);
+        }
+        return;
+    }
+    auto* handler = sample_handler.load(std::memory_order_acquire);
+    if (handler) {
+        const auto saved_errno = errno;
+        handler(info->si_value.sival_ptr, interruptedPC(ucontext));
+        errno = saved_errno;
+    }
+}
+
+} // namespace
+#endif
+
+SampleTimer::Thread SampleTimer::Thread::current() {
+    Thread thread;
+#if defined(__linux__)
+    thread.tid = int(getCurrentThreadID());
+    if (pthread_getcpuclockid(pthread_self(), &thread.cpu_clock) != 0) {
+        // The thread can't be sampled
+        thread.tid = 0;
+    }
+#endif
+    return thread;
+}
+
+SampleTimer::SampleTimer(const Thread& thread, void* context) {
+#if defined(__linux__)
+    if (thread.tid == 0) {
+        return;
+    }
+    sigevent event;
+    std::memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_value.sival_ptr = context;
+    event.sigev_notify_thread_id = thread.tid;
+    valid = timer_create(thread.cpu_clock, &event, &timer) == 0;
+#else
+    (void)thread;
+    (void)context;
+#endif
+}
+
+SampleTimer::~SampleTimer() {
+#if defined(__linux__)
+    if (valid) {
+        timer_delete(timer);
+    }
+#endif
+}
+
+bool SampleTimer::install(Handler handler) {
+#if defined(__linux__)
+    std::lock_guard<std::mutex> lh(install_mutex);
+    if (install_count == 0) {
+        struct sigaction current;
+        if (sigaction(SIGPROF, nullptr, &current) != 0) {
+            return false;
+        }
+        // The handler is still installed if the process hasn't replaced
+        // it since sampling last stopped, keep the handler saved then
+        if (!(current.sa_flags & SA_SIGINFO) ||
+            current.sa_sigaction != handleSampleSignal) {
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_sigaction = handleSampleSignal;
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(SIGPROF, &action, &previous_action) != 0) {
+                return false;
+            }
+        }
+        sample_handler.store(handler, std::memory_order_release);
+    }
+    ++install_count;
+    return true;
+#else
+    (void)handler;
+    return false;
+#endif
+}
+
+void SampleTimer::uninstall() {
+#if defined(__linux__)
+    std::lock_guard<std::mutex> lh(install_mutex);
+    if (install_count != 0 && --install_count == 0) {
+        // Restoring the previous handler could let the signal of a
+        // deleted timer terminate the process, so just drop timer
+        // signals from now on
+        sample_handler.store(nullptr, std::memory_order_release);
+    }
+#endif
+}
+
+bool SampleTimer::arm(std::chrono::nanoseconds interval) {
+#if defined(__linux__)
+    if (!valid) {
+        return false;
+    }
+    const auto seconds =
+            std::chrono::duration_cast<std::chrono::seconds>(interval);
+    itimerspec spec;
+    spec.it_interval.tv_sec = time_t(seconds.count());
+    spec.it_interval.tv_nsec = long((interval - seconds).count());
+    spec.it_value = spec.it_interval;
+    return timer_settime(timer, 0, &spec, nullptr) == 0;
+#else
+    (void)interval;
+    return false;
+#endif
+}
+
+} // namespace phosphor::platform
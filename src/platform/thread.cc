@@ -14,8 +14,16 @@
 #include <unistd.h>
 #elif defined(__linux__)
 #include <linux/unistd.h>
+#include <sched.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+// glibc 2.35+ registers an rseq area for every thread
+#if __has_include(<sys/rseq.h>) && defined(__has_builtin)
+#if __has_builtin(__builtin_thread_pointer)
+#include <sys/rseq.h>
+#define PHOSPHOR_HAVE_RSEQ 1
+#endif
+#endif
 #elif defined(_WIN32)
 #include <process.h>
 #include <windows.h>
@@ -45,6 +53,30 @@ uint32_t getCurrentThreadID() {
     return tid;
 }
 
+int getCurrentCPU() {
+#if defined(PHOSPHOR_HAVE_RSEQ)
+    // __rseq_size is 0 if glibc didn't register the area (e.g. it was
+    // disabled by the glibc.pthread.rseq tunable)
+    if (__rseq_size != 0) {
+        const auto* area = reinterpret_cast<const struct rseq*>(
+                static_cast<const char*>(__builtin_thread_pointer()) +
+                __rseq_offset);
+        const auto cpu = int32_t(
+                __atomic_load_n(&area->cpu_id, __ATOMIC_RELAXED));
+        if (cpu >= 0) {
+            return cpu;
+        }
+    }
+#endif
+#if defined(__linux__)
+    return sched_getcpu();
+#elif defined(_WIN32)
+    return int(GetCurrentProcessorNumber());
+#else
+    return -1;
+#endif
+}
+
 int getCurrentProcessID() {
 #if defined(__APPLE__) || defined(__linux__) || defined(__FreeBSD__)
     return getpid();
@@ -0,0 +1,1023 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utils/memory.h"
+#include <phosphor/intern_index.h>
+#include <phosphor/platform/thread.h>
+#include <phosphor/shared_memory_buffer.h>
+#include <phosphor/stats_callback.h>
+
+namespace phosphor {
+
+namespace {
+
+// "PHOSPHOR" in ASCII
+constexpr uint64_t shm_magic = 0x50484f5350484f52;
+constexpr uint32_t shm_version = 3;
+
+// Maximum number of distinct tracepoints (across all processes) that
+// can be interned in a segment
+constexpr size_t shm_intern_capacity = 1024;
+// Interned strings longer than this (including terminator) are truncated
+constexpr size_t shm_intern_string_size = 64;
+constexpr uint32_t shm_invalid_id = std::numeric_limits<uint32_t>::max();
+// Maximum number of distinct tracepoints of this process whose ids a
+// segment caches, beyond which each publish interns them again
+constexpr size_t shm_cached_tracepoints = 4096;
+
+// Number of times to yield while waiting for another process to finish
+// interning a tracepoint before giving up on that entry (e.g. because
+// the other process died part way through).
+constexpr int shm_max_claim_spins = 1024;
+
+// How long an attaching process will wait for the creator of the
+// segment to finish initialising it.
+constexpr std::chrono::seconds shm_init_timeout{1};
+
+enum class ShmSlotState : uint32_t {
+    // Available to be loaned to a writer
+    free,
+    // On loan to a writer
+    writing,
+    // Returned by a writer and ready to be collected
+    published,
+    // Being decoded by a reader
+    reading
+};
+
+enum class ShmInternState : uint32_t { empty, claiming, ready };
+
+using ShmString = std::array<char, shm_intern_string_size>;
+
+/**
+ * Tracepoint info of a single process interned into the segment
+ */
+struct ShmTracepoint {
+    std::atomic<ShmInternState> state;
+    uint32_t process_id;
+    // Address of the tracepoint_info in the writing process, only
+    // used as a key and never dereferenced
+    uint64_t address;
+    TraceEventType type;
+    std::array<TraceArgumentType, arg_count> argument_types;
+    ShmString category;
+    ShmString name;
+    std::array<ShmString, arg_count> argument_names;
+};
+
+struct ShmHeader {
+    uint64_t magic;
+    // Stored last by the creator of the segment, zero until the
+    // remainder of the header is initialised.
+    std::atomic<uint32_t> version;
+    uint32_t chunk_bytes;
+    uint64_t slot_count;
+    // Hint of where to start looking for a free slot
+    std::atomic<uint64_t> cursor;
+    std::array<ShmTracepoint, shm_intern_capacity> tracepoints;
+};
+
+struct ShmSlot {
+    std::atomic<ShmSlotState> state;
+    // Process id of the writer while the slot is on loan, zero until the
+    // writer has recorded it and whenever the slot is free
+    std::atomic<uint32_t> owner;
+    // Interned tracepoint id of each event in the chunk
+    std::array<uint32_t, TraceChunk::max_chunk_size> tracepoint_ids;
+    TraceChunk chunk;
+};
+
+static_assert(std::atomic<ShmSlotState>::is_always_lock_free &&
+                      std::atomic<ShmInternState>::is_always_lock_free &&
+                      std::atomic<uint32_t>::is_always_lock_free &&
+                      std::atomic<uint64_t>::is_always_lock_free,
+              "Atomics shared between processes must be lock-free");
+
+void copyString(ShmString& dest, const char* src) {
+    dest.fill('\0');
+    if (src) {
+        std::strncpy(dest.data(), src, dest.size() - 1);
+    }
+}
+
+std::string toString(const ShmString& src) {
+    return {src.data(), strnlen(src.data(), src.size())};
+}
+
+uint64_t mixHash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+template <typename Predicate>
+void waitFor(Predicate pred, const char* what) {
+    const auto deadline = std::chrono::steady_clock::now() + shm_init_timeout;
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error(
+                    std::string("SharedMemorySegment: Timed out waiting for ") +
+                    what);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+} // namespace
+
+/**
+ * A mapping of a named shared memory segment which holds a
+ * ShmHeader followed by an array of ShmSlots.
+ */
+class SharedMemorySegment {
+public:
+    /**
+     * @param name Name of the segment
+     * @param create_slots Number of slots to create the segment with
+     *        if it doesn't exist, or zero to only attach to an existing
+     *        segment.
+     */
+    SharedMemorySegment(const std::string& name, size_t create_slots);
+
+    ~SharedMemorySegment();
+
+    SharedMemorySegment(const SharedMemorySegment&) = delete;
+    SharedMemorySegment& operator=(const SharedMemorySegment&) = delete;
+
+    ShmHeader& header() const {
+        return *static_cast<ShmHeader*>(base);
+    }
+
+    ShmSlot& slot(size_t index) const {
+        return reinterpret_cast<ShmSlot*>(&header() + 1)[index];
+    }
+
+    size_t size() const {
+        return header().slot_count;
+    }
+
+    size_t indexOf(const TraceChunk& chunk) const {
+        const auto* first = reinterpret_cast<const char*>(&slot(0).chunk);
+        return (reinterpret_cast<const char*>(&chunk) - first) /
+               sizeof(ShmSlot);
+    }
+
+    /**
+     * Claim a free slot to be written to
+     *
+     * @param max_probes Maximum number of slots to check
+     * @param process_id Process id of the writer, recorded as the owner
+     *        of the slot
+     * @return The index of the claimed slot or npos if there were
+     *         no free slots
+     */
+    size_t acquire(size_t max_probes, uint32_t process_id);
+
+    /**
+     * Intern the tracepoints of the events in a claimed slot and
+     * make the slot available to readers
+     *
+     * Each tracepoint is only interned into the segment the first time
+     * this segment publishes it, after which its id is taken from a
+     * cache local to the process.
+     *
+     * @return The number of events whose tracepoint could not be
+     *         interned (and so cannot be decoded)
+     */
+    size_t publish(size_t index, uint32_t process_id);
+
+    /**
+     * Free the slots left on loan to writers which have exited (e.g.
+     * crashed while holding a chunk)
+     *
+     * A slot is only reclaimed once its owner's process id no longer
+     * exists, so a slot whose owner's id has been reused by a new process
+     * is not reclaimed.
+     *
+     * @return The number of reclaimed slots
+     */
+    size_t reclaimStale();
+
+    /**
+     * Intern the tracepoint info of a process into the segment
+     *
+     * @return The id of the interned tracepoint or shm_invalid_id if
+     *         the intern table is full.
+     */
+    uint32_t intern(uint32_t process_id, const tracepoint_info* tpi);
+
+    /**
+     * @return The id of a tracepoint of this process, interning it the
+     *         first time it is seen
+     */
+    uint32_t idOf(uint32_t process_id, const tracepoint_info* tpi);
+
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+
+    // Ids of the tracepoints this process has interned into the segment.
+    // Tracepoints which don't fit in a full intern table are cached too
+    // as the table never shrinks.
+    InternIndex interned_index{shm_cached_tracepoints};
+    std::unique_ptr<std::pair<const tracepoint_info*, uint32_t>[]> interned{
+            new std::pair<const tracepoint_info*, uint32_t>
+                    [shm_cached_tracepoints]};
+};
+
+SharedMemorySegment::SharedMemorySegment(const std::string& name,
+                                         size_t create_slots) {
+#ifndef _WIN32
+    int fd = -1;
+    bool created = false;
+    if (create_slots) {
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd != -1) {
+            created = true;
+        } else if (errno != EEXIST) {
+            throw std::system_error(errno,
+                                    std::system_category(),
+                                    "SharedMemorySegment: Failed to create " +
+                                            name);
+        }
+    }
+    if (fd == -1) {
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd == -1) {
+            throw std::system_error(
+                    errno,
+                    std::system_category(),
+                    "SharedMemorySegment: Failed to open " + name);
+        }
+    }
+
+    try {
+        auto map = [this, fd, &name](size_t bytes) {
+            base = mmap(nullptr,
+                        bytes,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        fd,
+                        0);
+            if (base == MAP_FAILED) {
+                base = nullptr;
+                throw std::system_error(
+                        errno,
+                        std::system_category(),
+                        "SharedMemorySegment: Failed to map " + name);
+            }
+            length = bytes;
+        };
+        auto segmentSize = [fd]() -> size_t {
+            struct stat st;
+            return fstat(fd, &st) == 0 ? st.st_size : 0;
+        };
+
+        if (created) {
+            const auto bytes = sizeof(ShmHeader) + create_slots * sizeof(ShmSlot);
+            if (ftruncate(fd, bytes) != 0) {
+                throw std::system_error(
+                        errno,
+                        std::system_category(),
+                        "SharedMemorySegment: Failed to size " + name);
+            }
+            // The new segment is zero-filled which is the initial state
+            // of every slot and intern table entry
+            map(bytes);
+            header().magic = shm_magic;
+            header().chunk_bytes = sizeof(TraceChunk);
+            header().slot_count = create_slots;
+            header().version.store(shm_version, std::memory_order_release);
+        } else {
+            waitFor([&]() { return segmentSize() >= sizeof(ShmHeader); },
+                    "segment to be sized");
+            map(sizeof(ShmHeader));
+            waitFor([this]() { return header().version.load() != 0; },
+                    "segment to be initialised");
+            if (header().magic != shm_magic ||
+                header().version.load() != shm_version ||
+                header().chunk_bytes != sizeof(TraceChunk)) {
+                throw std::runtime_error(
+                        "SharedMemorySegment: Incompatible segment " + name);
+            }
+            const auto bytes =
+                    sizeof(ShmHeader) + header().slot_count * sizeof(ShmSlot);
+            munmap(base, length);
+            base = nullptr;
+            if (segmentSize() < bytes) {
+                throw std::runtime_error(
+                        "SharedMemorySegment: Truncated segment " + name);
+            }
+            map(bytes);
+        }
+    } catch (...) {
+        if (base) {
+            munmap(base, length);
+        }
+        close(fd);
+        throw;
+    }
+    // The mapping remains valid after the descriptor is closed
+    close(fd);
+#else
+    (void)name;
+    (void)create_slots;
+    throw std::runtime_error(
+            "SharedMemorySegment: Shared memory buffers are not supported "
+            "on this platform");
+#endif
+}
+
+SharedMemorySegment::~SharedMemorySegment() {
+#ifndef _WIN32
+    munmap(base, length);
+#endif
+}
+
+size_t SharedMemorySegment::acquire(size_t max_probes,
+                                    uint32_t process_id) {
+    const auto start = header().cursor.fetch_add(1, std::memory_order_relaxed);
+    const auto probes = std::min(size(), max_probes);
+    for (size_t probe = 0; probe < probes; ++probe) {
+        const auto index = (start + probe) % size();
+        auto& state = slot(index).state;
+        auto expected = ShmSlotState::free;
+        if (state.load(std::memory_order_relaxed) == expected &&
+            state.compare_exchange_strong(expected,
+                                          ShmSlotState::writing,
+                                          std::memory_order_acquire)) {
+            slot(index).owner.store(process_id, std::memory_order_relaxed);
+            return index;
+        }
+    }
+    return npos;
+}
+
+size_t SharedMemorySegment::publish(size_t index, uint32_t process_id) {
+    auto& s = slot(index);
+    size_t unresolved = 0;
+    const tracepoint_info* last = nullptr;
+    uint32_t id = shm_invalid_id;
+    for (size_t i = 0; i < s.chunk.count(); ++i) {
+        const auto* tpi = s.chunk[i].getTracepointInfo();
+        // Consecutive events are often of the same tracepoint
+        if (tpi != last) {
+            id = idOf(process_id, tpi);
+            last = tpi;
+        }
+        if (id == shm_invalid_id) {
+            ++unresolved;
+        }
+        s.tracepoint_ids[i] = id;
+    }
+    s.state.store(ShmSlotState::published, std::memory_order_release);
+    return unresolved;
+}
+
+size_t SharedMemorySegment::reclaimStale() {
+    size_t reclaimed = 0;
+#ifndef _WIN32
+    for (size_t index = 0; index < size(); ++index) {
+        auto& s = slot(index);
+        if (s.state.load(std::memory_order_acquire) != ShmSlotState::writing) {
+            continue;
+        }
+        // An owner of zero is a writer which hasn't recorded its id yet
+        const auto owner = s.owner.load(std::memory_order_relaxed);
+        if (owner == 0 || kill(pid_t(owner), 0) == 0 || errno != ESRCH) {
+            continue;
+        }
+        auto expected = ShmSlotState::writing;
+        if (s.state.compare_exchange_strong(expected,
+                                            ShmSlotState::reading,
+                                            std::memory_order_acquire)) {
+            s.owner.store(0, std::memory_order_relaxed);
+            s.state.store(ShmSlotState::free, std::memory_order_release);
+            ++reclaimed;
+        }
+    }
+#endif
+    return reclaimed;
+}
+
+uint32_t SharedMemorySegment::idOf(uint32_t process_id,
+                                   const tracepoint_info* tpi) {
+    const auto index = interned_index.findOrInsert(
+            mixHash(reinterpret_cast<uintptr_t>(tpi)),
+            [this, tpi](uint32_t i) { return interned[i].first == tpi; },
+            [this, process_id, tpi](uint32_t i) {
+                interned[i] = {tpi, intern(process_id, tpi)};
+            });
+    if (index == InternIndex::npos) {
+        return intern(process_id, tpi);
+    }
+    return interned[index].second;
+}
+
+uint32_t SharedMemorySegment::intern(uint32_t process_id,
+                                     const tracepoint_info* tpi) {
+    const auto address = reinterpret_cast<uintptr_t>(tpi);
+    const auto hash = mixHash(address ^ (uint64_t(process_id) << 32));
+
+    for (size_t probe = 0; probe < shm_intern_capacity; ++probe) {
+        const auto index = (hash + probe) % shm_intern_capacity;
+        auto& entry = header().tracepoints[index];
+
+        auto state = entry.state.load(std::memory_order_acquire);
+        if (state == ShmInternState::empty &&
+            entry.state.compare_exchange_strong(state,
+                                                ShmInternState::claiming,
+                                                std::memory_order_acq_rel)) {
+            entry.process_id = process_id;
+            entry.address = address;
+            entry.type = tpi->type;
+            entry.argument_types = tpi->argument_types;
+            copyString(entry.category, tpi->category);
+            copyString(entry.name, tpi->name);
+            for (size_t i = 0; i < arg_count; ++i) {
+                copyString(entry.argument_names[i], tpi->argument_names[i]);
+            }
+            entry.state.store(ShmInternState::ready, std::memory_order_release);
+            return uint32_t(index);
+        }
+
+        for (int spins = 0;
+             state == ShmInternState::claiming && spins < shm_max_claim_spins;
+             ++spins) {
+            std::this_thread::yield();
+            state = entry.state.load(std::memory_order_acquire);
+        }
+        if (state == ShmInternState::ready &&
+            entry.process_id == process_id && entry.address == address) {
+            return uint32_t(index);
+        }
+    }
+    return shm_invalid_id;
+}
+
+/**
+ * TraceBuffer implementation that loans out chunks from the slots of a
+ * shared memory segment.
+ */
+class SharedMemoryTraceBuffer : public TraceBuffer {
+public:
+    /**
+     * Number of slots checked for a free chunk before giving up, this
+     * bounds the cost of a failed acquisition when the reader has fallen
+     * behind.
+     */
+    static constexpr size_t max_acquire_probes = 256;
+
+    SharedMemoryTraceBuffer(const std::string& name,
+                            size_t generation_,
+                            size_t buffer_size)
+        : segment(name, buffer_size),
+          ownership(segment.size()),
+          process_id(platform::getCurrentProcessID()),
+          on_loan(0),
+          total_loaned(0),
+          failed_acquisitions(0),
+          unresolved_tracepoints(0),
+          generation(generation_) {
+    }
+
+    ~SharedMemoryTraceBuffer() override {
+        // Chunks still on loan when tracing stopped are never returned,
+        // publish them so that their events are visible to the reader.
+        for (size_t index = 0; index < segment.size(); ++index) {
+            if (ownership[index] == Ownership::loaned) {
+                publish(index);
+            }
+        }
+    }
+
+    TraceChunk* getChunk() override {
+        const auto index = segment.acquire(max_acquire_probes, process_id);
+        if (index == SharedMemorySegment::npos) {
+            ++failed_acquisitions;
+            return nullptr;
+        }
+        ownership[index] = Ownership::loaned;
+        auto& chunk = segment.slot(index).chunk;
+        chunk.reset(platform::getCurrentThreadIDCached());
+        ++on_loan;
+        ++total_loaned;
+        return &chunk;
+    }
+
+    void returnChunk(TraceChunk& chunk) override {
+        const auto index = segment.indexOf(chunk);
+        publish(index);
+        --on_loan;
+    }
+
+    bool isFull() const override {
+        return false;
+    }
+
+    void getStats(StatsCallback& addStats) const override {
+        using namespace std::string_view_literals;
+        addStats("buffer_name"sv, "SharedMemoryTraceBuffer"sv);
+        addStats("buffer_is_full"sv, isFull());
+        addStats("buffer_chunk_count"sv, ownChunks().size());
+        addStats("buffer_total_loaned"sv, total_loaned);
+        addStats("buffer_loaned_chunks"sv, on_loan);
+        addStats("buffer_size"sv, segment.size());
+        addStats("buffer_generation"sv, generation);
+        addStats("buffer_failed_acquisitions"sv, failed_acquisitions);
+        addStats("buffer_unresolved_tracepoints"sv, unresolved_tracepoints);
+    }
+
+    size_t getGeneration() const override {
+        return generation;
+    }
+
+    BufferMode bufferMode() const override {
+        return BufferMode::custom;
+    }
+
+    const TraceChunk& operator[](const size_t index) const override {
+        static const TraceChunk empty{};
+        return index < snapshot.size() ? *snapshot[index] : empty;
+    }
+
+    size_t chunk_count() const override {
+        snapshot = ownChunks();
+        return snapshot.size();
+    }
+
+    chunk_iterator chunk_begin() const override {
+        return chunk_iterator(*this);
+    }
+
+    chunk_iterator chunk_end() const override {
+        return chunk_iterator(*this, chunk_count());
+    }
+
+    event_iterator begin() const override {
+        return event_iterator(chunk_begin(), chunk_end());
+    }
+
+    event_iterator end() const override {
+        return event_iterator(chunk_end(), chunk_end());
+    }
+
+protected:
+    enum class Ownership : uint8_t { none, loaned, returned };
+
+    void publish(size_t index) {
+        ownership[index] = Ownership::returned;
+        unresolved_tracepoints += segment.publish(index, process_id);
+    }
+
+    /**
+     * @return The chunks in the segment written by this buffer which
+     *         have not been collected by a reader.
+     */
+    std::vector<const TraceChunk*> ownChunks() const {
+        std::vector<const TraceChunk*> chunks;
+        for (size_t index = 0; index < segment.size(); ++index) {
+            const auto& slot = segment.slot(index);
+            const auto state = slot.state.load(std::memory_order_acquire);
+            if (ownership[index] != Ownership::none &&
+                (state == ShmSlotState::writing ||
+                 state == ShmSlotState::published) &&
+                slot.chunk.processID() == process_id) {
+                chunks.push_back(&slot.chunk);
+            }
+        }
+        return chunks;
+    }
+
+    SharedMemorySegment segment;
+    std::vector<std::atomic<Ownership>> ownership;
+    uint32_t process_id;
+    RelaxedAtomic<size_t> on_loan;
+    RelaxedAtomic<size_t> total_loaned;
+    RelaxedAtomic<size_t> failed_acquisitions;
+    RelaxedAtomic<size_t> unresolved_tracepoints;
+    size_t generation;
+    // Chunks visited by iteration, refreshed by chunk_count()
+    mutable std::vector<const TraceChunk*> snapshot;
+};
+
+buffer_ptr make_shared_memory_buffer(const std::string& name,
+                                     size_t generation,
+                                     size_t buffer_size) {
+    return utils::make_unique<SharedMemoryTraceBuffer>(
+            name, generation, buffer_size);
+}
+
+trace_buffer_factory make_shared_memory_buffer_factory(std::string name) {
+    return [name = std::move(name)](size_t generation, size_t buffer_size) {
+        return make_shared_memory_buffer(name, generation, buffer_size);
+    };
+}
+
+/**
+ * TraceBuffer decorator which copies every chunk returned to the
+ * decorated buffer into the slots of a shared memory segment, so that
+ * a SharedMemoryReader (e.g. phosphor-tail) can follow the events
+ * being traced without stopping the trace.
+ *
+ * The copy is made by a mirror thread rather than by the thread which
+ * returned the chunk: returned chunks are queued for the mirror thread,
+ * which copies them into the segment and only then hands them back to
+ * the decorated buffer, so a chunk can't be reused while it is copied.
+ */
+class TailTraceBuffer : public TraceBuffer {
+public:
+    TailTraceBuffer(buffer_ptr buffer_,
+                    const std::string& name,
+                    size_t tail_size)
+        : buffer(std::move(buffer_)),
+          segment(name, tail_size),
+          process_id(platform::getCurrentProcessID()),
+          published_chunks(0),
+          dropped_chunks(0),
+          unresolved_tracepoints(0) {
+        pending.reserve(segment.size());
+        mirror_thread = std::thread([this]() { run(); });
+    }
+
+    ~TailTraceBuffer() override {
+        {
+            std::lock_guard<std::mutex> lh(mutex);
+            stopping = true;
+        }
+        pending_cv.notify_one();
+        // The mirror thread returns any queued chunks before it exits
+        mirror_thread.join();
+    }
+
+    TraceChunk* getChunk() override {
+        return buffer->getChunk();
+    }
+
+    void returnChunk(TraceChunk& chunk) override {
+        if (!enqueue(chunk, no_partition)) {
+            buffer->returnChunk(chunk);
+        }
+    }
+
+    TraceChunk* getPartitionChunk(size_t partition) override {
+        return buffer->getPartitionChunk(partition);
+    }
+
+    void returnPartitionChunk(TraceChunk& chunk, size_t partition) override {
+        if (!enqueue(chunk, partition)) {
+            buffer->returnPartitionChunk(chunk, partition);
+        }
+    }
+
+    size_t partitionCount() const override {
+        return buffer->partitionCount();
+    }
+
+    bool isFull() const override {
+        return buffer->isFull();
+    }
+
+    void getStats(StatsCallback& addStats) const override {
+        using namespace std::string_view_literals;
+        buffer->getStats(addStats);
+        addStats("tail_published_chunks"sv, published_chunks);
+        addStats("tail_dropped_chunks"sv, dropped_chunks);
+        addStats("tail_unresolved_tracepoints"sv, unresolved_tracepoints);
+    }
+
+    size_t getGeneration() const override {
+        return buffer->getGeneration();
+    }
+
+    BufferMode bufferMode() const override {
+        return buffer->bufferMode();
+    }
+
+    const TraceChunk& operator[](const size_t index) const override {
+        drain();
+        return (*buffer)[index];
+    }
+
+    size_t chunk_count() const override {
+        drain();
+        return buffer->chunk_count();
+    }
+
+    void forEachChunk(const chunk_callback& callback) const override {
+        drain();
+        buffer->forEachChunk(callback);
+    }
+
+    chunk_iterator chunk_begin() const override {
+        return chunk_iterator(*this);
+    }
+
+    chunk_iterator chunk_end() const override {
+        return chunk_iterator(*this, chunk_count());
+    }
+
+    event_iterator begin() const override {
+        return event_iterator(chunk_begin(), chunk_end());
+    }
+
+    event_iterator end() const override {
+        return event_iterator(chunk_end(), chunk_end());
+    }
+
+protected:
+    static constexpr size_t no_partition = std::numeric_limits<size_t>::max();
+
+    struct PendingChunk {
+        TraceChunk* chunk;
+        // Partition the chunk was returned to, or no_partition if it was
+        // returned with returnChunk()
+        size_t partition;
+    };
+
+    /**
+     * Queue a returned chunk for the mirror thread
+     *
+     * Never waits for the tail to catch up, no more chunks are held back
+     * from the decorated buffer than the segment has slots.
+     *
+     * @return false if the chunk wasn't queued (and so won't be mirrored)
+     */
+    bool enqueue(TraceChunk& chunk, size_t partition) {
+        {
+            std::lock_guard<std::mutex> lh(mutex);
+            if (pending.size() + in_flight >= segment.size()) {
+                ++dropped_chunks;
+                return false;
+            }
+            pending.push_back({&chunk, partition});
+        }
+        pending_cv.notify_one();
+        return true;
+    }
+
+    /**
+     * Body of the mirror thread, mirrors and returns queued chunks until
+     * the buffer is destroyed
+     */
+    void run() {
+        std::vector<PendingChunk> batch;
+        batch.reserve(segment.size());
+        std::unique_lock<std::mutex> lh(mutex);
+        while (true) {
+            pending_cv.wait(lh,
+                            [this]() { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            batch.swap(pending);
+            in_flight = batch.size();
+            lh.unlock();
+
+            for (const auto& entry : batch) {
+                mirror(*entry.chunk);
+                if (entry.partition == no_partition) {
+                    buffer->returnChunk(*entry.chunk);
+                } else {
+                    buffer->returnPartitionChunk(*entry.chunk,
+                                                 entry.partition);
+                }
+            }
+            batch.clear();
+
+            lh.lock();
+            in_flight = 0;
+            drained_cv.notify_all();
+        }
+    }
+
+    void mirror(const TraceChunk& chunk) {
+        // If every slot is still waiting to be collected the copy is
+        // dropped
+        const auto index = segment.acquire(
+                SharedMemoryTraceBuffer::max_acquire_probes, process_id);
+        if (index == SharedMemorySegment::npos) {
+            ++dropped_chunks;
+            return;
+        }
+        segment.slot(index).chunk = chunk;
+        unresolved_tracepoints += segment.publish(index, process_id);
+        ++published_chunks;
+    }
+
+    /**
+     * Wait for the mirror thread to hand every queued chunk back to the
+     * decorated buffer, so that iteration sees all returned chunks
+     */
+    void drain() const {
+        std::unique_lock<std::mutex> lh(mutex);
+        drained_cv.wait(
+                lh, [this]() { return pending.empty() && in_flight == 0; });
+    }
+
+    buffer_ptr buffer;
+    SharedMemorySegment segment;
+    uint32_t process_id;
+    RelaxedAtomic<size_t> published_chunks;
+    RelaxedAtomic<size_t> dropped_chunks;
+    RelaxedAtomic<size_t> unresolved_tracepoints;
+
+    // Guards the queue of chunks waiting to be mirrored
+    mutable std::mutex mutex;
+    std::condition_variable pending_cv;
+    mutable std::condition_variable drained_cv;
+    std::vector<PendingChunk> pending;
+    // Number of chunks taken off the queue but not yet returned
+    size_t in_flight = 0;
+    bool stopping = false;
+    std::thread mirror_thread;
+};
+
+buffer_ptr make_tail_buffer(buffer_ptr buffer,
+                            const std::string& name,
+                            size_t tail_size) {
+    return utils::make_unique<TailTraceBuffer>(
+            std::move(buffer), name, tail_size);
+}
+
+bool remove_shared_memory_buffer(const std::string& name) {
+#ifndef _WIN32
+    return shm_unlink(name.c_str()) == 0;
+#else
+    (void)name;
+    return false;
+#endif
+}
+
+/*
+ * SharedMemoryReader implementation
+ */
+struct SharedMemoryReader::Tracepoint {
+    std::string category;
+    std::string name;
+    std::array<std::string, arg_count> argument_names;
+    tracepoint_info info;
+};
+
+SharedMemoryReader::SharedMemoryReader(const std::string& name)
+    : segment(utils::make_unique<SharedMemorySegment>(name, 0)) {
+}
+
+SharedMemoryReader::~SharedMemoryReader() = default;
+
+const SharedMemoryReader::Tracepoint* SharedMemoryReader::resolve(
+        uint32_t id) {
+    if (id >= shm_intern_capacity) {
+        return nullptr;
+    }
+    auto it = tracepoints.find(id);
+    if (it != tracepoints.end()) {
+        return it->second.get();
+    }
+
+    const auto& entry = segment->header().tracepoints[id];
+    if (entry.state.load(std::memory_order_acquire) != ShmInternState::ready) {
+        return nullptr;
+    }
+    auto tp = utils::make_unique<Tracepoint>();
+    tp->category = toString(entry.category);
+    tp->name = toString(entry.name);
+    tp->info.category = tp->category.c_str();
+    tp->info.name = tp->name.c_str();
+    tp->info.type = entry.type;
+    for (size_t i = 0; i < arg_count; ++i) {
+        tp->argument_names[i] = toString(entry.argument_names[i]);
+        tp->info.argument_names[i] = tp->argument_names[i].c_str();
+        // Strings recorded by pointer live in the writer's address space
+        // and interned strings and stacks in the writer's tables
+        switch (entry.argument_types[i]) {
+        case TraceArgumentType::is_string:
+            tp->info.argument_types[i] = TraceArgumentType::is_pointer;
+            break;
+        case TraceArgumentType::is_interned:
+        case TraceArgumentType::is_stack:
+            tp->info.argument_types[i] = TraceArgumentType::is_uint;
+            break;
+        default:
+            tp->info.argument_types[i] = entry.argument_types[i];
+        }
+    }
+    return tracepoints.emplace(id, std::move(tp)).first->second.get();
+}
+
+size_t SharedMemoryReader::decode(const EventCallback& callback,
+                                  bool release) {
+    using namespace std::chrono;
+    size_t decoded_count = 0;
+    TraceChunk chunk;
+    std::array<uint32_t, TraceChunk::max_chunk_size> ids;
+
+    reclaimed_slots += segment->reclaimStale();
+    for (size_t index = 0; index < segment->size(); ++index) {
+        auto& slot = segment->slot(index);
+        auto expected = ShmSlotState::published;
+        if (!slot.state.compare_exchange_strong(expected,
+                                                ShmSlotState::reading,
+                                                std::memory_order_acquire)) {
+            continue;
+        }
+        // Copy the chunk out so that the slot can be handed back to the
+        // writers as soon as possible
+        chunk = slot.chunk;
+        ids = slot.tracepoint_ids;
+        if (release) {
+            slot.owner.store(0, std::memory_order_relaxed);
+        }
+        slot.state.store(release ? ShmSlotState::free : ShmSlotState::published,
+                         std::memory_order_release);
+
+        const auto count = std::min(chunk.count(), chunk.capacity());
+        for (size_t i = 0; i < count; ++i) {
+            const auto* tp = resolve(ids[i]);
+            if (!tp) {
+                continue;
+            }
+            const auto& event = chunk[i];
+            auto args = event.getArgs();
+            TraceEvent decoded(
+                    &tp->info,
+                    steady_clock::time_point(duration_cast<steady_clock::duration>(
+                            nanoseconds(event.getTime()))),
+                    duration_cast<steady_clock::duration>(
+                            nanoseconds(event.getDuration())),
+                    std::move(args));
+            callback(decoded, chunk.threadID(), chunk.processID());
+            ++decoded_count;
+        }
+    }
+    return decoded_count;
+}
+
+std::vector<std::string> SharedMemoryReader::collect(bool release) {
+    std::vector<std::string> events;
+    decode(
+            [&events](const TraceEvent& event,
+                      uint32_t thread_id,
+                      uint32_t process_id) {
+                events.push_back(event.to_json(thread_id, process_id));
+            },
+            release);
+    return events;
+}
+
+std::string SharedMemoryReader::collectJSON(bool release) {
+    std::string output = "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& event : collect(release)) {
+        if (!first) {
+            output += ",";
+        }
+        output += event;
+        first = false;
+    }
+    output += "]}";
+    return output;
+}
+
+size_t SharedMemoryReader::size() const {
+    return segment->size();
+}
+
+size_t SharedMemoryReader::reclaimedSlots() const {
+    return reclaimed_slots;
+}
+
+} // namespace phosphor
@@ -0,0 +1,185 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#if (defined(__linux__) || defined(__APPLE__)) && __has_include(<execinfo.h>)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#define PHOSPHOR_HAVE_BACKTRACE 1
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "phosphor/stack_table.h"
+#include "phosphor/stats_callback.h"
+#include "utils/string_utils.h"
+
+namespace phosphor {
+
+namespace {
+
+size_t hashStack(const void* const* frames, size_t depth) {
+    // FNV-1a over the return addresses
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < depth; ++i) {
+        hash ^= reinterpret_cast<uintptr_t>(frames[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return size_t(hash ^ (hash >> 32));
+}
+
+std::string symbolizeFrame(const void* frame) {
+#if defined(PHOSPHOR_HAVE_BACKTRACE)
+    Dl_info info;
+    if (dladdr(frame, &info) != 0) {
+        const auto address = reinterpret_cast<uintptr_t>(frame);
+        if (info.dli_sname && info.dli_saddr) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(
+                    info.dli_sname, nullptr, nullptr, &status);
+            std::string name(status == 0 ? demangled : info.dli_sname);
+            std::free(demangled);
+            return utils::format_string(
+                    "%s+0x%zx",
+                    name.c_str(),
+                    size_t(address -
+                           reinterpret_cast<uintptr_t>(info.dli_saddr)));
+        }
+        if (info.dli_fname && info.dli_fbase) {
+            // Functions which aren't exported (e.g. static functions or
+            // an executable not linked with -rdynamic) can be resolved
+            // from the module offset with addr2line
+            const char* module = std::strrchr(info.dli_fname, '/');
+            return utils::format_string(
+                    "%s+0x%zx",
+                    module ? module + 1 : info.dli_fname,
+                    size_t(address -
+                           reinterpret_cast<uintptr_t>(info.dli_fbase)));
+        }
+    }
+#endif
+    return utils::format_string("%p", frame);
+}
+
+} // namespace
+
+StackTable::StackTable()
+    : intern_index(table_size), stacks(new Stack[table_size]) {
+}
+
+StackTable& StackTable::getInstance() {
+    static StackTable table;
+    return table;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+// The frame of capture() must exist for it to be skipped
+__attribute__((noinline))
+#endif
+stack_trace
+StackTable::capture(size_t skip) {
+#if defined(PHOSPHOR_HAVE_BACKTRACE)
+    std::array<void*, max_depth + 1> addresses;
+    const auto depth = size_t(backtrace(addresses.data(),
+                                        int(addresses.size())));
+    // Leave out capture() itself
+    ++skip;
+    if (depth <= skip) {
+        return {npos};
+    }
+    return intern(addresses.data() + skip, depth - skip, true);
+#else
+    (void)skip;
+    return {npos};
+#endif
+}
+
+stack_trace StackTable::captureInterrupted(const void* pc) {
+#if defined(PHOSPHOR_HAVE_BACKTRACE)
+    // Leave room for the frames of the signal handler
+    std::array<void*, max_depth + 8> addresses;
+    const auto depth = size_t(backtrace(addresses.data(),
+                                        int(addresses.size())));
+    // The unwinder reports the interrupted instruction itself as the
+    // frame which follows the signal trampoline
+    size_t first = 0;
+    while (first < depth && addresses[first] != pc) {
+        ++first;
+    }
+    if (first == depth) {
+        return {npos};
+    }
+    return intern(addresses.data() + first,
+                  std::min(depth - first, max_depth),
+                  false);
+#else
+    (void)pc;
+    return {npos};
+#endif
+}
+
+void StackTable::prime() {
+#if defined(PHOSPHOR_HAVE_BACKTRACE)
+    void* frame;
+    backtrace(&frame, 1);
+#endif
+}
+
+stack_trace StackTable::intern(const Frames& frames) {
+    return intern(
+            frames.data(), std::min(frames.size(), max_depth), true);
+}
+
+stack_trace StackTable::intern(const void* const* frames,
+                               size_t depth,
+                               bool wait) {
+    return {intern_index.findOrInsert(
+            hashStack(frames, depth),
+            [this, frames, depth](uint32_t index) {
+                const auto& stack = stacks[index];
+                return stack.depth == depth &&
+                       std::equal(frames,
+                                  frames + depth,
+                                  stack.frames.begin());
+            },
+            [this, frames, depth](uint32_t index) {
+                auto& stack = stacks[index];
+                stack.depth = depth;
+                std::copy(frames, frames + depth, stack.frames.begin());
+            },
+            wait)};
+}
+
+StackTable::Frames StackTable::lookup(stack_trace stack) const {
+    if (stack.id >= intern_index.size()) {
+        return {};
+    }
+    const auto& entry = stacks[stack.id];
+    return Frames(entry.frames.begin(), entry.frames.begin() + entry.depth);
+}
+
+std::vector<std::string> StackTable::symbolize(stack_trace stack) const {
+    std::vector<std::string> result;
+    for (const auto* frame : lookup(stack)) {
+        result.push_back(symbolizeFrame(frame));
+    }
+    return result;
+}
+
+void StackTable::getStats(StatsCallback& addStats) const {
+    using namespace std::string_view_literals;
+    addStats("stack_table_size"sv, size());
+    addStats("stack_table_dropped"sv, intern_index.getDropped());
+}
+
+} // namespace phosphor
@@ -0,0 +1,146 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <array>
+#include <atomic>
+#include <functional>
+
+#include "phosphor/stats_callback.h"
+#include "phosphor/string_table.h"
+#include "utils/memory.h"
+
+namespace phosphor {
+
+namespace {
+
+std::atomic<uint32_t> next_table_serial{1};
+
+// Live tables, used to resolve ids from any table. Each table claims a
+// free slot and keeps it for its lifetime, the slot is the low bits of
+// the table's serial. A slot is claimed before its table is constructed
+// and only holds the table once it has been.
+constexpr size_t live_table_bits = 6;
+constexpr size_t live_table_count = size_t(1) << live_table_bits;
+std::array<std::atomic<const StringTable*>, live_table_count> live_tables;
+std::array<std::atomic<bool>, live_table_count> live_table_claimed;
+
+/**
+ * Claim a free slot in the live tables
+ *
+ * @return The slot or live_table_count if every slot is taken
+ */
+size_t claimLiveTable() {
+    for (size_t slot = 0; slot < live_table_count; ++slot) {
+        if (!live_table_claimed[slot].load(std::memory_order_relaxed) &&
+            !live_table_claimed[slot].exchange(true,
+                                               std::memory_order_acquire)) {
+            return slot;
+        }
+    }
+    return live_table_count;
+}
+
+uint32_t makeSerial(size_t slot) {
+    // A table without a slot takes slot 0's bits, resolve() won't find
+    // it as the table in slot 0 has a different serial
+    const auto generation =
+            next_table_serial.fetch_add(1, std::memory_order_relaxed);
+    return (generation << live_table_bits) |
+           uint32_t(slot % live_table_count);
+}
+
+/**
+ * Per-thread direct-mapped cache of recently interned strings
+ */
+struct StringCacheEntry {
+    uint32_t serial = 0;
+    const std::string* str = nullptr;
+    interned_string id = {0};
+};
+
+constexpr size_t string_cache_size = 64;
+thread_local std::array<StringCacheEntry, string_cache_size> string_cache;
+
+constexpr interned_string makeId(uint32_t serial, size_t index) {
+    return {(uint64_t(serial) << 32) | (index + 1)};
+}
+
+} // namespace
+
+StringTable::StringTable(size_t table_size)
+    : StringTable(table_size, claimLiveTable()) {
+}
+
+StringTable::StringTable(size_t table_size, size_t slot)
+    : serial(makeSerial(slot)),
+      live(slot != live_table_count),
+      intern_index(table_size),
+      strings(new std::unique_ptr<const std::string>[table_size]) {
+    if (live) {
+        live_tables[slot].store(this, std::memory_order_release);
+    }
+}
+
+StringTable::~StringTable() {
+    if (live) {
+        const auto slot = serial % live_table_count;
+        live_tables[slot].store(nullptr, std::memory_order_release);
+        live_table_claimed[slot].store(false, std::memory_order_release);
+    }
+}
+
+interned_string StringTable::intern(std::string_view str) {
+    const auto hash = std::hash<std::string_view>()(str);
+    auto& cached = string_cache[hash % string_cache_size];
+    if (cached.serial == serial && *cached.str == str) {
+        return cached.id;
+    }
+
+    const auto index = intern_index.findOrInsert(
+            hash,
+            [this, str](uint32_t i) { return *strings[i] == str; },
+            [this, str](uint32_t i) {
+                strings[i] = utils::make_unique<const std::string>(str);
+            });
+    if (index == InternIndex::npos) {
+        return {0};
+    }
+
+    cached = {serial, strings[index].get(), makeId(serial, index)};
+    return cached.id;
+}
+
+std::string_view StringTable::lookup(interned_string str) const {
+    const auto index = str.id & 0xffffffff;
+    if ((str.id >> 32) != serial || index == 0 ||
+        index > intern_index.size()) {
+        return {};
+    }
+    return *strings[index - 1];
+}
+
+std::string_view StringTable::resolve(interned_string str) {
+    const auto serial = uint32_t(str.id >> 32);
+    const auto* table = live_tables[serial % live_table_count].load(
+            std::memory_order_acquire);
+    if (table == nullptr) {
+        return {};
+    }
+    return table->lookup(str);
+}
+
+void StringTable::getStats(StatsCallback& addStats) const {
+    using namespace std::string_view_literals;
+    addStats("string_table_size"sv, size());
+    addStats("string_table_dropped"sv, intern_index.getDropped());
+}
+
+} // namespace phosphor
@@ -0,0 +1,344 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+
+#include "phosphor/stats_callback.h"
+#include "phosphor/tools/aggregate.h"
+#include "phosphor/trace_buffer.h"
+
+namespace phosphor::tools {
+
+namespace {
+
+/**
+ * Log-linear histogram of durations, each power of two is split into
+ * 8 linear sub-buckets so a bucket is at most 1/8th of its lower bound
+ * wide.
+ */
+constexpr size_t duration_sub_buckets = 8;
+constexpr size_t duration_buckets = 62 * duration_sub_buckets;
+
+size_t durationBucket(uint64_t ns) {
+    if (ns < duration_sub_buckets) {
+        return size_t(ns);
+    }
+    size_t msb = 63;
+    while ((ns >> msb) == 0) {
+        --msb;
+    }
+    const auto shift = msb - 3;
+    return (msb - 2) * duration_sub_buckets +
+           ((ns >> shift) & (duration_sub_buckets - 1));
+}
+
+uint64_t durationBucketUpperBound(size_t bucket) {
+    if (bucket < duration_sub_buckets) {
+        return bucket;
+    }
+    const auto shift = (bucket / duration_sub_buckets) - 1;
+    const auto lower = (duration_sub_buckets + bucket % duration_sub_buckets)
+                       << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+struct DurationTotals {
+    void add(uint64_t ns) {
+        ++count;
+        total += ns;
+        min = std::min(min, ns);
+        max = std::max(max, ns);
+        ++histogram[durationBucket(ns)];
+    }
+
+    void merge(const DurationTotals& other) {
+        count += other.count;
+        total += other.total;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        for (size_t i = 0; i < duration_buckets; ++i) {
+            histogram[i] += other.histogram[i];
+        }
+    }
+
+    uint64_t percentile(double percentile) const {
+        const auto target = std::max(
+                uint64_t(1), uint64_t((percentile / 100.0) * count + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < duration_buckets; ++i) {
+            seen += histogram[i];
+            if (seen >= target) {
+                return std::clamp(durationBucketUpperBound(i), min, max);
+            }
+        }
+        return max;
+    }
+
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t min = std::numeric_limits<uint64_t>::max();
+    uint64_t max = 0;
+    std::array<uint64_t, duration_buckets> histogram{};
+};
+
+using DurationTable =
+        std::unordered_map<const tracepoint_info*, DurationTotals>;
+
+/**
+ * A start or end event which couldn't be paired within its chunk, copied
+ * as a compact chunk's events only outlive their chunk's turn
+ */
+struct UnpairedEvent {
+    TraceEvent event;
+    uint32_t thread_id;
+};
+
+/**
+ * Output of a worker summarising a contiguous range of chunks
+ */
+struct ChunkRangeResult {
+    DurationTable durations;
+    // In chunk order, which needn't be time order once a ring has wrapped
+    std::vector<UnpairedEvent> unpaired;
+    size_t events = 0;
+};
+
+uint64_t durationBetween(const TraceEvent& start, const TraceEvent& end) {
+    return end.getTime() > start.getTime()
+                   ? uint64_t(end.getTime() - start.getTime())
+                   : 0;
+}
+
+ChunkRangeResult aggregateChunks(const TraceChunk* const* first,
+                                 const TraceChunk* const* last) {
+    ChunkRangeResult result;
+    std::vector<const TraceEvent*> stack;
+    // Compact chunks are decoded one at a time
+    std::vector<TraceEvent> scratch;
+    for (; first != last; ++first) {
+        const auto span = TraceBuffer::getSpan(**first, scratch);
+        const auto thread_id = span.thread_id;
+        result.events += span.events.size();
+        stack.clear();
+        for (const auto& event : span.events) {
+            switch (event.getType()) {
+            case TraceEvent::Type::Complete:
+                result.durations[event.getTracepointInfo()].add(
+                        event.getDuration());
+                break;
+            case TraceEvent::Type::SyncStart:
+                stack.push_back(&event);
+                break;
+            case TraceEvent::Type::SyncEnd:
+                if (stack.empty()) {
+                    result.unpaired.push_back({event, thread_id});
+                } else {
+                    result.durations[stack.back()->getTracepointInfo()].add(
+                            durationBetween(*stack.back(), event));
+                    stack.pop_back();
+                }
+                break;
+            case TraceEvent::Type::AsyncStart:
+            case TraceEvent::Type::AsyncEnd:
+                result.unpaired.push_back({event, thread_id});
+                break;
+            case TraceEvent::Type::Instant:
+            case TraceEvent::Type::GlobalInstant:
+            case TraceEvent::Type::Sample:
+                break;
+            }
+        }
+        for (const auto* start : stack) {
+            result.unpaired.push_back({*start, thread_id});
+        }
+    }
+    return result;
+}
+
+/**
+ * Pair the events left over by the workers
+ *
+ * @return Number of events which could not be paired
+ */
+size_t pairEvents(std::vector<UnpairedEvent>& unpaired,
+                  DurationTable& durations) {
+    size_t unmatched = 0;
+
+    // Sync events pair by nesting on each thread so are put in time order
+    // per thread, as a wrapped ring buffer reuses earlier chunks for later
+    // events. The stable sort keeps events of the same time in chunk order.
+    std::stable_sort(unpaired.begin(),
+                     unpaired.end(),
+                     [](const UnpairedEvent& a, const UnpairedEvent& b) {
+                         if (a.thread_id != b.thread_id) {
+                             return a.thread_id < b.thread_id;
+                         }
+                         return a.event.getTime() < b.event.getTime();
+                     });
+    std::vector<const TraceEvent*> stack;
+    std::vector<const TraceEvent*> async;
+    for (size_t i = 0; i < unpaired.size(); ++i) {
+        if (i != 0 && unpaired[i].thread_id != unpaired[i - 1].thread_id) {
+            unmatched += stack.size();
+            stack.clear();
+        }
+        const auto& event = unpaired[i].event;
+        switch (event.getType()) {
+        case TraceEvent::Type::SyncStart:
+            stack.push_back(&event);
+            break;
+        case TraceEvent::Type::SyncEnd:
+            if (stack.empty()) {
+                ++unmatched;
+            } else {
+                durations[stack.back()->getTracepointInfo()].add(
+                        durationBetween(*stack.back(), event));
+                stack.pop_back();
+            }
+            break;
+        default:
+            async.push_back(&event);
+            break;
+        }
+    }
+    unmatched += stack.size();
+
+    // Async events may start and end on different threads so are paired
+    // in time order by their id and name
+    std::stable_sort(async.begin(),
+                     async.end(),
+                     [](const TraceEvent* a, const TraceEvent* b) {
+                         return a->getTime() < b->getTime();
+                     });
+    std::unordered_map<const void*, std::vector<const TraceEvent*>> open;
+    for (const auto* event : async) {
+        auto& starts = open[event->getArgs()[0].as_pointer];
+        if (event->getType() == TraceEvent::Type::AsyncStart) {
+            starts.push_back(event);
+            continue;
+        }
+        const auto start = std::find_if(
+                starts.rbegin(), starts.rend(), [event](const TraceEvent* s) {
+                    return std::strcmp(s->getName(), event->getName()) == 0;
+                });
+        if (start == starts.rend()) {
+            ++unmatched;
+            continue;
+        }
+        durations[(*start)->getTracepointInfo()].add(
+                durationBetween(**start, *event));
+        starts.erase(std::next(start).base());
+    }
+    for (const auto& entry : open) {
+        unmatched += entry.second.size();
+    }
+    return unmatched;
+}
+
+} // anonymous namespace
+
+Aggregator::Aggregator(size_t concurrency_) : concurrency(concurrency_) {
+    if (concurrency == 0) {
+        concurrency = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+Aggregator::Result Aggregator::aggregate(const TraceContext& context) const {
+    Result result;
+    const auto* buffer = context.getBuffer();
+    if (!buffer) {
+        return result;
+    }
+
+    std::vector<const TraceChunk*> chunks;
+    buffer->forEachChunk([&chunks](const TraceChunk& chunk) {
+        if (chunk.count()) {
+            chunks.push_back(&chunk);
+        }
+    });
+
+    // Each worker takes a contiguous range of chunks so that the events
+    // left unpaired stay in chunk order
+    const auto workers =
+            std::max(size_t(1), std::min(concurrency, chunks.size()));
+    const auto per_worker = chunks.size() / workers;
+    const auto remainder = chunks.size() % workers;
+    std::vector<std::future<ChunkRangeResult>> futures;
+    const auto* first = chunks.data();
+    for (size_t i = 0; i < workers; ++i) {
+        const auto* last = first + per_worker + (i < remainder ? 1 : 0);
+        if (i + 1 == workers) {
+            // Summarise the last range on this thread
+            futures.push_back(std::async(
+                    std::launch::deferred, aggregateChunks, first, last));
+        } else {
+            futures.push_back(std::async(
+                    std::launch::async, aggregateChunks, first, last));
+        }
+        first = last;
+    }
+
+    DurationTable durations;
+    std::vector<UnpairedEvent> unpaired;
+    for (auto& future : futures) {
+        auto range = future.get();
+        result.events += range.events;
+        for (const auto& entry : range.durations) {
+            durations[entry.first].merge(entry.second);
+        }
+        unpaired.insert(
+                unpaired.end(), range.unpaired.begin(), range.unpaired.end());
+    }
+    result.unmatched = pairEvents(unpaired, durations);
+
+    for (const auto& entry : durations) {
+        const auto& totals = entry.second;
+        result.summaries.push_back({entry.first,
+                                    totals.count,
+                                    totals.total,
+                                    totals.min,
+                                    totals.max,
+                                    totals.percentile(50),
+                                    totals.percentile(90),
+                                    totals.percentile(99)});
+    }
+    std::sort(result.summaries.begin(),
+              result.summaries.end(),
+              [](const Summary& a, const Summary& b) {
+                  return a.total_ns > b.total_ns;
+              });
+    return result;
+}
+
+void Aggregator::Result::getStats(StatsCallback& addStats) const {
+    using namespace std::string_view_literals;
+    addStats("aggregate_events"sv, events);
+    addStats("aggregate_unmatched"sv, unmatched);
+    for (const auto& summary : summaries) {
+        const auto prefix = std::string(summary.tpi->category) + ":" +
+                            summary.tpi->name + ":";
+        addStats(prefix + "count", size_t(summary.count));
+        addStats(prefix + "total_ns", size_t(summary.total_ns));
+        addStats(prefix + "min_ns", size_t(summary.min_ns));
+        addStats(prefix + "max_ns", size_t(summary.max_ns));
+        addStats(prefix + "p50_ns", size_t(summary.p50_ns));
+        addStats(prefix + "p90_ns", size_t(summary.p90_ns));
+        addStats(prefix + "p99_ns", size_t(summary.p99_ns));
+    }
+}
+
+} // namespace phosphor::tools
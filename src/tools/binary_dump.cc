@@ -0,0 +1,528 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "phosphor/platform/thread.h"
+#include "phosphor/tools/binary_dump.h"
+#include "phosphor/trace_buffer.h"
+#include "utils/memory.h"
+#include "utils/string_utils.h"
+
+namespace phosphor::tools {
+
+namespace {
+
+// Events are written and read back as raw bytes
+static_assert(std::is_trivially_copyable<TraceEvent>::value,
+              "TraceEvent must be trivially copyable to be dumped");
+
+constexpr std::array<char, 8> dump_magic = {
+        {'P', 'H', 'O', 'S', 'D', 'U', 'M', 'P'}};
+constexpr uint32_t dump_version = 1;
+// Length written in place of a null string
+constexpr uint32_t dump_null_string = 0xffffffff;
+
+struct DumpHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    // sizeof(TraceEvent) of the writer, used to detect a dump written
+    // by an incompatible build
+    uint32_t event_size;
+    uint32_t process_id;
+    uint32_t tracepoint_count;
+    uint64_t thread_count;
+    uint64_t string_count;
+    uint64_t chunk_count;
+    // Size of the tracepoint, thread name and interned string tables
+    // which follow
+    uint64_t metadata_size;
+};
+
+struct DumpChunkHeader {
+    uint32_t thread_id;
+    uint32_t process_id;
+    uint32_t event_count;
+    uint32_t reserved;
+};
+
+template <typename T>
+void appendValue(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void appendString(std::string& out, const char* str) {
+    if (str == nullptr) {
+        appendValue(out, dump_null_string);
+        return;
+    }
+    const auto length = uint32_t(std::strlen(str));
+    appendValue(out, length);
+    out.append(str, length);
+}
+
+/**
+ * Serialise the tracepoints and interned strings referenced by the
+ * buffer and the thread names into the metadata section of the dump,
+ * and collect the header of each chunk
+ */
+std::string buildMetadata(const TraceContext& context,
+                          DumpHeader& header,
+                          std::vector<DumpChunkHeader>& chunk_headers) {
+    std::unordered_set<const tracepoint_info*> seen;
+    std::unordered_set<uint64_t> interned;
+    std::string metadata;
+    context.getBuffer()->forEachSpan([&](const TraceBuffer::chunk_span& span) {
+        chunk_headers.push_back({span.thread_id,
+                                 span.process_id,
+                                 uint32_t(span.events.size()),
+                                 0});
+        for (const auto& event : span.events) {
+            const auto* tpi = event.getTracepointInfo();
+            for (size_t arg = 0; arg < arg_count; ++arg) {
+                if (tpi->argument_types[arg] ==
+                    TraceArgumentType::is_interned) {
+                    interned.insert(event.getArgs()[arg].as_interned.id);
+                }
+            }
+            if (!seen.insert(tpi).second) {
+                continue;
+            }
+            appendValue(metadata, uint64_t(reinterpret_cast<uintptr_t>(tpi)));
+            appendValue(metadata, uint32_t(tpi->type));
+            for (const auto type : tpi->argument_types) {
+                appendValue(metadata, uint32_t(type));
+            }
+            appendString(metadata, tpi->category);
+            appendString(metadata, tpi->name);
+            for (const auto* name : tpi->argument_names) {
+                appendString(metadata, name);
+            }
+        }
+    });
+    header.chunk_count = chunk_headers.size();
+    header.tracepoint_count = uint32_t(seen.size());
+
+    for (const auto& thread : context.getThreadNames()) {
+        appendValue(metadata, uint64_t(thread.first));
+        appendString(metadata, thread.second.c_str());
+    }
+    header.thread_count = context.getThreadNames().size();
+
+    for (const auto id : interned) {
+        const std::string str(StringTable::resolve({id}));
+        appendValue(metadata, id);
+        appendString(metadata, str.c_str());
+    }
+    header.string_count = interned.size();
+    return metadata;
+}
+
+[[noreturn]] void throwDumpError(const std::string& path) {
+    throw std::system_error(errno,
+                            std::system_category(),
+                            "phosphor::tools::writeBinaryDump(): Couldn't"
+                            " write file: " +
+                                    path);
+}
+
+#ifdef _WIN32
+using DumpIovec = std::pair<const void*, size_t>;
+
+DumpIovec makeIovec(const void* base, size_t length) {
+    return {base, length};
+}
+
+/**
+ * Writes a dump in batches of iovecs, so that events can be written
+ * straight from the buffer
+ */
+class DumpWriter {
+public:
+    explicit DumpWriter(const std::string& path_)
+        : path(path_), fp(utils::make_unique_FILE(path_.c_str(), "wb")) {
+        if (!fp) {
+            throwDumpError(path);
+        }
+        setvbuf(fp.get(), nullptr, _IONBF, 0);
+    }
+
+    void add(const void* base, size_t length) {
+        iovecs.push_back(makeIovec(base, length));
+    }
+
+    /**
+     * Write the iovecs added so far, after which their memory may be
+     * reused
+     */
+    void flush() {
+        for (const auto& iov : iovecs) {
+            if (fwrite(iov.first, 1, iov.second, fp.get()) != iov.second) {
+                throwDumpError(path);
+            }
+        }
+        iovecs.clear();
+    }
+
+    void finish(bool sync) {
+        flush();
+        if (sync && _commit(_fileno(fp.get())) != 0) {
+            throwDumpError(path);
+        }
+    }
+
+private:
+    const std::string& path;
+    utils::unique_FILE fp;
+    std::vector<DumpIovec> iovecs;
+};
+#else
+using DumpIovec = iovec;
+
+DumpIovec makeIovec(const void* base, size_t length) {
+    return {const_cast<void*>(base), length};
+}
+
+/**
+ * Closes a file descriptor when it goes out of scope
+ */
+struct DumpFile {
+    explicit DumpFile(int fd) : fd(fd) {
+    }
+    ~DumpFile() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    int fd;
+};
+
+/**
+ * Writes a dump in batches of iovecs, so that events can be written
+ * straight from the buffer
+ */
+class DumpWriter {
+public:
+    explicit DumpWriter(const std::string& path_)
+        : path(path_),
+          file(open(path_.c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644)) {
+        if (file.fd == -1) {
+            throwDumpError(path);
+        }
+    }
+
+    void add(const void* base, size_t length) {
+        iovecs.push_back(makeIovec(base, length));
+    }
+
+    /**
+     * Write the iovecs added so far, after which their memory may be
+     * reused
+     */
+    void flush() {
+        size_t next = 0;
+        while (next < iovecs.size()) {
+            const auto count =
+                    std::min(iovecs.size() - next, size_t(IOV_MAX));
+            const auto ret =
+                    pwritev(file.fd, &iovecs[next], int(count), offset);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throwDumpError(path);
+            }
+            offset += ret;
+
+            // Skip over what was written, a short write may leave the
+            // last iovec partially written
+            auto written = size_t(ret);
+            while (next < iovecs.size() && written >= iovecs[next].iov_len) {
+                written -= iovecs[next].iov_len;
+                ++next;
+            }
+            if (written) {
+                iovecs[next].iov_base =
+                        static_cast<char*>(iovecs[next].iov_base) + written;
+                iovecs[next].iov_len -= written;
+            }
+        }
+        iovecs.clear();
+    }
+
+    void finish(bool sync) {
+        flush();
+        if (sync && fsync(file.fd) != 0) {
+            throwDumpError(path);
+        }
+    }
+
+private:
+    const std::string& path;
+    DumpFile file;
+    off_t offset = 0;
+    std::vector<DumpIovec> iovecs;
+};
+#endif
+
+/**
+ * Bounds checked reads from the dump
+ */
+class DumpCursor {
+public:
+    DumpCursor(const std::vector<char>& data, size_t offset)
+        : data(data), offset(offset) {
+    }
+
+    const char* take(size_t length) {
+        if (length > data.size() - offset) {
+            throw std::runtime_error(
+                    "phosphor::tools::BinaryDumpReader: Truncated dump");
+        }
+        const auto* ptr = data.data() + offset;
+        offset += length;
+        return ptr;
+    }
+
+    template <typename T>
+    T value() {
+        T result;
+        std::memcpy(&result, take(sizeof(T)), sizeof(T));
+        return result;
+    }
+
+    /**
+     * @return The string and whether it was null
+     */
+    std::pair<std::string, bool> string() {
+        const auto length = value<uint32_t>();
+        if (length == dump_null_string) {
+            return {{}, true};
+        }
+        return {std::string(take(length), length), false};
+    }
+
+    size_t position() const {
+        return offset;
+    }
+
+private:
+    const std::vector<char>& data;
+    size_t offset;
+};
+
+} // namespace
+
+size_t writeBinaryDump(const TraceContext& context,
+                       const std::string& path,
+                       bool sync) {
+    DumpHeader header{};
+    header.magic = dump_magic;
+    header.version = dump_version;
+    header.event_size = sizeof(TraceEvent);
+    header.process_id = platform::getCurrentProcessID();
+    std::vector<DumpChunkHeader> chunk_headers;
+    const auto metadata = buildMetadata(context, header, chunk_headers);
+    header.metadata_size = metadata.size();
+
+    // Chunk headers are interleaved with the events which are written
+    // straight from the buffer. The events of compact chunks are decoded
+    // one chunk at a time so are written before the next is decoded.
+    DumpWriter writer(path);
+    writer.add(&header, sizeof(header));
+    writer.add(metadata.data(), metadata.size());
+    size_t total = sizeof(header) + metadata.size();
+    auto chunk_header = chunk_headers.begin();
+    context.getBuffer()->forEachSpan([&](const TraceBuffer::chunk_span& span) {
+        const auto events = span.events.size() * sizeof(TraceEvent);
+        writer.add(&*chunk_header, sizeof(DumpChunkHeader));
+        writer.add(span.events.data(), events);
+        if (span.decoded) {
+            writer.flush();
+        }
+        total += sizeof(DumpChunkHeader) + events;
+        ++chunk_header;
+    });
+    writer.finish(sync);
+    return total;
+}
+
+struct BinaryDumpReader::Tracepoint {
+    std::string category;
+    std::string name;
+    std::array<std::string, arg_count> argument_names;
+    tracepoint_info info;
+};
+
+BinaryDumpReader::BinaryDumpReader(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::system_error(errno,
+                                std::system_category(),
+                                "phosphor::tools::BinaryDumpReader: Couldn't"
+                                " open file: " +
+                                        path);
+    }
+    data.resize(size_t(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.data(), data.size())) {
+        throw std::system_error(errno,
+                                std::system_category(),
+                                "phosphor::tools::BinaryDumpReader: Couldn't"
+                                " read file: " +
+                                        path);
+    }
+
+    DumpCursor cursor(data, 0);
+    const auto header = cursor.value<DumpHeader>();
+    if (header.magic != dump_magic || header.version != dump_version) {
+        throw std::runtime_error(
+                "phosphor::tools::BinaryDumpReader: Not a phosphor dump: " +
+                path);
+    }
+    if (header.event_size != sizeof(TraceEvent)) {
+        throw std::runtime_error(
+                "phosphor::tools::BinaryDumpReader: Dump was written with an "
+                "incompatible event size of " +
+                std::to_string(header.event_size));
+    }
+
+    for (uint32_t i = 0; i < header.tracepoint_count; ++i) {
+        auto tp = utils::make_unique<Tracepoint>();
+        const auto address = cursor.value<uint64_t>();
+        tp->info.type = TraceEventType(cursor.value<uint32_t>());
+        for (auto& type : tp->info.argument_types) {
+            type = TraceArgumentType(cursor.value<uint32_t>());
+            // Strings recorded by pointer and stacks lived in the
+            // writer's address space
+            if (type == TraceArgumentType::is_string) {
+                type = TraceArgumentType::is_pointer;
+            } else if (type == TraceArgumentType::is_stack) {
+                type = TraceArgumentType::is_uint;
+            }
+        }
+        tp->category = cursor.string().first;
+        tp->name = cursor.string().first;
+        tp->info.category = tp->category.c_str();
+        tp->info.name = tp->name.c_str();
+        for (size_t arg = 0; arg < arg_count; ++arg) {
+            auto name = cursor.string();
+            tp->argument_names[arg] = std::move(name.first);
+            tp->info.argument_names[arg] =
+                    name.second ? nullptr : tp->argument_names[arg].c_str();
+        }
+        tracepoints[address] = std::move(tp);
+    }
+    for (uint64_t i = 0; i < header.thread_count; ++i) {
+        const auto thread_id = cursor.value<uint64_t>();
+        thread_names[thread_id] = cursor.string().first;
+    }
+    // Interned strings are interned again into the reader's own table
+    for (uint64_t i = 0; i < header.string_count; ++i) {
+        const auto id = cursor.value<uint64_t>();
+        strings[id] = string_table.intern(cursor.string().first);
+    }
+
+    chunks_offset = cursor.position();
+    if (chunks_offset != sizeof(DumpHeader) + header.metadata_size) {
+        throw std::runtime_error(
+                "phosphor::tools::BinaryDumpReader: Corrupt metadata");
+    }
+    chunk_count = header.chunk_count;
+    process_id = header.process_id;
+}
+
+BinaryDumpReader::~BinaryDumpReader() = default;
+
+size_t BinaryDumpReader::decode(const EventCallback& callback) const {
+    using namespace std::chrono;
+    size_t decoded_count = 0;
+    DumpCursor cursor(data, chunks_offset);
+    for (uint64_t i = 0; i < chunk_count; ++i) {
+        const auto chunk = cursor.value<DumpChunkHeader>();
+        for (uint32_t e = 0; e < chunk.event_count; ++e) {
+            const auto event = cursor.value<TraceEvent>();
+            const auto it = tracepoints.find(uint64_t(
+                    reinterpret_cast<uintptr_t>(event.getTracepointInfo())));
+            if (it == tracepoints.end()) {
+                continue;
+            }
+            auto args = event.getArgs();
+            for (size_t arg = 0; arg < arg_count; ++arg) {
+                if (it->second->info.argument_types[arg] ==
+                    TraceArgumentType::is_interned) {
+                    const auto string = strings.find(args[arg].as_interned.id);
+                    args[arg].as_interned = string == strings.end()
+                                                    ? interned_string{0}
+                                                    : string->second;
+                }
+            }
+            TraceEvent decoded(
+                    &it->second->info,
+                    steady_clock::time_point(duration_cast<steady_clock::duration>(
+                            nanoseconds(event.getTime()))),
+                    duration_cast<steady_clock::duration>(
+                            nanoseconds(event.getDuration())),
+                    std::move(args));
+            callback(decoded, chunk.thread_id, chunk.process_id);
+            ++decoded_count;
+        }
+    }
+    return decoded_count;
+}
+
+std::string BinaryDumpReader::toJSON() const {
+    std::string output = "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& thread : thread_names) {
+        if (!first) {
+            output += ",";
+        }
+        output += utils::format_string(
+                R"({"name":"thread_name","ph":"M","pid":%d,)"
+                R"("tid":%d,"args":{"name":"%s"}})",
+                int(process_id),
+                int(thread.first),
+                thread.second.c_str());
+        first = false;
+    }
+    decode([&output, &first](const TraceEvent& event,
+                             uint32_t thread_id,
+                             uint32_t process_id) {
+        if (!first) {
+            output += ",";
+        }
+        output += event.to_json(thread_id, process_id);
+        first = false;
+    });
+    output += "]}";
+    return output;
+}
+
+} // namespace phosphor::tools
@@ -11,13 +11,108 @@
 
 #include "phosphor/tools/export.h"
 #include "phosphor/platform/thread.h"
+#include "phosphor/tools/binary_dump.h"
 #include "utils/memory.h"
 #include "utils/string_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <ctime>
 #include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace phosphor::tools {
 
+namespace {
+
+std::string formatFilePath(std::string target) {
+    utils::string_replace(
+            target, "%p", std::to_string(platform::getCurrentProcessID()));
+
+    const auto now = std::chrono::system_clock::to_time_t(
+            std::chrono::system_clock::now());
+    std::string timestamp;
+    timestamp.resize(sizeof("YYYY-MM-DDTHH:MM:SSZ"));
+    strftime(&timestamp[0],
+             timestamp.size(),
+             "%Y.%m.%dT%H.%M.%SZ",
+             gmtime(&now));
+    timestamp.resize(timestamp.size() - 1);
+    utils::string_replace(target, "%d", timestamp);
+    return target;
+}
+
+void syncFile(FILE* fp, const std::string& path) {
+    // Anything still in the stdio buffer must reach the file first
+    auto ret = fflush(fp);
+    if (ret == 0) {
+#ifdef _WIN32
+        ret = _commit(_fileno(fp));
+#else
+        ret = fsync(fileno(fp));
+#endif
+    }
+    if (ret != 0) {
+        throw std::system_error(errno,
+                                std::system_category(),
+                                "phosphor::tools::syncFile(): Couldn't"
+                                " sync file: " +
+                                        path);
+    }
+}
+
+/**
+ * Write the JSON export of a context to a file in write_size pieces
+ */
+void writeContextToFile(const std::string& path,
+                        const TraceContext& context,
+                        size_t write_size,
+                        AsyncFileStopCallback::SyncPolicy sync) {
+    using SyncPolicy = AsyncFileStopCallback::SyncPolicy;
+
+    const auto fp = utils::make_unique_FILE(path.c_str(), "w");
+    if (!fp) {
+        throw std::system_error(
+                errno,
+                std::system_category(),
+                "phosphor::tools::ToFileStoppedCallback(): Couldn't"
+                " Couldn't open file: " +
+                        path);
+    }
+    // Pieces at least as large as the stdio buffer are already batched so
+    // skip the buffer, smaller pieces (e.g. the 4KiB of FileStopCallback)
+    // are still coalesced by it rather than each being a write(2)
+    if (write_size >= BUFSIZ) {
+        setvbuf(fp.get(), nullptr, _IONBF, 0);
+    }
+
+    std::vector<char> chunk(write_size);
+    JSONExport exporter(context);
+    while (const auto count = exporter.read(chunk.data(), chunk.size())) {
+        const auto ret = fwrite(chunk.data(), sizeof(chunk[0]), count, fp.get());
+        if (ret != count) {
+            throw std::runtime_error(
+                    "phosphor::tools::ToFileStoppedCallback(): Couldn't"
+                    " write entire chunk: " +
+                    std::to_string(ret));
+        }
+        if (sync == SyncPolicy::every_write) {
+            syncFile(fp.get(), path);
+        }
+    }
+    if (sync == SyncPolicy::on_close) {
+        syncFile(fp.get(), path);
+    }
+}
+
+} // namespace
+
 std::string threadAssociationToString(
         const std::pair<uint64_t, std::string>& assoc) {
     return utils::format_string(R"({"name":"thread_name","ph":"M","pid":%d,)"
@@ -27,14 +122,29 @@ std::string threadAssociationToString(
                                 assoc.second.c_str());
 }
 
-JSONExport::JSONExport(const TraceContext& _context)
+JSONExport::JSONExport(const TraceContext& _context, EventQuery _query)
     : context(_context),
-      it(context.getBuffer()->begin()),
+      query(std::move(_query)),
+      chunks(context.getBuffer()->query(query)),
       tit(context.getThreadNames().begin()) {
 }
 
 JSONExport::~JSONExport() = default;
 
+bool JSONExport::findEvent() {
+    while (chunk_index < chunks.size()) {
+        const auto& chunk = *chunks[chunk_index];
+        for (; event_index < chunk.count(); ++event_index) {
+            if (query.matches(chunk[event_index])) {
+                return true;
+            }
+        }
+        ++chunk_index;
+        event_index = 0;
+    }
+    return false;
+}
+
 size_t JSONExport::read(char* out, size_t length) {
     std::string event_json;
     size_t cursor = 0;
@@ -54,7 +164,7 @@ size_t JSONExport::read(char* out, size_t length) {
             cache = "{\"traceEvents\":[";
             if (tit != context.getThreadNames().end()) {
                 state = State::first_thread;
-            } else if (it != context.getBuffer()->end()) {
+            } else if (findEvent()) {
                 state = State::first_event;
             } else {
                 state = State::footer;
@@ -62,15 +172,17 @@ size_t JSONExport::read(char* out, size_t length) {
             break;
         case State::other_events:
             cache += ",";
-        case State::first_event:
-            event_json = it->to_json(it.getParent().threadID());
-            ++it;
+        case State::first_event: {
+            const auto& chunk = *chunks[chunk_index];
+            event_json = chunk[event_index].to_json(chunk.threadID());
+            ++event_index;
             cache += event_json;
             state = State::other_events;
-            if (it == context.getBuffer()->end()) {
+            if (!findEvent()) {
                 state = State::footer;
             }
             break;
+        }
         case State::other_threads:
             cache += ",";
         case State::first_thread:
@@ -79,7 +191,7 @@ size_t JSONExport::read(char* out, size_t length) {
             cache += event_json;
             state = State::other_threads;
             if (tit == context.getThreadNames().end()) {
-                if (it != context.getBuffer()->end()) {
+                if (findEvent()) {
                     state = State::other_events;
                 } else {
                     state = State::footer;
@@ -129,48 +241,100 @@ FileStopCallback::~FileStopCallback() = default;
 
 void FileStopCallback::operator()(TraceLog& log,
                                   std::lock_guard<TraceLog>& lh) {
-    const auto formatted_path = generateFilePath();
-    const auto fp = utils::make_unique_FILE(formatted_path.c_str(), "w");
-    if (!fp) {
-        throw std::system_error(
-                errno,
-                std::system_category(),
-                "phosphor::tools::ToFileStoppedCallback(): Couldn't"
-                " Couldn't open file: " +
-                        formatted_path);
+    const TraceContext context = log.getTraceContext(lh);
+    writeContextToFile(generateFilePath(),
+                       context,
+                       4096,
+                       AsyncFileStopCallback::SyncPolicy::none);
+}
+
+std::string FileStopCallback::generateFilePath() const {
+    return formatFilePath(file_path);
+}
+
+AsyncFileStopCallback::AsyncFileStopCallback(std::string file_path)
+    : AsyncFileStopCallback(std::move(file_path), Options()) {
+}
+
+AsyncFileStopCallback::AsyncFileStopCallback(std::string file_path,
+                                             Options options)
+    : file_path(std::move(file_path)), options(std::move(options)) {
+    if (this->options.write_size == 0) {
+        throw std::invalid_argument(
+                "AsyncFileStopCallback::AsyncFileStopCallback: write_size "
+                "must be non-zero");
     }
+}
 
-    const TraceContext context = log.getTraceContext(lh);
-    char chunk[4096];
-    JSONExport exporter(context);
-    while (const auto count = exporter.read(chunk, sizeof(chunk))) {
-        const auto ret = fwrite(chunk, sizeof(chunk[0]), count, fp.get());
-        if (ret != count) {
-            throw std::runtime_error(
-                    "phosphor::tools::ToFileStoppedCallback(): Couldn't"
-                    " write entire chunk: " +
-                    std::to_string(ret));
+AsyncFileStopCallback::~AsyncFileStopCallback() = default;
+
+void AsyncFileStopCallback::operator()(TraceLog& log,
+                                       std::lock_guard<TraceLog>& lh) {
+    // The writer doesn't reference this object so it may safely outlive
+    // the callback
+    auto write = [path = generateFilePath(),
+                  context = log.getTraceContext(lh),
+                  format = options.format,
+                  write_size = options.write_size,
+                  sync = options.sync,
+                  on_complete = options.on_complete]() {
+        std::exception_ptr error;
+        try {
+            if (format == Format::binary) {
+                writeBinaryDump(context, path, sync != SyncPolicy::none);
+            } else {
+                writeContextToFile(path, context, write_size, sync);
+            }
+        } catch (...) {
+            error = std::current_exception();
         }
-    }
+        if (on_complete) {
+            on_complete(path, error);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    };
+
+    std::lock_guard<std::mutex> guard(mutex);
+    // Forget about completed writes so they don't accumulate
+    writes.erase(std::remove_if(writes.begin(),
+                                writes.end(),
+                                [](const std::shared_future<void>& f) {
+                                    return f.wait_for(std::chrono::seconds(
+                                                   0)) ==
+                                           std::future_status::ready;
+                                }),
+                 writes.end());
+    // Unlike the future of std::async, the future of a packaged_task
+    // doesn't block when the last reference to it is dropped, so neither
+    // destroying the callback nor forgetting the write waits for it
+    std::packaged_task<void()> task(std::move(write));
+    writes.push_back(task.get_future().share());
+    std::thread(std::move(task)).detach();
 }
 
-std::string FileStopCallback::generateFilePath() const {
-    std::string target = file_path;
+std::shared_future<void> AsyncFileStopCallback::getLastWrite() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (writes.empty()) {
+        return {};
+    }
+    return writes.back();
+}
 
-    utils::string_replace(
-            target, "%p", std::to_string(platform::getCurrentProcessID()));
+void AsyncFileStopCallback::wait() const {
+    std::vector<std::shared_future<void>> pending;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        pending = writes;
+    }
+    for (const auto& write : pending) {
+        write.wait();
+    }
+}
 
-    const auto now = std::chrono::system_clock::to_time_t(
-            std::chrono::system_clock::now());
-    std::string timestamp;
-    timestamp.resize(sizeof("YYYY-MM-DDTHH:MM:SSZ"));
-    strftime(&timestamp[0],
-             timestamp.size(),
-             "%Y.%m.%dT%H.%M.%SZ",
-             gmtime(&now));
-    timestamp.resize(timestamp.size() - 1);
-    utils::string_replace(target, "%d", timestamp);
-    return target;
+std::string AsyncFileStopCallback::generateFilePath() const {
+    return formatFilePath(file_path);
 }
 
 } // namespace phosphor::tools
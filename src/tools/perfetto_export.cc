@@ -0,0 +1,565 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+#include "phosphor/tools/export.h"
+#include "utils/memory.h"
+#include "utils/string_utils.h"
+
+namespace phosphor::tools {
+
+namespace {
+
+/*
+ * Field numbers and enum values of the subset of the Perfetto trace
+ * protos (protos/perfetto/trace/...) which are written by the export.
+ */
+namespace proto {
+namespace Trace {
+constexpr uint32_t packet = 1;
+}
+namespace TracePacket {
+constexpr uint32_t clock_snapshot = 6;
+constexpr uint32_t timestamp = 8;
+constexpr uint32_t trusted_packet_sequence_id = 10;
+constexpr uint32_t track_event = 11;
+constexpr uint32_t interned_data = 12;
+constexpr uint32_t sequence_flags = 13;
+constexpr uint32_t timestamp_clock_id = 58;
+constexpr uint32_t trace_packet_defaults = 59;
+constexpr uint32_t track_descriptor = 60;
+
+constexpr uint64_t SEQ_INCREMENTAL_STATE_CLEARED = 1;
+constexpr uint64_t SEQ_NEEDS_INCREMENTAL_STATE = 2;
+} // namespace TracePacket
+namespace ClockSnapshot {
+constexpr uint32_t clocks = 1;
+constexpr uint32_t primary_trace_clock = 2;
+namespace Clock {
+constexpr uint32_t clock_id = 1;
+constexpr uint32_t timestamp = 2;
+constexpr uint32_t is_incremental = 3;
+} // namespace Clock
+} // namespace ClockSnapshot
+namespace BuiltinClock {
+constexpr uint64_t MONOTONIC = 3;
+}
+namespace TracePacketDefaults {
+constexpr uint32_t track_event_defaults = 11;
+constexpr uint32_t timestamp_clock_id = 58;
+} // namespace TracePacketDefaults
+namespace TrackEventDefaults {
+constexpr uint32_t track_uuid = 11;
+}
+namespace TrackDescriptor {
+constexpr uint32_t uuid = 1;
+constexpr uint32_t name = 2;
+constexpr uint32_t process = 3;
+constexpr uint32_t thread = 4;
+constexpr uint32_t parent_uuid = 5;
+} // namespace TrackDescriptor
+namespace ProcessDescriptor {
+constexpr uint32_t pid = 1;
+}
+namespace ThreadDescriptor {
+constexpr uint32_t pid = 1;
+constexpr uint32_t tid = 2;
+constexpr uint32_t thread_name = 5;
+} // namespace ThreadDescriptor
+namespace TrackEvent {
+constexpr uint32_t category_iids = 3;
+constexpr uint32_t debug_annotations = 4;
+constexpr uint32_t type = 9;
+constexpr uint32_t name_iid = 10;
+constexpr uint32_t track_uuid = 11;
+
+constexpr uint64_t TYPE_SLICE_BEGIN = 1;
+constexpr uint64_t TYPE_SLICE_END = 2;
+constexpr uint64_t TYPE_INSTANT = 3;
+} // namespace TrackEvent
+namespace DebugAnnotation {
+constexpr uint32_t name_iid = 1;
+constexpr uint32_t bool_value = 2;
+constexpr uint32_t uint_value = 3;
+constexpr uint32_t int_value = 4;
+constexpr uint32_t double_value = 5;
+constexpr uint32_t string_value = 6;
+constexpr uint32_t pointer_value = 7;
+} // namespace DebugAnnotation
+namespace InternedData {
+constexpr uint32_t event_categories = 1;
+constexpr uint32_t event_names = 2;
+constexpr uint32_t debug_annotation_names = 3;
+} // namespace InternedData
+// EventCategory, EventName and DebugAnnotationName share a layout
+namespace InternedString {
+constexpr uint32_t iid = 1;
+constexpr uint32_t name = 2;
+} // namespace InternedString
+} // namespace proto
+
+// Sequence-scoped clock used for delta-encoded timestamps
+constexpr uint64_t incremental_clock_id = 64;
+
+/**
+ * Minimal protobuf encoder, nested messages are encoded into their
+ * own ProtoWriter and then added to the parent.
+ */
+class ProtoWriter {
+public:
+    ProtoWriter& varint(uint32_t field, uint64_t value) {
+        tag(field, 0);
+        encodeVarint(value);
+        return *this;
+    }
+
+    ProtoWriter& fixed64(uint32_t field, uint64_t value) {
+        tag(field, 1);
+        for (int i = 0; i < 8; ++i) {
+            data.push_back(char(value >> (i * 8)));
+        }
+        return *this;
+    }
+
+    ProtoWriter& bytes(uint32_t field, std::string_view value) {
+        tag(field, 2);
+        encodeVarint(value.size());
+        data.append(value.data(), value.size());
+        return *this;
+    }
+
+    ProtoWriter& message(uint32_t field, const ProtoWriter& value) {
+        return bytes(field, value.data);
+    }
+
+    bool empty() const {
+        return data.empty();
+    }
+
+    const std::string& str() const {
+        return data;
+    }
+
+private:
+    void tag(uint32_t field, uint32_t wire_type) {
+        encodeVarint((uint64_t(field) << 3) | wire_type);
+    }
+
+    void encodeVarint(uint64_t value) {
+        while (value >= 0x80) {
+            data.push_back(char((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        data.push_back(char(value));
+    }
+
+    std::string data;
+};
+
+void appendPacket(std::string& out, const ProtoWriter& packet) {
+    ProtoWriter trace;
+    trace.message(proto::Trace::packet, packet);
+    out += trace.str();
+}
+
+uint64_t mixUuid(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t processUuid(uint32_t process_id) {
+    return mixUuid(0x100000000ULL | process_id);
+}
+
+uint64_t threadUuid(uint32_t process_id, uint32_t thread_id) {
+    return mixUuid((uint64_t(process_id) << 32) | thread_id) ^ 1;
+}
+
+uint64_t asyncUuid(uint32_t process_id, const char* name, const void* id) {
+    uint64_t hash = std::hash<std::string_view>{}(name);
+    return mixUuid(hash ^ reinterpret_cast<uintptr_t>(id) ^
+                   (uint64_t(process_id) << 32)) ^
+           2;
+}
+
+} // namespace
+
+struct PerfettoExport::Sequence {
+    uint32_t id;
+    uint32_t process_id;
+    uint64_t track_uuid;
+    // Current value of the incremental clock
+    uint64_t last_timestamp;
+
+    using InternTable = std::unordered_map<std::string_view, uint64_t>;
+    InternTable categories;
+    InternTable names;
+    InternTable annotation_names;
+
+    /**
+     * Get the interning id of a string, adding it to the interned data
+     * of the current packet if it's new to the sequence.
+     */
+    uint64_t intern(InternTable& table,
+                    std::string_view value,
+                    ProtoWriter& interned,
+                    uint32_t interned_field) {
+        auto it = table.find(value);
+        if (it != table.end()) {
+            return it->second;
+        }
+        const uint64_t iid = table.size() + 1;
+        table.emplace(value, iid);
+        interned.message(interned_field,
+                         ProtoWriter()
+                                 .varint(proto::InternedString::iid, iid)
+                                 .bytes(proto::InternedString::name, value));
+        return iid;
+    }
+};
+
+PerfettoExport::PerfettoExport(const TraceContext& _context)
+    : context(_context), it(context.getBuffer()->begin()) {
+}
+
+PerfettoExport::~PerfettoExport() = default;
+
+PerfettoExport::Sequence& PerfettoExport::getSequence(uint32_t process_id,
+                                                      uint32_t thread_id,
+                                                      uint64_t timestamp) {
+    const auto key = (uint64_t(process_id) << 32) | thread_id;
+    auto found = sequences.find(key);
+    if (found != sequences.end()) {
+        return *found->second;
+    }
+
+    auto sequence = utils::make_unique<Sequence>();
+    sequence->id = uint32_t(sequences.size() + 1);
+    sequence->process_id = process_id;
+    sequence->track_uuid = threadUuid(process_id, thread_id);
+    sequence->last_timestamp = timestamp;
+
+    // Start the sequence by defining the incremental clock relative to
+    // the monotonic clock used by phosphor
+    using namespace proto;
+    ProtoWriter snapshot;
+    snapshot.message(ClockSnapshot::clocks,
+                     ProtoWriter()
+                             .varint(ClockSnapshot::Clock::clock_id,
+                                     BuiltinClock::MONOTONIC)
+                             .varint(ClockSnapshot::Clock::timestamp,
+                                     sequence->last_timestamp));
+    snapshot.message(ClockSnapshot::clocks,
+                     ProtoWriter()
+                             .varint(ClockSnapshot::Clock::clock_id,
+                                     incremental_clock_id)
+                             .varint(ClockSnapshot::Clock::timestamp,
+                                     sequence->last_timestamp)
+                             .varint(ClockSnapshot::Clock::is_incremental, 1));
+    snapshot.varint(ClockSnapshot::primary_trace_clock, BuiltinClock::MONOTONIC);
+
+    ProtoWriter defaults;
+    defaults.varint(TracePacketDefaults::timestamp_clock_id,
+                    incremental_clock_id);
+    defaults.message(TracePacketDefaults::track_event_defaults,
+                     ProtoWriter().varint(TrackEventDefaults::track_uuid,
+                                          sequence->track_uuid));
+
+    appendPacket(cache,
+                 ProtoWriter()
+                         .varint(TracePacket::timestamp,
+                                 sequence->last_timestamp)
+                         .varint(TracePacket::timestamp_clock_id,
+                                 BuiltinClock::MONOTONIC)
+                         .varint(TracePacket::trusted_packet_sequence_id,
+                                 sequence->id)
+                         .message(TracePacket::clock_snapshot, snapshot)
+                         .message(TracePacket::trace_packet_defaults, defaults)
+                         .varint(TracePacket::sequence_flags,
+                                 TracePacket::SEQ_INCREMENTAL_STATE_CLEARED));
+
+    // Describe the process and thread tracks
+    const auto process_uuid = processUuid(process_id);
+    if (tracks.insert(process_uuid).second) {
+        ProtoWriter descriptor;
+        descriptor.varint(TrackDescriptor::uuid, process_uuid);
+        descriptor.message(
+                TrackDescriptor::process,
+                ProtoWriter().varint(ProcessDescriptor::pid, process_id));
+        appendPacket(cache,
+                     ProtoWriter()
+                             .varint(TracePacket::trusted_packet_sequence_id,
+                                     sequence->id)
+                             .message(TracePacket::track_descriptor,
+                                      descriptor));
+    }
+
+    ProtoWriter thread;
+    thread.varint(ThreadDescriptor::pid, process_id);
+    thread.varint(ThreadDescriptor::tid, thread_id);
+    const auto& thread_names = context.getThreadNames();
+    const auto name = thread_names.find(thread_id);
+    if (name != thread_names.end()) {
+        thread.bytes(ThreadDescriptor::thread_name, name->second);
+    }
+    tracks.insert(sequence->track_uuid);
+    appendPacket(cache,
+                 ProtoWriter()
+                         .varint(TracePacket::trusted_packet_sequence_id,
+                                 sequence->id)
+                         .message(TracePacket::track_descriptor,
+                                  ProtoWriter()
+                                          .varint(TrackDescriptor::uuid,
+                                                  sequence->track_uuid)
+                                          .varint(TrackDescriptor::parent_uuid,
+                                                  process_uuid)
+                                          .message(TrackDescriptor::thread,
+                                                   thread)));
+
+    return *sequences.emplace(key, std::move(sequence)).first->second;
+}
+
+void PerfettoExport::writeEvent(const TraceEvent& event, Sequence& sequence) {
+    using namespace proto;
+    const auto* tpi = event.getTracepointInfo();
+
+    // Interned data must be emitted in (or before) the first packet to
+    // reference it, so it is written into the first packet of the event
+    ProtoWriter interned;
+    ProtoWriter track_event;
+    track_event.varint(TrackEvent::category_iids,
+                       sequence.intern(sequence.categories,
+                                       tpi->category,
+                                       interned,
+                                       InternedData::event_categories));
+    track_event.varint(TrackEvent::name_iid,
+                       sequence.intern(sequence.names,
+                                       tpi->name,
+                                       interned,
+                                       InternedData::event_names));
+
+    uint64_t type = TrackEvent::TYPE_INSTANT;
+    size_t first_arg = 0;
+    switch (tpi->type) {
+    case TraceEvent::Type::AsyncStart:
+    case TraceEvent::Type::AsyncEnd: {
+        // Async events are placed on a track per id (which is the first
+        // argument) so that they may overlap other slices
+        const auto uuid = asyncUuid(
+                sequence.process_id, tpi->name, event.getArgs()[0].as_pointer);
+        if (tracks.insert(uuid).second) {
+            appendPacket(
+                    cache,
+                    ProtoWriter()
+                            .varint(TracePacket::trusted_packet_sequence_id,
+                                    sequence.id)
+                            .message(TracePacket::track_descriptor,
+                                     ProtoWriter()
+                                             .varint(TrackDescriptor::uuid,
+                                                     uuid)
+                                             .varint(TrackDescriptor::
+                                                             parent_uuid,
+                                                     processUuid(
+                                                             sequence.process_id))
+                                             .bytes(TrackDescriptor::name,
+                                                    tpi->name)));
+        }
+        track_event.varint(TrackEvent::track_uuid, uuid);
+        type = tpi->type == TraceEvent::Type::AsyncStart
+                       ? TrackEvent::TYPE_SLICE_BEGIN
+                       : TrackEvent::TYPE_SLICE_END;
+        first_arg = 1;
+        break;
+    }
+    case TraceEvent::Type::SyncStart:
+    case TraceEvent::Type::Complete:
+        type = TrackEvent::TYPE_SLICE_BEGIN;
+        break;
+    case TraceEvent::Type::SyncEnd:
+        type = TrackEvent::TYPE_SLICE_END;
+        break;
+    case TraceEvent::Type::Instant:
+    case TraceEvent::Type::Sample:
+        break;
+    case TraceEvent::Type::GlobalInstant:
+        track_event.varint(TrackEvent::track_uuid,
+                           processUuid(sequence.process_id));
+        break;
+    }
+    track_event.varint(TrackEvent::type, type);
+
+    const auto& args = event.getArgs();
+    for (size_t i = first_arg; i < arg_count; ++i) {
+        const auto arg_type = tpi->argument_types[i];
+        if (arg_type == TraceArgument::Type::is_none) {
+            break;
+        }
+        ProtoWriter annotation;
+        annotation.varint(DebugAnnotation::name_iid,
+                          sequence.intern(sequence.annotation_names,
+                                          tpi->argument_names[i]
+                                                  ? tpi->argument_names[i]
+                                                  : "",
+                                          interned,
+                                          InternedData::debug_annotation_names));
+        switch (arg_type) {
+        case TraceArgument::Type::is_bool:
+            annotation.varint(DebugAnnotation::bool_value, args[i].as_bool);
+            break;
+        case TraceArgument::Type::is_uint:
+            annotation.varint(DebugAnnotation::uint_value, args[i].as_uint);
+            break;
+        case TraceArgument::Type::is_int:
+            annotation.varint(DebugAnnotation::int_value,
+                              uint64_t(args[i].as_int));
+            break;
+        case TraceArgument::Type::is_double: {
+            uint64_t bits;
+            std::memcpy(&bits, &args[i].as_double, sizeof(bits));
+            annotation.fixed64(DebugAnnotation::double_value, bits);
+            break;
+        }
+        case TraceArgument::Type::is_pointer:
+            annotation.varint(DebugAnnotation::pointer_value,
+                              reinterpret_cast<uintptr_t>(args[i].as_pointer));
+            break;
+        case TraceArgument::Type::is_string:
+            annotation.bytes(DebugAnnotation::string_value,
+                             args[i].as_string ? args[i].as_string : "");
+            break;
+        case TraceArgument::Type::is_istring:
+            annotation.bytes(DebugAnnotation::string_value,
+                             std::string(args[i].as_istring));
+            break;
+        case TraceArgument::Type::is_interned:
+            annotation.bytes(DebugAnnotation::string_value,
+                             StringTable::resolve(args[i].as_interned));
+            break;
+        case TraceArgument::Type::is_stack:
+            annotation.bytes(DebugAnnotation::string_value,
+                             utils::join_string(
+                                     StackTable::getInstance().symbolize(
+                                             args[i].as_stack),
+                                     '\n'));
+            break;
+        case TraceArgument::Type::is_none:
+            break;
+        }
+        track_event.message(TrackEvent::debug_annotations, annotation);
+    }
+
+    const auto cpu = event.getCPU();
+    if (cpu >= 0) {
+        track_event.message(
+                TrackEvent::debug_annotations,
+                ProtoWriter()
+                        .varint(DebugAnnotation::name_iid,
+                                sequence.intern(
+                                        sequence.annotation_names,
+                                        "cpu",
+                                        interned,
+                                        InternedData::debug_annotation_names))
+                        .varint(DebugAnnotation::uint_value, uint64_t(cpu)));
+    }
+
+    auto writePacket = [this, &sequence](uint64_t time,
+                                         const ProtoWriter& interned,
+                                         const ProtoWriter& track_event) {
+        ProtoWriter packet;
+        if (time >= sequence.last_timestamp) {
+            packet.varint(TracePacket::timestamp,
+                          time - sequence.last_timestamp);
+            sequence.last_timestamp = time;
+        } else {
+            // The incremental clock can't go backwards (e.g. a Complete
+            // event which started before the previous event was logged)
+            // so use an absolute timestamp instead.
+            packet.varint(TracePacket::timestamp, time);
+            packet.varint(TracePacket::timestamp_clock_id,
+                          BuiltinClock::MONOTONIC);
+        }
+        packet.varint(TracePacket::trusted_packet_sequence_id, sequence.id);
+        if (!interned.empty()) {
+            packet.message(TracePacket::interned_data, interned);
+        }
+        packet.message(TracePacket::track_event, track_event);
+        packet.varint(TracePacket::sequence_flags,
+                      TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
+        appendPacket(cache, packet);
+    };
+
+    writePacket(event.getTime(), interned, track_event);
+
+    if (tpi->type == TraceEvent::Type::Complete) {
+        writePacket(event.getTime() + event.getDuration(),
+                    ProtoWriter(),
+                    ProtoWriter().varint(TrackEvent::type,
+                                         TrackEvent::TYPE_SLICE_END));
+    }
+}
+
+size_t PerfettoExport::read(char* out, size_t length) {
+    size_t cursor = 0;
+
+    while (cursor < length && !(finished && cache.empty())) {
+        if (!cache.empty()) {
+            const auto copied = cache.copy((out + cursor), length - cursor);
+            cache.erase(0, copied);
+            cursor += copied;
+
+            if (cursor >= length) {
+                break;
+            }
+        }
+        if (it == context.getBuffer()->end()) {
+            finished = true;
+            continue;
+        }
+        const auto& chunk = it.getParent();
+        auto& sequence = getSequence(
+                chunk.processID(), chunk.threadID(), it->getTime());
+        writeEvent(*it, sequence);
+        ++it;
+    }
+    return cursor;
+}
+
+std::string PerfettoExport::read(size_t length) {
+    std::string out;
+    out.resize(length, '\0');
+    out.resize(read(&out[0], length));
+    return out;
+}
+
+std::string PerfettoExport::read() {
+    std::string out;
+
+    size_t last_wrote;
+    do {
+        out.resize(out.size() + 4096);
+        last_wrote = read(&out[out.size() - 4096], 4096);
+    } while (!done());
+
+    out.resize(out.size() - (4096 - last_wrote));
+    return out;
+}
+
+bool PerfettoExport::done() {
+    return finished && cache.empty();
+}
+
+} // namespace phosphor::tools
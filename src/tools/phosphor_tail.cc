@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+/*
+ * phosphor-tail displays a rolling view of the tracepoints firing in a
+ * running process which has been configured to mirror its trace buffer
+ * into a shared memory segment (e.g. with "tail-segment:/memcached").
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <phosphor/shared_memory_buffer.h>
+#include <phosphor/tools/tail.h>
+
+static void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [options] <segment>\n"
+              << "\n"
+              << "  -i <ms>     Refresh interval (default 1000)\n"
+              << "  -w <count>  Number of intervals to average over "
+                 "(default 5)\n"
+              << "  -n <rows>   Number of rows to display (default 25)\n"
+              << "  -c          Summarise by category\n"
+              << "  -x <count>  Exit after the given number of refreshes\n";
+}
+
+int main(int argc, char** argv) {
+    std::chrono::milliseconds interval{1000};
+    size_t window = 5;
+    size_t limit = 25;
+    bool by_category = false;
+    size_t iterations = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:w:n:cx:")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = std::chrono::milliseconds(std::atol(optarg));
+            break;
+        case 'w':
+            window = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'n':
+            limit = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'c':
+            by_category = true;
+            break;
+        case 'x':
+            iterations = std::strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || interval.count() <= 0 || window == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        phosphor::SharedMemoryReader reader(argv[optind]);
+        phosphor::tools::TailAggregator aggregator(window);
+        const bool clear = isatty(STDOUT_FILENO);
+
+        auto last = std::chrono::steady_clock::now();
+        for (size_t i = 0; iterations == 0 || i < iterations; ++i) {
+            std::this_thread::sleep_for(interval);
+            reader.decode([&aggregator](const phosphor::TraceEvent& event,
+                                        uint32_t,
+                                        uint32_t) { aggregator.add(event); });
+            const auto now = std::chrono::steady_clock::now();
+            aggregator.advance(now - last);
+            last = now;
+
+            if (clear) {
+                std::cout << "\033[2J\033[H";
+            }
+            std::cout << phosphor::tools::TailAggregator::format(
+                                 aggregator.getRows(by_category), limit)
+                      << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
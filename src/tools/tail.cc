@@ -0,0 +1,115 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include "phosphor/tools/tail.h"
+#include "utils/string_utils.h"
+
+namespace phosphor::tools {
+
+TailAggregator::Totals& TailAggregator::Totals::operator+=(
+        const Totals& other) {
+    count += other.count;
+    complete += other.complete;
+    total_duration += other.total_duration;
+    max_duration = std::max(max_duration, other.max_duration);
+    return *this;
+}
+
+TailAggregator::TailAggregator(size_t window_)
+    : window(window_), intervals(1) {
+    if (window == 0) {
+        throw std::invalid_argument(
+                "TailAggregator::TailAggregator: window must be non-zero");
+    }
+}
+
+void TailAggregator::add(const TraceEvent& event) {
+    auto& totals =
+            intervals.back().totals[{event.getCategory(), event.getName()}];
+    ++totals.count;
+    if (event.getType() == TraceEvent::Type::Complete) {
+        const auto duration = event.getDuration();
+        ++totals.complete;
+        totals.total_duration += duration;
+        totals.max_duration = std::max(totals.max_duration, duration);
+    }
+}
+
+void TailAggregator::advance(std::chrono::steady_clock::duration length) {
+    intervals.back().length = length;
+    if (intervals.size() > window) {
+        intervals.pop_front();
+    }
+    intervals.emplace_back();
+}
+
+std::vector<TailAggregator::Row> TailAggregator::getRows(
+        bool by_category) const {
+    std::map<Key, Totals> sums;
+    std::chrono::steady_clock::duration length{};
+    // The last interval is still open so isn't included
+    for (auto it = intervals.begin(); it != std::prev(intervals.end()); ++it) {
+        length += it->length;
+        for (const auto& entry : it->totals) {
+            Key key = entry.first;
+            if (by_category) {
+                key.second.clear();
+            }
+            sums[key] += entry.second;
+        }
+    }
+
+    const auto seconds =
+            std::chrono::duration_cast<std::chrono::duration<double>>(length)
+                    .count();
+    std::vector<Row> rows;
+    for (const auto& entry : sums) {
+        const auto& totals = entry.second;
+        rows.push_back({entry.first.first,
+                        entry.first.second,
+                        totals.count,
+                        seconds > 0 ? totals.count / seconds : 0,
+                        totals.complete ? totals.total_duration /
+                                                  totals.complete
+                                        : 0,
+                        totals.max_duration});
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.rate > b.rate;
+    });
+    return rows;
+}
+
+std::string TailAggregator::format(const std::vector<Row>& rows,
+                                   size_t limit) {
+    std::string output = utils::format_string("%-24s %-32s %12s %12s %12s\n",
+                                              "CATEGORY",
+                                              "NAME",
+                                              "RATE/s",
+                                              "MEAN(us)",
+                                              "MAX(us)");
+    for (size_t i = 0; i < rows.size() && i < limit; ++i) {
+        const auto& row = rows[i];
+        output += utils::format_string("%-24.24s %-32.32s %12.1f %12.3f %12.3f\n",
+                                       row.category.c_str(),
+                                       row.name.c_str(),
+                                       row.rate,
+                                       row.mean_duration_ns / 1000.0,
+                                       row.max_duration_ns / 1000.0);
+    }
+    return output;
+}
+
+} // namespace phosphor::tools
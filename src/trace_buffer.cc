@@ -9,16 +9,21 @@
  *   the file licenses/APL2.txt.
  */
 
+#include <algorithm>
+#include <limits>
+#include <map>
 #include <mutex>
 #include <stdexcept>
 
 #include <dvyukov/mpmc_bounded_queue.h>
-#include <gsl_p/dyn_array.h>
 
 #include "utils/memory.h"
+#include "utils/streaming_store.h"
+#include <phosphor/category_registry.h>
 #include <phosphor/platform/thread.h>
 #include <phosphor/stats_callback.h>
 #include <phosphor/trace_buffer.h>
+#include <phosphor/tracepoint_table.h>
 
 namespace phosphor {
 
@@ -28,40 +33,237 @@ namespace phosphor {
 
 void TraceChunk::reset(uint32_t _thread_id) {
     next_free = 0;
+    event_format = EventFormat::full;
+    streaming = false;
     thread_id = _thread_id;
+    process_id = platform::getCurrentProcessID();
+    min_time = std::numeric_limits<uint64_t>::max();
+    max_time = 0;
+    category_mask = 0;
 }
 
-bool TraceChunk::isFull() const {
-    return next_free == chunk.max_size();
+void TraceChunk::setFormat(EventFormat format) {
+    if (next_free != 0) {
+        throw std::logic_error(
+                "phosphor::TraceChunk::setFormat: "
+                "Cannot change the format of a chunk with events");
+    }
+    event_format = format;
 }
 
-size_t TraceChunk::count() const {
-    return next_free;
+bool TraceChunk::isFull() const {
+    return next_free == capacity();
 }
 
 TraceEvent& TraceChunk::addEvent() {
+    if (event_format == EventFormat::compact) {
+        throw std::logic_error(
+                "phosphor::TraceChunk::addEvent: "
+                "Events of a compact chunk cannot be assigned in place");
+    }
     if (isFull()) {
         throw std::out_of_range(
                 "phosphor::TraceChunk::addEvent: "
                 "All events in chunk have been used");
     }
+    min_time = 0;
+    max_time = std::numeric_limits<uint64_t>::max();
+    category_mask = all_categories;
     return chunk[next_free++];
 }
 
-const TraceEvent& TraceChunk::operator[](const size_t index) const {
-    return chunk[index];
+void TraceChunk::addEvent(const TraceEvent& event, size_t category_group) {
+    if (isFull()) {
+        throw std::out_of_range(
+                "phosphor::TraceChunk::addEvent: "
+                "All events in chunk have been used");
+    }
+    if (!canAdd(event)) {
+        throw std::out_of_range(
+                "phosphor::TraceChunk::addEvent: "
+                "Event is too far from the base time of the chunk");
+    }
+    category_mask |= uint64_t(1) << (category_group % 64);
+    store(event);
+}
+
+bool TraceChunk::canAdd(const TraceEvent& event) const {
+    if (isFull()) {
+        return false;
+    }
+    if (event_format == EventFormat::full || next_free == 0) {
+        return true;
+    }
+    const auto offset = event.getTime() - int64_t(base_time);
+    return offset >= std::numeric_limits<int32_t>::min() &&
+           offset <= std::numeric_limits<int32_t>::max();
+}
+
+size_t TraceChunk::append(const_iterator first,
+                          const_iterator last,
+                          uint64_t mask) {
+    size_t copied = 0;
+    for (; first != last; ++first, ++copied) {
+        const auto event = *first;
+        if (!canAdd(event)) {
+            break;
+        }
+        store(event);
+    }
+    if (copied) {
+        category_mask |= mask;
+    }
+    return copied;
+}
+
+void TraceChunk::truncate(size_t new_count) {
+    if (new_count < next_free) {
+        next_free = new_count;
+    }
+}
+
+void TraceChunk::store(const TraceEvent& event) {
+    const auto time = uint64_t(event.getTime());
+    min_time = std::min(min_time, time);
+    max_time = std::max(max_time, time);
+    if (event_format == EventFormat::full) {
+        if (streaming) {
+            utils::streamingStore(chunk[next_free++], event);
+        } else {
+            chunk[next_free++] = event;
+        }
+        return;
+    }
+    if (next_free == 0) {
+        base_time = time;
+    }
+    const CompactEvent compact = {
+            TracepointTable::getInstance().indexOf(event.getTracepointInfo()),
+            int32_t(event.getTime() - int64_t(base_time)),
+            // Keep the CPU number packed into the duration's high bits
+            event.getDuration() |
+                    (uint64_t(event.getCPU() + 1) << TraceEvent::cpu_shift),
+            event.getArgs()};
+    if (streaming) {
+        utils::streamingStore(compact_chunk[next_free++], compact);
+    } else {
+        compact_chunk[next_free++] = compact;
+    }
+}
+
+TraceEvent TraceChunk::decode(size_t index) const {
+    using namespace std::chrono;
+    const auto& compact = compact_chunk[index];
+    auto args = compact.args;
+    TraceEvent event(
+            TracepointTable::getInstance().lookup(compact.tpi_index),
+            steady_clock::time_point(steady_clock::duration(
+                    int64_t(base_time) + compact.time_offset)),
+            steady_clock::duration(compact.duration &
+                                   TraceEvent::max_duration),
+            std::move(args));
+    event.setCPU(int(compact.duration >> TraceEvent::cpu_shift) - 1);
+    return event;
 }
 
 uint32_t TraceChunk::threadID() const {
     return thread_id;
 }
 
-TraceChunk::const_iterator TraceChunk::begin() const {
-    return chunk.begin();
+uint32_t TraceChunk::processID() const {
+    return process_id;
+}
+
+
+/*
+ * EventQuery implementation
+ */
+EventQuery::EventQuery()
+    : begin_time(0),
+      end_time(std::numeric_limits<uint64_t>::max()),
+      group_mask(TraceChunk::all_categories) {
+}
+
+EventQuery& EventQuery::setTimeRange(
+        std::chrono::steady_clock::time_point begin,
+        std::chrono::steady_clock::time_point end) {
+    using namespace std::chrono;
+    begin_time = duration_cast<nanoseconds>(begin.time_since_epoch()).count();
+    end_time = duration_cast<nanoseconds>(end.time_since_epoch()).count();
+    return *this;
+}
+
+EventQuery& EventQuery::setCategories(std::vector<std::string> _categories,
+                                      uint64_t _group_mask) {
+    categories = std::move(_categories);
+    group_mask = _group_mask;
+    category_cache.clear();
+    return *this;
+}
+
+bool EventQuery::matches(const TraceChunk& chunk) const {
+    return chunk.count() != 0 && chunk.maxTime() >= begin_time &&
+           chunk.minTime() < end_time &&
+           (chunk.categoryMask() & group_mask) != 0;
+}
+
+bool EventQuery::matches(const TraceEvent& event) const {
+    const auto time = uint64_t(event.getTime());
+    if (time < begin_time || time >= end_time) {
+        return false;
+    }
+    if (categories.empty()) {
+        return true;
+    }
+    const auto* tpi = event.getTracepointInfo();
+    auto cached = category_cache.find(tpi);
+    if (cached == category_cache.end()) {
+        const auto status = CategoryRegistry::calculateEnabled(
+                tpi->category, categories, {});
+        cached = category_cache
+                         .emplace(tpi, status == CategoryStatus::Enabled)
+                         .first;
+    }
+    return cached->second;
+}
+
+std::vector<const TraceChunk*> TraceBuffer::query(
+        const EventQuery& query) const {
+    std::vector<const TraceChunk*> matching;
+    forEachChunk([&query, &matching](const TraceChunk& chunk) {
+        if (query.matches(chunk)) {
+            matching.push_back(&chunk);
+        }
+    });
+    return matching;
+}
+
+void TraceBuffer::forEachChunk(const chunk_callback& callback) const {
+    const auto count = chunk_count();
+    for (size_t i = 0; i < count; ++i) {
+        callback((*this)[i]);
+    }
+}
+
+void TraceBuffer::forEachSpan(const span_callback& callback) const {
+    std::vector<TraceEvent> scratch;
+    forEachChunk([&callback, &scratch](const TraceChunk& chunk) {
+        if (chunk.count()) {
+            callback(getSpan(chunk, scratch));
+        }
+    });
 }
 
-TraceChunk::const_iterator TraceChunk::end() const {
-    return chunk.begin() + count();
+TraceBuffer::chunk_span TraceBuffer::getSpan(
+        const TraceChunk& chunk, std::vector<TraceEvent>& scratch) {
+    if (chunk.format() == EventFormat::full) {
+        return {chunk.events(), chunk.threadID(), chunk.processID(), false};
+    }
+    scratch.assign(chunk.begin(), chunk.end());
+    return {{scratch.data(), scratch.size()},
+            chunk.threadID(),
+            chunk.processID(),
+            true};
 }
 
 /*
@@ -69,30 +271,117 @@ TraceChunk::const_iterator TraceChunk::end() const {
  */
 TraceBuffer::chunk_iterator::chunk_iterator(const TraceBuffer& buffer_,
                                             size_t index_)
-    : buffer(buffer_), index(index_) {
+    : buffer(buffer_), index(index_), chunk(nullptr) {
 }
 
 TraceBuffer::chunk_iterator::chunk_iterator(const TraceBuffer& buffer_)
     : chunk_iterator(buffer_, 0) {
 }
 
-const TraceChunk& TraceBuffer::chunk_iterator::operator*() const {
-    return buffer[index];
+
+/*
+ * ChunkStorage implementation
+ */
+ChunkStorage::ChunkStorage(size_t size)
+    : chunks(new TraceChunk[size]), count(size) {
+}
+
+ChunkStorage::ChunkStorage(std::unique_ptr<TraceChunk[]> chunks_,
+                           size_t count_,
+                           std::weak_ptr<ChunkStoragePool> pool_)
+    : chunks(std::move(chunks_)), count(count_), pool(std::move(pool_)) {
 }
-const TraceChunk* TraceBuffer::chunk_iterator::operator->() const {
-    return &(buffer[index]);
+
+ChunkStorage::ChunkStorage(ChunkStorage&& other) noexcept
+    : chunks(std::move(other.chunks)),
+      count(other.count),
+      pool(std::move(other.pool)) {
+    other.count = 0;
 }
-TraceBuffer::chunk_iterator& TraceBuffer::chunk_iterator::operator++() {
-    ++index;
-    return *this;
+
+ChunkStorage::~ChunkStorage() {
+    if (chunks) {
+        if (auto owner = pool.lock()) {
+            owner->release(std::move(chunks), count);
+        }
+    }
+}
+
+/*
+ * ChunkStoragePool implementation
+ */
+ChunkStoragePool::ChunkStoragePool(size_t max_retained_)
+    : max_retained(max_retained_) {
+}
+
+ChunkStorage ChunkStoragePool::acquire(size_t size) {
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        // Prefer the most recently released storage as it is the most
+        // likely to still be resident
+        for (auto it = retained.rbegin(); it != retained.rend(); ++it) {
+            if (it->size == size) {
+                auto chunks = std::move(it->chunks);
+                retained.erase(std::next(it).base());
+                ++reused;
+                return ChunkStorage(std::move(chunks), size, weak_from_this());
+            }
+        }
+        ++allocated;
+    }
+    // Allocate without holding the lock
+    return ChunkStorage(std::unique_ptr<TraceChunk[]>(new TraceChunk[size]),
+                        size,
+                        weak_from_this());
+}
+
+void ChunkStoragePool::release(std::unique_ptr<TraceChunk[]> chunks,
+                               size_t size) {
+    // Storage which isn't retained is freed after the lock is dropped
+    std::unique_ptr<TraceChunk[]> discarded;
+    std::lock_guard<std::mutex> lh(mutex);
+    if (max_retained == 0) {
+        return;
+    }
+    if (retained.size() == max_retained) {
+        discarded = std::move(retained.front().chunks);
+        retained.erase(retained.begin());
+    }
+    retained.push_back({std::move(chunks), size});
+}
+
+void ChunkStoragePool::setMaxRetained(size_t max_retained_) {
+    std::vector<Retained> discarded;
+    std::lock_guard<std::mutex> lh(mutex);
+    max_retained = max_retained_;
+    if (retained.size() > max_retained) {
+        const auto excess = retained.size() - max_retained;
+        std::move(retained.begin(),
+                  retained.begin() + excess,
+                  std::back_inserter(discarded));
+        retained.erase(retained.begin(), retained.begin() + excess);
+    }
 }
-bool TraceBuffer::chunk_iterator::operator==(
-        const TraceBuffer::chunk_iterator& other) const {
-    return &buffer == &(other.buffer) && index == other.index;
+
+void ChunkStoragePool::clear() {
+    std::vector<Retained> discarded;
+    std::lock_guard<std::mutex> lh(mutex);
+    discarded.swap(retained);
 }
-bool TraceBuffer::chunk_iterator::operator!=(
-        const TraceBuffer::chunk_iterator& other) const {
-    return !(*this == other);
+
+void ChunkStoragePool::getStats(StatsCallback& addStats) const {
+    using namespace std::string_view_literals;
+    std::lock_guard<std::mutex> lh(mutex);
+    size_t retained_chunks = 0;
+    for (const auto& storage : retained) {
+        retained_chunks += storage.size;
+    }
+    addStats("buffer_pool_max_retained"sv, max_retained);
+    addStats("buffer_pool_retained"sv, retained.size());
+    addStats("buffer_pool_retained_bytes"sv,
+             retained_chunks * sizeof(TraceChunk));
+    addStats("buffer_pool_reused"sv, reused);
+    addStats("buffer_pool_allocated"sv, allocated);
 }
 
 /**
@@ -101,8 +390,11 @@ bool TraceBuffer::chunk_iterator::operator!=(
  */
 class FixedTraceBuffer : public TraceBuffer {
 public:
-    FixedTraceBuffer(size_t generation_, size_t buffer_size_)
-        : buffer(buffer_size_), issued(0), on_loan(0), generation(generation_) {
+    FixedTraceBuffer(size_t generation_, ChunkStorage buffer_)
+        : buffer(std::move(buffer_)),
+          issued(0),
+          on_loan(0),
+          generation(generation_) {
     }
 
     ~FixedTraceBuffer() override = default;
@@ -156,6 +448,13 @@ public:
         return (buffer.size() > tmp) ? tmp : buffer.size();
     }
 
+    void forEachChunk(const chunk_callback& callback) const override {
+        const auto count = chunk_count();
+        for (size_t i = 0; i < count; ++i) {
+            callback(buffer[i]);
+        }
+    }
+
     chunk_iterator chunk_begin() const override {
         return chunk_iterator(*this);
     }
@@ -173,7 +472,7 @@ public:
     }
 
 protected:
-    gsl_p::dyn_array<TraceChunk> buffer;
+    ChunkStorage buffer;
     // This is the total number of chunks loaned out
     std::atomic<size_t> issued;
     // This is the number of chunks currently loaned out
@@ -183,7 +482,15 @@ protected:
 
 std::unique_ptr<TraceBuffer> make_fixed_buffer(size_t generation,
                                                size_t buffer_size) {
-    return utils::make_unique<FixedTraceBuffer>(generation, buffer_size);
+    return utils::make_unique<FixedTraceBuffer>(generation,
+                                                ChunkStorage(buffer_size));
+}
+
+buffer_ptr make_pooled_fixed_buffer(size_t generation,
+                                    size_t buffer_size,
+                                    ChunkStoragePool& pool) {
+    return utils::make_unique<FixedTraceBuffer>(generation,
+                                                pool.acquire(buffer_size));
 }
 
 /**
@@ -192,11 +499,20 @@ std::unique_ptr<TraceBuffer> make_fixed_buffer(size_t generation,
  */
 class RingTraceBuffer : public TraceBuffer {
 public:
-    RingTraceBuffer(size_t generation_, size_t buffer_size_)
+    /**
+     * Number of attempts made to pull a chunk from the return queue
+     * before giving up. This bounds the time a thread can spin when
+     * every chunk in the buffer is on loan (e.g. when there are more
+     * tenants than chunks).
+     */
+    static constexpr size_t max_dequeue_attempts = 1024;
+
+    RingTraceBuffer(size_t generation_, ChunkStorage buffer_)
         : actual_count(0),
           on_loan(0),
-          buffer(buffer_size_),
-          return_queue(upper_power_of_two(buffer_size_)),
+          failed_acquisitions(0),
+          buffer(std::move(buffer_)),
+          return_queue(upper_power_of_two(buffer.size())),
           generation(generation_) {
     }
 
@@ -210,7 +526,16 @@ public:
         // Once we've handed out more chunks than the buffer size, start
         // pulling chunks from the queue
         if (offset >= buffer.size()) {
+            size_t attempts = 0;
             while (!return_queue.dequeue(chunk)) {
+                if (++attempts == max_dequeue_attempts) {
+                    // Every chunk is on loan, rather than stalling the
+                    // caller let it know that it should drop the event.
+                    // The offset isn't consumed so undo the increment.
+                    --actual_count;
+                    ++failed_acquisitions;
+                    return nullptr;
+                }
             }
         } else {
             chunk = &buffer[offset];
@@ -242,6 +567,7 @@ public:
         addStats("buffer_loaned_chunks"sv, on_loan);
         addStats("buffer_size"sv, buffer.size());
         addStats("buffer_generation"sv, generation);
+        addStats("buffer_failed_acquisitions"sv, failed_acquisitions);
     }
 
     size_t getGeneration() const override {
@@ -265,6 +591,13 @@ public:
         return actual_count;
     }
 
+    void forEachChunk(const chunk_callback& callback) const override {
+        const auto count = chunk_count();
+        for (size_t i = 0; i < count; ++i) {
+            callback(buffer[i]);
+        }
+    }
+
     chunk_iterator chunk_begin() const override {
         return chunk_iterator(*this);
     }
@@ -286,7 +619,9 @@ protected:
     std::atomic<size_t> actual_count;
     // This is the number of chunks currently loaned out
     RelaxedAtomic<size_t> on_loan;
-    gsl_p::dyn_array<TraceChunk> buffer;
+    // This is the number of times getChunk() gave up waiting for a chunk
+    RelaxedAtomic<size_t> failed_acquisitions;
+    ChunkStorage buffer;
     dvyukov::mpmc_bounded_queue<TraceChunk*> return_queue;
     size_t generation;
 
@@ -311,7 +646,161 @@ private:
 
 std::unique_ptr<TraceBuffer> make_ring_buffer(size_t generation,
                                               size_t buffer_size) {
-    return utils::make_unique<RingTraceBuffer>(generation, buffer_size);
+    return utils::make_unique<RingTraceBuffer>(generation,
+                                               ChunkStorage(buffer_size));
+}
+
+buffer_ptr make_pooled_ring_buffer(size_t generation,
+                                   size_t buffer_size,
+                                   ChunkStoragePool& pool) {
+    return utils::make_unique<RingTraceBuffer>(generation,
+                                               pool.acquire(buffer_size));
+}
+
+/**
+ * StatsCallback which sums the size_t stats reported by several buffers
+ */
+class SummingStatsCallback : public StatsCallback {
+public:
+    void operator()(std::string_view, std::string_view) override {
+    }
+    void operator()(std::string_view, bool) override {
+    }
+    void operator()(std::string_view key, size_t value) override {
+        sums[std::string(key)] += value;
+    }
+    void operator()(std::string_view, ssize_t) override {
+    }
+    void operator()(std::string_view, double) override {
+    }
+
+    size_t get(const std::string& key) const {
+        auto it = sums.find(key);
+        return it == sums.end() ? 0 : it->second;
+    }
+
+private:
+    std::map<std::string, size_t> sums;
+};
+
+/**
+ * TraceBuffer implementation that divides events between a number of
+ * independent sub-buffers, one per partition.
+ */
+class PartitionedTraceBuffer : public TraceBuffer {
+public:
+    PartitionedTraceBuffer(std::vector<buffer_ptr> partitions_)
+        : partitions(std::move(partitions_)) {
+        if (partitions.empty() || partitions.size() > max_buffer_partitions) {
+            throw std::invalid_argument(
+                    "phosphor::PartitionedTraceBuffer: Invalid number of "
+                    "partitions (" +
+                    std::to_string(partitions.size()) + ")");
+        }
+    }
+
+    ~PartitionedTraceBuffer() override = default;
+
+    TraceChunk* getChunk() override {
+        return getPartitionChunk(0);
+    }
+
+    void returnChunk(TraceChunk& chunk) override {
+        returnPartitionChunk(chunk, 0);
+    }
+
+    TraceChunk* getPartitionChunk(size_t partition) override {
+        return partitions[partition]->getChunk();
+    }
+
+    void returnPartitionChunk(TraceChunk& chunk, size_t partition) override {
+        partitions[partition]->returnChunk(chunk);
+    }
+
+    size_t partitionCount() const override {
+        return partitions.size();
+    }
+
+    bool isFull() const override {
+        return std::all_of(partitions.begin(),
+                           partitions.end(),
+                           [](const buffer_ptr& p) { return p->isFull(); });
+    }
+
+    void getStats(StatsCallback& addStats) const override {
+        using namespace std::string_view_literals;
+        SummingStatsCallback sums;
+        for (const auto& partition : partitions) {
+            partition->getStats(sums);
+        }
+        addStats("buffer_name"sv, "PartitionedTraceBuffer"sv);
+        addStats("buffer_is_full"sv, isFull());
+        addStats("buffer_chunk_count"sv, sums.get("buffer_chunk_count"));
+        addStats("buffer_total_loaned"sv, sums.get("buffer_total_loaned"));
+        addStats("buffer_loaned_chunks"sv, sums.get("buffer_loaned_chunks"));
+        addStats("buffer_size"sv, sums.get("buffer_size"));
+        addStats("buffer_generation"sv, getGeneration());
+        addStats("buffer_partition_count"sv, partitions.size());
+    }
+
+    size_t getGeneration() const override {
+        return partitions.front()->getGeneration();
+    }
+
+    BufferMode bufferMode() const override {
+        return partitions.front()->bufferMode();
+    }
+
+    const TraceChunk& operator[](size_t index) const override {
+        // Indexes past the end are forwarded to the last partition, as
+        // with the other buffers the event iterator relies on being able
+        // to get the (unused) chunk at chunk_count().
+        for (size_t i = 0; i < partitions.size() - 1; ++i) {
+            const auto count = partitions[i]->chunk_count();
+            if (index < count) {
+                return (*partitions[i])[index];
+            }
+            index -= count;
+        }
+        return (*partitions.back())[index];
+    }
+
+    size_t chunk_count() const override {
+        size_t count = 0;
+        for (const auto& partition : partitions) {
+            count += partition->chunk_count();
+        }
+        return count;
+    }
+
+    void forEachChunk(const chunk_callback& callback) const override {
+        for (const auto& partition : partitions) {
+            partition->forEachChunk(callback);
+        }
+    }
+
+    chunk_iterator chunk_begin() const override {
+        return chunk_iterator(*this);
+    }
+
+    chunk_iterator chunk_end() const override {
+        return chunk_iterator(*this, chunk_count());
+    }
+
+    event_iterator begin() const override {
+        return event_iterator(chunk_begin(), chunk_end());
+    }
+
+    event_iterator end() const override {
+        return event_iterator(chunk_end(), chunk_end());
+    }
+
+protected:
+    std::vector<buffer_ptr> partitions;
+};
+
+buffer_ptr make_partitioned_buffer(std::vector<buffer_ptr> partitions) {
+    return utils::make_unique<PartitionedTraceBuffer>(std::move(partitions));
 }
 
 BufferMode parseBufferMode(std::string_view mode) {
@@ -327,6 +816,17 @@ BufferMode parseBufferMode(std::string_view mode) {
     throw std::invalid_argument("parseBufferMode(): Invalid buffer mode: " +
                                 std::string(mode));
 }
+
+EventFormat parseEventFormat(std::string_view format) {
+    if (format == "full") {
+        return EventFormat::full;
+    }
+    if (format == "compact") {
+        return EventFormat::compact;
+    }
+    throw std::invalid_argument("parseEventFormat(): Invalid event format: " +
+                                std::string(format));
+}
 } // namespace phosphor
 
 std::string to_string(phosphor::BufferMode mode) {
@@ -342,3 +842,15 @@ std::string to_string(phosphor::BufferMode mode) {
             "to_string(BufferMode): " + std::to_string(uint64_t(mode)) +
             " is not a valid BufferMode");
 }
+
+std::string to_string(phosphor::EventFormat format) {
+    switch (format) {
+    case phosphor::EventFormat::full:
+        return "full";
+    case phosphor::EventFormat::compact:
+        return "compact";
+    }
+    throw std::invalid_argument(
+            "to_string(EventFormat): " + std::to_string(uint64_t(format)) +
+            " is not a valid EventFormat");
+}
@@ -9,6 +9,7 @@
  *   the file licenses/APL2.txt.
  */
 
+#include <algorithm>
 #include <cstring>
 #include <exception>
 #include <string>
@@ -43,6 +44,30 @@ TraceConfig* TraceLogConfig::getStartupTrace() const {
     return startup_trace.get();
 }
 
+TraceLogConfig& TraceLogConfig::setBufferPoolSize(size_t _buffer_pool_size) {
+    buffer_pool_size = _buffer_pool_size;
+    return *this;
+}
+
+size_t TraceLogConfig::getBufferPoolSize() const {
+    return buffer_pool_size;
+}
+
+TraceLogConfig& TraceLogConfig::setStringTableSize(
+        size_t _string_table_size) {
+    if (_string_table_size == 0) {
+        throw std::invalid_argument(
+                "phosphor::TraceLogConfig::setStringTableSize: "
+                "string_table_size must be greater than 0");
+    }
+    string_table_size = _string_table_size;
+    return *this;
+}
+
+size_t TraceLogConfig::getStringTableSize() const {
+    return string_table_size;
+}
+
 TraceLogConfig& TraceLogConfig::fromEnvironment() {
     const char* startup_config = std::getenv("PHOSPHOR_TRACING_START");
     if (startup_config && strlen(startup_config)) {
@@ -142,6 +167,117 @@ const std::vector<std::string>& TraceConfig::getDisabledCategories() const {
     return disabled_categories;
 }
 
+TraceConfig& TraceConfig::addPartition(
+        const std::vector<std::string>& categories, size_t buffer_size) {
+    // The default partition takes up one of the partitions
+    if (partitions.size() + 1 >= max_buffer_partitions) {
+        throw std::invalid_argument(
+                "phosphor::TraceConfig::addPartition: Cannot add more than " +
+                std::to_string(max_buffer_partitions - 1) + " partitions");
+    }
+    partitions.push_back({categories, buffer_size});
+    return *this;
+}
+
+const std::vector<BufferPartition>& TraceConfig::getPartitions() const {
+    return partitions;
+}
+
+TraceConfig& TraceConfig::setCategoryThreshold(
+        const std::string& category, std::chrono::nanoseconds threshold) {
+    auto it = std::find_if(category_thresholds.begin(),
+                           category_thresholds.end(),
+                           [&category](const CategoryThresholds::value_type&
+                                               entry) {
+                               return entry.first == category;
+                           });
+    if (it != category_thresholds.end()) {
+        it->second = threshold;
+    } else {
+        category_thresholds.emplace_back(category, threshold);
+    }
+    return *this;
+}
+
+const CategoryThresholds& TraceConfig::getCategoryThresholds() const {
+    return category_thresholds;
+}
+
+TraceConfig& TraceConfig::setCountedCategories(
+        std::vector<std::string> categories) {
+    counted_categories = std::move(categories);
+    return *this;
+}
+
+const std::vector<std::string>& TraceConfig::getCountedCategories() const {
+    return counted_categories;
+}
+
+TraceConfig& TraceConfig::setStackThreshold(
+        std::chrono::nanoseconds threshold) {
+    stack_threshold = threshold;
+    return *this;
+}
+
+std::chrono::nanoseconds TraceConfig::getStackThreshold() const {
+    return stack_threshold;
+}
+
+TraceConfig& TraceConfig::setSampleInterval(
+        std::chrono::nanoseconds interval) {
+    sample_interval = interval;
+    return *this;
+}
+
+std::chrono::nanoseconds TraceConfig::getSampleInterval() const {
+    return sample_interval;
+}
+
+TraceConfig& TraceConfig::setTailSegment(std::string name) {
+    tail_segment = std::move(name);
+    return *this;
+}
+
+const std::string& TraceConfig::getTailSegment() const {
+    return tail_segment;
+}
+
+TraceConfig& TraceConfig::setEventFormat(EventFormat format) {
+    event_format = format;
+    return *this;
+}
+
+EventFormat TraceConfig::getEventFormat() const {
+    return event_format;
+}
+
+TraceConfig& TraceConfig::setStreamingStores(bool enabled) {
+    streaming_stores = enabled;
+    return *this;
+}
+
+bool TraceConfig::getStreamingStores() const {
+    return streaming_stores;
+}
+
+TraceConfig& TraceConfig::setSpareChunks(bool enabled) {
+    spare_chunks = enabled;
+    return *this;
+}
+
+bool TraceConfig::getSpareChunks() const {
+    return spare_chunks;
+}
+
+TraceConfig& TraceConfig::setRecordCPU(bool enabled) {
+    record_cpu = enabled;
+    return *this;
+}
+
+bool TraceConfig::getRecordCPU() const {
+    return record_cpu;
+}
+
 void TraceConfig::updateFromString(const std::string& config) {
     auto arguments(phosphor::utils::split_string(config, ';'));
 
@@ -193,10 +329,112 @@ void TraceConfig::updateFromString(const std::string& config) {
             tracing_stopped_callback =
                     std::make_shared<tools::FileStopCallback>(value);
             stop_tracing = true;
+        } else if (key == "async-save-on-stop") {
+            tracing_stopped_callback =
+                    std::make_shared<tools::AsyncFileStopCallback>(value);
+            stop_tracing = true;
         } else if (key == "enabled-categories") {
             enabled_categories = utils::split_string(value, ',');
         } else if (key == "disabled-categories") {
             disabled_categories = utils::split_string(value, ',');
+        } else if (key == "category-thresholds") {
+            // Comma separated list of category=nanoseconds pairs
+            category_thresholds.clear();
+            for (const auto& entry : utils::split_string(value, ',')) {
+                auto pair(utils::split_string(entry, '='));
+                if (pair.size() != 2) {
+                    throw std::invalid_argument(
+                            "TraceConfig::fromString: "
+                            "Category thresholds must be given as "
+                            "'category=nanoseconds' pairs");
+                }
+                long long ns;
+                try {
+                    ns = std::stoll(pair[1]);
+                } catch (std::logic_error&) {
+                    throw std::invalid_argument(
+                            "TraceConfig::fromString: "
+                            "category threshold was not a valid integer");
+                }
+                if (ns < 0) {
+                    throw std::invalid_argument(
+                            "TraceConfig::fromString: "
+                            "category threshold cannot be negative");
+                }
+                setCategoryThreshold(pair[0], std::chrono::nanoseconds(ns));
+            }
+        } else if (key == "counted-categories") {
+            counted_categories = utils::split_string(value, ',');
+        } else if (key == "stack-threshold") {
+            long long ns;
+            try {
+                ns = std::stoll(value);
+            } catch (std::logic_error&) {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "stack threshold was not a valid integer");
+            }
+            if (ns < 0) {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "stack threshold cannot be negative");
+            }
+            stack_threshold = std::chrono::nanoseconds(ns);
+        } else if (key == "sample-interval") {
+            long long ns;
+            try {
+                ns = std::stoll(value);
+            } catch (std::logic_error&) {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "sample interval was not a valid integer");
+            }
+            if (ns < 0) {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "sample interval cannot be negative");
+            }
+            sample_interval = std::chrono::nanoseconds(ns);
+        } else if (key == "tail-segment") {
+            tail_segment = value;
+        } else if (key == "event-format") {
+            try {
+                event_format = parseEventFormat(value);
+            } catch (std::invalid_argument&) {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "Invalid event format given");
+            }
+        } else if (key == "streaming-stores") {
+            if (value == "true") {
+                streaming_stores = true;
+            } else if (value == "false") {
+                streaming_stores = false;
+            } else {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "streaming-stores must be 'true' or 'false'");
+            }
+        } else if (key == "spare-chunks") {
+            if (value == "true") {
+                spare_chunks = true;
+            } else if (value == "false") {
+                spare_chunks = false;
+            } else {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "spare-chunks must be 'true' or 'false'");
+            }
+        } else if (key == "record-cpu") {
+            if (value == "true") {
+                record_cpu = true;
+            } else if (value == "false") {
+                record_cpu = false;
+            } else {
+                throw std::invalid_argument(
+                        "TraceConfig::fromString: "
+                        "record-cpu must be 'true' or 'false'");
+            }
         }
     }
 }
@@ -218,8 +456,42 @@ std::string TraceConfig::toString() const {
            << utils::join_string(enabled_categories, ',') << ";";
     result << "disabled-categories:"
            << utils::join_string(disabled_categories, ',') << "";
+    if (!category_thresholds.empty()) {
+        std::vector<std::string> thresholds;
+        for (const auto& entry : category_thresholds) {
+            thresholds.push_back(entry.first + "=" +
+                                 std::to_string(entry.second.count()));
+        }
+        result << ";category-thresholds:"
+               << utils::join_string(thresholds, ',');
+    }
+    if (!counted_categories.empty()) {
+        result << ";counted-categories:"
+               << utils::join_string(counted_categories, ',');
+    }
+    if (stack_threshold.count() != 0) {
+        result << ";stack-threshold:" << stack_threshold.count();
+    }
+    if (sample_interval.count() != 0) {
+        result << ";sample-interval:" << sample_interval.count();
+    }
+    if (!tail_segment.empty()) {
+        result << ";tail-segment:" << tail_segment;
+    }
+    if (event_format != EventFormat::full) {
+        result << ";event-format:" << to_string(event_format);
+    }
+    if (streaming_stores) {
+        result << ";streaming-stores:true";
+    }
+    if (spare_chunks) {
+        result << ";spare-chunks:true";
+    }
+    if (record_cpu) {
+        result << ";record-cpu:true";
+    }
 
-    // Can't easily do the 'save-on-stop' callback
+    // Can't easily do the 'save-on-stop' or 'async-save-on-stop' callbacks
 
     return result.str();
 }
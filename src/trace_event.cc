@@ -13,6 +13,7 @@
 
 #include "phosphor/platform/thread.h"
 #include "utils/string_utils.h"
+#include <algorithm>
 #include <cinttypes>
 
 namespace phosphor {
@@ -35,7 +36,7 @@ TraceEvent::TraceEvent(const tracepoint_info* _tpi,
     : tpi(_tpi),
       args(_args),
       time(_start.time_since_epoch().count()),
-      duration(_duration.count()) {
+      duration(std::min(uint64_t(_duration.count()), max_duration)) {
 }
 
 std::string TraceEvent::to_string() const {
@@ -71,6 +72,11 @@ std::string TraceEvent::to_string() const {
 }
 
 std::string TraceEvent::to_json(uint32_t thread_id) const {
+    return to_json(thread_id, platform::getCurrentProcessID());
+}
+
+std::string TraceEvent::to_json(uint32_t thread_id,
+                                uint32_t process_id) const {
     std::string output;
     output += "{\"name\":" + utils::to_json(getName());
     output += ",\"cat\":" + utils::to_json(getCategory());
@@ -81,7 +87,7 @@ std::string TraceEvent::to_json(uint32_t thread_id) const {
 
     const auto [time_us, time_ns] = std::lldiv(time, 1000);
     output += utils::format_string(",\"ts\":%lld.%03lld", time_us, time_ns);
-    output += ",\"pid\":" + std::to_string(platform::getCurrentProcessID());
+    output += ",\"pid\":" + std::to_string(process_id);
     output += ",\"tid\":" + std::to_string(thread_id);
 
     output += ",\"args\":{";
@@ -96,6 +102,13 @@ std::string TraceEvent::to_json(uint32_t thread_id) const {
         output += utils::to_json(tpi->argument_names[i]) + ":";
         output += args[i].to_string(tpi->argument_types[i]);
     }
+    const auto cpu = getCPU();
+    if (cpu >= 0) {
+        if (tpi->argument_types[0] != TraceArgument::Type::is_none) {
+            output += ",";
+        }
+        output += "\"cpu\":" + std::to_string(cpu);
+    }
     output += "}";
 
     output += "}";
@@ -118,6 +131,8 @@ const char* TraceEvent::typeToString(Type type) {
         return "GlobalInstant";
     case Type::Complete:
         return "Complete";
+    case Type::Sample:
+        return "Sample";
     }
     throw std::invalid_argument(
             "TraceEvent::typeToString: "
@@ -132,6 +147,10 @@ const char* TraceEvent::getCategory() const {
     return tpi->category;
 }
 
+const tracepoint_info* TraceEvent::getTracepointInfo() const {
+    return tpi;
+}
+
 TraceEvent::Type TraceEvent::getType() const {
     return tpi->type;
 }
@@ -154,7 +173,18 @@ int64_t TraceEvent::getTime() const {
 }
 
 uint64_t TraceEvent::getDuration() const {
-    return duration;
+    return duration & max_duration;
+}
+
+int TraceEvent::getCPU() const {
+    return int(duration >> cpu_shift) - 1;
+}
+
+void TraceEvent::setCPU(int cpu) {
+    if (cpu < 0 || uint64_t(cpu) + 1 > (UINT64_MAX >> cpu_shift)) {
+        return;
+    }
+    duration = getDuration() | (uint64_t(cpu + 1) << cpu_shift);
 }
 
 TraceEvent::ToJsonResult TraceEvent::typeToJSON() const {
@@ -187,13 +217,20 @@ TraceEvent::ToJsonResult TraceEvent::typeToJSON() const {
         res.type = "i";
         res.extras = ",\"s\":\"g\"";
         return res;
-    case Type::Complete:
+    case Type::Complete: {
         res.type = "X";
-        const auto [dur_us, dur_ns] = std::lldiv(duration, 1000);
+        const auto [dur_us, dur_ns] = std::lldiv(getDuration(), 1000);
         res.extras =
                 utils::format_string(",\"dur\":%lld.%03lld", dur_us, dur_ns);
         return res;
     }
+    case Type::Sample:
+        // The sampled stack is the first argument
+        res.type = "P";
+        res.extras = ",\"stack\":" +
+                     args[0].to_string(tpi->argument_types[0]);
+        return res;
+    }
     throw std::invalid_argument(
             "TraceEvent::typeToJSON: Invalid TraceArgument type");
 }
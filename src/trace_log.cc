@@ -9,14 +9,18 @@
  *   the file licenses/APL2.txt.
  */
 
+#include <algorithm>
 #include <cstring>
 #include <exception>
 #include <string>
 
 #include "phosphor/platform/thread.h"
+#include "phosphor/shared_memory_buffer.h"
+#include "phosphor/stack_table.h"
 #include "phosphor/stats_callback.h"
 #include "phosphor/tools/export.h"
 #include "phosphor/trace_log.h"
+#include "phosphor/tracepoint_table.h"
 #include "utils/memory.h"
 #include "utils/string_utils.h"
 
@@ -35,8 +39,73 @@ namespace phosphor {
  */
 thread_local ChunkTenant thread_chunk;
 
+namespace {
+
+// Tracepoints of the events logged by TraceLog::logPerfCounters()
+const tracepoint_info perf_counters_tpi = {
+        "phosphor",
+        "perf_counters",
+        TraceEventType::Complete,
+        {{"instructions", "cycles"}},
+        {{TraceArgumentType::is_uint, TraceArgumentType::is_uint}}};
+
+const tracepoint_info perf_cache_tpi = {
+        "phosphor",
+        "perf_cache",
+        TraceEventType::Complete,
+        {{"llc_misses", nullptr}},
+        {{TraceArgumentType::is_uint, TraceArgumentType::is_none}}};
+
+const tracepoint_info perf_sched_tpi = {
+        "phosphor",
+        "perf_sched",
+        TraceEventType::Complete,
+        {{"context_switches", "page_faults"}},
+        {{TraceArgumentType::is_uint, TraceArgumentType::is_uint}}};
+
+// Tracepoint of the events logged by TraceLog::logStackTrace()
+const tracepoint_info stack_trace_tpi = {
+        "phosphor",
+        "stack_trace",
+        TraceEventType::Instant,
+        {{"stack", nullptr}},
+        {{TraceArgumentType::is_stack, TraceArgumentType::is_none}}};
+
+// Tracepoint of the events logged by TraceLog::logSample()
+const tracepoint_info cpu_sample_tpi = {
+        "phosphor",
+        "cpu_sample",
+        TraceEventType::Sample,
+        {{"stack", nullptr}},
+        {{TraceArgumentType::is_stack, TraceArgumentType::is_none}}};
+
+} // namespace
+
 TraceLog::TraceLog(const TraceLogConfig& _config)
-    : enabled(false), generation(0) {
+    : enabled(false),
+      buffer_pool(std::make_shared<ChunkStoragePool>(0)),
+      generation(0),
+      string_table(_config.getStringTableSize()),
+      dropped_events(0),
+      discarded_deferred_events(0),
+      partition_count(1),
+      event_format(EventFormat::full),
+      streaming_stores(false),
+      spare_chunks(false),
+      replenish_pending(false),
+      replenisher_stopping(false),
+      record_cpu(false),
+      stack_threshold(0),
+      sampling(false),
+      sample_chunks(false),
+      sample_group(0),
+      dropped_samples(0),
+      active_sessions(0),
+      callback_session(0) {
+    for (auto& entry : tracepoint_groups) {
+        entry.tpi.store(nullptr, std::memory_order_relaxed);
+        entry.group.store(0, std::memory_order_relaxed);
+    }
     configure(_config);
 }
 
@@ -44,12 +113,26 @@ TraceLog::TraceLog() : TraceLog(TraceLogConfig().fromEnvironment()) {
 }
 
 TraceLog::~TraceLog() {
-    stop(true);
+    {
+        std::lock_guard<std::mutex> lh(replenisher_mutex);
+        replenisher_stopping = true;
+    }
+    replenisher_cv.notify_one();
+    if (replenisher.joinable()) {
+        replenisher.join();
+    }
+
+    std::lock_guard<TraceLog> lh(*this);
+    for (size_t session = 1; session < max_trace_sessions; ++session) {
+        stopSession(lh, session, true);
+    }
+    stop(lh, true);
 }
 
 void TraceLog::configure(const TraceLogConfig& _config) {
     std::lock_guard<TraceLog> lh(*this);
 
+    buffer_pool->setMaxRetained(_config.getBufferPoolSize());
     if (auto* startup_trace = _config.getStartupTrace()) {
         start(lh, *startup_trace);
     }
@@ -84,7 +167,18 @@ void TraceLog::maybe_stop(size_t _generation) {
 
 void TraceLog::stop(std::lock_guard<TraceLog>& lh, bool shutdown) {
     if (enabled.exchange(false)) {
-        registry.disableAll();
+        registry.disableSession(0);
+        // Secondary sessions don't record the CPU, capture stacks or
+        // sample threads
+        record_cpu = false;
+        stack_threshold = 0;
+        if (sampling) {
+            sampling = false;
+            // A signal the timers sent before they were deleted is
+            // ignored once the handler has been uninstalled
+            sample_timers.clear();
+            platform::SampleTimer::uninstall();
+        }
         evictThreads(lh);
         auto* cb = trace_config.getStoppedCallback();
         if ((cb != nullptr) &&
@@ -103,34 +197,341 @@ void TraceLog::start(std::lock_guard<TraceLog>& lh,
                      const TraceConfig& _trace_config) {
     trace_config = _trace_config;
 
-    size_t buffer_size = trace_config.getBufferSize() / sizeof(TraceChunk);
-    if (buffer_size == 0) {
-        throw std::invalid_argument(
-                "Cannot specify a buffer size less than a single chunk (" +
-                std::to_string(sizeof(TraceChunk)) + " bytes)");
+    // Buffer sizes (in chunks) of the default partition followed by any
+    // additional partitions
+    std::vector<size_t> buffer_sizes{trace_config.getBufferSize()};
+    std::vector<std::vector<std::string>> partition_categories;
+    for (const auto& partition : trace_config.getPartitions()) {
+        buffer_sizes.push_back(partition.buffer_size);
+        partition_categories.push_back(partition.categories);
+    }
+
+    for (auto& buffer_size : buffer_sizes) {
+        buffer_size = getBufferChunks(buffer_size,
+                                      trace_config.getBufferMode(),
+                                      trace_config.getSpareChunks());
     }
 
     if (enabled) {
         stop(lh);
     }
 
-    buffer = trace_config.getBufferFactory()(generation++, buffer_size);
+    // Release the previous buffer (if it wasn't taken by getTraceContext)
+    // first so that its storage can be reused
+    buffer.reset();
+
+    if (buffer_sizes.size() == 1) {
+        buffer = makeBuffer(trace_config, generation, buffer_sizes.front());
+    } else {
+        std::vector<buffer_ptr> partitions;
+        for (const auto buffer_size : buffer_sizes) {
+            partitions.push_back(
+                    makeBuffer(trace_config, generation, buffer_size));
+        }
+        buffer = make_partitioned_buffer(std::move(partitions));
+    }
+    if (!trace_config.getTailSegment().empty()) {
+        buffer = make_tail_buffer(std::move(buffer),
+                                  trace_config.getTailSegment());
+    }
+    ++generation;
+    partition_count = buffer->partitionCount();
+    // Custom buffers may depend on the layout of full format chunks
+    event_format = trace_config.getBufferMode() == BufferMode::custom
+                           ? EventFormat::full
+                           : trace_config.getEventFormat();
+    streaming_stores = trace_config.getStreamingStores();
+    spare_chunks = trace_config.getSpareChunks();
+    record_cpu = trace_config.getRecordCPU();
+    stack_threshold = std::chrono::duration_cast<
+                              std::chrono::steady_clock::duration>(
+                              trace_config.getStackThreshold())
+                              .count();
+    registry.updatePartitions(partition_categories);
     registry.updateEnabled(trace_config.getEnabledCategories(),
-                           trace_config.getDisabledCategories());
+                           trace_config.getDisabledCategories(),
+                           trace_config.getCategoryThresholds());
+    registry.updateCounted(trace_config.getCountedCategories());
     clearDeregisteredThreads();
     enabled.store(true);
+
+    if (spare_chunks && !replenisher.joinable()) {
+        replenisher = std::thread([this]() { runReplenisher(); });
+    }
+    {
+        // Switches a waiting replenisher to its periodic pass
+        std::lock_guard<std::mutex> replenisher_lh(replenisher_mutex);
+        replenisher_cv.notify_one();
+    }
+
+    const auto sample_interval = trace_config.getSampleInterval();
+    if (sample_interval.count() != 0 &&
+        platform::SampleTimer::install(&TraceLog::handleSample)) {
+        // Do everything the handler can't do in signal context up front
+        StackTable::prime();
+        if (event_format == EventFormat::compact) {
+            TracepointTable::getInstance().indexOf(&cpu_sample_tpi);
+        }
+        sample_group = getGroupIndex(&cpu_sample_tpi);
+        sample_chunks = trace_config.getBufferMode() != BufferMode::custom &&
+                        trace_config.getTailSegment().empty();
+        sampling = true;
+        for (const auto& entry : sample_threads) {
+            armSampleTimer(entry.first, entry.second);
+        }
+    }
+}
+
+void TraceLog::armSampleTimer(ChunkTenant* tenant,
+                              const platform::SampleTimer::Thread& thread) {
+    auto timer = utils::make_unique<platform::SampleTimer>(thread, this);
+    if (timer->isValid() && timer->arm(trace_config.getSampleInterval())) {
+        sample_timers[tenant] = std::move(timer);
+    }
+}
+
+size_t TraceLog::getBufferChunks(size_t buffer_size,
+                                 BufferMode mode,
+                                 bool spares) const {
+    buffer_size /= sizeof(TraceChunk);
+    if (buffer_size == 0) {
+        throw std::invalid_argument(
+                "Cannot specify a buffer size less than a single chunk (" +
+                std::to_string(sizeof(TraceChunk)) + " bytes)");
+    }
+
+    // Every registered thread may hold a chunk (and a spare) at any one
+    // time so a ring buffer needs at least one more chunk than the
+    // tenants hold to guarantee that a chunk is always in circulation.
+    if (mode == BufferMode::ring) {
+        const size_t held = spares ? 2 : 1;
+        buffer_size = std::max(buffer_size,
+                               held * registered_chunk_tenants.size() + 1);
+    }
+    return buffer_size;
+}
+
+buffer_ptr TraceLog::makeBuffer(const TraceConfig& config,
+                                size_t buffer_generation,
+                                size_t buffer_chunks) {
+    switch (config.getBufferMode()) {
+    case BufferMode::fixed:
+        return make_pooled_fixed_buffer(
+                buffer_generation, buffer_chunks, *buffer_pool);
+    case BufferMode::ring:
+        return make_pooled_ring_buffer(
+                buffer_generation, buffer_chunks, *buffer_pool);
+    case BufferMode::custom:
+        break;
+    }
+    return config.getBufferFactory()(buffer_generation, buffer_chunks);
+}
+
+TraceLog::Session& TraceLog::getSession(size_t session) {
+    if (session == 0 || session >= max_trace_sessions) {
+        throw std::invalid_argument(
+                "phosphor::TraceLog::getSession: Invalid session id " +
+                std::to_string(session));
+    }
+    return sessions[session - 1];
+}
+
+const TraceLog::Session& TraceLog::getSession(size_t session) const {
+    return const_cast<TraceLog*>(this)->getSession(session);
+}
+
+size_t TraceLog::startSession(const TraceConfig& config) {
+    if (!config.getPartitions().empty() ||
+        !config.getTailSegment().empty() ||
+        !config.getCategoryThresholds().empty() ||
+        !config.getCountedCategories().empty() ||
+        config.getStackThreshold().count() != 0 ||
+        config.getSampleInterval().count() != 0 || config.getSpareChunks() ||
+        config.getRecordCPU()) {
+        throw std::invalid_argument(
+                "phosphor::TraceLog::startSession: Secondary sessions don't "
+                "support partitions, tail segments, category thresholds, "
+                "counted categories, stack thresholds, sampling, spare "
+                "chunks or recording the CPU");
+    }
+
+    std::lock_guard<TraceLog> lh(*this);
+    // Prefer a stopped session whose context has been taken
+    size_t id = 0;
+    for (size_t session = 1; session < max_trace_sessions; ++session) {
+        const auto& candidate = getSession(session);
+        if (!candidate.enabled && (id == 0 || !candidate.buffer)) {
+            id = session;
+            if (!candidate.buffer) {
+                break;
+            }
+        }
+    }
+    if (id == 0) {
+        throw std::logic_error(
+                "phosphor::TraceLog::startSession: All " +
+                std::to_string(max_trace_sessions - 1) +
+                " secondary sessions are running");
+    }
+
+    auto& session = getSession(id);
+    const auto buffer_chunks =
+            getBufferChunks(
+                    config.getBufferSize(), config.getBufferMode(), false);
+    // Release the previous buffer first so that its storage can be reused
+    session.buffer.reset();
+    session.trace_config = config;
+    session.buffer = makeBuffer(config, ++session.generation, buffer_chunks);
+    session.event_format = config.getBufferMode() == BufferMode::custom
+                                   ? EventFormat::full
+                                   : config.getEventFormat();
+    session.streaming_stores = config.getStreamingStores();
+    registry.updateSessionEnabled(id,
+                                  config.getEnabledCategories(),
+                                  config.getDisabledCategories());
+    session.enabled.store(true);
+    ++active_sessions;
+    return id;
+}
+
+void TraceLog::stopSession(size_t session) {
+    std::lock_guard<TraceLog> lh(*this);
+    if (session == 0) {
+        stop(lh);
+    } else {
+        stopSession(lh, session);
+    }
+}
+
+void TraceLog::stopSession(std::lock_guard<TraceLog>& lh,
+                           size_t session,
+                           bool shutdown) {
+    auto& state = getSession(session);
+    if (state.enabled.exchange(false)) {
+        --active_sessions;
+        registry.disableSession(session);
+        evictSession(lh, session);
+        auto* cb = state.trace_config.getStoppedCallback();
+        if ((cb != nullptr) &&
+            (!shutdown || state.trace_config.getStopTracingOnDestruct())) {
+            callback_session = session;
+            try {
+                (*cb)(*this, lh);
+            } catch (...) {
+                callback_session = 0;
+                throw;
+            }
+            callback_session = 0;
+        }
+    }
+}
+
+void TraceLog::maybeStopSession(size_t session, size_t _generation) {
+    if (mutex.try_lock()) {
+        std::lock_guard<TraceLog> lh(*this, std::adopt_lock);
+        if (getSession(session).generation != _generation) {
+            return;
+        }
+        stopSession(lh, session);
+    }
+}
+
+bool TraceLog::isSessionEnabled(size_t session) const {
+    return session == 0 ? isEnabled() : getSession(session).enabled.load();
+}
+
+TraceConfig TraceLog::getSessionConfig(size_t session) const {
+    if (session == 0) {
+        return getTraceConfig();
+    }
+    std::lock_guard<std::mutex> lh(mutex);
+    return getSession(session).trace_config;
+}
+
+TraceContext TraceLog::getSessionContext(size_t session) {
+    if (session == 0) {
+        return getTraceContext();
+    }
+    std::lock_guard<TraceLog> lh(*this);
+    auto& state = getSession(session);
+    if (state.enabled) {
+        throw std::logic_error(
+                "phosphor::TraceLog::getSessionContext: Cannot get the "
+                "TraceContext while the session is enabled");
+    }
+    return TraceContext(std::move(state.buffer), thread_names);
+}
+
+void TraceLog::addSessionEvent(const TraceEvent& event,
+                               size_t group,
+                               unsigned int session_mask) {
+    // Bit 0 is the primary session
+    session_mask >>= 1;
+    for (size_t session = 1; session_mask; ++session, session_mask >>= 1) {
+        if (!(session_mask & 1)) {
+            continue;
+        }
+        auto cl = getSessionChunkTenant(session, event);
+        if (cl) {
+            cl.mutex()->chunkForSession(session)->addEvent(event, group);
+        }
+    }
+}
+
+std::unique_lock<ChunkTenant> TraceLog::getSessionChunkTenant(
+        size_t session, const TraceEvent& event) {
+    // As getChunkTenant(), the session's buffer can't be replaced while
+    // the ChunkTenant lock is held
+    std::unique_lock<ChunkTenant> cl{thread_chunk, std::try_to_lock};
+    if (!cl || !thread_chunk.initialised) {
+        return {};
+    }
+
+    auto& state = sessions[session - 1];
+    auto*& chunk = thread_chunk.chunkForSession(session);
+    if (!chunk || !chunk->canAdd(event)) {
+        if (!state.enabled) {
+            return {};
+        }
+        if (chunk) {
+            state.buffer->returnChunk(*chunk);
+        }
+        chunk = state.buffer->getChunk();
+        if (!chunk) {
+            if (!state.buffer->isFull()) {
+                ++dropped_events;
+                return {};
+            }
+            size_t current = state.generation;
+            cl.unlock();
+            maybeStopSession(session, current);
+            return {};
+        }
+        chunk->setFormat(state.event_format);
+        chunk->setStreaming(state.streaming_stores);
+    }
+    return cl;
 }
 
 void TraceLog::logEvent(const tracepoint_info* tpi,
                         TraceArgument argA,
                         TraceArgument argB) {
-    if (!enabled) {
+    if (!enabled && !active_sessions) {
         return;
     }
-    auto cl = getChunkTenant();
-    if (cl) {
-        cl.mutex()->chunk->addEvent() = TraceEvent(tpi, {{argA, argB}});
+    TraceEvent event(tpi, {{argA, argB}});
+    logGroupEvent(event, getGroupIndex(tpi));
+}
+
+void TraceLog::logEvent(const tracepoint_info* tpi,
+                        const AtomicCategoryStatus& status,
+                        TraceArgument argA,
+                        TraceArgument argB) {
+    if (!enabled && !active_sessions) {
+        return;
     }
+    TraceEvent event(tpi, {{argA, argB}});
+    logGroupEvent(event, registry.getGroupIndex(status));
 }
 
 void TraceLog::logEvent(const tracepoint_info* tpi,
@@ -138,16 +539,249 @@ void TraceLog::logEvent(const tracepoint_info* tpi,
                         std::chrono::steady_clock::duration duration,
                         TraceArgument argA,
                         TraceArgument argB) {
+    if (!enabled && !active_sessions) {
+        return;
+    }
+    TraceEvent event(tpi, start, duration, {{argA, argB}});
+    logGroupEvent(event, getGroupIndex(tpi));
+}
+
+void TraceLog::logEvent(const tracepoint_info* tpi,
+                        const AtomicCategoryStatus& status,
+                        std::chrono::steady_clock::time_point start,
+                        std::chrono::steady_clock::duration duration,
+                        TraceArgument argA,
+                        TraceArgument argB) {
+    if (!enabled && !active_sessions) {
+        return;
+    }
+    TraceEvent event(tpi, start, duration, {{argA, argB}});
+    logGroupEvent(event, registry.getGroupIndex(status));
+}
+
+void TraceLog::logPerfCounters(const AtomicCategoryStatus& status,
+                               std::chrono::steady_clock::time_point start,
+                               std::chrono::steady_clock::duration duration,
+                               platform::PerfCounterSet counters,
+                               const platform::PerfCounterValues& deltas) {
+    if (!enabled && !active_sessions) {
+        return;
+    }
+    // The counters follow the scoped event into its group's partition
+    // and sessions
+    const auto group = registry.getGroupIndex(status);
+    auto logCounters = [this, start, duration, group](
+                               const tracepoint_info* counters_tpi,
+                               TraceArgument argA,
+                               TraceArgument argB) {
+        TraceEvent event(counters_tpi, start, duration, {{argA, argB}});
+        logGroupEvent(event, group);
+    };
+    switch (counters) {
+    case platform::PerfCounterSet::none:
+        return;
+    case platform::PerfCounterSet::hardware:
+        logCounters(&perf_counters_tpi, deltas[0], deltas[1]);
+        logCounters(&perf_cache_tpi, deltas[2], NoneType());
+        return;
+    case platform::PerfCounterSet::software:
+        logCounters(&perf_sched_tpi, deltas[0], deltas[1]);
+        return;
+    }
+}
+
+void TraceLog::logStackTrace(const tracepoint_info* tpi) {
+    if (!enabled && !active_sessions) {
+        return;
+    }
+    // Leave out this frame, the innermost frame is the slow scope's
+    // guard
+    const auto stack = StackTable::getInstance().capture(1);
+    if (stack.id == StackTable::npos) {
+        return;
+    }
+    TraceEvent event(&stack_trace_tpi, {{stack, NoneType()}});
+    logGroupEvent(event, getGroupIndex(tpi));
+}
+
+void TraceLog::logSample(const void* pc) {
+    // This interrupts the thread at an arbitrary point so must neither
+    // block nor allocate. The sample is dropped if the thread was
+    // interrupted while holding its ChunkTenant, and only replaces a full
+    // chunk if the buffer hands out chunks without locking.
+    if (!sampling || !thread_chunk.initialised) {
+        return;
+    }
+    if (!thread_chunk.lck.tryLockSlaveOnce()) {
+        ++dropped_samples;
+        return;
+    }
+    std::unique_lock<ChunkTenant> cl{thread_chunk, std::adopt_lock};
     if (!enabled) {
         return;
     }
-    auto cl = getChunkTenant();
+
+    const auto stack = StackTable::getInstance().captureInterrupted(pc);
+    if (stack.id == StackTable::npos) {
+        ++dropped_samples;
+        return;
+    }
+    TraceEvent event(&cpu_sample_tpi, {{stack, NoneType()}});
+    if (record_cpu) {
+        event.setCPU(platform::getCurrentCPU());
+    }
+    const size_t group = sample_group;
+    const auto partition = getGroupPartition(group);
+    auto*& chunk = thread_chunk.chunkFor(partition);
+    if ((!chunk || !chunk->canAdd(event)) &&
+        (!sample_chunks || !replaceChunk(thread_chunk, partition, false))) {
+        ++dropped_samples;
+        return;
+    }
+    chunk->addEvent(event, group);
+}
+
+void TraceLog::handleSample(void* context, const void* pc) {
+    static_cast<TraceLog*>(context)->logSample(pc);
+}
+
+void TraceLog::logGroupEvent(TraceEvent& event, size_t group) {
+    if (record_cpu) {
+        event.setCPU(platform::getCurrentCPU());
+    }
+    addEvent(event, group);
+}
+
+void TraceLog::addEvent(const TraceEvent& event, size_t group) {
+    if (active_sessions) {
+        const auto sessions = registry.getSessionMask(group);
+        addSessionEvent(event, group, sessions);
+        // The event may only have been logged for the secondary sessions
+        if (!(sessions & 1)) {
+            return;
+        }
+    }
+    if (!enabled) {
+        return;
+    }
+    if (thread_chunk.deferred_depth && thread_chunk.staging) {
+        stageEvent(event, group);
+        return;
+    }
+    const auto partition = getGroupPartition(group);
+    auto cl = getChunkTenant(partition, &event);
     if (cl) {
-        cl.mutex()->chunk->addEvent() =
-                TraceEvent(tpi, start, duration, {{argA, argB}});
+        cl.mutex()->chunkFor(partition)->addEvent(event, group);
     }
 }
 
+size_t TraceLog::beginDeferredSpan() {
+    // Only registered threads can later commit their staged events
+    if (!thread_chunk.initialised) {
+        return 0;
+    }
+    if (!thread_chunk.staging) {
+        thread_chunk.staging = utils::make_unique<TraceChunk>();
+        thread_chunk.staging->reset(platform::getCurrentThreadIDCached());
+    }
+    ++thread_chunk.deferred_depth;
+    return thread_chunk.staging->count();
+}
+
+void TraceLog::endDeferredSpan(size_t mark, bool commit) {
+    if (!thread_chunk.deferred_depth || !thread_chunk.staging) {
+        return;
+    }
+    auto& staging = *thread_chunk.staging;
+    if (!commit && mark < staging.count()) {
+        discarded_deferred_events += staging.count() - mark;
+        staging.truncate(mark);
+    }
+    if (--thread_chunk.deferred_depth == 0) {
+        commitStagedEvents();
+    }
+}
+
+void TraceLog::stageEvent(const TraceEvent& event, size_t group) {
+    auto& staging = *thread_chunk.staging;
+    if (staging.isFull()) {
+        ++dropped_events;
+        return;
+    }
+    staging.addEvent(event, group);
+}
+
+void TraceLog::commitStagedEvents() {
+    auto& staging = *thread_chunk.staging;
+    auto next = staging.begin();
+    while (next != staging.end()) {
+        // Copy runs of events which belong to the same partition
+        const auto partition = getPartition(next->getTracepointInfo());
+        auto last = next + 1;
+        while (last != staging.end() &&
+               getPartition(last->getTracepointInfo()) == partition) {
+            ++last;
+        }
+
+        const auto first = *next;
+        auto cl = getChunkTenant(partition, &first);
+        if (!cl) {
+            if (!enabled) {
+                break;
+            }
+            dropped_events += std::distance(next, last);
+            next = last;
+            continue;
+        }
+        // The staging chunk's summary covers every staged event
+        next += cl.mutex()->chunkFor(partition)->append(
+                next, last, staging.categoryMask());
+    }
+    staging.truncate(0);
+}
+
+size_t TraceLog::getPartition(const tracepoint_info* tpi) {
+    if (partition_count == 1) {
+        return 0;
+    }
+    return registry.getPartition(getGroupIndex(tpi));
+}
+
+size_t TraceLog::getGroupPartition(size_t group) const {
+    if (partition_count == 1) {
+        return 0;
+    }
+    return registry.getPartition(group);
+}
+
+size_t TraceLog::getGroupIndex(const tracepoint_info* tpi) {
+    // Tracepoints are static so are cached by address in an open
+    // addressing table. A group of 0 marks an entry whose group is still
+    // being looked up by the thread that inserted it.
+    const auto hash = reinterpret_cast<uintptr_t>(tpi) >> 4;
+    for (size_t probe = 0; probe < tracepoint_cache_probes; ++probe) {
+        auto& entry = tracepoint_groups[(hash + probe) %
+                                        tracepoint_groups.size()];
+        auto* cached = entry.tpi.load(std::memory_order_acquire);
+        if (cached == nullptr) {
+            if (entry.tpi.compare_exchange_strong(cached, tpi)) {
+                const auto index = registry.getGroupIndex(
+                        registry.getStatus(tpi->category));
+                entry.group.store(index + 1, std::memory_order_release);
+                return index;
+            }
+        }
+        if (cached == tpi) {
+            const auto group = entry.group.load(std::memory_order_acquire);
+            if (group != 0) {
+                return group - 1;
+            }
+            break;
+        }
+    }
+    return registry.getGroupIndex(registry.getStatus(tpi->category));
+}
+
 const AtomicCategoryStatus& TraceLog::getCategoryStatus(
         const char* category_group) {
     return registry.getStatus(category_group);
@@ -159,6 +793,9 @@ std::unique_ptr<TraceBuffer> TraceLog::getBuffer() {
 }
 
 std::unique_ptr<TraceBuffer> TraceLog::getBuffer(std::lock_guard<TraceLog>&) {
+    if (callback_session) {
+        return std::move(getSession(callback_session).buffer);
+    }
     if (enabled) {
         throw std::logic_error(
                 "phosphor::TraceLog::getBuffer: Cannot get the current "
@@ -173,6 +810,10 @@ TraceContext TraceLog::getTraceContext() {
 }
 
 TraceContext TraceLog::getTraceContext(std::lock_guard<TraceLog>&) {
+    if (callback_session) {
+        return TraceContext(std::move(getSession(callback_session).buffer),
+                            thread_names);
+    }
     if (enabled) {
         throw std::logic_error(
                 "phosphor::TraceLog::getTraceContext: Cannot get the "
@@ -195,7 +836,17 @@ void TraceLog::registerThread(const std::string& thread_name) {
     }
 
     thread_chunk.initialised = true;
-    registered_chunk_tenants.insert(&thread_chunk);
+    thread_chunk.thread_id = platform::getCurrentThreadIDCached();
+    {
+        std::lock_guard<std::mutex> replenisher_lh(replenisher_mutex);
+        registered_chunk_tenants.insert(&thread_chunk);
+    }
+
+    const auto sample_thread = platform::SampleTimer::Thread::current();
+    sample_threads[&thread_chunk] = sample_thread;
+    if (sampling) {
+        armSampleTimer(&thread_chunk, sample_thread);
+    }
 
     if (thread_name != "") {
         // Unconditionally set the name of the thread, even for the unlikely
@@ -217,15 +868,43 @@ void TraceLog::deregisterThread() {
                 "not been previously registered");
     }
 
-    if (thread_chunk.chunk) {
-        if (buffer) {
-            buffer->returnChunk(*thread_chunk.chunk);
+    // Delete the timer (discarding any pending signal) before the chunks
+    // are returned, so that a sample can't be added to a returned chunk
+    sample_timers.erase(&thread_chunk);
+    sample_threads.erase(&thread_chunk);
+
+    // Stops the replenisher from giving the tenant a spare as it is
+    // being deregistered
+    std::lock_guard<std::mutex> replenisher_lh(replenisher_mutex);
+    for (size_t partition = 0; partition < max_buffer_partitions;
+         ++partition) {
+        auto*& chunk = thread_chunk.chunkFor(partition);
+        for (auto* held :
+             {chunk,
+              thread_chunk.spare_chunks[partition].exchange(nullptr),
+              thread_chunk.retired_chunks[partition].exchange(nullptr)}) {
+            if (held && buffer) {
+                buffer->returnPartitionChunk(*held, partition);
+            }
+        }
+        chunk = nullptr;
+        thread_chunk.spare_wanted[partition] = false;
+    }
+    for (size_t session = 1; session < max_trace_sessions; ++session) {
+        auto*& chunk = thread_chunk.chunkForSession(session);
+        if (chunk) {
+            if (auto& session_buffer = getSession(session).buffer) {
+                session_buffer->returnChunk(*chunk);
+            }
+            chunk = nullptr;
         }
-        thread_chunk.chunk = nullptr;
     }
     registered_chunk_tenants.erase(&thread_chunk);
     thread_chunk.initialised = false;
 
+    thread_chunk.staging.reset();
+    thread_chunk.deferred_depth = 0;
+
     if (isEnabled()) {
         deregistered_threads.emplace(platform::getCurrentThreadIDCached());
     } else {
@@ -242,6 +921,10 @@ void TraceLog::getStats(StatsCallback& addStats) const {
     std::lock_guard<std::mutex> lh(mutex);
     using namespace std::string_view_literals;
     registry.getStats(addStats);
+    string_table.getStats(addStats);
+    TracepointTable::getInstance().getStats(addStats);
+    StackTable::getInstance().getStats(addStats);
+    buffer_pool->getStats(addStats);
     if (buffer) {
         buffer->getStats(addStats);
     }
@@ -251,9 +934,14 @@ void TraceLog::getStats(StatsCallback& addStats) const {
     addStats("log_thread_names"sv, thread_names.size());
     addStats("log_deregistered_threads"sv, deregistered_threads.size());
     addStats("log_registered_tenants"sv, registered_chunk_tenants.size());
+    addStats("log_sessions"sv, active_sessions);
+    addStats("log_dropped_events"sv, dropped_events);
+    addStats("log_discarded_deferred_events"sv, discarded_deferred_events);
+    addStats("log_dropped_samples"sv, dropped_samples);
 }
 
-std::unique_lock<ChunkTenant> TraceLog::getChunkTenant() {
+std::unique_lock<ChunkTenant> TraceLog::getChunkTenant(
+        size_t partition, const TraceEvent* event) {
     std::unique_lock<ChunkTenant> cl{thread_chunk, std::try_to_lock};
 
     // If we didn't acquire the lock then we're stopping so bail out
@@ -282,14 +970,22 @@ std::unique_lock<ChunkTenant> TraceLog::getChunkTenant() {
         return {};
     }
 
-    if (!thread_chunk.chunk || thread_chunk.chunk->isFull()) {
+    auto* chunk = thread_chunk.chunkFor(partition);
+    if (!chunk || (event ? !chunk->canAdd(*event) : chunk->isFull())) {
         // If we're missing our chunk then it might be because we're
         // meant to be stopping right now.
         if (!enabled) {
             return {};
         }
 
-        if (!replaceChunk(thread_chunk)) {
+        if (!replaceChunk(thread_chunk, partition)) {
+            // If the buffer isn't full then we've failed to get a chunk
+            // for a transient reason (e.g. all chunks of a ring buffer
+            // are on loan) so drop the event instead of stopping.
+            if (enabled && buffer && !buffer->isFull()) {
+                ++dropped_events;
+                return {};
+            }
             size_t current = generation;
             cl.unlock();
             maybe_stop(current);
@@ -300,18 +996,133 @@ std::unique_lock<ChunkTenant> TraceLog::getChunkTenant() {
     return cl;
 }
 
-bool TraceLog::replaceChunk(ChunkTenant& ct) {
-    if (ct.chunk) {
-        buffer->returnChunk(*ct.chunk);
-        ct.chunk = nullptr;
+bool TraceLog::replaceChunk(ChunkTenant& ct, size_t partition, bool wake) {
+    auto*& chunk = ct.chunkFor(partition);
+    if (spare_chunks) {
+        // Only one full chunk at a time waits to be returned by the
+        // replenisher thread
+        auto& retired = ct.retired_chunks[partition];
+        if (chunk && !retired.load(std::memory_order_acquire)) {
+            auto* spare = ct.spare_chunks[partition].exchange(
+                    nullptr, std::memory_order_acquire);
+            if (spare) {
+                retired.store(chunk, std::memory_order_release);
+                chunk = spare;
+                requestReplenish(wake);
+                return true;
+            }
+        }
+    }
+    if (chunk) {
+        buffer->returnPartitionChunk(*chunk, partition);
+        chunk = nullptr;
+    }
+    if (!enabled || !buffer ||
+        !(chunk = buffer->getPartitionChunk(partition))) {
+        return false;
+    }
+    chunk->setFormat(event_format);
+    chunk->setStreaming(streaming_stores);
+    if (spare_chunks) {
+        // Asked for after the chunk was acquired so that the spare
+        // normally follows it in the buffer
+        ct.spare_wanted[partition].store(true, std::memory_order_relaxed);
+        requestReplenish(wake);
+    }
+    return true;
+}
+
+void TraceLog::requestReplenish(bool wake) {
+    if (!replenish_pending.exchange(true) && wake) {
+        replenisher_cv.notify_one();
+    }
+}
+
+void TraceLog::runReplenisher() {
+    // A request made just before the thread waits doesn't wake it (the
+    // requesting thread can't take the lock) so while tracing pending
+    // requests are also picked up periodically
+    const auto interval = std::chrono::milliseconds(10);
+    auto requested = [this]() {
+        return replenisher_stopping || replenish_pending.load();
+    };
+    auto started = [this, &requested]() {
+        return requested() || (enabled && spare_chunks);
+    };
+
+    // Whether a spare couldn't be acquired by the last pass
+    bool retry = false;
+
+    std::unique_lock<std::mutex> lh(replenisher_mutex);
+    while (!replenisher_stopping) {
+        if (enabled && spare_chunks) {
+            replenisher_cv.wait_for(lh, interval, requested);
+        } else {
+            replenisher_cv.wait(lh, started);
+        }
+        if ((!replenish_pending.exchange(false) && !retry) || !enabled ||
+            !buffer) {
+            retry = false;
+            continue;
+        }
+        retry = false;
+        for (auto* chunk_tenant : registered_chunk_tenants) {
+            retry |= !replenishSpareChunks(*chunk_tenant);
+        }
+    }
+}
+
+bool TraceLog::replenishSpareChunks(ChunkTenant& ct) {
+    bool replenished = true;
+    for (size_t partition = 0; partition < partition_count; ++partition) {
+        auto* retired = ct.retired_chunks[partition].exchange(
+                nullptr, std::memory_order_acquire);
+        if (retired) {
+            buffer->returnPartitionChunk(*retired, partition);
+        }
+        const bool wanted =
+                ct.spare_wanted[partition].exchange(false) || retired;
+        auto& spare = ct.spare_chunks[partition];
+        if (!wanted || spare.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        auto* chunk = buffer->getPartitionChunk(partition);
+        if (!chunk) {
+            ct.spare_wanted[partition] = true;
+            replenished = false;
+            continue;
+        }
+        // Reset with the id of the thread the spare is for rather than
+        // the replenisher's
+        chunk->reset(ct.thread_id);
+        chunk->setFormat(event_format);
+        chunk->setStreaming(streaming_stores);
+        spare.store(chunk, std::memory_order_release);
     }
-    return enabled && buffer && (ct.chunk = buffer->getChunk());
+    return replenished;
 }
 
 void TraceLog::evictThreads(std::lock_guard<TraceLog>&) {
+    // Waits for a replenisher pass which started before tracing stopped
+    std::lock_guard<std::mutex> replenisher_lh(replenisher_mutex);
     for (auto* chunk_tenant : registered_chunk_tenants) {
         chunk_tenant->lck.master().lock();
         chunk_tenant->chunk = nullptr;
+        chunk_tenant->partition_chunks.fill(nullptr);
+        for (size_t partition = 0; partition < max_buffer_partitions;
+             ++partition) {
+            chunk_tenant->spare_chunks[partition] = nullptr;
+            chunk_tenant->retired_chunks[partition] = nullptr;
+            chunk_tenant->spare_wanted[partition] = false;
+        }
+        chunk_tenant->lck.master().unlock();
+    }
+}
+
+void TraceLog::evictSession(std::lock_guard<TraceLog>&, size_t session) {
+    for (auto* chunk_tenant : registered_chunk_tenants) {
+        chunk_tenant->lck.master().lock();
+        chunk_tenant->chunkForSession(session) = nullptr;
         chunk_tenant->lck.master().unlock();
     }
 }
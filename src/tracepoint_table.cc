@@ -0,0 +1,62 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "phosphor/stats_callback.h"
+#include "phosphor/tracepoint_table.h"
+
+namespace phosphor {
+
+namespace {
+
+// Stands in for tracepoints which could not be added to a full table
+const tracepoint_info unknown_tracepoint = {
+        "phosphor",
+        "unknown_tracepoint",
+        TraceEventType::Instant,
+        {{nullptr, nullptr}},
+        {{TraceArgumentType::is_none, TraceArgumentType::is_none}}};
+
+size_t hashTracepoint(const tracepoint_info* tpi) {
+    // Tracepoints are static so are spread out by at least their size
+    return reinterpret_cast<uintptr_t>(tpi) >> 4;
+}
+
+} // namespace
+
+TracepointTable::TracepointTable() : intern_index(table_size) {
+}
+
+TracepointTable& TracepointTable::getInstance() {
+    static TracepointTable table;
+    return table;
+}
+
+uint32_t TracepointTable::indexOf(const tracepoint_info* tpi) {
+    return intern_index.findOrInsert(
+            hashTracepoint(tpi),
+            [this, tpi](uint32_t i) { return tracepoints[i] == tpi; },
+            [this, tpi](uint32_t i) { tracepoints[i] = tpi; });
+}
+
+const tracepoint_info* TracepointTable::lookup(uint32_t index) const {
+    if (index >= intern_index.size()) {
+        return &unknown_tracepoint;
+    }
+    return tracepoints[index];
+}
+
+void TracepointTable::getStats(StatsCallback& addStats) const {
+    using namespace std::string_view_literals;
+    addStats("tracepoint_table_size"sv, size());
+    addStats("tracepoint_table_dropped"sv, intern_index.getDropped());
+}
+
+} // namespace phosphor
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// x86's MOVNTI isn't used: every event is logged under the tenant's
+// lock, whose locked instruction drains the write-combining buffers the
+// non-temporal stores are held in, and that drain costs several times
+// more per event than the cache misses it saves
+#if defined(__aarch64__)
+#define PHOSPHOR_STREAMING_STORES_ARM64 1
+#endif
+
+namespace phosphor {
+
+namespace utils {
+
+/**
+ * True if streamingStore() uses non-temporal stores on this platform
+ */
+#if defined(PHOSPHOR_STREAMING_STORES_ARM64)
+constexpr bool has_streaming_stores = true;
+#else
+constexpr bool has_streaming_stores = false;
+#endif
+
+/**
+ * Copy an object with non-temporal stores, which write around the cache
+ * rather than pulling the destination's cache lines in.
+ *
+ * The stores are ordered like regular stores, so the destination is
+ * published to other threads by a release operation as usual. Platforms
+ * without suitable non-temporal stores fall back to a regular copy.
+ *
+ * @param dest Destination, must be 8-byte aligned
+ * @param src Source object, typically in registers / on the stack
+ */
+template <typename T>
+inline void streamingStore(T& dest, const T& src) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "streamingStore requires a trivially copyable type");
+    static_assert(sizeof(T) % sizeof(uint64_t) == 0,
+                  "streamingStore copies whole 8-byte words");
+    constexpr size_t words = sizeof(T) / sizeof(uint64_t);
+    uint64_t values[words];
+    std::memcpy(values, &src, sizeof(T));
+    auto* out = reinterpret_cast<uint64_t*>(&dest);
+#if defined(PHOSPHOR_STREAMING_STORES_ARM64)
+    size_t i = 0;
+    for (; i + 1 < words; i += 2) {
+        asm volatile("stnp %x0, %x1, [%2]"
+                     :
+                     : "r"(values[i]), "r"(values[i + 1]), "r"(out + i)
+                     : "memory");
+    }
+    for (; i < words; ++i) {
+        out[i] = values[i];
+    }
+#else
+    std::memcpy(out, values, sizeof(T));
+#endif
+}
+
+} // namespace utils
+} // namespace phosphor
@@ -52,3 +52,74 @@ void RegisterTenants(benchmark::State& state) {
     log.deregisterThread();
 }
 BENCHMARK(RegisterTenants)->ThreadRange(1, phosphor::benchNumThreads());
+
+/*
+ * Starve a ring buffer by having more threads than chunks so that
+ * threads must compete for chunks as they're returned.
+ */
+void RingBufferStarvation(benchmark::State& state) {
+    static phosphor::TraceLog log{phosphor::TraceLogConfig()};
+    static const phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            phosphor::TraceEvent::Type::Instant,
+            {{"arg1", "arg2"}},
+            {{phosphor::TraceArgument::Type::is_int,
+              phosphor::TraceArgument::Type::is_none}}};
+
+    if (state.thread_index() == 0) {
+        log.start(phosphor::TraceConfig(phosphor::BufferMode::ring,
+                                        sizeof(phosphor::TraceChunk)));
+    }
+    log.registerThread();
+    while (state.KeepRunning()) {
+        log.logEvent(&tpi, 0, phosphor::NoneType());
+    }
+    log.deregisterThread();
+    if (state.thread_index() == 0) {
+        log.stop();
+    }
+}
+BENCHMARK(RingBufferStarvation)->ThreadRange(2, phosphor::benchNumThreads());
+
+/*
+ * Measure the slowest event of each chunk's worth of events, which is
+ * one that replaces the thread's chunk, with and without spare chunks
+ * (see phosphor::TraceConfig::setSpareChunks).
+ */
+void ChunkReplacementLatency(benchmark::State& state) {
+    using namespace std::chrono;
+    static phosphor::TraceLog log{phosphor::TraceLogConfig()};
+    static const phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            phosphor::TraceEvent::Type::Instant,
+            {{"arg1", "arg2"}},
+            {{phosphor::TraceArgument::Type::is_int,
+              phosphor::TraceArgument::Type::is_none}}};
+
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::ring,
+                                    sizeof(phosphor::TraceChunk) * 64)
+                      .setSpareChunks(state.range(0)));
+    log.registerThread();
+    nanoseconds slowest{0};
+    while (state.KeepRunning()) {
+        nanoseconds chunk_slowest{0};
+        for (size_t i = 0; i < phosphor::TraceChunk::chunk_size; ++i) {
+            const auto start = steady_clock::now();
+            log.logEvent(&tpi, 0, phosphor::NoneType());
+            chunk_slowest = std::max(
+                    chunk_slowest,
+                    duration_cast<nanoseconds>(steady_clock::now() - start));
+        }
+        slowest += chunk_slowest;
+    }
+    log.deregisterThread();
+    log.stop();
+
+    state.counters["slowest_ns"] =
+            double(slowest.count()) / double(state.iterations());
+    state.SetItemsProcessed(state.iterations() *
+                            phosphor::TraceChunk::chunk_size);
+}
+BENCHMARK(ChunkReplacementLatency)->ArgName("spare")->Arg(false)->Arg(true);
@@ -0,0 +1,81 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <cstdio>
+
+#include <benchmark/benchmark.h>
+
+#include "bench_common.h"
+#include "phosphor/platform/thread.h"
+#include "phosphor/tools/binary_dump.h"
+#include "phosphor/tools/export.h"
+#include "utils/memory.h"
+
+/*
+ * Compare writing a full buffer to a file as JSON against the binary
+ * dump, which writes the chunks directly from the buffer.
+ */
+class ExportBench : public benchmark::Fixture {
+public:
+    void SetUp(const benchmark::State& state) override {
+        static const phosphor::tracepoint_info tpi = {
+                "category",
+                "name",
+                phosphor::TraceEvent::Type::Instant,
+                {{"arg1", "arg2"}},
+                {{phosphor::TraceArgument::Type::is_int,
+                  phosphor::TraceArgument::Type::is_none}}};
+
+        context = phosphor::utils::make_unique<phosphor::TraceContext>(
+                phosphor::make_fixed_buffer(0, state.range(0)));
+        auto* buffer = context->getBuffer();
+        while (auto* chunk = buffer->getChunk()) {
+            while (!chunk->isFull()) {
+                chunk->addEvent() = phosphor::TraceEvent(&tpi, {{1, 0}});
+            }
+            buffer->returnChunk(*chunk);
+        }
+        path = "export_bench." +
+               std::to_string(phosphor::platform::getCurrentProcessID());
+    }
+
+    void TearDown(const benchmark::State&) override {
+        context.reset();
+        std::remove(path.c_str());
+    }
+
+protected:
+    std::unique_ptr<phosphor::TraceContext> context;
+    std::string path;
+};
+
+BENCHMARK_DEFINE_F(ExportBench, JSONFile)(benchmark::State& state) {
+    size_t bytes = 0;
+    while (state.KeepRunning()) {
+        auto fp = phosphor::utils::make_unique_FILE(path.c_str(), "w");
+        phosphor::tools::JSONExport exporter(*context);
+        char chunk[4096];
+        while (const auto count = exporter.read(chunk, sizeof(chunk))) {
+            bytes += fwrite(chunk, 1, count, fp.get());
+        }
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK_REGISTER_F(ExportBench, JSONFile)->Arg(256);
+
+BENCHMARK_DEFINE_F(ExportBench, BinaryDump)(benchmark::State& state) {
+    size_t bytes = 0;
+    while (state.KeepRunning()) {
+        bytes += phosphor::tools::writeBinaryDump(*context, path);
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK_REGISTER_F(ExportBench, BinaryDump)->Arg(256);
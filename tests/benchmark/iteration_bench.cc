@@ -0,0 +1,95 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "phosphor/trace_buffer.h"
+
+/*
+ * Compare the ways of visiting every event of a full buffer: the event
+ * iterator, the chunk iterators and the contiguous chunk spans.
+ */
+class IterationBench : public benchmark::Fixture {
+public:
+    void SetUp(const benchmark::State& state) override {
+        static const phosphor::tracepoint_info tpi = {
+                "category",
+                "name",
+                phosphor::TraceEvent::Type::Instant,
+                {{"arg1", "arg2"}},
+                {{phosphor::TraceArgument::Type::is_int,
+                  phosphor::TraceArgument::Type::is_none}}};
+
+        buffer = phosphor::make_fixed_buffer(0, state.range(0));
+        while (auto* chunk = buffer->getChunk()) {
+            while (!chunk->isFull()) {
+                chunk->addEvent() = phosphor::TraceEvent(&tpi, {{1, 0}});
+            }
+            buffer->returnChunk(*chunk);
+        }
+    }
+
+    void TearDown(const benchmark::State&) override {
+        buffer.reset();
+    }
+
+protected:
+    phosphor::buffer_ptr buffer;
+};
+
+BENCHMARK_DEFINE_F(IterationBench, EventIterator)(benchmark::State& state) {
+    size_t events = 0;
+    while (state.KeepRunning()) {
+        int64_t sum = 0;
+        for (const auto& event : *buffer) {
+            sum += event.getTime();
+            ++events;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(events);
+}
+BENCHMARK_REGISTER_F(IterationBench, EventIterator)->Arg(256);
+
+BENCHMARK_DEFINE_F(IterationBench, ChunkIterator)(benchmark::State& state) {
+    size_t events = 0;
+    while (state.KeepRunning()) {
+        int64_t sum = 0;
+        for (const auto& chunk : buffer->chunks()) {
+            for (const auto& event : chunk) {
+                sum += event.getTime();
+                ++events;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(events);
+}
+BENCHMARK_REGISTER_F(IterationBench, ChunkIterator)->Arg(256);
+
+BENCHMARK_DEFINE_F(IterationBench, ChunkSpans)(benchmark::State& state) {
+    size_t events = 0;
+    while (state.KeepRunning()) {
+        int64_t sum = 0;
+        buffer->forEachSpan(
+                [&sum, &events](const phosphor::TraceBuffer::chunk_span& span) {
+                    int64_t chunk_sum = 0;
+                    for (const auto& event : span.events) {
+                        chunk_sum += event.getTime();
+                    }
+                    sum += chunk_sum;
+                    events += span.events.size();
+                });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(events);
+}
+BENCHMARK_REGISTER_F(IterationBench, ChunkSpans)->Arg(256);
@@ -0,0 +1,87 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <chrono>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <phosphor/phosphor.h>
+
+namespace {
+
+phosphor::tracepoint_info streaming_tpi = {
+        "category",
+        "name",
+        phosphor::TraceEvent::Type::Instant,
+        {{"arg1", "arg2"}},
+        {{phosphor::TraceArgument::Type::is_int,
+          phosphor::TraceArgument::Type::is_none}}};
+
+} // namespace
+
+/*
+ * The TracingCachePollution test interleaves bursts of tracing with a
+ * cache-sensitive workload (repeated walks of a working set which fits
+ * in the L2 cache) to compare regular and streaming stores (see
+ * TraceConfig::setStreamingStores). It reports the cost of each event
+ * and the time taken by each walk of the working set, which grows as
+ * the trace buffer evicts the working set from the cache. Both use
+ * regular stores on platforms without streaming stores (e.g. x86).
+ */
+void TracingCachePollution(benchmark::State& state) {
+    using namespace std::chrono;
+    static phosphor::TraceLog log{phosphor::TraceLogConfig()};
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::ring,
+                                    4 * 1024 * 1024)
+                      .setStreamingStores(state.range(0)));
+    log.registerThread();
+
+    constexpr size_t events_per_burst = 1000;
+    constexpr size_t walks_per_burst = 4;
+    std::vector<int64_t> working_set(state.range(1) / sizeof(int64_t), 1);
+
+    nanoseconds trace_time{0};
+    nanoseconds workload_time{0};
+    int64_t sum = 0;
+    while (state.KeepRunning()) {
+        const auto start = steady_clock::now();
+        for (size_t i = 0; i < events_per_burst; ++i) {
+            log.logEvent(&streaming_tpi, int(i), phosphor::NoneType());
+        }
+        const auto traced = steady_clock::now();
+        for (size_t walk = 0; walk < walks_per_burst; ++walk) {
+            // One load per cache line
+            for (size_t i = 0; i < working_set.size(); i += 8) {
+                sum += working_set[i];
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+        const auto walked = steady_clock::now();
+        trace_time += traced - start;
+        workload_time += walked - traced;
+    }
+
+    log.deregisterThread();
+    log.stop();
+
+    const auto iterations = double(state.iterations());
+    state.counters["event_ns"] =
+            trace_time.count() / (iterations * events_per_burst);
+    state.counters["walk_ns"] =
+            workload_time.count() / (iterations * walks_per_burst);
+}
+BENCHMARK(TracingCachePollution)
+        ->ArgNames({"streaming", "working_set"})
+        ->Args({false, 256 * 1024})
+        ->Args({true, 256 * 1024})
+        ->Args({false, 1024 * 1024})
+        ->Args({true, 1024 * 1024});
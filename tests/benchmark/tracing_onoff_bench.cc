@@ -53,6 +53,33 @@ BENCHMARK(TracingOnOff)->Arg(false);
 BENCHMARK(TracingOnOff)->Arg(true)->ThreadPerCpu();
 BENCHMARK(TracingOnOff)->Arg(false)->ThreadPerCpu();
 
+/*
+ * Compare the cost of logging events in the full and compact event
+ * formats (see phosphor::EventFormat).
+ */
+void TracingEventFormat(benchmark::State& state) {
+    static phosphor::TraceLog log{phosphor::TraceLogConfig()};
+    if (state.thread_index() == 0) {
+        log.start(phosphor::TraceConfig(phosphor::BufferMode::ring,
+                                        1024 * 1024)
+                          .setEventFormat(
+                                  phosphor::EventFormat(state.range(0))));
+    }
+    log.registerThread();
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100; i++) {
+            log.logEvent(&tpi, 0, phosphor::NoneType());
+        }
+    }
+    log.deregisterThread();
+    if (state.thread_index() == 0) {
+        log.stop();
+    }
+}
+BENCHMARK(TracingEventFormat)
+        ->Arg(int(phosphor::EventFormat::full))
+        ->Arg(int(phosphor::EventFormat::compact));
+
 /*
  * The TracingOnOffMacro test is similar to the TracingOnOff test except
  * it uses a standard tracing macro and so is disabled from the category
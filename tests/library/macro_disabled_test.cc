@@ -45,4 +45,23 @@ TEST_F(MacroDisabledTraceEventTest, LockGuard) {
         TRACE_LOCKGUARD_TIMED(
                 m, "category", "name", std::chrono::microseconds(1));
     }
+    {
+        testing::InSequence dummy;
+        EXPECT_CALL(m, try_lock()).WillOnce(testing::Return(true));
+        EXPECT_CALL(m, unlock()).Times(1);
+        verifications.clear();
+
+        TRACE_TRY_LOCKGUARD(guard, m, "category", "name");
+        EXPECT_TRUE(guard.owns_lock());
+    }
+
+    MockSharedLock shared;
+    {
+        testing::InSequence dummy;
+        EXPECT_CALL(shared, lock_shared()).Times(1);
+        EXPECT_CALL(shared, unlock_shared()).Times(1);
+        verifications.clear();
+
+        TRACE_LOCKGUARD_SHARED(shared, "category", "name");
+    }
 }
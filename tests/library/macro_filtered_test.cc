@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+/**
+ * Tests that Phosphor macros of categories which aren't listed in
+ * PHOSPHOR_COMPILED_CATEGORIES are compiled out.
+ */
+
+#undef PHOSPHOR_COMPILED_CATEGORIES
+#define PHOSPHOR_COMPILED_CATEGORIES "category"
+
+#include "macro_test.h"
+
+static_assert(PHOSPHOR_CATEGORY_COMPILED("category"));
+static_assert(PHOSPHOR_CATEGORY_COMPILED("category:child"));
+static_assert(PHOSPHOR_CATEGORY_COMPILED("example,category"));
+static_assert(!PHOSPHOR_CATEGORY_COMPILED("example"));
+static_assert(!PHOSPHOR_CATEGORY_COMPILED("example,cat"));
+
+class MacroFilteredTraceEventTest : public MacroTraceEventTest {
+protected:
+    int evaluate() {
+        return ++evaluations;
+    }
+
+    int evaluations = 0;
+};
+
+/*
+ * "example" is enabled by the fixture's config so its events would be
+ * logged if they were compiled in
+ */
+TEST_F(MacroFilteredTraceEventTest, FilteredCategory) {
+    TRACE_INSTANT1("example", "name", "arg", evaluate());
+    TRACE_EVENT1("example", "name", "arg", evaluate());
+    TRACE_FUNCTION1("example", "arg", evaluate());
+    TRACE_ASYNC_START1("example", "name", 0, "arg", evaluate());
+    TRACE_COMPLETE1("example",
+                    "name",
+                    std::chrono::steady_clock::now(),
+                    std::chrono::steady_clock::now(),
+                    "arg",
+                    evaluate());
+    TRACE_ASYNC_COMPLETE1("example",
+                          "name",
+                          nullptr,
+                          std::chrono::steady_clock::now(),
+                          std::chrono::steady_clock::now(),
+                          "arg",
+                          evaluate());
+    TRACE_DEFERRED_EVENT1("example",
+                          "name",
+                          std::chrono::steady_clock::duration::zero(),
+                          "arg",
+                          evaluate());
+    EXPECT_EQ(0, evaluations);
+}
+
+TEST_F(MacroFilteredTraceEventTest, CompiledCategory) {
+    {
+        TRACE_FUNCTION1("category", "arg", evaluate());
+        TRACE_INSTANT1("category", "name", "arg", evaluate());
+    }
+    EXPECT_EQ(2, evaluations);
+
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("name", event.getName());
+        EXPECT_EQ(2, event.getArgs()[0].as_int);
+    });
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("TestBody", event.getName());
+        EXPECT_EQ(phosphor::TraceEvent::Type::Complete, event.getType());
+        EXPECT_EQ(1, event.getArgs()[0].as_int);
+    });
+}
+
+/**
+ * Test that the lock guards of a filtered category still lock / unlock
+ * the mutex.
+ */
+TEST_F(MacroFilteredTraceEventTest, LockGuard) {
+    MockUniqueLock m;
+    {
+        testing::InSequence dummy;
+        EXPECT_CALL(m, lock()).Times(1);
+        EXPECT_CALL(m, unlock()).Times(1);
+
+        TRACE_LOCKGUARD(m, "example", "name");
+    }
+    {
+        testing::InSequence dummy;
+        EXPECT_CALL(m, lock()).Times(1);
+        EXPECT_CALL(m, unlock()).Times(1);
+
+        TRACE_LOCKGUARD_TIMED(
+                m, "example", "name", std::chrono::microseconds(1));
+    }
+    {
+        testing::InSequence dummy;
+        EXPECT_CALL(m, try_lock()).WillOnce(testing::Return(true));
+        EXPECT_CALL(m, unlock()).Times(1);
+
+        TRACE_TRY_LOCKGUARD(guard, m, "example", "name");
+        EXPECT_TRUE(guard.owns_lock());
+    }
+
+    MockSharedLock shared;
+    {
+        testing::InSequence dummy;
+        EXPECT_CALL(shared, lock_shared()).Times(1);
+        EXPECT_CALL(shared, unlock_shared()).Times(1);
+
+        TRACE_LOCKGUARD_SHARED(shared, "example", "name");
+    }
+}
@@ -11,6 +11,14 @@
 
 #include "macro_test.h"
 
+#include <phosphor/platform/thread.h>
+#include <phosphor/shared_memory_buffer.h>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
 TEST_F(MacroTraceEventTest, Synchronous) {
     TRACE_EVENT_START0("category", "name");
     verifications.emplace_back([](const phosphor::TraceEvent& event) {
@@ -188,6 +196,422 @@ TEST_F(MacroTraceEventTest, Scoped) {
     }
 }
 
+TEST_F(MacroTraceEventTest, ScopedThreshold) {
+    {
+        // Should be dropped as the scope won't last 100 seconds
+        TRACE_EVENT_THRESHOLD0("category", "name", std::chrono::seconds(100));
+    }
+    {
+        TRACE_EVENT_THRESHOLD1(
+                "category", "name", std::chrono::nanoseconds(0), "my_arg1", 3);
+        verifications.emplace_back([](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("name", event.getName());
+            EXPECT_EQ(phosphor::TraceEvent::Type::Complete, event.getType());
+            EXPECT_EQ(3, event.getArgs()[0].as_int);
+        });
+    }
+    {
+        TRACE_FUNCTION_THRESHOLD2("category",
+                                  std::chrono::seconds(100),
+                                  "my_arg1",
+                                  3,
+                                  "my_arg2",
+                                  4);
+    }
+}
+
+TEST_F(MacroTraceEventTest, ScopedCategoryThreshold) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk))
+                    .setCategories({{"category"}}, {})
+                    .setCategoryThreshold("cat*", std::chrono::seconds(100)));
+    {
+        // Dropped by the category's threshold
+        TRACE_EVENT0("category", "name");
+    }
+    // Non-scoped events are unaffected by the threshold
+    TRACE_INSTANT0("category", "name");
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("name", event.getName());
+        EXPECT_EQ(phosphor::TraceEvent::Type::Instant, event.getType());
+    });
+}
+
+TEST_F(MacroTraceEventTest, DeferredSpanCommitted) {
+    {
+        TRACE_DEFERRED_EVENT1(
+                "category", "outer", std::chrono::nanoseconds(0), "arg", 1);
+        TRACE_INSTANT0("category", "inner");
+    }
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("inner", event.getName());
+        EXPECT_EQ(phosphor::TraceEvent::Type::Instant, event.getType());
+    });
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("outer", event.getName());
+        EXPECT_EQ(phosphor::TraceEvent::Type::Complete, event.getType());
+        EXPECT_EQ(1, event.getArgs()[0].as_int);
+    });
+}
+
+TEST_F(MacroTraceEventTest, DeferredSpanDiscarded) {
+    {
+        TRACE_DEFERRED_EVENT0("category", "outer", std::chrono::seconds(100));
+        TRACE_INSTANT0("category", "inner");
+        TRACE_EVENT0("category", "scoped");
+    }
+    // Events logged after the span are unaffected
+    TRACE_INSTANT0("category", "after");
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("after", event.getName());
+    });
+}
+
+TEST_F(MacroTraceEventTest, DeferredSpanNested) {
+    {
+        TRACE_DEFERRED_EVENT0("category", "outer", std::chrono::nanoseconds(0));
+        TRACE_INSTANT0("category", "first");
+        {
+            // A fast nested span is discarded even though the outer one
+            // is committed
+            TRACE_DEFERRED_EVENT2("category",
+                                  "nested",
+                                  std::chrono::seconds(100),
+                                  "arg1",
+                                  1,
+                                  "arg2",
+                                  2);
+            TRACE_INSTANT0("category", "discarded");
+        }
+        TRACE_INSTANT0("category", "second");
+    }
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("first", event.getName());
+    });
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("second", event.getName());
+    });
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("outer", event.getName());
+    });
+}
+
+/// A chatty category filling its partition shouldn't stop events in
+/// another partition from being logged.
+TEST_F(MacroTraceEventTest, Partitioned) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk))
+                    .setCategories({{"category"}, {"ex*"}}, {})
+                    .addPartition({"ex*"}, sizeof(phosphor::TraceChunk)));
+    for (size_t i = 0; i < phosphor::TraceChunk::chunk_size * 2; ++i) {
+        TRACE_INSTANT0("category", "chatty");
+    }
+    TRACE_INSTANT0("example", "important");
+
+    for (size_t i = 0; i < phosphor::TraceChunk::chunk_size; ++i) {
+        verifications.emplace_back([](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("chatty", event.getName());
+        });
+    }
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("important", event.getName());
+        EXPECT_STREQ("example", event.getCategory());
+    });
+}
+
+#ifndef _WIN32
+TEST_F(MacroTraceEventTest, TailSegment) {
+    const auto segment = "/phosphor-macro-test-" +
+                         std::to_string(phosphor::platform::getCurrentProcessID());
+    phosphor::remove_shared_memory_buffer(segment);
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk) * 2)
+                    .setCategories({{"category"}}, {})
+                    .setTailSegment(segment));
+    EXPECT_NE(std::string::npos,
+              PHOSPHOR_INSTANCE.getTraceConfig().toString().find(
+                      "tail-segment:" + segment));
+
+    for (size_t i = 0; i < phosphor::TraceChunk::chunk_size + 1; ++i) {
+        TRACE_INSTANT0("category", "tailed");
+        verifications.emplace_back([](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("tailed", event.getName());
+        });
+    }
+
+    // Only the filled (and returned) chunk is visible to the tail, once
+    // the tail buffer's thread has copied it
+    phosphor::SharedMemoryReader reader(segment);
+    size_t collected = 0;
+    const auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (collected < phosphor::TraceChunk::chunk_size &&
+           std::chrono::steady_clock::now() < deadline) {
+        collected += reader.collect().size();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(phosphor::TraceChunk::chunk_size, collected);
+    phosphor::remove_shared_memory_buffer(segment);
+}
+#endif
+
+/// Events stored in the compact format are decoded with full fidelity,
+/// an event too far from the start of its chunk rolls over to the next.
+TEST_F(MacroTraceEventTest, CompactFormat) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk) * 2)
+                    .setCategories({{"category"}}, {})
+                    .setEventFormat(phosphor::EventFormat::compact));
+    EXPECT_NE(std::string::npos,
+              PHOSPHOR_INSTANCE.getTraceConfig().toString().find(
+                      "event-format:compact"));
+
+    // More events than fit in a full format chunk
+    for (int i = 0; i < int(phosphor::TraceChunk::chunk_size) + 1; ++i) {
+        TRACE_INSTANT1("category", "compact", "index", i);
+        verifications.emplace_back([i](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("compact", event.getName());
+            EXPECT_EQ(phosphor::TraceEvent::Type::Instant, event.getType());
+            EXPECT_EQ(i, event.getArgs()[0].as_int);
+        });
+    }
+
+    const auto start = std::chrono::steady_clock::now() - std::chrono::hours(1);
+    const auto end = start + std::chrono::microseconds(1);
+    TRACE_COMPLETE1("category", "early", start, end, "arg", 3);
+    verifications.emplace_back([start](const phosphor::TraceEvent& event) {
+        using namespace std::chrono;
+        EXPECT_STREQ("early", event.getName());
+        EXPECT_EQ(duration_cast<nanoseconds>(start.time_since_epoch()).count(),
+                  event.getTime());
+        EXPECT_EQ(1000UL, event.getDuration());
+        EXPECT_EQ(3, event.getArgs()[0].as_int);
+    });
+}
+
+TEST_F(MacroTraceEventTest, StreamingStores) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk) * 2)
+                    .setCategories({{"category"}}, {})
+                    .setStreamingStores(true));
+
+    // Events streamed to the chunk must be visible once it's read
+    for (int i = 0; i < int(phosphor::TraceChunk::chunk_size) + 1; ++i) {
+        TRACE_INSTANT1("category", "streamed", "index", i);
+        verifications.emplace_back([i](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("streamed", event.getName());
+            EXPECT_EQ(i, event.getArgs()[0].as_int);
+        });
+    }
+}
+
+TEST_F(MacroTraceEventTest, RecordCPU) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk) * 2)
+                    .setCategories({{"category"}}, {})
+                    .setRecordCPU(true));
+
+    const bool cpu_known = phosphor::platform::getCurrentCPU() >= 0;
+    TRACE_INSTANT0("category", "instant");
+    verifications.emplace_back([cpu_known](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("instant", event.getName());
+        EXPECT_EQ(cpu_known, event.getCPU() >= 0);
+    });
+    const auto start = std::chrono::steady_clock::now();
+    TRACE_COMPLETE0("category",
+                    "complete",
+                    start,
+                    start + std::chrono::nanoseconds(1000));
+    verifications.emplace_back([cpu_known](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("complete", event.getName());
+        EXPECT_EQ(1000, event.getDuration());
+        EXPECT_EQ(cpu_known, event.getCPU() >= 0);
+    });
+}
+
+TEST_F(MacroTraceEventTest, CountedCategories) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk) * 2)
+                    .setCategories({{"category"}, {"uncounted"}}, {})
+                    .setCountedCategories({"category"}));
+
+    { TRACE_EVENT0("uncounted", "scope"); }
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("scope", event.getName());
+    });
+
+    // The counters are logged after the scope and span the same time
+    auto start = std::make_shared<int64_t>();
+    {
+        TRACE_EVENT1("category", "scope", "arg", 3);
+        // Something to count, sleeping always switches context
+        std::vector<char> pages(1024 * 1024, 1);
+        std::this_thread::sleep_for(std::chrono::microseconds(1));
+    }
+    verifications.emplace_back([start](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("scope", event.getName());
+        EXPECT_EQ(3, event.getArgs()[0].as_int);
+        *start = event.getTime();
+    });
+    switch (phosphor::platform::PerfCounters::getThreadInstance().getSet()) {
+    case phosphor::platform::PerfCounterSet::none:
+        break;
+    case phosphor::platform::PerfCounterSet::hardware:
+        verifications.emplace_back([start](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("perf_counters", event.getName());
+            EXPECT_EQ(*start, event.getTime());
+            EXPECT_GT(event.getArgs()[0].as_uint, 0);
+            EXPECT_GT(event.getArgs()[1].as_uint, 0);
+        });
+        verifications.emplace_back([start](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("perf_cache", event.getName());
+            EXPECT_EQ(*start, event.getTime());
+        });
+        break;
+    case phosphor::platform::PerfCounterSet::software:
+        verifications.emplace_back([start](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("perf_sched", event.getName());
+            EXPECT_EQ(*start, event.getTime());
+            EXPECT_GT(event.getArgs()[0].as_uint, 0);
+        });
+        break;
+    }
+}
+
+TEST_F(MacroTraceEventTest, StackTraces) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk) * 2)
+                    .setCategories({{"category"}}, {})
+                    .setStackThreshold(std::chrono::nanoseconds(1)));
+
+    // A stack is logged after each slow scope
+    const auto verifyStack = [](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("stack_trace", event.getName());
+        const auto stack = event.getArgs()[0].as_stack;
+        EXPECT_NE(phosphor::StackTable::npos, stack.id);
+        EXPECT_FALSE(phosphor::StackTable::getInstance().lookup(stack).empty());
+        // The stack is symbolized into an array of frames
+        const auto json = event.getArgs()[0].to_string(
+                phosphor::TraceArgument::Type::is_stack);
+        EXPECT_EQ('[', json.front());
+        EXPECT_EQ(']', json.back());
+    };
+    const bool captured = phosphor::StackTable::getInstance().capture().id !=
+                          phosphor::StackTable::npos;
+
+    {
+        TRACE_EVENT0("category", "scope");
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+    }
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("scope", event.getName());
+    });
+    if (captured) {
+        verifications.emplace_back(verifyStack);
+    }
+
+    {
+        testing::NiceMock<MockUniqueLock> m;
+        TRACE_LOCKGUARD(m, "category", "name");
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+    }
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("name.wait", event.getName());
+    });
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("name.held", event.getName());
+    });
+    if (captured) {
+        verifications.emplace_back(verifyStack);
+    }
+}
+
+TEST_F(MacroTraceEventTest, SpareChunks) {
+    PHOSPHOR_INSTANCE.start(
+            phosphor::TraceConfig(phosphor::BufferMode::fixed,
+                                  sizeof(phosphor::TraceChunk) * 4)
+                    .setCategories({{"category"}}, {})
+                    .setSpareChunks(true));
+
+    // Chunks swapped for spares keep every event. A chunk replaced while
+    // the spare was being acquired can be out of order in the buffer,
+    // so the events are checked once they have all been seen.
+    const int count = int(phosphor::TraceChunk::chunk_size) * 3 + 1;
+    auto seen = std::make_shared<std::vector<int>>();
+    for (int i = 0; i < count; ++i) {
+        TRACE_INSTANT1("category", "spare", "index", i);
+        verifications.emplace_back([seen, count](
+                                           const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("spare", event.getName());
+            seen->push_back(int(event.getArgs()[0].as_int));
+            if (int(seen->size()) == count) {
+                std::sort(seen->begin(), seen->end());
+                for (int j = 0; j < count; ++j) {
+                    EXPECT_EQ(j, (*seen)[j]);
+                }
+            }
+        });
+    }
+}
+
+/*
+ * Saves the context of the session which stopped
+ */
+struct SessionStoppedCallback : public phosphor::TracingStoppedCallback {
+    void operator()(phosphor::TraceLog& log,
+                    std::lock_guard<phosphor::TraceLog>& lh) override {
+        context = std::make_unique<phosphor::TraceContext>(
+                log.getTraceContext(lh));
+    }
+
+    std::unique_ptr<phosphor::TraceContext> context;
+};
+
+TEST_F(MacroTraceEventTest, Sessions) {
+    auto callback = std::make_shared<SessionStoppedCallback>();
+    const auto flight_recorder = PHOSPHOR_INSTANCE.startSession(
+            phosphor::TraceConfig(phosphor::BufferMode::ring,
+                                  sizeof(phosphor::TraceChunk) * 4)
+                    .setCategories({{"session"}}, {})
+                    .setStoppedCallback(callback));
+    EXPECT_NE(0, flight_recorder);
+    EXPECT_TRUE(PHOSPHOR_INSTANCE.isSessionEnabled(flight_recorder));
+
+    // Events are logged to each session with their category enabled
+    TRACE_INSTANT0("category", "primary");
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("primary", event.getName());
+    });
+    TRACE_INSTANT0("session", "secondary");
+    TRACE_INSTANT0("category,session", "both");
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("both", event.getName());
+    });
+
+    // Stopping the primary session leaves the other running
+    PHOSPHOR_INSTANCE.stop();
+    EXPECT_TRUE(PHOSPHOR_INSTANCE.isSessionEnabled(flight_recorder));
+    TRACE_INSTANT0("category,session", "after");
+
+    PHOSPHOR_INSTANCE.stopSession(flight_recorder);
+    EXPECT_FALSE(PHOSPHOR_INSTANCE.isSessionEnabled(flight_recorder));
+    ASSERT_TRUE(callback->context);
+    std::vector<std::string> names;
+    for (const auto& event : *callback->context->getBuffer()) {
+        names.emplace_back(event.getName());
+    }
+    EXPECT_EQ(std::vector<std::string>({"secondary", "both", "after"}),
+              names);
+}
+
 TEST_F(MacroTraceEventTest, LockGuard) {
     {
         testing::InSequence dummy;
@@ -243,6 +667,78 @@ TEST_F(MacroTraceEventTest, LockGuardTimedFast) {
     verifications.clear();
 }
 
+TEST_F(MacroTraceEventTest, LockGuardShared) {
+    {
+        testing::InSequence dummy;
+        MockSharedLock m;
+        EXPECT_CALL(m, lock_shared()).Times(1);
+        EXPECT_CALL(m, unlock_shared()).Times(1);
+        TRACE_LOCKGUARD_SHARED(m, "category", "name");
+        verifications.emplace_back([](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("name.wait", event.getName());
+            EXPECT_EQ(phosphor::TraceEvent::Type::Complete, event.getType());
+        });
+        verifications.emplace_back([](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("name.held", event.getName());
+            EXPECT_EQ(phosphor::TraceEvent::Type::Complete, event.getType());
+        });
+    }
+}
+
+TEST_F(MacroTraceEventTest, TryLockGuard) {
+    {
+        testing::InSequence dummy;
+        MockUniqueLock m;
+        EXPECT_CALL(m, try_lock()).WillOnce(testing::Return(true));
+        EXPECT_CALL(m, unlock()).Times(1);
+        TRACE_TRY_LOCKGUARD(guard, m, "category", "name");
+        EXPECT_TRUE(guard.owns_lock());
+        verifications.emplace_back([](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("name.wait", event.getName());
+        });
+        verifications.emplace_back([](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("name.held", event.getName());
+        });
+    }
+    {
+        // A failed try-lock neither unlocks nor logs any events
+        MockUniqueLock m;
+        EXPECT_CALL(m, try_lock()).WillOnce(testing::Return(false));
+        EXPECT_CALL(m, unlock()).Times(0);
+        TRACE_TRY_LOCKGUARD(guard, m, "category", "name");
+        EXPECT_FALSE(guard.owns_lock());
+    }
+}
+
+/// While the lock profiler is enabled no events should be logged, instead
+/// the acquisitions are aggregated by the profiler.
+TEST_F(MacroTraceEventTest, LockGuardProfiled) {
+    auto& profiler = phosphor::LockProfiler::getInstance();
+    profiler.reset();
+    profiler.enable();
+    std::mutex m;
+    for (int i = 0; i < 3; ++i) {
+        TRACE_LOCKGUARD(m, "category", "name");
+    }
+    {
+        TRACE_TRY_LOCKGUARD(guard, m, "category", "name");
+        EXPECT_TRUE(guard.owns_lock());
+        TRACE_TRY_LOCKGUARD(guard2, m, "category", "name");
+        EXPECT_FALSE(guard2.owns_lock());
+    }
+    profiler.disable();
+
+    const auto report = profiler.getReport();
+    ASSERT_EQ(1, report.size());
+    EXPECT_EQ(&m, report[0].mutex);
+    EXPECT_STREQ("name.wait", report[0].tpi->name);
+    EXPECT_EQ(4, report[0].acquisitions);
+    EXPECT_EQ(1, report[0].try_lock_failures);
+    profiler.reset();
+
+    verifications.clear();
+}
+
 void macro_test_functionA() {
     TRACE_FUNCTION0("category");
 }
@@ -436,6 +932,26 @@ TEST_F(MacroTraceEventTest, InlineString) {
     });
 }
 
+TEST_F(MacroTraceEventTest, InternedString) {
+    const std::string bucket = "a-bucket-name-longer-than-8-bytes";
+    TRACE_INSTANT1(
+            "category", "name", "arg", PHOSPHOR_INTERNED_STR(bucket));
+    TRACE_INSTANT1(
+            "category", "name", "arg", PHOSPHOR_INTERNED_STR(bucket.c_str()));
+    for (int i = 0; i < 2; ++i) {
+        verifications.emplace_back([bucket](const phosphor::TraceEvent& event) {
+            EXPECT_STREQ("name", event.getName());
+            EXPECT_EQ(phosphor::TraceArgument::Type::is_interned,
+                      event.getTracepointInfo()->argument_types[0]);
+            EXPECT_EQ(bucket,
+                      phosphor::StringTable::resolve(
+                              event.getArgs()[0].as_interned));
+            EXPECT_NE(std::string::npos,
+                      event.to_json(0).find("\"arg\":\"" + bucket + "\""));
+        });
+    }
+}
+
 // Basic smoke test that category filtering works at a macro level,
 // other unit tests should handle the more extensive testing
 TEST_F(MacroTraceEventTest, CategoryFiltering) {
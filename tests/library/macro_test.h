@@ -62,5 +62,12 @@ protected:
 class MockUniqueLock {
 public:
     MOCK_METHOD0(lock, void());
+    MOCK_METHOD0(try_lock, bool());
     MOCK_METHOD0(unlock, void());
 };
+
+class MockSharedLock {
+public:
+    MOCK_METHOD0(lock_shared, void());
+    MOCK_METHOD0(unlock_shared, void());
+};
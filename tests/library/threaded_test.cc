@@ -10,8 +10,12 @@
  */
 
 #include <atomic>
+#include <csignal>
 #include <condition_variable>
+#include <cstring>
+#include <map>
 #include <memory>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -20,8 +24,30 @@
 
 #include "barrier.h"
 #include "utils/memory.h"
+#include <phosphor/stack_table.h>
+#include <phosphor/stats_callback.h>
 #include <phosphor/trace_log.h>
 
+/*
+ * Collects the unsigned stats of a TraceLog
+ */
+class SizeStatsCallback : public phosphor::StatsCallback {
+public:
+    void operator()(std::string_view, std::string_view) override {
+    }
+    void operator()(std::string_view, bool) override {
+    }
+    void operator()(std::string_view key, size_t value) override {
+        stats[std::string(key)] = value;
+    }
+    void operator()(std::string_view, phosphor::ssize_t) override {
+    }
+    void operator()(std::string_view, double) override {
+    }
+
+    std::map<std::string, size_t> stats;
+};
+
 class ThreadedTest : public ::testing::Test {
 public:
     ThreadedTest() : running(false) {
@@ -110,3 +136,143 @@ TEST_F(ThreadedTest, ThreadedInternalStop) {
 
     stopWorkload();
 }
+
+TEST_F(ThreadedTest, RingBufferMoreThreadsThanChunks) {
+    const phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            phosphor::TraceEvent::Type::Instant,
+            {{"arg1", "arg2"}},
+            {{phosphor::TraceArgument::Type::is_int,
+              phosphor::TraceArgument::Type::is_int}}};
+
+    phosphor::TraceLog log;
+
+    // Start with a single chunk before any threads have registered so
+    // that the threads have to compete for it
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::ring,
+                                    sizeof(phosphor::TraceChunk)));
+    startWorkload(4, log, [&log, &tpi]() { log.logEvent(&tpi, 0, 0); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // Failing to get a chunk from a ring buffer shouldn't stop tracing
+    EXPECT_TRUE(log.isEnabled());
+    SizeStatsCallback callback;
+    log.getStats(callback);
+    log.stop();
+
+    // The threads which didn't hold the chunk dropped their events
+    EXPECT_NE(0, callback.stats["buffer_failed_acquisitions"]);
+    EXPECT_NE(0, callback.stats["log_dropped_events"]);
+
+    stopWorkload();
+}
+
+#if defined(__linux__)
+TEST_F(ThreadedTest, Sampling) {
+    const phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            phosphor::TraceEvent::Type::Instant,
+            {{"arg1", "arg2"}},
+            {{phosphor::TraceArgument::Type::is_int,
+              phosphor::TraceArgument::Type::is_int}}};
+
+    phosphor::TraceLog log;
+
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::ring, 1024 * 1024)
+                      .setCategories({{"*"}}, {})
+                      .setSampleInterval(std::chrono::microseconds(500)));
+    // Mostly spin between events so that most samples don't interrupt
+    // the threads while they are logging
+    startWorkload(2, log, [&log, &tpi]() {
+        log.logEvent(&tpi, 0, 0);
+        std::atomic<uint64_t> sum{0};
+        for (int i = 0; i < 10000; ++i) {
+            sum.fetch_add(i, std::memory_order_relaxed);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    log.stop();
+    stopWorkload();
+
+    size_t samples = 0;
+    auto buffer = log.getBuffer();
+    for (const auto& event : *buffer) {
+        if (event.getType() != phosphor::TraceEvent::Type::Sample) {
+            continue;
+        }
+        ++samples;
+        EXPECT_STREQ("cpu_sample", event.getName());
+        const auto stack = event.getArgs()[0].as_stack;
+        EXPECT_FALSE(phosphor::StackTable::getInstance().lookup(stack).empty());
+    }
+    EXPECT_GT(samples, 0);
+}
+
+namespace {
+std::atomic<int> previous_sigprof_count{0};
+void countSigprof(int) {
+    ++previous_sigprof_count;
+}
+} // namespace
+
+/*
+ * The timers of threads registered before sampling starts are created
+ * by start(), and the process' own SIGPROF handler is passed signals it
+ * sent itself both while sampling and once sampling has stopped (when
+ * the sampling handler stays installed so that a timer signal which is
+ * still pending can't terminate the process)
+ */
+TEST_F(ThreadedTest, SamplingPassesOnSignals) {
+    const phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            phosphor::TraceEvent::Type::Instant,
+            {{"arg1", "arg2"}},
+            {{phosphor::TraceArgument::Type::is_int,
+              phosphor::TraceArgument::Type::is_int}}};
+
+    previous_sigprof_count = 0;
+    struct sigaction action;
+    struct sigaction original;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = countSigprof;
+    sigemptyset(&action.sa_mask);
+    ASSERT_EQ(0, sigaction(SIGPROF, &action, &original));
+
+    phosphor::TraceLog log;
+    startWorkload(2, log, [&log, &tpi]() {
+        log.logEvent(&tpi, 0, 0);
+        std::atomic<uint64_t> sum{0};
+        for (int i = 0; i < 10000; ++i) {
+            sum.fetch_add(i, std::memory_order_relaxed);
+        }
+    });
+    // Give the threads time to register before sampling starts
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::ring, 1024 * 1024)
+                      .setCategories({{"*"}}, {})
+                      .setSampleInterval(std::chrono::microseconds(500)));
+    raise(SIGPROF);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    log.stop();
+    stopWorkload();
+
+    EXPECT_EQ(1, previous_sigprof_count);
+    raise(SIGPROF);
+    EXPECT_EQ(2, previous_sigprof_count);
+    size_t samples = 0;
+    auto buffer = log.getBuffer();
+    for (const auto& event : *buffer) {
+        if (event.getType() == phosphor::TraceEvent::Type::Sample) {
+            ++samples;
+        }
+    }
+    EXPECT_GT(samples, 0);
+
+    struct sigaction installed;
+    ASSERT_EQ(0, sigaction(SIGPROF, &original, &installed));
+    EXPECT_TRUE(installed.sa_flags & SA_SIGINFO);
+}
+#endif
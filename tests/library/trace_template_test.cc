@@ -0,0 +1,135 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "macro_test.h"
+
+#include <phosphor/trace_template.h>
+
+#include <memory>
+
+using phosphor::TraceArgument;
+
+/*
+ * The C++17 form of the strings, which also works in C++20
+ */
+static constexpr char category[] = "category";
+static constexpr char excluded[] = "excluded";
+static constexpr char name[] = "name";
+static constexpr char arg1[] = "my_arg1";
+static constexpr char arg2[] = "my_arg2";
+
+enum class Colour : uint8_t { Red, Green };
+
+class TraceTemplateTest : public MacroTraceEventTest {};
+
+TEST_F(TraceTemplateTest, Instant) {
+    phosphor::trace<category, name>();
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("name", event.getName());
+        EXPECT_STREQ("category", event.getCategory());
+        EXPECT_EQ(phosphor::TraceEvent::Type::Instant, event.getType());
+        EXPECT_EQ(TraceArgument::Type::is_none, event.getArgTypes()[0]);
+        EXPECT_EQ(TraceArgument::Type::is_none, event.getArgTypes()[1]);
+    });
+    phosphor::trace<category, name, arg1>(3);
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_EQ(phosphor::TraceEvent::Type::Instant, event.getType());
+        EXPECT_EQ(3, event.getArgs()[0].as_int);
+        EXPECT_STREQ("my_arg1", event.getArgNames()[0]);
+        EXPECT_EQ(TraceArgument::Type::is_none, event.getArgTypes()[1]);
+    });
+    phosphor::trace<category, name, arg1, arg2>(3, 4.5);
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_EQ(3, event.getArgs()[0].as_int);
+        EXPECT_STREQ("my_arg1", event.getArgNames()[0]);
+        EXPECT_EQ(4.5, event.getArgs()[1].as_double);
+        EXPECT_STREQ("my_arg2", event.getArgNames()[1]);
+    });
+    phosphor::trace<excluded, name>();
+}
+
+TEST_F(TraceTemplateTest, ArgumentEncoding) {
+    static const int value = 0;
+    phosphor::trace<category, name, arg1, arg2>(Colour::Green, "literal");
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_EQ(TraceArgument::Type::is_uint, event.getArgTypes()[0]);
+        EXPECT_EQ(1, event.getArgs()[0].as_uint);
+        EXPECT_EQ(TraceArgument::Type::is_string, event.getArgTypes()[1]);
+        EXPECT_STREQ("literal", event.getArgs()[1].as_string);
+    });
+    phosphor::trace<category, name, arg1, arg2>(
+            &value, PHOSPHOR_INLINE_STR("inline"));
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_EQ(TraceArgument::Type::is_pointer, event.getArgTypes()[0]);
+        EXPECT_EQ(&value, event.getArgs()[0].as_pointer);
+        EXPECT_EQ(TraceArgument::Type::is_istring, event.getArgTypes()[1]);
+    });
+}
+
+/*
+ * Unlike the macros the arguments are evaluated by the caller, even when
+ * the category is disabled
+ */
+TEST_F(TraceTemplateTest, DisabledCategoryEvaluatesArguments) {
+    int evaluations = 0;
+    phosphor::trace<excluded, name, arg1>(++evaluations);
+    EXPECT_EQ(1, evaluations);
+}
+
+TEST_F(TraceTemplateTest, Scoped) {
+    {
+        auto guard = phosphor::traceScope<category, name, arg1>(3);
+        phosphor::trace<category, name>();
+    }
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_EQ(phosphor::TraceEvent::Type::Instant, event.getType());
+    });
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("name", event.getName());
+        EXPECT_STREQ("category", event.getCategory());
+        EXPECT_EQ(phosphor::TraceEvent::Type::Complete, event.getType());
+        EXPECT_EQ(3, event.getArgs()[0].as_int);
+        EXPECT_STREQ("my_arg1", event.getArgNames()[0]);
+    });
+}
+
+/*
+ * Trace points of the same strings, type and argument types share their
+ * tracepoint_info
+ */
+TEST_F(TraceTemplateTest, SharedTracepoint) {
+    for (int i = 0; i < 2; ++i) {
+        phosphor::trace<category, name, arg1>(i);
+    }
+    phosphor::trace<category, name, arg1>(2);
+    // Verified after the test body returns so can't refer to its locals
+    auto tpi = std::make_shared<const phosphor::tracepoint_info*>(nullptr);
+    for (int i = 0; i < 3; ++i) {
+        verifications.emplace_back([tpi](const phosphor::TraceEvent& event) {
+            if (!*tpi) {
+                *tpi = event.getTracepointInfo();
+            }
+            EXPECT_EQ(*tpi, event.getTracepointInfo());
+        });
+    }
+}
+
+#if PHOSPHOR_HAVE_STRING_TEMPLATE_ARGS
+TEST_F(TraceTemplateTest, StringLiterals) {
+    phosphor::trace<"category", "literal_name", "my_arg1">(3);
+    verifications.emplace_back([](const phosphor::TraceEvent& event) {
+        EXPECT_STREQ("literal_name", event.getName());
+        EXPECT_STREQ("category", event.getCategory());
+        EXPECT_EQ(3, event.getArgs()[0].as_int);
+        EXPECT_STREQ("my_arg1", event.getArgNames()[0]);
+    });
+}
+#endif
@@ -0,0 +1,241 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "mock_stats_callback.h"
+#include "phosphor/tools/aggregate.h"
+#include "phosphor/trace_buffer.h"
+
+using namespace phosphor;
+using phosphor::tools::Aggregator;
+
+static tracepoint_info complete_tpi = {
+        "category",
+        "complete",
+        TraceEvent::Type::Complete,
+        {{nullptr, nullptr}},
+        {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+static tracepoint_info start_tpi = {
+        "category",
+        "sync",
+        TraceEvent::Type::SyncStart,
+        {{nullptr, nullptr}},
+        {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+static tracepoint_info end_tpi = {
+        "category",
+        "sync",
+        TraceEvent::Type::SyncEnd,
+        {{nullptr, nullptr}},
+        {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+static tracepoint_info async_start_tpi = {
+        "category",
+        "async",
+        TraceEvent::Type::AsyncStart,
+        {{"id", nullptr}},
+        {{TraceArgument::Type::is_pointer, TraceArgument::Type::is_none}}};
+
+static tracepoint_info async_end_tpi = {
+        "category",
+        "async",
+        TraceEvent::Type::AsyncEnd,
+        {{"id", nullptr}},
+        {{TraceArgument::Type::is_pointer, TraceArgument::Type::is_none}}};
+
+class AggregatorTest : public testing::Test {
+protected:
+    AggregatorTest() : context(make_fixed_buffer(0, 8)) {
+    }
+
+    TraceChunk& newChunk(uint32_t thread_id) {
+        auto* chunk = context.getBuffer()->getChunk();
+        chunk->reset(thread_id);
+        return *chunk;
+    }
+
+    static TraceEvent event(tracepoint_info* tpi,
+                            int64_t time,
+                            int64_t duration = 0,
+                            const void* id = nullptr) {
+        using namespace std::chrono;
+        return TraceEvent(tpi,
+                          steady_clock::time_point(nanoseconds(time)),
+                          nanoseconds(duration),
+                          {{id, 0}});
+    }
+
+    const Aggregator::Summary& find(const Aggregator::Result& result,
+                                    const tracepoint_info& tpi) {
+        for (const auto& summary : result.summaries) {
+            if (summary.tpi == &tpi) {
+                return summary;
+            }
+        }
+        throw std::out_of_range("No summary for " + std::string(tpi.name));
+    }
+
+    TraceContext context;
+};
+
+TEST_F(AggregatorTest, Empty) {
+    const auto result = Aggregator().aggregate(context);
+    EXPECT_TRUE(result.summaries.empty());
+    EXPECT_EQ(0, result.events);
+    EXPECT_EQ(0, result.unmatched);
+
+    EXPECT_EQ(0, Aggregator().aggregate(TraceContext(nullptr)).events);
+}
+
+TEST_F(AggregatorTest, Complete) {
+    auto& chunk = newChunk(1);
+    for (int i = 1; i <= 100; ++i) {
+        chunk.addEvent() = event(&complete_tpi, i * 1000, i * 1000);
+    }
+
+    const auto result = Aggregator().aggregate(context);
+    ASSERT_EQ(1, result.summaries.size());
+    const auto& summary = result.summaries[0];
+    EXPECT_EQ(&complete_tpi, summary.tpi);
+    EXPECT_EQ(100, summary.count);
+    EXPECT_EQ(5050 * 1000, summary.total_ns);
+    EXPECT_EQ(1000, summary.min_ns);
+    EXPECT_EQ(100000, summary.max_ns);
+    // Percentiles are within 1/8th of the true value
+    EXPECT_NEAR(50000, summary.p50_ns, 50000 / 8);
+    EXPECT_NEAR(90000, summary.p90_ns, 90000 / 8);
+    EXPECT_NEAR(99000, summary.p99_ns, 99000 / 8);
+    EXPECT_LE(summary.p50_ns, summary.p90_ns);
+    EXPECT_LE(summary.p90_ns, summary.p99_ns);
+}
+
+TEST_F(AggregatorTest, Sync) {
+    // Nested pair within a chunk
+    auto& first = newChunk(1);
+    first.addEvent() = event(&start_tpi, 100);
+    first.addEvent() = event(&start_tpi, 110);
+    first.addEvent() = event(&end_tpi, 120);
+    // Outer pair ends in a later chunk of the same thread, with a
+    // chunk of another thread in between
+    auto& other = newChunk(2);
+    other.addEvent() = event(&end_tpi, 150);
+    auto& second = newChunk(1);
+    second.addEvent() = event(&end_tpi, 400);
+    second.addEvent() = event(&start_tpi, 500);
+
+    for (size_t concurrency : {1, 2, 3}) {
+        const auto result = Aggregator(concurrency).aggregate(context);
+        EXPECT_EQ(6, result.events);
+        // An end without a start and a start without an end
+        EXPECT_EQ(2, result.unmatched);
+        const auto& summary = find(result, start_tpi);
+        EXPECT_EQ(2, summary.count);
+        EXPECT_EQ(10, summary.min_ns);
+        EXPECT_EQ(300, summary.max_ns);
+    }
+}
+
+/*
+ * Once a ring buffer wraps a thread's later events can be in a chunk
+ * which comes before its earlier events in buffer order
+ */
+TEST_F(AggregatorTest, SyncRingWrapped) {
+    TraceContext ring(make_ring_buffer(0, 2));
+    auto* buffer = ring.getBuffer();
+    auto* oldest = buffer->getChunk();
+    oldest->reset(1);
+    oldest->addEvent() = event(&complete_tpi, 0, 10);
+    auto* earlier = buffer->getChunk();
+    earlier->reset(1);
+    earlier->addEvent() = event(&start_tpi, 200);
+    buffer->returnChunk(*oldest);
+    auto* later = buffer->getChunk();
+    ASSERT_EQ(oldest, later);
+    later->reset(1);
+    later->addEvent() = event(&end_tpi, 400);
+    later->addEvent() = event(&start_tpi, 500);
+    ASSERT_EQ(later, &(*buffer)[0]);
+
+    for (size_t concurrency : {1, 2}) {
+        const auto result = Aggregator(concurrency).aggregate(ring);
+        EXPECT_EQ(3, result.events);
+        EXPECT_EQ(1, result.unmatched);
+        const auto& summary = find(result, start_tpi);
+        EXPECT_EQ(1, summary.count);
+        EXPECT_EQ(200, summary.total_ns);
+    }
+}
+
+/*
+ * Compact chunks are decoded one at a time, so events paired across
+ * chunks mustn't refer to the decoded events of an earlier chunk
+ */
+TEST_F(AggregatorTest, SyncCompact) {
+    auto& first = newChunk(1);
+    first.setFormat(EventFormat::compact);
+    first.addEvent(event(&start_tpi, 100), 0);
+    auto& second = newChunk(1);
+    second.setFormat(EventFormat::compact);
+    second.addEvent(event(&end_tpi, 400), 0);
+    second.addEvent(event(&start_tpi, 500), 0);
+
+    const auto result = Aggregator(1).aggregate(context);
+    EXPECT_EQ(3, result.events);
+    EXPECT_EQ(1, result.unmatched);
+    const auto& summary = find(result, start_tpi);
+    EXPECT_EQ(1, summary.count);
+    EXPECT_EQ(300, summary.total_ns);
+}
+
+TEST_F(AggregatorTest, Async) {
+    int a, b;
+    // Ends on another thread, ahead of the starts in buffer order
+    auto& other = newChunk(2);
+    other.addEvent() = event(&async_end_tpi, 1000, 0, &a);
+    other.addEvent() = event(&async_end_tpi, 50, 0, &b);
+    auto& first = newChunk(1);
+    first.addEvent() = event(&async_start_tpi, 100, 0, &a);
+    first.addEvent() = event(&async_start_tpi, 200, 0, &b);
+
+    const auto result = Aggregator(2).aggregate(context);
+    EXPECT_EQ(2, result.unmatched);
+    const auto& summary = find(result, async_start_tpi);
+    EXPECT_EQ(1, summary.count);
+    EXPECT_EQ(900, summary.total_ns);
+}
+
+TEST_F(AggregatorTest, Ordering) {
+    auto& chunk = newChunk(1);
+    chunk.addEvent() = event(&complete_tpi, 0, 10);
+    chunk.addEvent() = event(&start_tpi, 0);
+    chunk.addEvent() = event(&end_tpi, 100);
+
+    const auto result = Aggregator().aggregate(context);
+    ASSERT_EQ(2, result.summaries.size());
+    EXPECT_EQ(&start_tpi, result.summaries[0].tpi);
+    EXPECT_EQ(&complete_tpi, result.summaries[1].tpi);
+}
+
+TEST_F(AggregatorTest, Stats) {
+    auto& chunk = newChunk(1);
+    chunk.addEvent() = event(&complete_tpi, 0, 10);
+
+    MockStatsCallback callback;
+    using namespace testing;
+    callback.expectAny();
+    EXPECT_CALL(callback, callU(Eq("aggregate_events"), 1));
+    EXPECT_CALL(callback, callU(Eq("category:complete:count"), 1));
+    EXPECT_CALL(callback, callU(Eq("category:complete:max_ns"), 10));
+    Aggregator().aggregate(context).getStats(callback);
+}
@@ -0,0 +1,232 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <cstdio>
+#include <fstream>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+#include "phosphor/platform/thread.h"
+#include "phosphor/tools/binary_dump.h"
+#include "phosphor/tools/export.h"
+
+using namespace phosphor;
+using phosphor::tools::BinaryDumpReader;
+using phosphor::tools::writeBinaryDump;
+
+static tracepoint_info instant_tpi = {
+        "category",
+        "instant",
+        TraceEvent::Type::Instant,
+        {{"arg1", nullptr}},
+        {{TraceArgument::Type::is_int, TraceArgument::Type::is_none}}};
+
+static tracepoint_info complete_tpi = {
+        "other",
+        "complete",
+        TraceEvent::Type::Complete,
+        {{"arg1", "arg2"}},
+        {{TraceArgument::Type::is_double, TraceArgument::Type::is_bool}}};
+
+class DumpTraceContext : public TraceContext {
+public:
+    using TraceContext::TraceContext;
+
+    void public_addThreadName(uint64_t id, std::string name) {
+        addThreadName(id, std::move(name));
+    }
+};
+
+class BinaryDumpTest : public testing::Test {
+protected:
+    BinaryDumpTest()
+        : path("binarydumptest." +
+               std::to_string(platform::getCurrentProcessID()) + ".dump"),
+          context(make_fixed_buffer(0, 3)) {
+    }
+
+    ~BinaryDumpTest() override {
+        std::remove(path.c_str());
+    }
+
+    void addEvents(size_t count) {
+        using namespace std::chrono;
+        auto* chunk = context.getBuffer()->getChunk();
+        for (size_t i = 0; i < count; ++i) {
+            const steady_clock::time_point time(nanoseconds(1000 + i));
+            if (i % 2) {
+                chunk->addEvent() = TraceEvent(&complete_tpi,
+                                               time,
+                                               nanoseconds(i),
+                                               {{1.5, true}});
+            } else {
+                chunk->addEvent() =
+                        TraceEvent(&instant_tpi, time, {}, {{int(i), 0}});
+            }
+        }
+        context.getBuffer()->returnChunk(*chunk);
+    }
+
+    std::string path;
+    DumpTraceContext context;
+};
+
+TEST_F(BinaryDumpTest, RoundTrip) {
+    addEvents(TraceChunk::chunk_size);
+    addEvents(5);
+    context.public_addThreadName(platform::getCurrentThreadIDCached(),
+                                 "dumper");
+
+    const auto written = writeBinaryDump(context, path, true);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    EXPECT_EQ(written, size_t(file.tellg()));
+
+    BinaryDumpReader reader(path);
+    EXPECT_EQ("dumper",
+              reader.getThreadNames().at(platform::getCurrentThreadIDCached()));
+
+    auto expected = context.getBuffer()->begin();
+    EXPECT_EQ(TraceChunk::chunk_size + 5,
+              reader.decode([&expected](const TraceEvent& event,
+                                        uint32_t thread_id,
+                                        uint32_t process_id) {
+                  EXPECT_EQ(platform::getCurrentThreadIDCached(), thread_id);
+                  EXPECT_EQ(platform::getCurrentProcessID(), process_id);
+                  EXPECT_STREQ(expected->getName(), event.getName());
+                  EXPECT_STREQ(expected->getCategory(), event.getCategory());
+                  EXPECT_EQ(expected->getType(), event.getType());
+                  EXPECT_EQ(expected->getTime(), event.getTime());
+                  EXPECT_EQ(expected->getDuration(), event.getDuration());
+                  EXPECT_EQ(expected->to_json(thread_id),
+                            event.to_json(thread_id));
+                  ++expected;
+              }));
+    EXPECT_EQ(context.getBuffer()->end(), expected);
+
+    // The JSON conversion matches a JSON export of the buffer
+    EXPECT_EQ(nlohmann::json::parse(tools::JSONExport(context).read()),
+              nlohmann::json::parse(reader.toJSON()));
+}
+
+TEST_F(BinaryDumpTest, InternedStrings) {
+    static tracepoint_info interned_tpi = {
+            "category",
+            "interned",
+            TraceEvent::Type::Instant,
+            {{"arg1", "arg2"}},
+            {{TraceArgument::Type::is_interned,
+              TraceArgument::Type::is_interned}}};
+    auto* chunk = context.getBuffer()->getChunk();
+    {
+        StringTable table;
+        chunk->addEvent() = TraceEvent(
+                &interned_tpi, {{table.intern("first"), table.intern("second")}});
+        chunk->addEvent() = TraceEvent(
+                &interned_tpi, {{table.intern("second"), interned_string{0}}});
+        writeBinaryDump(context, path);
+    }
+
+    // The strings are resolved from the dump after the table has gone
+    BinaryDumpReader reader(path);
+    std::vector<std::string> strings;
+    reader.decode([&strings](const TraceEvent& event, uint32_t, uint32_t) {
+        for (const auto& arg : event.getArgs()) {
+            strings.emplace_back(StringTable::resolve(arg.as_interned));
+        }
+    });
+    EXPECT_THAT(strings, testing::ElementsAre("first", "second", "second", ""));
+}
+
+TEST_F(BinaryDumpTest, Compact) {
+    using namespace std::chrono;
+    // Compact chunks are written as full events, each decoded in turn
+    for (size_t c = 0; c < 2; ++c) {
+        auto* chunk = context.getBuffer()->getChunk();
+        chunk->setFormat(EventFormat::compact);
+        for (size_t i = 0; i < TraceChunk::compact_chunk_size; ++i) {
+            chunk->addEvent(TraceEvent(&complete_tpi,
+                                       steady_clock::time_point(nanoseconds(
+                                               c * 10000 + 5000 - i)),
+                                       nanoseconds(i),
+                                       {{1.5, true}}),
+                            0);
+        }
+        context.getBuffer()->returnChunk(*chunk);
+    }
+
+    writeBinaryDump(context, path);
+    BinaryDumpReader reader(path);
+    auto expected = context.getBuffer()->begin();
+    EXPECT_EQ(TraceChunk::compact_chunk_size * 2,
+              reader.decode([&expected](const TraceEvent& event,
+                                        uint32_t thread_id,
+                                        uint32_t) {
+                  EXPECT_EQ(expected->getTime(), event.getTime());
+                  EXPECT_EQ(expected->getDuration(), event.getDuration());
+                  EXPECT_EQ(expected->to_json(thread_id),
+                            event.to_json(thread_id));
+                  ++expected;
+              }));
+    EXPECT_EQ(context.getBuffer()->end(), expected);
+    EXPECT_EQ(nlohmann::json::parse(tools::JSONExport(context).read()),
+              nlohmann::json::parse(reader.toJSON()));
+}
+
+TEST_F(BinaryDumpTest, Empty) {
+    writeBinaryDump(context, path);
+    BinaryDumpReader reader(path);
+    EXPECT_EQ(0, reader.decode([](const TraceEvent&, uint32_t, uint32_t) {
+        FAIL();
+    }));
+    EXPECT_TRUE(reader.getThreadNames().empty());
+}
+
+TEST_F(BinaryDumpTest, ManyChunks) {
+    // More chunks than can be written in a single pwritev call
+    context = DumpTraceContext(make_fixed_buffer(0, 1500));
+    for (int i = 0; i < 1500; ++i) {
+        addEvents(1);
+    }
+    writeBinaryDump(context, path);
+    BinaryDumpReader reader(path);
+    EXPECT_EQ(1500,
+              reader.decode([](const TraceEvent&, uint32_t, uint32_t) {}));
+}
+
+TEST_F(BinaryDumpTest, Invalid) {
+    EXPECT_THROW(BinaryDumpReader reader(path), std::system_error);
+    EXPECT_THROW(writeBinaryDump(context, ""), std::system_error);
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "Not a dump, but long enough to hold a dump header";
+    }
+    EXPECT_THROW(BinaryDumpReader reader(path), std::runtime_error);
+
+    addEvents(10);
+    writeBinaryDump(context, path);
+    // Truncate the dump part way through the events
+    std::string contents;
+    {
+        std::ifstream file(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    contents.resize(contents.size() - 1);
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << contents;
+    }
+    BinaryDumpReader reader(path);
+    EXPECT_THROW(reader.decode([](const TraceEvent&, uint32_t, uint32_t) {}),
+                 std::runtime_error);
+}
@@ -89,6 +89,113 @@ TEST_F(CategoryRegistryTest, DisableAll) {
     EXPECT_EQ(CategoryStatus::Disabled, registry.getStatus("notdefault"));
 }
 
+TEST_F(CategoryRegistryTest, Sessions) {
+    const auto& both = registry.getStatus("memcached,ep-engine");
+    const auto group = registry.getGroupIndex(both);
+    registry.updateEnabled({{"memcached"}}, {{}});
+    registry.updateSessionEnabled(2, {{"ep-engine"}}, {{}});
+    EXPECT_EQ(0b101u, registry.getSessionMask(group));
+    EXPECT_EQ(CategoryStatus::Disabled, registry.getStatus("other"));
+
+    // Categories added later are enabled in each matching session
+    const auto& engine = registry.getStatus("ep-engine");
+    EXPECT_EQ(0b100u, registry.getSessionMask(registry.getGroupIndex(engine)));
+    EXPECT_NE(CategoryStatus::Disabled, engine.load());
+
+    // Sessions are disabled independently
+    registry.disableSession(0);
+    EXPECT_EQ(0b100u, registry.getSessionMask(group));
+    registry.updateEnabled({{"*"}}, {{}});
+    registry.disableSession(2);
+    EXPECT_EQ(CategoryStatus::Enabled, both.load());
+    registry.disableAll();
+    EXPECT_EQ(CategoryStatus::Disabled, both.load());
+}
+
+TEST_F(CategoryRegistryTest, Thresholds) {
+    using namespace std::chrono_literals;
+    const auto& single = registry.getStatus("memcached");
+    const auto& multi = registry.getStatus("memcached,ep-engine");
+    EXPECT_EQ(0ns, registry.getThreshold(single));
+    EXPECT_FALSE(registry.hasThresholds());
+
+    registry.updateEnabled({{"*"}}, {{}}, {{"memcached", 10us}, {"*", 1us}});
+    EXPECT_TRUE(registry.hasThresholds());
+    EXPECT_EQ(10us, registry.getThreshold(single));
+    // The smallest threshold of the enabled categories in the group
+    EXPECT_EQ(1us, registry.getThreshold(multi));
+    // Groups registered after the update also get a threshold
+    EXPECT_EQ(1us, registry.getThreshold(registry.getStatus("other")));
+
+    // A disabled category doesn't contribute to the group's threshold
+    registry.updateEnabled({{"*"}}, {{"ep-engine"}}, {{"memcached", 10us}});
+    EXPECT_EQ(10us, registry.getThreshold(multi));
+
+    registry.updateEnabled({{"*"}}, {{}});
+    EXPECT_FALSE(registry.hasThresholds());
+    EXPECT_EQ(0ns, registry.getThreshold(single));
+    EXPECT_EQ(0ns, registry.getThreshold(multi));
+
+    // A status which isn't the registry's has no threshold
+    const AtomicCategoryStatus other(CategoryStatus::Enabled);
+    EXPECT_EQ(0ns, registry.getThreshold(other));
+}
+
+TEST_F(CategoryRegistryTest, Partitions) {
+    const auto& frontend = registry.getStatus("memcached:frontend");
+    const auto& flusher = registry.getStatus("ep-engine:flusher");
+    const auto& both = registry.getStatus("ep-engine:flusher,memcached:bucket");
+    EXPECT_EQ(0, registry.getPartition(registry.getGroupIndex(frontend)));
+
+    registry.updatePartitions({{"memcached:*"}, {"ep-engine:flusher"}});
+    EXPECT_EQ(1, registry.getPartition(registry.getGroupIndex(frontend)));
+    EXPECT_EQ(2, registry.getPartition(registry.getGroupIndex(flusher)));
+    // The first matching partition is used
+    EXPECT_EQ(1, registry.getPartition(registry.getGroupIndex(both)));
+    // Groups registered after the update are also assigned a partition
+    EXPECT_EQ(0,
+              registry.getPartition(
+                      registry.getGroupIndex(registry.getStatus("other"))));
+
+    registry.updatePartitions({});
+    EXPECT_EQ(0, registry.getPartition(registry.getGroupIndex(frontend)));
+}
+
+TEST_F(CategoryRegistryTest, Counted) {
+    const auto& frontend = registry.getStatus("memcached:frontend");
+    const auto& flusher = registry.getStatus("ep-engine:flusher");
+    const auto& both = registry.getStatus("ep-engine:flusher,memcached:bucket");
+    EXPECT_FALSE(registry.isCounted(frontend));
+
+    registry.updateCounted({"memcached:*"});
+    EXPECT_TRUE(registry.isCounted(frontend));
+    EXPECT_FALSE(registry.isCounted(flusher));
+    // Any counted category counts the group
+    EXPECT_TRUE(registry.isCounted(both));
+    // Groups registered after the update are also counted
+    EXPECT_TRUE(registry.isCounted(registry.getStatus("memcached:other")));
+
+    registry.updateCounted({});
+    EXPECT_FALSE(registry.isCounted(frontend));
+}
+
+TEST_F(CategoryRegistryTest, GroupMask) {
+    const auto frontend = registry.getGroupIndex(
+            registry.getStatus("memcached:frontend"));
+    const auto flusher =
+            registry.getGroupIndex(registry.getStatus("ep-engine:flusher"));
+    const auto both = registry.getGroupIndex(
+            registry.getStatus("ep-engine:flusher,memcached:bucket"));
+
+    const auto mask = registry.getGroupMask({"ep-engine*"});
+    EXPECT_TRUE(mask & (uint64_t(1) << flusher));
+    EXPECT_TRUE(mask & (uint64_t(1) << both));
+    EXPECT_FALSE(mask & (uint64_t(1) << frontend));
+
+    EXPECT_TRUE(registry.getGroupMask({"memcached:*"}) &
+                (uint64_t(1) << frontend));
+}
+
 // Fills the registry with categories, checks they're all disabled,
 // enables them all, checks they're all enabled, disables them all,
 // checks they're all disabled.
@@ -9,14 +9,22 @@
  *   the file licenses/APL2.txt.
  */
 
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <map>
+
 #include "phosphor/platform/thread.h"
+#include "phosphor/tools/binary_dump.h"
 #include "phosphor/tools/export.h"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <nlohmann/json.hpp>
 
+using phosphor::tools::AsyncFileStopCallback;
 using phosphor::tools::FileStopCallback;
 using phosphor::tools::JSONExport;
+using phosphor::tools::PerfettoExport;
 using namespace phosphor;
 
 static tracepoint_info tpi = {
@@ -170,11 +178,263 @@ TEST_F(ExportTest, LotsOfThreadsEmptyBuffer) {
     EXPECT_TRUE(entry.is_object()) << entry.dump();
 }
 
+TEST_F(ExportTest, Query) {
+    using namespace std::chrono;
+    static tracepoint_info other_tpi = {
+            "other",
+            "other_name",
+            TraceEvent::Type::Instant,
+            {{nullptr, nullptr}},
+            {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+    const steady_clock::time_point epoch;
+    auto* chunk = context.getBuffer()->getChunk();
+    for (int i = 0; i < 10; ++i) {
+        chunk->addEvent(TraceEvent(i % 2 ? &tpi : &other_tpi,
+                                   epoch + nanoseconds(i * 100),
+                                   {},
+                                   {}),
+                        i % 2);
+    }
+    addThreadsToContext(2);
+
+    EventQuery query;
+    query.setTimeRange(epoch + 200ns, epoch + 800ns).setCategories({"category"});
+    const auto json = nlohmann::json::parse(JSONExport(context, query).read());
+    std::vector<int> times;
+    for (const auto& event : json["traceEvents"]) {
+        if (event["ph"] != "M") {
+            EXPECT_EQ("name", event["name"]);
+            times.push_back(int(event["ts"].get<double>() * 1000));
+        }
+    }
+    EXPECT_EQ(std::vector<int>({300, 500, 700}), times);
+    EXPECT_EQ(2 + 3, json["traceEvents"].size());
+
+    // Nothing matches so only the thread names are exported
+    query.setTimeRange(epoch + 1000ns, epoch + 2000ns);
+    EXPECT_EQ(2,
+              nlohmann::json::parse(JSONExport(context, query).read())
+                      ["traceEvents"]
+                              .size());
+}
+
 TEST_F(ExportTest, TestEmpty) {
     const auto json = getTraceJson();
     EXPECT_EQ(0, json["traceEvents"].size());
 }
 
+/**
+ * Minimal protobuf decoder used to verify the Perfetto export. Varint
+ * and fixed64 fields are decoded as integers, length-delimited fields
+ * as bytes (which may be parsed again as a nested message).
+ */
+struct ProtoMessage {
+    std::multimap<uint32_t, uint64_t> ints;
+    std::multimap<uint32_t, std::string> bytes;
+
+    static ProtoMessage parse(std::string_view data) {
+        ProtoMessage message;
+        size_t pos = 0;
+        auto varint = [&data, &pos]() {
+            uint64_t value = 0;
+            for (int shift = 0; pos < data.size(); shift += 7) {
+                const auto byte = uint8_t(data[pos++]);
+                value |= uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    return value;
+                }
+            }
+            throw std::runtime_error("ProtoMessage: truncated varint");
+        };
+        while (pos < data.size()) {
+            const auto key = varint();
+            const auto field = uint32_t(key >> 3);
+            switch (key & 7) {
+            case 0:
+                message.ints.emplace(field, varint());
+                break;
+            case 1: {
+                uint64_t value;
+                std::memcpy(&value, data.data() + pos, sizeof(value));
+                message.ints.emplace(field, value);
+                pos += sizeof(value);
+                break;
+            }
+            case 2: {
+                const auto length = varint();
+                message.bytes.emplace(field, data.substr(pos, length));
+                pos += length;
+                break;
+            }
+            default:
+                throw std::runtime_error("ProtoMessage: unexpected wire type");
+            }
+        }
+        if (pos != data.size()) {
+            throw std::runtime_error("ProtoMessage: truncated message");
+        }
+        return message;
+    }
+
+    bool has(uint32_t field) const {
+        return ints.count(field) || bytes.count(field);
+    }
+
+    uint64_t getInt(uint32_t field) const {
+        return ints.find(field)->second;
+    }
+
+    std::vector<ProtoMessage> getMessages(uint32_t field) const {
+        std::vector<ProtoMessage> messages;
+        const auto range = bytes.equal_range(field);
+        for (auto it = range.first; it != range.second; ++it) {
+            messages.push_back(parse(it->second));
+        }
+        return messages;
+    }
+
+    ProtoMessage getMessage(uint32_t field) const {
+        return parse(bytes.find(field)->second);
+    }
+};
+
+class PerfettoExportTest : public ExportTest {
+protected:
+    std::vector<ProtoMessage> getPackets(bool chunked = false) {
+        PerfettoExport exporter(context);
+        std::string data;
+        if (chunked) {
+            std::string section;
+            while (!(section = exporter.read(16)).empty()) {
+                data.append(section);
+            }
+        } else {
+            data = exporter.read();
+        }
+        EXPECT_TRUE(exporter.done());
+        EXPECT_TRUE(exporter.read(4096).empty());
+
+        const auto trace = ProtoMessage::parse(data);
+        // A trace only consists of packets
+        EXPECT_TRUE(trace.ints.empty());
+        EXPECT_EQ(trace.bytes.size(), trace.bytes.count(1));
+        return trace.getMessages(1);
+    }
+};
+
+TEST_F(PerfettoExportTest, Empty) {
+    EXPECT_TRUE(getPackets().empty());
+}
+
+TEST_F(PerfettoExportTest, Events) {
+    using namespace std::chrono;
+    static tracepoint_info instant_tpi = {
+            "category",
+            "instant",
+            TraceEvent::Type::Instant,
+            {{"number", "text"}},
+            {{TraceArgument::Type::is_int, TraceArgument::Type::is_string}}};
+    static tracepoint_info complete_tpi = {
+            "category",
+            "complete",
+            TraceEvent::Type::Complete,
+            {{nullptr, nullptr}},
+            {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+    const steady_clock::time_point t0(nanoseconds(1000000));
+
+    auto* chunk = context.getBuffer()->getChunk();
+    context.public_addThreadName(chunk->threadID(), "worker");
+    chunk->addEvent() = TraceEvent(&instant_tpi, t0, {}, {{-3, "hello"}});
+    chunk->addEvent() =
+            TraceEvent(&complete_tpi, t0 - 500ns, 2000ns, {{0, 0}});
+    chunk->addEvent() =
+            TraceEvent(&instant_tpi, t0 + 3000ns, {}, {{4, "again"}});
+
+    const auto packets = getPackets();
+
+    // The sequence starts by clearing its state and defining the clocks
+    ASSERT_FALSE(packets.empty());
+    const auto& start = packets[0];
+    const auto sequence_id = start.getInt(10);
+    EXPECT_EQ(1, start.getInt(13));
+    const auto clocks = start.getMessage(6).getMessages(1);
+    ASSERT_EQ(2, clocks.size());
+    EXPECT_EQ(64, clocks[1].getInt(1));
+    EXPECT_EQ(1, clocks[1].getInt(3));
+    auto clock = clocks[1].getInt(2);
+    EXPECT_EQ(1000000, clock);
+    const auto defaults = start.getMessage(59);
+    EXPECT_EQ(64, defaults.getInt(58));
+    const auto thread_uuid = defaults.getMessage(11).getInt(11);
+
+    std::map<uint64_t, std::string> names;
+    std::vector<ProtoMessage> events;
+    std::vector<uint64_t> timestamps;
+    bool described_thread = false;
+    for (const auto& packet : packets) {
+        EXPECT_EQ(sequence_id, packet.getInt(10));
+        if (packet.has(60)) {
+            const auto track = packet.getMessage(60);
+            if (track.has(4)) {
+                EXPECT_EQ(thread_uuid, track.getInt(1));
+                const auto thread = track.getMessage(4);
+                EXPECT_EQ(chunk->threadID(), thread.getInt(2));
+                EXPECT_EQ("worker", thread.bytes.find(5)->second);
+                described_thread = true;
+            }
+        }
+        if (packet.has(12)) {
+            for (const auto& name : packet.getMessage(12).getMessages(2)) {
+                names[name.getInt(1)] = name.bytes.find(2)->second;
+            }
+        }
+        if (packet.has(11)) {
+            events.push_back(packet.getMessage(11));
+            if (packet.ints.count(58)) {
+                // Absolute timestamp on the monotonic clock
+                EXPECT_EQ(3, packet.getInt(58));
+                timestamps.push_back(packet.getInt(8));
+            } else {
+                clock += packet.getInt(8);
+                timestamps.push_back(clock);
+            }
+        }
+    }
+    EXPECT_TRUE(described_thread);
+
+    // Complete events are split into a begin and end
+    ASSERT_EQ(4, events.size());
+    EXPECT_EQ(std::vector<uint64_t>({1000000, 999500, 1001500, 1003000}),
+              timestamps);
+    EXPECT_EQ(3, events[0].getInt(9));
+    EXPECT_EQ("instant", names[events[0].getInt(10)]);
+    EXPECT_EQ(1, events[1].getInt(9));
+    EXPECT_EQ("complete", names[events[1].getInt(10)]);
+    EXPECT_EQ(2, events[2].getInt(9));
+    EXPECT_EQ(events[0].getInt(10), events[3].getInt(10));
+
+    const auto annotations = events[0].getMessages(4);
+    ASSERT_EQ(2, annotations.size());
+    EXPECT_EQ(-3, int64_t(annotations[0].getInt(4)));
+    EXPECT_EQ("hello", annotations[1].bytes.find(6)->second);
+}
+
+TEST_F(PerfettoExportTest, Chunked) {
+    fillContextBuffer();
+    PerfettoExport single(context);
+    PerfettoExport chunked(context);
+    std::string data;
+    std::string section;
+    while (!(section = chunked.read(7)).empty()) {
+        data.append(section);
+    }
+    EXPECT_EQ(single.read(), data);
+    // Every event is interned and delta-encoded so should be much smaller
+    // than the equivalent JSON
+    EXPECT_LT(data.size() * 3, JSONExport(context).read().size());
+    EXPECT_EQ(100 + 3, getPackets(true).size());
+}
+
 class FileStopCallbackTest : public testing::Test {
 public:
     void TearDown() override {
@@ -234,3 +494,130 @@ TEST_F(FileStopCallbackTest, file_open_fail) {
                               std::make_shared<FileStopCallback>(filename)));
     EXPECT_THROW(log.stop(), std::runtime_error);
 }
+
+TEST_F(FileStopCallbackTest, async_to_file) {
+    phosphor::TraceLog log;
+    filename = "asyncfilecallbacktest.json";
+
+    std::string completed_path;
+    std::exception_ptr completed_error;
+    AsyncFileStopCallback::Options options;
+    options.write_size = 100;
+    options.sync = AsyncFileStopCallback::SyncPolicy::on_close;
+    options.on_complete = [&completed_path, &completed_error](
+                                  const std::string& path,
+                                  std::exception_ptr error) {
+        completed_path = path;
+        completed_error = error;
+    };
+    auto callback = std::make_shared<AsyncFileStopCallback>(filename, options);
+    EXPECT_FALSE(callback->getLastWrite().valid());
+
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::fixed, 80000)
+                      .setStoppedCallback(callback));
+    log.registerThread();
+    size_t count = 0;
+    while (log.isEnabled()) {
+        log.logEvent(&tpi, 0, NoneType());
+        ++count;
+    }
+    log.deregisterThread();
+
+    // The buffer has been handed over to the writer so tracing can be
+    // restarted straight away
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::fixed, 80000));
+    log.stop();
+
+    auto write = callback->getLastWrite();
+    ASSERT_TRUE(write.valid());
+    EXPECT_NO_THROW(write.get());
+    EXPECT_EQ(filename, completed_path);
+    EXPECT_FALSE(completed_error);
+
+    std::ifstream file(filename);
+    const auto json = nlohmann::json::parse(file);
+    // The event which filled the buffer was dropped
+    EXPECT_EQ(count - 1, json["traceEvents"].size());
+}
+
+TEST_F(FileStopCallbackTest, async_binary_dump) {
+    phosphor::TraceLog log;
+    filename = "asyncfilecallbacktest.dump";
+    AsyncFileStopCallback::Options options;
+    options.format = AsyncFileStopCallback::Format::binary;
+    auto callback = std::make_shared<AsyncFileStopCallback>(filename, options);
+
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::fixed, 80000)
+                      .setStoppedCallback(callback));
+    log.registerThread();
+    for (int i = 0; i < 10; ++i) {
+        log.logEvent(&tpi, 0, NoneType());
+    }
+    log.deregisterThread();
+    log.stop();
+    callback->wait();
+
+    phosphor::tools::BinaryDumpReader reader(filename);
+    EXPECT_EQ(10,
+              reader.decode([](const TraceEvent& event, uint32_t, uint32_t) {
+                  EXPECT_STREQ("name", event.getName());
+              }));
+}
+
+TEST_F(FileStopCallbackTest, async_file_open_fail) {
+    phosphor::TraceLog log;
+    bool completed = false;
+    AsyncFileStopCallback::Options options;
+    options.on_complete = [&completed](const std::string&,
+                                       std::exception_ptr error) {
+        completed = true;
+        EXPECT_TRUE(error);
+    };
+    auto callback = std::make_shared<AsyncFileStopCallback>("", options);
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::fixed, 80000)
+                      .setStoppedCallback(callback));
+    // The error is reported by the writer rather than by stop()
+    EXPECT_NO_THROW(log.stop());
+    EXPECT_THROW(callback->getLastWrite().get(), std::system_error);
+    EXPECT_TRUE(completed);
+}
+
+TEST_F(FileStopCallbackTest, async_restart_during_write) {
+    phosphor::TraceLog log;
+    filename = "asyncrestarttest.json";
+
+    // Holds up the writer until the restart has returned
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    AsyncFileStopCallback::Options options;
+    options.on_complete = [released](const std::string&, std::exception_ptr) {
+        released.wait();
+    };
+    auto callback = std::make_shared<AsyncFileStopCallback>(filename, options);
+    log.start(phosphor::TraceConfig(phosphor::BufferMode::fixed, 80000)
+                      .setStoppedCallback(callback));
+    log.stop();
+    auto write = callback->getLastWrite();
+
+    // Restarting replaces the config holding the last reference to the
+    // callback while its write is still in flight
+    callback.reset();
+    auto restart = std::async(std::launch::async, [&log]() {
+        log.start(phosphor::TraceConfig(phosphor::BufferMode::fixed, 80000));
+    });
+    EXPECT_EQ(std::future_status::ready,
+              restart.wait_for(std::chrono::seconds(10)));
+    EXPECT_EQ(std::future_status::timeout,
+              write.wait_for(std::chrono::seconds(0)));
+    release.set_value();
+    restart.get();
+    EXPECT_NO_THROW(write.get());
+    log.stop();
+}
+
+TEST_F(FileStopCallbackTest, async_invalid_write_size) {
+    AsyncFileStopCallback::Options options;
+    options.write_size = 0;
+    EXPECT_THROW(AsyncFileStopCallback("test.json", options),
+                 std::invalid_argument);
+}
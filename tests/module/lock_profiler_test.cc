@@ -0,0 +1,149 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <chrono>
+#include <shared_mutex>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <phosphor/lock_profiler.h>
+#include <phosphor/scoped_event_guard.h>
+
+using namespace std::chrono_literals;
+
+class LockProfilerTest : public testing::Test {
+protected:
+    LockProfilerTest() : profiler(phosphor::LockProfiler::getInstance()) {
+        profiler.reset();
+        profiler.enable();
+    }
+
+    ~LockProfilerTest() override {
+        profiler.disable();
+        profiler.reset();
+    }
+
+    phosphor::LockProfiler& profiler;
+    int mutexA = 0;
+    int mutexB = 0;
+};
+
+TEST_F(LockProfilerTest, RecordAndRank) {
+    profiler.record(&mutexA,
+                    nullptr,
+                    phosphor::LockMode::exclusive,
+                    10ns,
+                    100ns);
+    profiler.record(&mutexB,
+                    nullptr,
+                    phosphor::LockMode::exclusive,
+                    1000ns,
+                    100ns);
+    profiler.record(&mutexB, nullptr, phosphor::LockMode::shared, 24ns, 1ns);
+
+    const auto report = profiler.getReport();
+    ASSERT_EQ(2, report.size());
+
+    // mutexB has waited the longest so should be ranked first
+    EXPECT_EQ(&mutexB, report[0].mutex);
+    EXPECT_EQ(1, report[0].acquisitions);
+    EXPECT_EQ(1, report[0].shared_acquisitions);
+    EXPECT_EQ(1024, report[0].total_wait_ns);
+    EXPECT_EQ(1000, report[0].max_wait_ns);
+    EXPECT_EQ(101, report[0].total_held_ns);
+
+    EXPECT_EQ(&mutexA, report[1].mutex);
+    EXPECT_EQ(10, report[1].total_wait_ns);
+
+    EXPECT_EQ(1, profiler.getReport(1).size());
+}
+
+TEST_F(LockProfilerTest, TryLockFailure) {
+    profiler.recordTryLockFailure(&mutexA, nullptr);
+    profiler.recordTryLockFailure(&mutexA, nullptr);
+
+    const auto report = profiler.getReport();
+    ASSERT_EQ(1, report.size());
+    EXPECT_EQ(2, report[0].try_lock_failures);
+    EXPECT_EQ(0, report[0].acquisitions);
+}
+
+TEST_F(LockProfilerTest, Reset) {
+    profiler.record(&mutexA, nullptr, phosphor::LockMode::exclusive, 1ns, 1ns);
+    profiler.reset();
+    EXPECT_TRUE(profiler.getReport().empty());
+}
+
+TEST_F(LockProfilerTest, MergesExitedThreads) {
+    std::thread([this]() {
+        profiler.record(
+                &mutexA, nullptr, phosphor::LockMode::exclusive, 5ns, 5ns);
+    }).join();
+    profiler.record(&mutexA, nullptr, phosphor::LockMode::exclusive, 5ns, 5ns);
+
+    const auto report = profiler.getReport();
+    ASSERT_EQ(1, report.size());
+    EXPECT_EQ(2, report[0].acquisitions);
+    EXPECT_EQ(10, report[0].total_wait_ns);
+}
+
+TEST_F(LockProfilerTest, Percentile) {
+    using LockStats = phosphor::LockProfiler::LockStats;
+    for (int i = 0; i < 99; ++i) {
+        profiler.record(
+                &mutexA, nullptr, phosphor::LockMode::exclusive, 3ns, 0ns);
+    }
+    profiler.record(
+            &mutexA, nullptr, phosphor::LockMode::exclusive, 1000ns, 0ns);
+
+    const auto report = profiler.getReport();
+    ASSERT_EQ(1, report.size());
+    // 3ns falls in the [2, 4) bucket and 1000ns in the [512, 1024) bucket
+    EXPECT_EQ(3, LockStats::percentile(report[0].wait_histogram, 50));
+    EXPECT_EQ(1023, LockStats::percentile(report[0].wait_histogram, 100));
+    EXPECT_EQ(0, LockStats::percentile(report[0].held_histogram, 99));
+    EXPECT_EQ(0, LockStats::percentile(LockStats().held_histogram, 50));
+}
+
+TEST_F(LockProfilerTest, SharedMutexGuards) {
+    std::shared_mutex mutex;
+    {
+        phosphor::SharedMutexEventGuard<std::shared_mutex> reader(
+                nullptr, nullptr, false, mutex);
+        phosphor::SharedMutexEventGuard<std::shared_mutex> reader2(
+                nullptr, nullptr, false, mutex);
+        phosphor::MutexEventGuard<std::shared_mutex> writer(
+                nullptr, nullptr, false, mutex, std::try_to_lock);
+        EXPECT_FALSE(writer.owns_lock());
+    }
+    {
+        phosphor::MutexEventGuard<std::shared_mutex> writer(
+                nullptr, nullptr, false, mutex);
+    }
+
+    const auto report = profiler.getReport();
+    ASSERT_EQ(1, report.size());
+    EXPECT_EQ(&mutex, report[0].mutex);
+    EXPECT_EQ(1, report[0].acquisitions);
+    EXPECT_EQ(2, report[0].shared_acquisitions);
+    EXPECT_EQ(1, report[0].try_lock_failures);
+}
+
+TEST_F(LockProfilerTest, DisabledGuardsDoNotRecord) {
+    profiler.disable();
+    std::mutex mutex;
+    {
+        phosphor::MutexEventGuard<std::mutex> guard(
+                nullptr, nullptr, false, mutex);
+    }
+    EXPECT_TRUE(profiler.getReport().empty());
+}
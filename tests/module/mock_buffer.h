@@ -23,10 +23,10 @@ public:
     MOCK_CONST_METHOD1(getStats, void(phosphor::StatsCallback&));
 
     // Delegate for mockable method name
-    virtual const phosphor::TraceChunk& operator[](const int index) const {
+    const phosphor::TraceChunk& operator[](const size_t index) const override {
         return operatorAt(index);
     }
-    MOCK_CONST_METHOD1(operatorAt, const phosphor::TraceChunk&(const int));
+    MOCK_CONST_METHOD1(operatorAt, const phosphor::TraceChunk&(const size_t));
 
     MOCK_CONST_METHOD0(chunk_count, size_t());
     MOCK_CONST_METHOD0(getGeneration, size_t());
@@ -0,0 +1,294 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#ifndef _WIN32
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <map>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+#include <phosphor/platform/thread.h>
+#include <phosphor/shared_memory_buffer.h>
+
+#include "mock_stats_callback.h"
+
+using namespace phosphor;
+using namespace std::string_view_literals;
+
+static tracepoint_info tpi = {
+        "category",
+        "name",
+        TraceEvent::Type::Instant,
+        {{"arg1", "arg2"}},
+        {{TraceArgument::Type::is_int, TraceArgument::Type::is_string}}};
+
+class SharedMemoryBufferTest : public testing::Test {
+protected:
+    SharedMemoryBufferTest()
+        : name("/phosphor-test-" +
+               std::to_string(platform::getCurrentProcessID())) {
+        remove_shared_memory_buffer(name);
+    }
+
+    ~SharedMemoryBufferTest() override {
+        remove_shared_memory_buffer(name);
+    }
+
+    static void addEvents(TraceBuffer& buffer, int count, bool give_back) {
+        auto* chunk = buffer.getChunk();
+        ASSERT_NE(nullptr, chunk);
+        for (int i = 0; i < count; ++i) {
+            chunk->addEvent() = TraceEvent(&tpi, {{i, "value"}});
+        }
+        if (give_back) {
+            buffer.returnChunk(*chunk);
+        }
+    }
+
+    std::string name;
+};
+
+TEST_F(SharedMemoryBufferTest, ReaderDecodesEvents) {
+    auto buffer = make_shared_memory_buffer(name, 0, 4);
+    addEvents(*buffer, 2, true);
+
+    SharedMemoryReader reader(name);
+    EXPECT_EQ(4, reader.size());
+    const auto events = reader.collect();
+    ASSERT_EQ(2, events.size());
+
+    const auto json = nlohmann::json::parse(events[1]);
+    EXPECT_EQ("name", json["name"]);
+    EXPECT_EQ("category", json["cat"]);
+    EXPECT_EQ("i", json["ph"]);
+    EXPECT_EQ(platform::getCurrentProcessID(), json["pid"]);
+    EXPECT_EQ(platform::getCurrentThreadIDCached(), json["tid"]);
+    EXPECT_EQ(1, json["args"]["arg1"]);
+    // String arguments recorded by pointer are exported as an address
+    EXPECT_TRUE(json["args"]["arg2"].is_string());
+
+    // Released chunks are not collected again
+    EXPECT_TRUE(reader.collect().empty());
+
+    const auto document = nlohmann::json::parse(reader.collectJSON());
+    EXPECT_TRUE(document["traceEvents"].empty());
+}
+
+TEST_F(SharedMemoryBufferTest, CollectWithoutRelease) {
+    auto buffer = make_shared_memory_buffer(name, 0, 1);
+    addEvents(*buffer, 3, true);
+    EXPECT_EQ(nullptr, buffer->getChunk());
+
+    SharedMemoryReader reader(name);
+    EXPECT_EQ(3, reader.collect(false).size());
+    EXPECT_EQ(nullptr, buffer->getChunk());
+
+    const auto document = nlohmann::json::parse(reader.collectJSON());
+    EXPECT_EQ(3, document["traceEvents"].size());
+
+    // The collected chunk can now be reused by the writer
+    EXPECT_NE(nullptr, buffer->getChunk());
+}
+
+TEST_F(SharedMemoryBufferTest, NeverFull) {
+    auto buffer = make_shared_memory_buffer(name, 0, 1);
+    addEvents(*buffer, 1, false);
+    EXPECT_EQ(nullptr, buffer->getChunk());
+    EXPECT_FALSE(buffer->isFull());
+
+    testing::NiceMock<MockStatsCallback> callback;
+    callback.expectAny();
+    EXPECT_CALL(callback, callS("buffer_name"sv, "SharedMemoryTraceBuffer"sv));
+    EXPECT_CALL(callback, callB("buffer_is_full"sv, false));
+    EXPECT_CALL(callback, callU("buffer_chunk_count"sv, 1));
+    EXPECT_CALL(callback, callU("buffer_loaned_chunks"sv, 1));
+    EXPECT_CALL(callback, callU("buffer_size"sv, 1));
+    EXPECT_CALL(callback, callU("buffer_failed_acquisitions"sv, 1));
+    buffer->getStats(callback);
+}
+
+TEST_F(SharedMemoryBufferTest, LoanedChunksPublishedOnDestruction) {
+    auto buffer = make_shared_memory_buffer(name, 0, 2);
+    addEvents(*buffer, 5, false);
+
+    SharedMemoryReader reader(name);
+    EXPECT_TRUE(reader.collect().empty());
+    buffer.reset();
+    EXPECT_EQ(5, reader.collect().size());
+}
+
+TEST_F(SharedMemoryBufferTest, IteratesUncollectedChunks) {
+    auto buffer = make_shared_memory_buffer(name, 0, 4);
+    addEvents(*buffer, 3, true);
+    addEvents(*buffer, 2, false);
+
+    size_t count = 0;
+    for (const auto& event : *buffer) {
+        EXPECT_STREQ("name", event.getName());
+        ++count;
+    }
+    EXPECT_EQ(5, count);
+
+    SharedMemoryReader reader(name);
+    reader.collect();
+    count = 0;
+    for (const auto& event : *buffer) {
+        (void)event;
+        ++count;
+    }
+    EXPECT_EQ(2, count);
+}
+
+TEST_F(SharedMemoryBufferTest, WritersShareSegment) {
+    auto first = make_shared_memory_buffer(name, 0, 2);
+    // The size of the existing segment is used
+    auto second = make_shared_memory_buffer_factory(name)(1, 10);
+    EXPECT_EQ(1, second->getGeneration());
+    addEvents(*first, 1, true);
+    addEvents(*second, 1, true);
+    EXPECT_EQ(nullptr, second->getChunk());
+
+    SharedMemoryReader reader(name);
+    EXPECT_EQ(2, reader.size());
+    EXPECT_EQ(2, reader.collect().size());
+}
+
+TEST_F(SharedMemoryBufferTest, MultipleProcesses) {
+    auto buffer = make_shared_memory_buffer(name, 0, 4);
+    addEvents(*buffer, 1, true);
+
+    const auto child = fork();
+    ASSERT_NE(-1, child);
+    if (child == 0) {
+        static tracepoint_info child_tpi = {
+                "child",
+                "child_name",
+                TraceEvent::Type::Instant,
+                {{nullptr, nullptr}},
+                {{TraceArgument::Type::is_none,
+                  TraceArgument::Type::is_none}}};
+        auto child_buffer = make_shared_memory_buffer(name, 0, 4);
+        auto* chunk = child_buffer->getChunk();
+        chunk->addEvent() = TraceEvent(&child_tpi, {{0, 0}});
+        child_buffer->returnChunk(*chunk);
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    SharedMemoryReader reader(name);
+    const auto document = nlohmann::json::parse(reader.collectJSON());
+    const auto& events = document["traceEvents"];
+    ASSERT_EQ(2, events.size());
+    std::map<int, std::string> names;
+    for (const auto& event : events) {
+        names[event["pid"].get<int>()] = event["name"];
+    }
+    EXPECT_EQ("name", names[platform::getCurrentProcessID()]);
+    EXPECT_EQ("child_name", names[child]);
+}
+
+TEST_F(SharedMemoryBufferTest, ReclaimsSlotsOfExitedWriters) {
+    auto buffer = make_shared_memory_buffer(name, 0, 1);
+
+    // The child exits while it still holds the only slot
+    const auto child = fork();
+    ASSERT_NE(-1, child);
+    if (child == 0) {
+        auto child_buffer = make_shared_memory_buffer(name, 0, 1);
+        _exit(child_buffer->getChunk() ? 0 : 1);
+    }
+    int status = 0;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+    EXPECT_EQ(nullptr, buffer->getChunk());
+
+    SharedMemoryReader reader(name);
+    EXPECT_TRUE(reader.collect().empty());
+    EXPECT_EQ(1, reader.reclaimedSlots());
+    EXPECT_NE(nullptr, buffer->getChunk());
+
+    // Slots on loan to a live writer are left alone
+    EXPECT_TRUE(reader.collect().empty());
+    EXPECT_EQ(1, reader.reclaimedSlots());
+}
+
+TEST_F(SharedMemoryBufferTest, Decode) {
+    auto buffer = make_shared_memory_buffer(name, 0, 2);
+    addEvents(*buffer, 3, true);
+
+    SharedMemoryReader reader(name);
+    std::vector<int64_t> args;
+    EXPECT_EQ(3,
+              reader.decode([&args](const TraceEvent& event,
+                                    uint32_t thread_id,
+                                    uint32_t process_id) {
+                  EXPECT_STREQ("name", event.getName());
+                  EXPECT_EQ(platform::getCurrentThreadIDCached(), thread_id);
+                  EXPECT_EQ(platform::getCurrentProcessID(), process_id);
+                  args.push_back(event.getArgs()[0].as_int);
+              }));
+    EXPECT_EQ(std::vector<int64_t>({0, 1, 2}), args);
+}
+
+TEST_F(SharedMemoryBufferTest, TailMirrorsReturnedChunks) {
+    auto buffer = make_tail_buffer(make_fixed_buffer(3, 2), name, 1);
+    EXPECT_EQ(3, buffer->getGeneration());
+    EXPECT_EQ(BufferMode::fixed, buffer->bufferMode());
+
+    addEvents(*buffer, 4, true);
+    // The tail is full so the second chunk isn't mirrored
+    addEvents(*buffer, 1, true);
+    EXPECT_TRUE(buffer->isFull());
+
+    // The decorated buffer is unaffected
+    size_t count = 0;
+    for (const auto& event : *buffer) {
+        (void)event;
+        ++count;
+    }
+    EXPECT_EQ(5, count);
+
+    testing::NiceMock<MockStatsCallback> callback;
+    callback.expectAny();
+    EXPECT_CALL(callback, callS("buffer_name"sv, "FixedTraceBuffer"sv));
+    EXPECT_CALL(callback, callU("tail_published_chunks"sv, 1));
+    EXPECT_CALL(callback, callU("tail_dropped_chunks"sv, 1));
+    buffer->getStats(callback);
+
+    SharedMemoryReader reader(name);
+    EXPECT_EQ(4, reader.collect().size());
+}
+
+TEST_F(SharedMemoryBufferTest, TailMirrorsQueuedChunksOnDestruction) {
+    auto buffer = make_tail_buffer(make_fixed_buffer(0, 2), name, 2);
+    addEvents(*buffer, 2, true);
+    addEvents(*buffer, 3, true);
+    buffer.reset();
+
+    SharedMemoryReader reader(name);
+    EXPECT_EQ(5, reader.collect().size());
+}
+
+TEST_F(SharedMemoryBufferTest, ReaderRequiresSegment) {
+    EXPECT_THROW(SharedMemoryReader reader(name), std::system_error);
+}
+
+#endif
@@ -0,0 +1,102 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <thread>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "phosphor/stack_table.h"
+
+#include "mock_stats_callback.h"
+
+using namespace phosphor;
+using namespace std::string_view_literals;
+
+namespace {
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#endif
+stack_trace
+captureFrom(StackTable& table) {
+    return table.capture();
+}
+
+/*
+ * Captures a stack on a new thread, so that every call captures the same
+ * frames whichever call site (or unrolled loop iteration) it is from
+ */
+stack_trace captureOnThread(StackTable& table) {
+    stack_trace stack;
+    std::thread([&table, &stack]() { stack = captureFrom(table); }).join();
+    return stack;
+}
+
+} // namespace
+
+TEST(StackTableTest, Intern) {
+    StackTable table;
+    int a;
+    int b;
+    const StackTable::Frames frames = {&a, &b};
+    const auto stack = table.intern(frames);
+    EXPECT_EQ(stack.id, table.intern(frames).id);
+    EXPECT_NE(stack.id, table.intern({&b, &a}).id);
+    EXPECT_EQ(2, table.size());
+
+    EXPECT_EQ(frames, table.lookup(stack));
+    EXPECT_EQ(2, table.symbolize(stack).size());
+    EXPECT_TRUE(table.lookup({StackTable::npos}).empty());
+    EXPECT_TRUE(table.symbolize({StackTable::npos}).empty());
+}
+
+TEST(StackTableTest, Capture) {
+    StackTable table;
+    const auto stack = captureFrom(table);
+    if (stack.id == StackTable::npos) {
+        // Stacks can't be captured on this platform
+        return;
+    }
+    const auto& frames = table.lookup(stack);
+    EXPECT_FALSE(frames.empty());
+    EXPECT_LE(frames.size(), StackTable::max_depth);
+
+    // Captures from the same place share a stack
+    const auto first = captureOnThread(table);
+    const auto second = captureOnThread(table);
+    EXPECT_EQ(first.id, second.id);
+    EXPECT_NE(stack.id, first.id);
+
+    // Every frame is symbolized
+    const auto symbols = table.symbolize(stack);
+    EXPECT_EQ(frames.size(), symbols.size());
+    for (const auto& symbol : symbols) {
+        EXPECT_FALSE(symbol.empty());
+    }
+}
+
+TEST(StackTableTest, Full) {
+    StackTable table;
+    std::vector<char> addresses(StackTable::table_size + 1);
+    for (size_t i = 0; i < StackTable::table_size; ++i) {
+        EXPECT_NE(StackTable::npos, table.intern({&addresses[i]}).id);
+    }
+    EXPECT_EQ(StackTable::npos,
+              table.intern({&addresses[StackTable::table_size]}).id);
+
+    testing::NiceMock<MockStatsCallback> callback;
+    callback.expectAny();
+    EXPECT_CALL(callback,
+                callU("stack_table_size"sv, StackTable::table_size));
+    EXPECT_CALL(callback, callU("stack_table_dropped"sv, 1));
+    table.getStats(callback);
+}
@@ -0,0 +1,118 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "phosphor/string_table.h"
+
+#include "mock_stats_callback.h"
+
+using namespace phosphor;
+using namespace std::string_view_literals;
+
+TEST(StringTableTest, Intern) {
+    StringTable table;
+    const auto hello = table.intern("hello");
+    const auto world = table.intern(std::string("world"));
+    EXPECT_NE(hello.id, world.id);
+    EXPECT_EQ(hello.id, table.intern("hello"sv).id);
+    EXPECT_EQ(2, table.size());
+
+    EXPECT_EQ("hello", table.lookup(hello));
+    EXPECT_EQ("world", StringTable::resolve(world));
+    EXPECT_EQ("", table.lookup({0}));
+    EXPECT_EQ("", StringTable::resolve({0}));
+
+    // Strings are not truncated
+    const std::string long_string(1000, 'x');
+    EXPECT_EQ(long_string, table.lookup(table.intern(long_string)));
+}
+
+TEST(StringTableTest, SeparateTables) {
+    StringTable first;
+    interned_string id;
+    {
+        StringTable second;
+        id = second.intern("hello");
+        // Ids are only valid for the table which returned them
+        EXPECT_NE(id.id, first.intern("hello").id);
+        EXPECT_EQ("", first.lookup(id));
+        EXPECT_EQ("hello", StringTable::resolve(id));
+    }
+    // The table which interned the string no longer exists
+    EXPECT_EQ("", StringTable::resolve(id));
+}
+
+/*
+ * A long-lived table can still be resolved after many other tables have
+ * come and gone (e.g. those of each BinaryDumpReader)
+ */
+TEST(StringTableTest, ManyTables) {
+    StringTable table;
+    const auto id = table.intern("hello");
+    for (int i = 0; i < 200; ++i) {
+        StringTable other;
+        const auto other_id = other.intern("other");
+        EXPECT_EQ("other", StringTable::resolve(other_id));
+        EXPECT_EQ("hello", StringTable::resolve(id));
+    }
+    EXPECT_EQ("hello", StringTable::resolve(id));
+}
+
+TEST(StringTableTest, Full) {
+    StringTable table(16);
+    EXPECT_EQ(16, table.getCapacity());
+    for (size_t i = 0; i < 16; ++i) {
+        const auto str = std::to_string(i);
+        EXPECT_EQ(str, table.lookup(table.intern(str)));
+    }
+    EXPECT_EQ("", table.lookup(table.intern("overflow")));
+    // Existing strings can still be found
+    EXPECT_EQ("10", table.lookup(table.intern("10")));
+
+    testing::NiceMock<MockStatsCallback> callback;
+    callback.expectAny();
+    EXPECT_CALL(callback, callU("string_table_size"sv, 16));
+    EXPECT_CALL(callback, callU("string_table_dropped"sv, 1));
+    table.getStats(callback);
+}
+
+TEST(StringTableTest, Threaded) {
+    StringTable table;
+    std::vector<std::vector<interned_string>> ids(4);
+    std::vector<std::thread> threads;
+    for (auto& thread_ids : ids) {
+        threads.emplace_back([&table, &thread_ids]() {
+            for (int repeat = 0; repeat < 10; ++repeat) {
+                for (int i = 0; i < 100; ++i) {
+                    thread_ids.push_back(table.intern(std::to_string(i)));
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Every thread got the same id for each string
+    EXPECT_EQ(100, table.size());
+    for (const auto& thread_ids : ids) {
+        for (size_t i = 0; i < thread_ids.size(); ++i) {
+            EXPECT_EQ(ids[0][i].id, thread_ids[i].id);
+            EXPECT_EQ(std::to_string(i % 100), table.lookup(thread_ids[i]));
+        }
+    }
+}
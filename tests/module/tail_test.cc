@@ -0,0 +1,117 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <phosphor/tools/tail.h>
+
+using namespace phosphor;
+using phosphor::tools::TailAggregator;
+using namespace std::chrono_literals;
+
+static tracepoint_info instant_tpi = {
+        "category",
+        "instant",
+        TraceEvent::Type::Instant,
+        {{nullptr, nullptr}},
+        {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+static tracepoint_info complete_tpi = {
+        "category",
+        "complete",
+        TraceEvent::Type::Complete,
+        {{nullptr, nullptr}},
+        {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+static tracepoint_info other_tpi = {
+        "other",
+        "instant",
+        TraceEvent::Type::Instant,
+        {{nullptr, nullptr}},
+        {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+static TraceEvent makeComplete(std::chrono::nanoseconds duration) {
+    return TraceEvent(
+            &complete_tpi, std::chrono::steady_clock::now(), duration, {});
+}
+
+TEST(TailAggregatorTest, RatesAndLatency) {
+    TailAggregator aggregator;
+    for (int i = 0; i < 4; ++i) {
+        aggregator.add(TraceEvent(&instant_tpi, {}));
+    }
+    aggregator.add(makeComplete(1000ns));
+    aggregator.add(makeComplete(3000ns));
+
+    // Nothing is reported until the interval is closed
+    EXPECT_TRUE(aggregator.getRows().empty());
+    aggregator.advance(2s);
+
+    const auto rows = aggregator.getRows();
+    ASSERT_EQ(2, rows.size());
+    EXPECT_EQ("instant", rows[0].name);
+    EXPECT_EQ(4, rows[0].count);
+    EXPECT_DOUBLE_EQ(2.0, rows[0].rate);
+    EXPECT_EQ(0, rows[0].max_duration_ns);
+
+    EXPECT_EQ("complete", rows[1].name);
+    EXPECT_EQ(2, rows[1].count);
+    EXPECT_EQ(2000, rows[1].mean_duration_ns);
+    EXPECT_EQ(3000, rows[1].max_duration_ns);
+}
+
+TEST(TailAggregatorTest, ByCategory) {
+    TailAggregator aggregator;
+    aggregator.add(TraceEvent(&instant_tpi, {}));
+    aggregator.add(makeComplete(10ns));
+    aggregator.add(TraceEvent(&other_tpi, {}));
+    aggregator.advance(1s);
+
+    const auto rows = aggregator.getRows(true);
+    ASSERT_EQ(2, rows.size());
+    EXPECT_EQ("category", rows[0].category);
+    EXPECT_EQ("", rows[0].name);
+    EXPECT_EQ(2, rows[0].count);
+    EXPECT_EQ(10, rows[0].max_duration_ns);
+    EXPECT_EQ("other", rows[1].category);
+}
+
+TEST(TailAggregatorTest, RollingWindow) {
+    TailAggregator aggregator(2);
+    aggregator.add(TraceEvent(&instant_tpi, {}));
+    aggregator.advance(1s);
+    aggregator.advance(1s);
+    EXPECT_EQ(1, aggregator.getRows().front().count);
+    EXPECT_DOUBLE_EQ(0.5, aggregator.getRows().front().rate);
+
+    // The first interval has now left the window
+    aggregator.advance(1s);
+    EXPECT_TRUE(aggregator.getRows().empty());
+
+    EXPECT_THROW(TailAggregator(0), std::invalid_argument);
+}
+
+TEST(TailAggregatorTest, Format) {
+    TailAggregator aggregator;
+    aggregator.add(TraceEvent(&instant_tpi, {}));
+    aggregator.add(TraceEvent(&other_tpi, {}));
+    aggregator.advance(1s);
+
+    using testing::HasSubstr;
+    const auto table = TailAggregator::format(aggregator.getRows());
+    EXPECT_THAT(table, HasSubstr("RATE/s"));
+    EXPECT_THAT(table, HasSubstr("other"));
+    EXPECT_EQ(3, std::count(table.begin(), table.end(), '\n'));
+
+    const auto limited = TailAggregator::format(aggregator.getRows(), 1);
+    EXPECT_EQ(2, std::count(limited.begin(), limited.end(), '\n'));
+}
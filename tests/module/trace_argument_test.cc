@@ -63,6 +63,9 @@ TEST(TraceArgument, enum_conversions) {
 
     EXPECT_EQ(TraceArgumentConversion<inline_zstring<8>>::getType(),
               TraceArgument::Type::is_istring);
+
+    EXPECT_EQ(TraceArgumentConversion<phosphor::interned_string>::getType(),
+              TraceArgument::Type::is_interned);
 }
 
 template <class T>
@@ -92,6 +95,11 @@ TEST(TraceArgument, to_string) {
     EXPECT_EQ(inner_to_string_test(inline_zstring<8>("Hello, World!")),
               "\"Hello, W\""); // Pointer
 
+    phosphor::StringTable table;
+    EXPECT_EQ(inner_to_string_test(table.intern("Hello, World!")),
+              "\"Hello, World!\"");
+    EXPECT_EQ(inner_to_string_test(phosphor::interned_string{0}), "\"\"");
+
     EXPECT_EQ(TraceArgument().to_string(TraceArgument::Type::is_none),
               "\"Type::is_none\"");
 
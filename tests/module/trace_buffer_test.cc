@@ -15,6 +15,7 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <phosphor/platform/thread.h>
 #include <phosphor/trace_buffer.h>
 
 #include "mock_stats_callback.h"
@@ -46,6 +47,196 @@ TEST(TraceChunkTest, fillAndOverfillAndCount) {
     EXPECT_EQ(count, chunk.count());
 }
 
+TEST(TraceChunkTest, owner) {
+    TraceChunk chunk;
+    chunk.reset(42);
+    EXPECT_EQ(42, chunk.threadID());
+    EXPECT_EQ(platform::getCurrentProcessID(), chunk.processID());
+}
+
+TEST(TraceChunkTest, appendAndTruncate) {
+    TraceChunk source;
+    source.reset(0);
+    for (int i = 0; i < 3; ++i) {
+        source.addEvent() = TraceEvent(&tpi, {{i, 0}});
+    }
+
+    TraceChunk chunk;
+    chunk.reset(0);
+    EXPECT_EQ(3, chunk.append(source.begin(), source.end()));
+    EXPECT_EQ(3, chunk.count());
+    EXPECT_EQ(2, chunk[2].getArgs()[0].as_int);
+
+    chunk.truncate(1);
+    EXPECT_EQ(1, chunk.count());
+    chunk.truncate(2);
+    EXPECT_EQ(1, chunk.count());
+
+    // Only as many events as fit in the chunk are appended
+    while (chunk.count() < TraceChunk::chunk_size - 2) {
+        chunk.addEvent() = TraceEvent(&tpi, {{0, 0}});
+    }
+    EXPECT_EQ(2, chunk.append(source.begin(), source.end()));
+    EXPECT_TRUE(chunk.isFull());
+}
+
+static TraceEvent eventAt(int64_t ns) {
+    using namespace std::chrono;
+    return TraceEvent(&tpi, steady_clock::time_point(nanoseconds(ns)), {}, {});
+}
+
+TEST(TraceChunkTest, summary) {
+    TraceChunk chunk;
+    chunk.reset(0);
+    EXPECT_EQ(0, chunk.categoryMask());
+
+    chunk.addEvent(eventAt(200), 3);
+    chunk.addEvent(eventAt(100), 67);
+    chunk.addEvent(eventAt(300), 3);
+    EXPECT_EQ(100, chunk.minTime());
+    EXPECT_EQ(300, chunk.maxTime());
+    EXPECT_EQ(uint64_t(1) << 3, chunk.categoryMask());
+
+    TraceChunk appended;
+    appended.reset(0);
+    appended.append(chunk.begin() + 1, chunk.end(), chunk.categoryMask());
+    EXPECT_EQ(100, appended.minTime());
+    EXPECT_EQ(300, appended.maxTime());
+    EXPECT_EQ(chunk.categoryMask(), appended.categoryMask());
+
+    // Events added without a summary could be anything
+    chunk.addEvent() = eventAt(400);
+    EXPECT_EQ(0, chunk.minTime());
+    EXPECT_EQ(std::numeric_limits<uint64_t>::max(), chunk.maxTime());
+    EXPECT_EQ(TraceChunk::all_categories, chunk.categoryMask());
+
+    chunk.reset(0);
+    EXPECT_EQ(0, chunk.categoryMask());
+}
+
+TEST(TraceChunkTest, compact) {
+    using namespace std::chrono;
+    TraceChunk chunk;
+    chunk.reset(0);
+    chunk.setFormat(EventFormat::compact);
+    EXPECT_EQ(EventFormat::compact, chunk.format());
+    EXPECT_EQ(TraceChunk::compact_chunk_size, chunk.capacity());
+    EXPECT_GT(TraceChunk::compact_chunk_size, TraceChunk::chunk_size);
+    EXPECT_THROW(chunk.addEvent(), std::logic_error);
+
+    const auto base = steady_clock::now();
+    int i = 0;
+    while (!chunk.isFull()) {
+        TraceEvent event(&tpi,
+                         base - microseconds(i),
+                         nanoseconds(i),
+                         {{i, double(i) / 2}});
+        if (i % 2) {
+            event.setCPU(i);
+        }
+        chunk.addEvent(event, 0);
+        ++i;
+    }
+    EXPECT_EQ(TraceChunk::compact_chunk_size, chunk.count());
+    EXPECT_THROW(chunk.events(), std::logic_error);
+    EXPECT_THROW(chunk.setFormat(EventFormat::full), std::logic_error);
+
+    // Events are reconstructed in full
+    i = 0;
+    for (const auto& event : chunk) {
+        EXPECT_EQ(&tpi, event.getTracepointInfo());
+        EXPECT_EQ(duration_cast<nanoseconds>(
+                          (base - microseconds(i)).time_since_epoch())
+                          .count(),
+                  event.getTime());
+        EXPECT_EQ(uint64_t(i), event.getDuration());
+        EXPECT_EQ(i % 2 ? i : -1, event.getCPU());
+        EXPECT_EQ(i, event.getArgs()[0].as_int);
+        EXPECT_EQ(double(i) / 2, event.getArgs()[1].as_double);
+        ++i;
+    }
+    EXPECT_EQ(int(chunk.count()), i);
+    EXPECT_EQ(chunk[1].getTime(), (chunk.begin() + 1)->getTime());
+
+    chunk.reset(0);
+    EXPECT_EQ(EventFormat::full, chunk.format());
+}
+
+TEST(TraceChunkTest, compactRollover) {
+    TraceChunk chunk;
+    chunk.reset(0);
+    chunk.setFormat(EventFormat::compact);
+
+    // Any event can be added to an empty chunk, later events must be
+    // within the range of a 32-bit offset of the first
+    const int64_t base = 10'000'000'000;
+    const int64_t range = std::numeric_limits<int32_t>::max();
+    EXPECT_TRUE(chunk.canAdd(eventAt(base)));
+    chunk.addEvent(eventAt(base), 0);
+    EXPECT_TRUE(chunk.canAdd(eventAt(base + range)));
+    EXPECT_TRUE(chunk.canAdd(eventAt(base - range)));
+    EXPECT_FALSE(chunk.canAdd(eventAt(base + range + 1)));
+    EXPECT_FALSE(chunk.canAdd(eventAt(base - range - 2)));
+    EXPECT_THROW(chunk.addEvent(eventAt(base + range + 1), 0),
+                 std::out_of_range);
+
+    // Appending stops at the first event which doesn't fit
+    TraceChunk source;
+    source.reset(0);
+    source.addEvent(eventAt(base + 1), 0);
+    source.addEvent(eventAt(base + range + 1), 0);
+    source.addEvent(eventAt(base + 2), 0);
+    EXPECT_EQ(1, chunk.append(source.begin(), source.end()));
+    EXPECT_EQ(2, chunk.count());
+    EXPECT_EQ(base + 1, chunk[1].getTime());
+    EXPECT_EQ(uint64_t(base + 1), chunk.maxTime());
+}
+
+TEST(TraceChunkTest, streaming) {
+    for (auto format : {EventFormat::full, EventFormat::compact}) {
+        TraceChunk chunk;
+        chunk.reset(0);
+        EXPECT_FALSE(chunk.isStreaming());
+        chunk.setFormat(format);
+        chunk.setStreaming(true);
+        EXPECT_TRUE(chunk.isStreaming());
+
+        int64_t i = 0;
+        while (!chunk.isFull()) {
+            chunk.addEvent(eventAt(1000 + i), 1);
+            ++i;
+        }
+        EXPECT_EQ(2, chunk.categoryMask());
+        EXPECT_EQ(1000u, chunk.minTime());
+        EXPECT_EQ(uint64_t(999 + i), chunk.maxTime());
+        i = 0;
+        for (const auto& event : chunk) {
+            EXPECT_EQ(&tpi, event.getTracepointInfo());
+            EXPECT_EQ(1000 + i, event.getTime());
+            ++i;
+        }
+        EXPECT_EQ(int64_t(chunk.count()), i);
+
+        // Appended events are streamed too
+        TraceChunk copy;
+        copy.reset(0);
+        copy.setFormat(format);
+        copy.setStreaming(true);
+        EXPECT_EQ(chunk.count(), copy.append(chunk.begin(), chunk.end()));
+        EXPECT_TRUE(std::equal(
+                chunk.begin(),
+                chunk.end(),
+                copy.begin(),
+                [](const TraceEvent& a, const TraceEvent& b) {
+                    return a.getTime() == b.getTime() &&
+                           a.getTracepointInfo() == b.getTracepointInfo();
+                }));
+
+        chunk.reset(0);
+        EXPECT_FALSE(chunk.isStreaming());
+    }
+}
+
 TEST(TraceChunkTest, string_check) {
     TraceChunk chunk;
     chunk.reset(0);
@@ -210,6 +401,54 @@ TEST_P(TraceBufferTest, fullChunks) {
     EXPECT_EQ(event_count, i);
 }
 
+TEST_P(TraceBufferTest, forEachChunk) {
+    make_buffer(5);
+    populate_chunk(buffer->getChunk(), 1);
+    buffer->getChunk();
+    populate_chunk(buffer->getChunk(), 2);
+
+    // Visits the same chunks as the chunk iterators
+    std::vector<const TraceChunk*> visited;
+    buffer->forEachChunk([&visited](const TraceChunk& chunk) {
+        visited.push_back(&chunk);
+    });
+    std::vector<const TraceChunk*> iterated;
+    for (const auto& chunk : buffer->chunks()) {
+        iterated.push_back(&chunk);
+    }
+    EXPECT_EQ(iterated, visited);
+
+    // Spans skip the empty chunk
+    std::vector<TraceBuffer::chunk_span> spans;
+    buffer->forEachSpan([&spans](const TraceBuffer::chunk_span& span) {
+        spans.push_back(span);
+    });
+    ASSERT_EQ(2, spans.size());
+    EXPECT_EQ(1, spans[0].events.size());
+    EXPECT_EQ(visited[0]->events().data(), spans[0].events.data());
+    EXPECT_FALSE(spans[0].decoded);
+    EXPECT_EQ(2, spans[1].events.size());
+    EXPECT_EQ(visited[2]->events().end(), spans[1].events.end());
+    EXPECT_EQ(platform::getCurrentThreadIDCached(), spans[1].thread_id);
+    EXPECT_EQ(platform::getCurrentProcessID(), spans[1].process_id);
+
+    // The events of compact chunks are decoded one chunk at a time
+    auto* compact = buffer->getChunk();
+    compact->setFormat(EventFormat::compact);
+    compact->addEvent(eventAt(1000), 0);
+    compact->addEvent(eventAt(2000), 0);
+    size_t decoded = 0;
+    buffer->forEachSpan([&decoded](const TraceBuffer::chunk_span& span) {
+        if (span.decoded) {
+            ++decoded;
+            ASSERT_EQ(2, span.events.size());
+            EXPECT_EQ(&tpi, span.events[0].getTracepointInfo());
+            EXPECT_EQ(2000, span.events[1].getTime());
+        }
+    });
+    EXPECT_EQ(1, decoded);
+}
+
 TEST_P(TraceBufferTest, MassiveBufferFail) {
     EXPECT_ANY_THROW(make_buffer(std::numeric_limits<size_t>::max()));
 }
@@ -325,6 +564,30 @@ TEST_P(UnFillableTraceBufferTest, CorrectCount) {
     EXPECT_EQ(1UL, buffer->chunk_count());
 }
 
+// Test that a ring buffer with every chunk on loan gives up rather
+// than spinning until a chunk is returned
+TEST_P(UnFillableTraceBufferTest, AllChunksLoaned) {
+    using namespace std::string_view_literals;
+    using namespace testing;
+
+    make_buffer(1);
+    TraceChunk* chunk = buffer->getChunk();
+    ASSERT_NE(nullptr, chunk);
+    EXPECT_EQ(nullptr, buffer->getChunk());
+    EXPECT_FALSE(buffer->isFull());
+
+    NiceMock<MockStatsCallback> callback;
+    callback.expectAny();
+    EXPECT_CALL(callback, callU("buffer_total_loaned"sv, 1));
+    EXPECT_CALL(callback, callU("buffer_loaned_chunks"sv, 1));
+    EXPECT_CALL(callback, callU("buffer_failed_acquisitions"sv, 1));
+    buffer->getStats(callback);
+    Mock::VerifyAndClearExpectations(&callback);
+
+    buffer->returnChunk(*chunk);
+    EXPECT_EQ(chunk, buffer->getChunk());
+}
+
 TEST_P(UnFillableTraceBufferTest, StatsTest) {
     using namespace std::string_view_literals;
     using namespace testing;
@@ -377,12 +640,131 @@ TEST_P(UnFillableTraceBufferTest, StatsTest) {
     Mock::VerifyAndClearExpectations(&callback);
 }
 
+TEST(PartitionedTraceBufferTest, Partitions) {
+    std::vector<buffer_ptr> partitions;
+    partitions.push_back(make_fixed_buffer(0, 1));
+    partitions.push_back(make_fixed_buffer(0, 2));
+    auto buffer = make_partitioned_buffer(std::move(partitions));
+    EXPECT_EQ(2, buffer->partitionCount());
+
+    // Filling one partition doesn't fill the buffer
+    auto* chunk = buffer->getPartitionChunk(0);
+    ASSERT_NE(nullptr, chunk);
+    chunk->addEvent() = TraceEvent(&tpi, {{0, 0}});
+    EXPECT_EQ(nullptr, buffer->getPartitionChunk(0));
+    EXPECT_FALSE(buffer->isFull());
+
+    chunk = buffer->getPartitionChunk(1);
+    ASSERT_NE(nullptr, chunk);
+    chunk->addEvent() = TraceEvent(&tpi, {{1, 0}});
+    chunk->addEvent() = TraceEvent(&tpi, {{2, 0}});
+    buffer->returnPartitionChunk(*chunk, 1);
+    ASSERT_NE(nullptr, buffer->getPartitionChunk(1));
+    EXPECT_TRUE(buffer->isFull());
+
+    // Iteration visits every partition in turn
+    EXPECT_EQ(3, buffer->chunk_count());
+    int expected = 0;
+    for (const auto& event : *buffer) {
+        EXPECT_EQ(expected++, event.getArgs()[0].as_int);
+    }
+    EXPECT_EQ(3, expected);
+
+    expected = 0;
+    buffer->forEachSpan([&expected](const TraceBuffer::chunk_span& span) {
+        for (const auto& event : span.events) {
+            EXPECT_EQ(expected++, event.getArgs()[0].as_int);
+        }
+    });
+    EXPECT_EQ(3, expected);
+}
+
+TEST(ChunkStoragePoolTest, Reuse) {
+    auto pool = std::make_shared<ChunkStoragePool>(2);
+    const TraceChunk* first;
+    {
+        auto buffer = make_pooled_fixed_buffer(0, 4, *pool);
+        first = &(*buffer)[0];
+    }
+    // Only storage of the same size is reused
+    auto other = make_pooled_ring_buffer(0, 2, *pool);
+    EXPECT_NE(first, &(*other)[0]);
+    auto buffer = make_pooled_ring_buffer(0, 4, *pool);
+    EXPECT_EQ(first, &(*buffer)[0]);
+
+    using namespace std::string_view_literals;
+    MockStatsCallback callback;
+    callback.expectAny();
+    EXPECT_CALL(callback, callU("buffer_pool_allocated"sv, 2));
+    EXPECT_CALL(callback, callU("buffer_pool_reused"sv, 1));
+    EXPECT_CALL(callback, callU("buffer_pool_retained"sv, 0));
+    pool->getStats(callback);
+    testing::Mock::VerifyAndClearExpectations(&callback);
+
+    other.reset();
+    buffer.reset();
+    callback.expectAny();
+    EXPECT_CALL(callback, callU("buffer_pool_retained"sv, 2));
+    EXPECT_CALL(callback,
+                callU("buffer_pool_retained_bytes"sv, 6 * sizeof(TraceChunk)));
+    pool->getStats(callback);
+}
+
+TEST(ChunkStoragePoolTest, Limits) {
+    auto pool = std::make_shared<ChunkStoragePool>(1);
+    for (size_t size = 1; size <= 3; ++size) {
+        pool->acquire(size);
+    }
+    // Only the most recently released storage is kept
+    EXPECT_EQ(3, pool->acquire(3).size());
+    using namespace std::string_view_literals;
+    MockStatsCallback callback;
+    callback.expectAny();
+    EXPECT_CALL(callback, callU("buffer_pool_reused"sv, 1));
+    pool->getStats(callback);
+    testing::Mock::VerifyAndClearExpectations(&callback);
+
+    pool->clear();
+    pool->acquire(1);
+    pool->setMaxRetained(0);
+    pool->acquire(1);
+    callback.expectAny();
+    EXPECT_CALL(callback, callU("buffer_pool_retained"sv, 0));
+    EXPECT_CALL(callback, callU("buffer_pool_allocated"sv, 5));
+    pool->getStats(callback);
+    testing::Mock::VerifyAndClearExpectations(&callback);
+
+    // Storage can outlive its pool
+    auto storage = pool->acquire(1);
+    pool.reset();
+}
+
+TEST(PartitionedTraceBufferTest, InvalidPartitionCount) {
+    EXPECT_THROW(make_partitioned_buffer({}), std::invalid_argument);
+
+    std::vector<buffer_ptr> partitions;
+    for (size_t i = 0; i <= max_buffer_partitions; ++i) {
+        partitions.push_back(make_fixed_buffer(0, 1));
+    }
+    EXPECT_THROW(make_partitioned_buffer(std::move(partitions)),
+                 std::invalid_argument);
+}
+
+static buffer_ptr make_single_partition_buffer(size_t generation,
+                                               size_t buffer_size) {
+    std::vector<buffer_ptr> partitions;
+    partitions.push_back(make_ring_buffer(generation, buffer_size));
+    return make_partitioned_buffer(std::move(partitions));
+}
+
 INSTANTIATE_TEST_SUITE_P(
         BuiltIn,
         TraceBufferTest,
         testing::Values(
                 TraceBufferTest::ParamType(make_fixed_buffer, "FixedBuffer"),
-                TraceBufferTest::ParamType(make_ring_buffer, "RingBuffer")),
+                TraceBufferTest::ParamType(make_ring_buffer, "RingBuffer"),
+                TraceBufferTest::ParamType(make_single_partition_buffer,
+                                           "PartitionedBuffer")),
         [](const ::testing::TestParamInfo<TraceBufferTest::ParamType>&
                    testInfo) { return testInfo.param.second; });
 
@@ -401,3 +783,65 @@ INSTANTIATE_TEST_SUITE_P(
                                                    "RingBuffer")),
         [](const ::testing::TestParamInfo<TraceBufferTest::ParamType>&
                    testInfo) { return testInfo.param.second; });
+
+TEST(EventQueryTest, Matches) {
+    using namespace std::chrono;
+    static tracepoint_info other_tpi = {
+            "other",
+            "name",
+            TraceEvent::Type::Instant,
+            {{nullptr, nullptr}},
+            {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+    TraceChunk chunk;
+    chunk.reset(0);
+    chunk.addEvent(eventAt(100), 1);
+    chunk.addEvent(eventAt(200), 1);
+
+    EventQuery query;
+    EXPECT_TRUE(query.matches(chunk));
+    EXPECT_TRUE(query.matches(chunk[0]));
+
+    const steady_clock::time_point epoch;
+    query.setTimeRange(epoch + 150ns, epoch + 200ns);
+    EXPECT_TRUE(query.matches(chunk));
+    EXPECT_FALSE(query.matches(chunk[0]));
+    EXPECT_FALSE(query.matches(chunk[1]));
+    query.setTimeRange(epoch + 150ns, epoch + 201ns);
+    EXPECT_TRUE(query.matches(chunk[1]));
+    query.setTimeRange(epoch + 201ns, epoch + 300ns);
+    EXPECT_FALSE(query.matches(chunk));
+    query.setTimeRange(epoch, epoch + 100ns);
+    EXPECT_FALSE(query.matches(chunk));
+
+    query = EventQuery();
+    query.setCategories({"cat*"});
+    EXPECT_TRUE(query.matches(chunk));
+    EXPECT_TRUE(query.matches(chunk[0]));
+    EXPECT_FALSE(query.matches(TraceEvent(&other_tpi, {})));
+    // The group mask allows the chunk to be skipped
+    query.setCategories({"cat*"}, uint64_t(1) << 2);
+    EXPECT_FALSE(query.matches(chunk));
+
+    // Empty chunks never match
+    chunk.reset(0);
+    EXPECT_FALSE(EventQuery().matches(chunk));
+}
+
+TEST(EventQueryTest, Query) {
+    using namespace std::chrono;
+    auto buffer = make_fixed_buffer(0, 4);
+    for (int i = 0; i < 4; ++i) {
+        auto* chunk = buffer->getChunk();
+        chunk->addEvent(eventAt(i * 100), 0);
+        chunk->addEvent(eventAt(i * 100 + 50), 0);
+        buffer->returnChunk(*chunk);
+    }
+    const steady_clock::time_point epoch;
+    const auto chunks = buffer->query(
+            EventQuery().setTimeRange(epoch + 120ns, epoch + 260ns));
+    ASSERT_EQ(2, chunks.size());
+    EXPECT_EQ(100, chunks[0]->minTime());
+    EXPECT_EQ(200, chunks[1]->minTime());
+    EXPECT_EQ(4, buffer->query(EventQuery()).size());
+}
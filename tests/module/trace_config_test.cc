@@ -14,6 +14,7 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "phosphor/tools/export.h"
 #include "phosphor/trace_config.h"
 
 using namespace phosphor;
@@ -35,6 +36,13 @@ TEST(TraceLogConfigTest, startup_trace) {
                       .getStartupTrace());
 }
 
+TEST(TraceLogConfigTest, string_table_size) {
+    TraceLogConfig config;
+    EXPECT_EQ(StringTable::default_table_size, config.getStringTableSize());
+    EXPECT_EQ(16, config.setStringTableSize(16).getStringTableSize());
+    EXPECT_THROW(config.setStringTableSize(0), std::invalid_argument);
+}
+
 TEST(TraceConfigTest, defaultConstructor) {
     TraceConfig config;
 }
@@ -141,6 +149,11 @@ TEST(TraceConfigTest, fromString) {
                                          "buffer-size:1024;")
                          .getStopTracingOnDestruct());
 
+    config = TraceConfig::fromString("async-save-on-stop:out.json");
+    EXPECT_TRUE(dynamic_cast<tools::AsyncFileStopCallback*>(
+            config.getStoppedCallback()));
+    EXPECT_TRUE(config.getStopTracingOnDestruct());
+
     EXPECT_THROW(TraceConfig::fromString("buffer-mode:other"),
                  std::invalid_argument);
     EXPECT_THROW(TraceConfig::fromString("buffer-size:-1"),
@@ -174,6 +187,110 @@ TEST(TraceConfigTest, toString) {
             config3.toString());
 }
 
+TEST(TraceConfigTest, countedCategories) {
+    TraceConfig config(BufferMode::ring, 1337);
+    config.setCategories({{"hello"}}, {{"world"}});
+    EXPECT_TRUE(config.getCountedCategories().empty());
+    EXPECT_EQ(std::string::npos, config.toString().find("counted-categories"));
+
+    config.updateFromString("counted-categories:hello,memcached*");
+    EXPECT_THAT(config.getCountedCategories(),
+                testing::ElementsAre("hello", "memcached*"));
+    EXPECT_EQ(config.getCountedCategories(),
+              TraceConfig::fromString(config.toString())
+                      .getCountedCategories());
+}
+
+TEST(TraceConfigTest, stackThreshold) {
+    TraceConfig config(BufferMode::ring, 1337);
+    config.setCategories({{"hello"}}, {{"world"}});
+    EXPECT_EQ(0, config.getStackThreshold().count());
+    EXPECT_EQ(std::string::npos, config.toString().find("stack-threshold"));
+
+    config.updateFromString("stack-threshold:1000");
+    EXPECT_EQ(std::chrono::microseconds(1), config.getStackThreshold());
+    EXPECT_EQ(std::chrono::microseconds(1),
+              TraceConfig::fromString(config.toString()).getStackThreshold());
+    EXPECT_THROW(TraceConfig::fromString("stack-threshold:slow"),
+                 std::invalid_argument);
+    EXPECT_THROW(TraceConfig::fromString("stack-threshold:-1"),
+                 std::invalid_argument);
+}
+
+TEST(TraceConfigTest, sampleInterval) {
+    TraceConfig config(BufferMode::ring, 1337);
+    config.setCategories({{"hello"}}, {{"world"}});
+    EXPECT_EQ(0, config.getSampleInterval().count());
+    EXPECT_EQ(std::string::npos, config.toString().find("sample-interval"));
+
+    config.updateFromString("sample-interval:1000000");
+    EXPECT_EQ(std::chrono::milliseconds(1), config.getSampleInterval());
+    EXPECT_EQ(std::chrono::milliseconds(1),
+              TraceConfig::fromString(config.toString()).getSampleInterval());
+    EXPECT_THROW(TraceConfig::fromString("sample-interval:often"),
+                 std::invalid_argument);
+    EXPECT_THROW(TraceConfig::fromString("sample-interval:-1"),
+                 std::invalid_argument);
+}
+
+TEST(TraceConfigTest, eventFormat) {
+    TraceConfig config(BufferMode::fixed, 1337);
+    config.setCategories({{"hello"}}, {{"world"}});
+    EXPECT_EQ(EventFormat::full, config.getEventFormat());
+    EXPECT_EQ(std::string::npos, config.toString().find("event-format"));
+
+    config.updateFromString("event-format:compact");
+    EXPECT_EQ(EventFormat::compact, config.getEventFormat());
+    EXPECT_EQ(EventFormat::compact,
+              TraceConfig::fromString(config.toString()).getEventFormat());
+
+    EXPECT_THROW(TraceConfig::fromString("event-format:other"),
+                 std::invalid_argument);
+}
+
+TEST(TraceConfigTest, streamingStores) {
+    TraceConfig config(BufferMode::fixed, 1337);
+    config.setCategories({{"hello"}}, {{"world"}});
+    EXPECT_FALSE(config.getStreamingStores());
+    EXPECT_EQ(std::string::npos, config.toString().find("streaming-stores"));
+
+    config.updateFromString("streaming-stores:true");
+    EXPECT_TRUE(config.getStreamingStores());
+    EXPECT_TRUE(TraceConfig::fromString(config.toString())
+                        .getStreamingStores());
+
+    config.updateFromString("streaming-stores:false");
+    EXPECT_FALSE(config.getStreamingStores());
+    EXPECT_THROW(TraceConfig::fromString("streaming-stores:yes"),
+                 std::invalid_argument);
+}
+
+TEST(TraceConfigTest, spareChunks) {
+    TraceConfig config(BufferMode::ring, 1337);
+    config.setCategories({{"hello"}}, {{"world"}});
+    EXPECT_FALSE(config.getSpareChunks());
+    EXPECT_EQ(std::string::npos, config.toString().find("spare-chunks"));
+
+    config.updateFromString("spare-chunks:true");
+    EXPECT_TRUE(config.getSpareChunks());
+    EXPECT_TRUE(TraceConfig::fromString(config.toString()).getSpareChunks());
+    EXPECT_THROW(TraceConfig::fromString("spare-chunks:1"),
+                 std::invalid_argument);
+}
+
+TEST(TraceConfigTest, recordCPU) {
+    TraceConfig config(BufferMode::ring, 1337);
+    config.setCategories({{"hello"}}, {{"world"}});
+    EXPECT_FALSE(config.getRecordCPU());
+    EXPECT_EQ(std::string::npos, config.toString().find("record-cpu"));
+
+    config.updateFromString("record-cpu:true");
+    EXPECT_TRUE(config.getRecordCPU());
+    EXPECT_TRUE(TraceConfig::fromString(config.toString()).getRecordCPU());
+    EXPECT_THROW(TraceConfig::fromString("record-cpu:on"),
+                 std::invalid_argument);
+}
+
 TEST(TraceConfigTest, getBufferFactoryReturnsCorrectFactoryForBuiltIns) {
     TraceConfig cfga(BufferMode::fixed, 1337);
     EXPECT_EQ(BufferMode::fixed, cfga.getBufferFactory()(0, 1)->bufferMode());
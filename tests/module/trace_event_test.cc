@@ -10,6 +10,7 @@
  */
 
 #include "phosphor/platform/thread.h"
+#include "phosphor/stack_table.h"
 #include "phosphor/trace_event.h"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -77,6 +78,8 @@ TEST(TraceEvent, typeToString) {
                  TraceEvent::typeToString(TraceEvent::Type::GlobalInstant));
     EXPECT_STREQ("Complete",
                  TraceEvent::typeToString(TraceEvent::Type::Complete));
+    EXPECT_STREQ("Sample",
+                 TraceEvent::typeToString(TraceEvent::Type::Sample));
     EXPECT_THROW(TraceEvent::typeToString(static_cast<TraceEvent::Type>(0xFF)),
                  std::invalid_argument);
 }
@@ -187,6 +190,79 @@ TEST_F(TraceEventJsonTest, toJSONAlt) {
     assertFloatField(json, "ts");
 }
 
+TEST_F(TraceEventJsonTest, toJSONProcess) {
+    constexpr phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            TraceEvent::Type::Instant,
+            {{"arg1", "arg2"}},
+            {{TraceArgument::Type::is_none, TraceArgument::Type::is_none}}};
+
+    TraceEvent event(&tpi, {{0, 0}});
+
+    const auto json = nlohmann::json::parse(event.to_json(1, 4242));
+    assertNumericField(json, "pid", 4242);
+    assertNumericField(json, "tid", 1);
+}
+
+TEST_F(TraceEventJsonTest, toJSONSample) {
+    constexpr phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            TraceEvent::Type::Sample,
+            {{"stack", nullptr}},
+            {{TraceArgument::Type::is_stack, TraceArgument::Type::is_none}}};
+
+    int frame;
+    const auto stack = phosphor::StackTable::getInstance().intern({&frame});
+    TraceEvent event(&tpi, {{stack, phosphor::NoneType()}});
+
+    // Samples are Chrome sample events with their stack inline
+    const auto json = nlohmann::json::parse(event.to_json(1));
+    assertStringField(json, "ph", "P");
+    ASSERT_TRUE(json["stack"].is_array()) << json.dump();
+    EXPECT_EQ(1, json["stack"].size());
+    EXPECT_EQ(json["stack"], json["args"]["stack"]);
+}
+
+TEST_F(TraceEventJsonTest, toJSONCPU) {
+    constexpr phosphor::tracepoint_info tpi = {
+            "category",
+            "name",
+            TraceEvent::Type::Complete,
+            {{"arg1", "arg2"}},
+            {{TraceArgument::Type::is_int, TraceArgument::Type::is_none}}};
+
+    TraceEvent event(&tpi,
+                     std::chrono::steady_clock::now(),
+                     std::chrono::nanoseconds(1001),
+                     {{5, 0}});
+    EXPECT_EQ(-1, event.getCPU());
+    EXPECT_EQ(nlohmann::json::parse(event.to_json(1))["args"].count("cpu"),
+              0);
+
+    // The CPU doesn't disturb the duration
+    event.setCPU(7);
+    EXPECT_EQ(7, event.getCPU());
+    EXPECT_EQ(1001, event.getDuration());
+    const auto json = nlohmann::json::parse(event.to_json(1));
+    EXPECT_EQ(5, json["args"]["arg1"]);
+    EXPECT_EQ(7, json["args"]["cpu"]);
+    EXPECT_EQ(1.001, json["dur"]);
+
+    // Unknown CPUs aren't recorded
+    event.setCPU(-1);
+    EXPECT_EQ(7, event.getCPU());
+
+    // Durations which would overlap the CPU are clamped
+    TraceEvent longest(&tpi,
+                       std::chrono::steady_clock::now(),
+                       std::chrono::nanoseconds(TraceEvent::max_duration + 1),
+                       {{5, 0}});
+    EXPECT_EQ(TraceEvent::max_duration, longest.getDuration());
+    EXPECT_EQ(-1, longest.getCPU());
+}
+
 class MockTraceEvent : public TraceEvent {
 public:
     using TraceEvent::TraceEvent;
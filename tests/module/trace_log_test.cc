@@ -9,12 +9,15 @@
  *   the file licenses/APL2.txt.
  */
 
+#include <map>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "phosphor/platform/thread.h"
 #include "phosphor/trace_buffer.h"
 #include "phosphor/trace_log.h"
 #include "utils/memory.h"
@@ -348,6 +351,7 @@ TEST_F(TraceLogTest, nonBlockingStop) {
     // Return nullptr to indicate buffer is full
     EXPECT_CALL(*buffer_ptr, getChunk())
             .WillRepeatedly(testing::Return(nullptr));
+    EXPECT_CALL(*buffer_ptr, isFull()).WillRepeatedly(testing::Return(true));
 
     trace_log.start(TraceConfig(
             [&buffer](size_t generation, size_t buffer_size) {
@@ -458,6 +462,8 @@ TEST_F(TraceLogTest, StatsTest) {
 
     NiceMock<MockStatsCallback> callback;
 
+    // Allow the stats not checked below
+    EXPECT_CALL(callback, callU(_, _)).Times(AnyNumber());
     EXPECT_CALL(callback, callB("log_has_buffer"sv, false));
     EXPECT_CALL(callback, callB("log_is_enabled"sv, false));
 
@@ -483,3 +489,177 @@ TEST_F(TraceLogTest, StatsTest) {
     trace_log.getStats(callback);
     Mock::VerifyAndClearExpectations(&callback);
 }
+
+TEST_F(TraceLogTest, BufferPool) {
+    using namespace std::string_view_literals;
+    using namespace testing;
+    trace_log.configure(TraceLogConfig().setBufferPoolSize(1));
+
+    const TraceChunk* first_chunk;
+    start_basic();
+    log_event();
+    trace_log.stop();
+    {
+        auto context = trace_log.getTraceContext();
+        first_chunk = &(*context.getBuffer())[0];
+    }
+
+    // The released buffer's storage is reused by the next trace of the
+    // same size, whether or not its context was taken
+    for (int i = 0; i < 2; ++i) {
+        start_basic();
+        log_event();
+        trace_log.stop();
+    }
+    auto context = trace_log.getTraceContext();
+    EXPECT_EQ(first_chunk, &(*context.getBuffer())[0]);
+
+    MockStatsCallback callback;
+    callback.expectAny();
+    EXPECT_CALL(callback, callU("buffer_pool_allocated"sv, 1));
+    EXPECT_CALL(callback, callU("buffer_pool_reused"sv, 2));
+    EXPECT_CALL(callback, callU("buffer_pool_retained"sv, 0));
+    trace_log.getStats(callback);
+}
+
+/*
+ * Saves the size_t stats of a TraceLog
+ */
+class SizeStatsCallback : public StatsCallback {
+public:
+    void operator()(std::string_view, std::string_view) override {
+    }
+    void operator()(std::string_view, bool) override {
+    }
+    void operator()(std::string_view key, size_t value) override {
+        stats[std::string(key)] = value;
+    }
+    void operator()(std::string_view, phosphor::ssize_t) override {
+    }
+    void operator()(std::string_view, double) override {
+    }
+
+    std::map<std::string, size_t> stats;
+};
+
+/*
+ * Waits for a stat of the TraceLog to reach the expected value, which
+ * the replenisher thread of spare chunks changes asynchronously
+ */
+static ::testing::AssertionResult waitForStat(TraceLog& log,
+                                              const std::string& key,
+                                              size_t expected) {
+    const auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    SizeStatsCallback callback;
+    do {
+        log.getStats(callback);
+        if (callback.stats[key] == expected) {
+            return ::testing::AssertionSuccess();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    } while (std::chrono::steady_clock::now() < deadline);
+    return ::testing::AssertionFailure()
+           << key << " is " << callback.stats[key] << ", expected "
+           << expected;
+}
+
+TEST_F(TraceLogTest, SpareChunks) {
+    trace_log.start(TraceConfig(BufferMode::ring, min_buffer_size * 4)
+                            .setSpareChunks(true));
+
+    // The first event asks for a spare alongside its chunk
+    log_event();
+    EXPECT_TRUE(waitForStat(trace_log, "buffer_loaned_chunks", 2));
+
+    // The full chunk is swapped for the spare, then returned and replaced
+    // by a new spare off the logging thread
+    for (size_t i = 0; i < TraceChunk::chunk_size; ++i) {
+        log_event();
+    }
+    EXPECT_TRUE(waitForStat(trace_log, "buffer_total_loaned", 3));
+    EXPECT_TRUE(waitForStat(trace_log, "buffer_loaned_chunks", 2));
+
+    // Both are returned when the thread is deregistered
+    trace_log.deregisterThread();
+    EXPECT_TRUE(waitForStat(trace_log, "buffer_loaned_chunks", 0));
+    trace_log.registerThread();
+    trace_log.stop();
+}
+
+/*
+ * Spare chunks are acquired by the replenisher thread but belong to the
+ * thread they are swapped in for
+ */
+TEST_F(TraceLogTest, SpareChunksThreadID) {
+    trace_log.start(TraceConfig(BufferMode::fixed, min_buffer_size * 8)
+                            .setSpareChunks(true));
+    // Wait for each spare so that the full chunk is swapped for it
+    log_event();
+    EXPECT_TRUE(waitForStat(trace_log, "buffer_total_loaned", 2));
+    for (size_t i = 0; i < TraceChunk::chunk_size; ++i) {
+        log_event();
+    }
+    EXPECT_TRUE(waitForStat(trace_log, "buffer_total_loaned", 3));
+    for (size_t i = 0; i < TraceChunk::chunk_size; ++i) {
+        log_event();
+    }
+    trace_log.stop();
+
+    auto buffer = trace_log.getBuffer();
+    const auto thread_id = platform::getCurrentThreadID();
+    size_t events = 0;
+    buffer->forEachChunk([thread_id, &events](const TraceChunk& chunk) {
+        EXPECT_EQ(thread_id, chunk.threadID());
+        events += chunk.count();
+    });
+    EXPECT_EQ(TraceChunk::chunk_size * 2 + 1, events);
+}
+
+/*
+ * A ring buffer holds at least two chunks per thread when threads hold
+ * spare chunks
+ */
+TEST_F(TraceLogTest, SpareChunksRingSize) {
+    trace_log.start(
+            TraceConfig(BufferMode::ring, min_buffer_size).setSpareChunks(true));
+    EXPECT_TRUE(waitForStat(trace_log, "buffer_size", 3));
+    trace_log.stop();
+}
+
+TEST_F(TraceLogTest, Sessions) {
+    EXPECT_THROW(trace_log.isSessionEnabled(max_trace_sessions),
+                 std::invalid_argument);
+    EXPECT_THROW(trace_log.startSession(
+                         TraceConfig(BufferMode::fixed, min_buffer_size)
+                                 .setTailSegment("phosphor_sessions")),
+                 std::invalid_argument);
+
+    // Sessions run independently of the primary session and each other
+    std::vector<size_t> ids;
+    for (size_t i = 1; i < max_trace_sessions; ++i) {
+        ids.push_back(trace_log.startSession(
+                TraceConfig(BufferMode::fixed, min_buffer_size)));
+    }
+    EXPECT_EQ(std::vector<size_t>({1, 2, 3}), ids);
+    EXPECT_THROW(trace_log.startSession(
+                         TraceConfig(BufferMode::fixed, min_buffer_size)),
+                 std::logic_error);
+    EXPECT_FALSE(trace_log.isEnabled());
+    log_event();
+    EXPECT_THROW(trace_log.getSessionContext(2), std::logic_error);
+
+    // A session is stopped once its fixed buffer is full
+    while (trace_log.isSessionEnabled(2)) {
+        log_event();
+    }
+    EXPECT_FALSE(trace_log.isSessionEnabled(1));
+    auto context = trace_log.getSessionContext(2);
+    EXPECT_EQ(TraceChunk::chunk_size, (*context.getBuffer())[0].count());
+
+    // The stopped session's id is reused first
+    EXPECT_EQ(2, trace_log.startSession(
+                         TraceConfig(BufferMode::fixed, min_buffer_size)));
+    trace_log.stopSession(2);
+    EXPECT_FALSE(trace_log.isSessionEnabled(2));
+}